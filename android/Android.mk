@@ -69,6 +69,7 @@ LOCAL_SRC_FILES := \
 	bluez/src/shared/gatt-db.c \
 	bluez/src/shared/io-glib.c \
 	bluez/src/shared/timeout-glib.c \
+	bluez/src/shared/aes.c \
 	bluez/src/shared/crypto.c \
 	bluez/src/shared/uhid.c \
 	bluez/src/shared/att.c \
@@ -355,12 +356,17 @@ LOCAL_SRC_FILES := \
 	bluez/monitor/keys.c \
 	bluez/monitor/ellisys.c \
 	bluez/monitor/analyze.c \
+	bluez/monitor/filter.c \
+	bluez/monitor/histogram.c \
 	bluez/monitor/intel.c \
 	bluez/monitor/broadcom.c \
 	bluez/src/shared/util.c \
 	bluez/src/shared/queue.c \
+	bluez/src/shared/aes.c \
+	bluez/src/shared/rpa.c \
 	bluez/src/shared/crypto.c \
 	bluez/src/shared/btsnoop.c \
+	bluez/src/shared/lz4.c \
 	bluez/src/shared/mainloop.c \
 	bluez/lib/hci.c \
 	bluez/lib/bluetooth.c \
@@ -509,6 +515,7 @@ LOCAL_SRC_FILES := \
 	bluez/android/bluetoothd-snoop.c \
 	bluez/src/shared/mainloop.c \
 	bluez/src/shared/btsnoop.c \
+	bluez/src/shared/lz4.c \
 	bluez/android/log.c \
 
 LOCAL_C_INCLUDES := \
@@ -27,6 +27,7 @@
 
 #include "src/shared/util.h"
 #include "src/shared/crypto.h"
+#include "src/shared/rpa.h"
 #include "src/shared/ecc.h"
 #include "src/shared/mainloop.h"
 #include "monitor/bt.h"
@@ -36,6 +37,7 @@
 
 #define ACCEPT_LIST_SIZE	16
 #define RESOLV_LIST_SIZE	16
+#define RPA_CACHE_SIZE		16
 #define SCAN_CACHE_SIZE		64
 
 #define DEFAULT_TX_LEN		0x001b
@@ -59,6 +61,7 @@ struct bt_le {
 	int vhci_fd;
 	struct bt_phy *phy;
 	struct bt_crypto *crypto;
+	struct bt_rpa_resolver *resolver;
 	int adv_timeout_id;
 	int scan_timeout_id;
 	bool scan_window_active;
@@ -150,7 +153,8 @@ static void resolve_peer_addr(struct bt_le *hci, uint8_t peer_addr_type,
 					const uint8_t peer_addr[6],
 					uint8_t *addr_type, uint8_t addr[6])
 {
-	int i;
+	void *data;
+	uint8_t *entry;
 
 	if (!hci->le_resolv_enable)
 		goto done;
@@ -161,36 +165,45 @@ static void resolve_peer_addr(struct bt_le *hci, uint8_t peer_addr_type,
 	if ((peer_addr[5] & 0xc0) != 0x40)
 		goto done;
 
-	for (i = 0; i < hci->le_resolv_list_size; i++) {
-		uint8_t local_hash[3];
-
-		if (hci->le_resolv_list[i][0] == 0xff)
-			continue;
+	if (!bt_rpa_resolver_resolve(hci->resolver, peer_addr, &data))
+		goto done;
 
-		bt_crypto_ah(hci->crypto, &hci->le_resolv_list[i][7],
-						peer_addr + 3, local_hash);
+	entry = data;
 
-		if (!memcmp(peer_addr, local_hash, 3)) {
-			switch (hci->le_resolv_list[i][0]) {
-			case 0x00:
-				*addr_type = 0x02;
-				break;
-			case 0x01:
-				*addr_type = 0x03;
-				break;
-			default:
-				continue;
-			}
-			memcpy(addr, &hci->le_resolv_list[i][1], 6);
-			return;
-		}
+	switch (entry[0]) {
+	case 0x00:
+		*addr_type = 0x02;
+		break;
+	case 0x01:
+		*addr_type = 0x03;
+		break;
+	default:
+		goto done;
 	}
 
+	memcpy(addr, &entry[1], 6);
+	return;
+
 done:
 	*addr_type = peer_addr_type;
 	memcpy(addr, peer_addr, 6);
 }
 
+static void update_resolver(struct bt_le *hci)
+{
+	int i;
+
+	bt_rpa_resolver_clear(hci->resolver);
+
+	for (i = 0; i < hci->le_resolv_list_size; i++) {
+		if (hci->le_resolv_list[i][0] == 0xff)
+			continue;
+
+		bt_rpa_resolver_add(hci->resolver, &hci->le_resolv_list[i][7],
+						hci->le_resolv_list[i]);
+	}
+}
+
 static void clear_resolv_list(struct bt_le *hci)
 {
 	int i;
@@ -199,6 +212,8 @@ static void clear_resolv_list(struct bt_le *hci)
 		hci->le_resolv_list[i][0] = 0xff;
 		memset(&hci->le_resolv_list[i][1], 0, 38);
 	}
+
+	update_resolver(hci);
 }
 
 static void reset_defaults(struct bt_le *hci)
@@ -1535,6 +1550,8 @@ static void cmd_le_add_to_resolv_list(struct bt_le *hci,
 	memcpy(&hci->le_resolv_list[pos][7], cmd->peer_irk, 16);
 	memcpy(&hci->le_resolv_list[pos][23], cmd->local_irk, 16);
 
+	update_resolver(hci);
+
 	status = BT_HCI_ERR_SUCCESS;
 	cmd_complete(hci, BT_HCI_CMD_LE_ADD_TO_RESOLV_LIST,
 						&status, sizeof(status));
@@ -1572,6 +1589,8 @@ static void cmd_le_remove_from_resolv_list(struct bt_le *hci,
 	hci->le_resolv_list[pos][0] = 0xff;
 	memset(&hci->le_resolv_list[pos][1], 0, 38);
 
+	update_resolver(hci);
+
 	status = BT_HCI_ERR_SUCCESS;
 	cmd_complete(hci, BT_HCI_CMD_LE_REMOVE_FROM_RESOLV_LIST,
 						&status, sizeof(status));
@@ -2025,10 +2044,13 @@ struct bt_le *bt_le_new(void)
 	hci->scan_timeout_id = -1;
 	hci->scan_window_active = false;
 
+	hci->resolver = bt_rpa_resolver_new(RPA_CACHE_SIZE);
+
 	reset_defaults(hci);
 
 	hci->vhci_fd = open("/dev/vhci", O_RDWR);
 	if (hci->vhci_fd < 0) {
+		bt_rpa_resolver_free(hci->resolver);
 		free(hci);
 		return NULL;
 	}
@@ -2038,6 +2060,7 @@ struct bt_le *bt_le_new(void)
 
 	if (write(hci->vhci_fd, setup_cmd, sizeof(setup_cmd)) < 0) {
 		close(hci->vhci_fd);
+		bt_rpa_resolver_free(hci->resolver);
 		free(hci);
 		return NULL;
 	}
@@ -2073,6 +2096,7 @@ void bt_le_unref(struct bt_le *hci)
 	stop_adv(hci);
 
 	bt_crypto_unref(hci->crypto);
+	bt_rpa_resolver_free(hci->resolver);
 	bt_phy_unref(hci->phy);
 
 	mainloop_remove_fd(hci->vhci_fd);
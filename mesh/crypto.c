@@ -80,37 +80,26 @@ bool mesh_crypto_aes_cmac(const uint8_t key[16], const uint8_t *msg,
 	return aes_cmac_one(key, msg, msg_len, res);
 }
 
-bool mesh_crypto_aes_ccm_encrypt(const uint8_t nonce[13], const uint8_t key[16],
+static bool ccm_encrypt(struct l_aead_cipher *cipher,
+					const uint8_t nonce[13],
 					const uint8_t *aad, uint16_t aad_len,
 					const void *msg, uint16_t msg_len,
-					void *out_msg,
-					void *out_mic, size_t mic_size)
+					void *out_msg, size_t mic_size)
 {
-	void *cipher;
-	bool result;
-
-	cipher = l_aead_cipher_new(L_AEAD_CIPHER_AES_CCM, key, 16, mic_size);
-
-	result = l_aead_cipher_encrypt(cipher, msg, msg_len, aad, aad_len,
+	return l_aead_cipher_encrypt(cipher, msg, msg_len, aad, aad_len,
 					nonce, 13, out_msg, msg_len + mic_size);
-
-	l_aead_cipher_free(cipher);
-
-	return result;
 }
 
-bool mesh_crypto_aes_ccm_decrypt(const uint8_t nonce[13], const uint8_t key[16],
+static bool ccm_decrypt(struct l_aead_cipher *cipher,
+				const uint8_t nonce[13],
 				const uint8_t *aad, uint16_t aad_len,
 				const void *enc_msg, uint16_t enc_msg_len,
 				void *out_msg,
 				void *out_mic, size_t mic_size)
 {
-	void *cipher;
 	bool result;
 	size_t out_msg_len = enc_msg_len - mic_size;
 
-	cipher = l_aead_cipher_new(L_AEAD_CIPHER_AES_CCM, key, 16, mic_size);
-
 	result = l_aead_cipher_decrypt(cipher, enc_msg, enc_msg_len,
 							aad, aad_len, nonce, 13,
 							out_msg, out_msg_len);
@@ -124,6 +113,42 @@ bool mesh_crypto_aes_ccm_decrypt(const uint8_t nonce[13], const uint8_t key[16],
 				l_get_be64(enc_msg + enc_msg_len - mic_size);
 	}
 
+	return result;
+}
+
+bool mesh_crypto_aes_ccm_encrypt(const uint8_t nonce[13], const uint8_t key[16],
+					const uint8_t *aad, uint16_t aad_len,
+					const void *msg, uint16_t msg_len,
+					void *out_msg,
+					void *out_mic, size_t mic_size)
+{
+	struct l_aead_cipher *cipher;
+	bool result;
+
+	cipher = l_aead_cipher_new(L_AEAD_CIPHER_AES_CCM, key, 16, mic_size);
+
+	result = ccm_encrypt(cipher, nonce, aad, aad_len, msg, msg_len,
+							out_msg, mic_size);
+
+	l_aead_cipher_free(cipher);
+
+	return result;
+}
+
+bool mesh_crypto_aes_ccm_decrypt(const uint8_t nonce[13], const uint8_t key[16],
+				const uint8_t *aad, uint16_t aad_len,
+				const void *enc_msg, uint16_t enc_msg_len,
+				void *out_msg,
+				void *out_mic, size_t mic_size)
+{
+	struct l_aead_cipher *cipher;
+	bool result;
+
+	cipher = l_aead_cipher_new(L_AEAD_CIPHER_AES_CCM, key, 16, mic_size);
+
+	result = ccm_decrypt(cipher, nonce, aad, aad_len, enc_msg, enc_msg_len,
+						out_msg, out_mic, mic_size);
+
 	l_aead_cipher_free(cipher);
 
 	return result;
@@ -465,6 +490,92 @@ static void mesh_crypto_privacy_counter(uint32_t iv_index,
 	memcpy(privacy_counter + 9, payload, 7);
 }
 
+/*
+ * Network layer cipher state for one NetKey. Ciphers are only set up on
+ * first use, so a context living on the stack for a single PDU costs no
+ * more than the one-shot helpers above.
+ */
+struct mesh_crypto_net_ctx {
+	uint8_t enc_key[16];
+	uint8_t privacy_key[16];
+	struct l_cipher *privacy;
+	struct l_aead_cipher *ccm32;
+	struct l_aead_cipher *ccm64;
+};
+
+static void net_ctx_init(struct mesh_crypto_net_ctx *ctx,
+					const uint8_t enc_key[16],
+					const uint8_t privacy_key[16])
+{
+	memset(ctx, 0, sizeof(*ctx));
+
+	if (enc_key)
+		memcpy(ctx->enc_key, enc_key, 16);
+
+	if (privacy_key)
+		memcpy(ctx->privacy_key, privacy_key, 16);
+}
+
+static void net_ctx_clear(struct mesh_crypto_net_ctx *ctx)
+{
+	l_cipher_free(ctx->privacy);
+	l_aead_cipher_free(ctx->ccm32);
+	l_aead_cipher_free(ctx->ccm64);
+	memset(ctx, 0, sizeof(*ctx));
+}
+
+static struct l_aead_cipher *net_ctx_ccm(struct mesh_crypto_net_ctx *ctx,
+							size_t mic_size)
+{
+	struct l_aead_cipher **cipher;
+
+	cipher = (mic_size == 8) ? &ctx->ccm64 : &ctx->ccm32;
+
+	if (!*cipher)
+		*cipher = l_aead_cipher_new(L_AEAD_CIPHER_AES_CCM,
+						ctx->enc_key, 16, mic_size);
+
+	return *cipher;
+}
+
+struct mesh_crypto_net_ctx *mesh_crypto_net_ctx_new(const uint8_t enc_key[16],
+					const uint8_t privacy_key[16])
+{
+	struct mesh_crypto_net_ctx *ctx;
+
+	ctx = l_new(struct mesh_crypto_net_ctx, 1);
+	net_ctx_init(ctx, enc_key, privacy_key);
+
+	/* Set up everything now so that no PDU pays for it */
+	ctx->privacy = l_cipher_new(L_CIPHER_AES, privacy_key, 16);
+	if (!ctx->privacy || !net_ctx_ccm(ctx, 4) || !net_ctx_ccm(ctx, 8)) {
+		mesh_crypto_net_ctx_free(ctx);
+		return NULL;
+	}
+
+	return ctx;
+}
+
+void mesh_crypto_net_ctx_free(struct mesh_crypto_net_ctx *ctx)
+{
+	if (!ctx)
+		return;
+
+	net_ctx_clear(ctx);
+	l_free(ctx);
+}
+
+static bool net_ctx_pecb(struct mesh_crypto_net_ctx *ctx, uint32_t iv_index,
+					const uint8_t *payload, uint8_t pecb[16])
+{
+	mesh_crypto_privacy_counter(iv_index, payload, pecb);
+
+	if (!ctx->privacy)
+		ctx->privacy = l_cipher_new(L_CIPHER_AES, ctx->privacy_key, 16);
+
+	return l_cipher_encrypt(ctx->privacy, pecb, pecb, 16);
+}
+
 static bool mesh_crypto_pecb(const uint8_t privacy_key[16],
 						uint32_t iv_index,
 						const uint8_t *payload,
@@ -474,42 +585,28 @@ static bool mesh_crypto_pecb(const uint8_t privacy_key[16],
 	return aes_ecb_one(privacy_key, pecb, pecb);
 }
 
-static bool mesh_crypto_network_obfuscate(uint8_t *packet,
-						const uint8_t privacy_key[16],
-						uint32_t iv_index,
+static void network_obfuscate(uint8_t *packet, const uint8_t pecb[16],
 						bool ctl, uint8_t ttl,
 						uint32_t seq, uint16_t src)
 {
-	uint8_t pecb[16];
 	uint8_t *net_hdr = packet + 1;
 	int i;
 
-	if (!mesh_crypto_pecb(privacy_key, iv_index, packet + 7, pecb))
-		return false;
-
 	l_put_be16(src, net_hdr + 4);
 	l_put_be32(seq & SEQ_MASK, net_hdr);
 	net_hdr[0] = ((!!ctl) << 7) | (ttl & TTL_MASK);
 
 	for (i = 0; i < 6; i++)
 		net_hdr[i] = pecb[i] ^ net_hdr[i];
-
-	return true;
 }
 
-static bool mesh_crypto_network_clarify(uint8_t *packet,
-						const uint8_t privacy_key[16],
-						uint32_t iv_index,
+static void network_clarify(uint8_t *packet, const uint8_t pecb[16],
 						bool *ctl, uint8_t *ttl,
 						uint32_t *seq, uint16_t *src)
 {
-	uint8_t pecb[16];
 	uint8_t *net_hdr = packet + 1;
 	int i;
 
-	if (!mesh_crypto_pecb(privacy_key, iv_index, packet + 7, pecb))
-		return false;
-
 	for (i = 0; i < 6; i++)
 		net_hdr[i] = pecb[i] ^ net_hdr[i];
 
@@ -517,6 +614,36 @@ static bool mesh_crypto_network_clarify(uint8_t *packet,
 	*seq = l_get_be32(net_hdr) & SEQ_MASK;
 	*ttl = net_hdr[0] & TTL_MASK;
 	*ctl = !!(net_hdr[0] & CTL);
+}
+
+static bool mesh_crypto_network_obfuscate(uint8_t *packet,
+						const uint8_t privacy_key[16],
+						uint32_t iv_index,
+						bool ctl, uint8_t ttl,
+						uint32_t seq, uint16_t src)
+{
+	uint8_t pecb[16];
+
+	if (!mesh_crypto_pecb(privacy_key, iv_index, packet + 7, pecb))
+		return false;
+
+	network_obfuscate(packet, pecb, ctl, ttl, seq, src);
+
+	return true;
+}
+
+static bool mesh_crypto_network_clarify(uint8_t *packet,
+						const uint8_t privacy_key[16],
+						uint32_t iv_index,
+						bool *ctl, uint8_t *ttl,
+						uint32_t *seq, uint16_t *src)
+{
+	uint8_t pecb[16];
+
+	if (!mesh_crypto_pecb(privacy_key, iv_index, packet + 7, pecb))
+		return false;
+
+	network_clarify(packet, pecb, ctl, ttl, seq, src);
 
 	return true;
 }
@@ -792,13 +919,14 @@ bool mesh_crypto_payload_decrypt(uint8_t *aad, uint16_t aad_len,
 	return true;
 }
 
-static bool mesh_crypto_packet_encrypt(uint8_t *packet, uint8_t packet_len,
-				const uint8_t network_key[16],
+static bool packet_encrypt(struct mesh_crypto_net_ctx *ctx,
+				uint8_t *packet, uint8_t packet_len,
 				uint32_t iv_index, bool proxy,
 				bool ctl, uint8_t ttl, uint32_t seq,
 				uint16_t src)
 {
 	uint8_t nonce[13];
+	size_t mic_size = ctl ? 8 : 4;
 
 	/* Detect Proxy packet by CTL == true && DST == 0x0000 */
 	if (ctl && proxy)
@@ -806,51 +934,76 @@ static bool mesh_crypto_packet_encrypt(uint8_t *packet, uint8_t packet_len,
 	else
 		mesh_crypto_network_nonce(ctl, ttl, seq, src, iv_index, nonce);
 
-	/* Check for Long net-MIC */
-	if (ctl) {
-		if (!mesh_crypto_aes_ccm_encrypt(nonce, network_key,
-					NULL, 0,
-					packet + 7, packet_len - 7 - 8,
-					packet + 7, NULL, 8))
-			return false;
-	} else {
-		if (!mesh_crypto_aes_ccm_encrypt(nonce, network_key,
-					NULL, 0,
-					packet + 7, packet_len - 7 - 4,
-					packet + 7, NULL, 4))
-			return false;
-	}
-
-	return true;
+	/* Long net-MIC for control messages */
+	return ccm_encrypt(net_ctx_ccm(ctx, mic_size), nonce, NULL, 0,
+				packet + 7, packet_len - 7 - mic_size,
+				packet + 7, mic_size);
 }
 
-bool mesh_crypto_packet_encode(uint8_t *packet, uint8_t packet_len,
-				uint32_t iv_index,
+static bool mesh_crypto_packet_encrypt(uint8_t *packet, uint8_t packet_len,
 				const uint8_t network_key[16],
-				const uint8_t privacy_key[16])
+				uint32_t iv_index, bool proxy,
+				bool ctl, uint8_t ttl, uint32_t seq,
+				uint16_t src)
+{
+	struct mesh_crypto_net_ctx ctx;
+	bool result;
+
+	net_ctx_init(&ctx, network_key, NULL);
+	result = packet_encrypt(&ctx, packet, packet_len, iv_index, proxy,
+							ctl, ttl, seq, src);
+	net_ctx_clear(&ctx);
+
+	return result;
+}
+
+bool mesh_crypto_net_ctx_encode(struct mesh_crypto_net_ctx *ctx,
+				uint8_t *packet, uint8_t packet_len,
+				uint32_t iv_index)
 {
 	bool ctl;
 	uint8_t ttl;
 	uint32_t seq;
 	uint16_t src;
 	uint16_t dst;
+	uint8_t pecb[16];
+
+	if (!ctx)
+		return false;
 
 	if (!network_header_parse(packet, packet_len,
 						&ctl, &ttl, &seq, &src, &dst))
 		return false;
 
-	if (!mesh_crypto_packet_encrypt(packet, packet_len, network_key,
-							iv_index, !dst,
+	if (!packet_encrypt(ctx, packet, packet_len, iv_index, !dst,
 							ctl, ttl, seq, src))
+		return false;
 
+	if (!net_ctx_pecb(ctx, iv_index, packet + 7, pecb))
 		return false;
 
-	return mesh_crypto_network_obfuscate(packet, privacy_key, iv_index,
-							ctl, ttl, seq, src);
+	network_obfuscate(packet, pecb, ctl, ttl, seq, src);
+
+	return true;
 }
 
-static bool mesh_crypto_packet_decrypt(uint8_t *packet, uint8_t packet_len,
+bool mesh_crypto_packet_encode(uint8_t *packet, uint8_t packet_len,
+				uint32_t iv_index,
 				const uint8_t network_key[16],
+				const uint8_t privacy_key[16])
+{
+	struct mesh_crypto_net_ctx ctx;
+	bool result;
+
+	net_ctx_init(&ctx, network_key, privacy_key);
+	result = mesh_crypto_net_ctx_encode(&ctx, packet, packet_len, iv_index);
+	net_ctx_clear(&ctx);
+
+	return result;
+}
+
+static bool packet_decrypt(struct mesh_crypto_net_ctx *ctx,
+				uint8_t *packet, uint8_t packet_len,
 				uint32_t iv_index, bool proxy,
 				bool ctl, uint8_t ttl, uint32_t seq,
 				uint16_t src)
@@ -871,8 +1024,7 @@ static bool mesh_crypto_packet_decrypt(uint8_t *packet, uint8_t packet_len,
 	if (ctl) {
 		uint64_t mic;
 
-		if (!mesh_crypto_aes_ccm_decrypt(nonce, network_key,
-					NULL, 0,
+		if (!ccm_decrypt(net_ctx_ccm(ctx, sizeof(mic)), nonce, NULL, 0,
 					packet + 7, packet_len - 7,
 					packet + 7, &mic, sizeof(mic)))
 			return false;
@@ -885,8 +1037,7 @@ static bool mesh_crypto_packet_decrypt(uint8_t *packet, uint8_t packet_len,
 	} else {
 		uint32_t mic;
 
-		if (!mesh_crypto_aes_ccm_decrypt(nonce, network_key,
-					NULL, 0,
+		if (!ccm_decrypt(net_ctx_ccm(ctx, sizeof(mic)), nonce, NULL, 0,
 					packet + 7, packet_len - 7,
 					packet + 7, &mic, sizeof(mic)))
 			return false;
@@ -901,30 +1052,63 @@ static bool mesh_crypto_packet_decrypt(uint8_t *packet, uint8_t packet_len,
 	return true;
 }
 
-bool mesh_crypto_packet_decode(const uint8_t *packet, uint8_t packet_len,
-				bool proxy, uint8_t *out, uint32_t iv_index,
+static bool mesh_crypto_packet_decrypt(uint8_t *packet, uint8_t packet_len,
 				const uint8_t network_key[16],
-				const uint8_t privacy_key[16])
+				uint32_t iv_index, bool proxy,
+				bool ctl, uint8_t ttl, uint32_t seq,
+				uint16_t src)
+{
+	struct mesh_crypto_net_ctx ctx;
+	bool result;
+
+	net_ctx_init(&ctx, network_key, NULL);
+	result = packet_decrypt(&ctx, packet, packet_len, iv_index, proxy,
+							ctl, ttl, seq, src);
+	net_ctx_clear(&ctx);
+
+	return result;
+}
+
+bool mesh_crypto_net_ctx_decode(struct mesh_crypto_net_ctx *ctx,
+				const uint8_t *packet, uint8_t packet_len,
+				bool proxy, uint8_t *out, uint32_t iv_index)
 {
 	bool ctl;
 	uint8_t ttl;
 	uint32_t seq;
 	uint16_t src;
+	uint8_t pecb[16];
 
-	if (packet_len < 14)
+	if (!ctx || packet_len < 14)
 		return false;
 
 	memcpy(out, packet, packet_len);
 
-	if (!mesh_crypto_network_clarify(out, privacy_key, iv_index,
-						&ctl, &ttl, &seq, &src))
+	if (!net_ctx_pecb(ctx, iv_index, out + 7, pecb))
 		return false;
 
-	return mesh_crypto_packet_decrypt(out, packet_len, network_key,
-							iv_index, proxy,
+	network_clarify(out, pecb, &ctl, &ttl, &seq, &src);
+
+	return packet_decrypt(ctx, out, packet_len, iv_index, proxy,
 							ctl, ttl, seq, src);
 }
 
+bool mesh_crypto_packet_decode(const uint8_t *packet, uint8_t packet_len,
+				bool proxy, uint8_t *out, uint32_t iv_index,
+				const uint8_t network_key[16],
+				const uint8_t privacy_key[16])
+{
+	struct mesh_crypto_net_ctx ctx;
+	bool result;
+
+	net_ctx_init(&ctx, network_key, privacy_key);
+	result = mesh_crypto_net_ctx_decode(&ctx, packet, packet_len, proxy,
+								out, iv_index);
+	net_ctx_clear(&ctx);
+
+	return result;
+}
+
 bool mesh_crypto_packet_label(uint8_t *packet, uint8_t packet_len,
 				uint16_t iv_index, uint8_t network_id)
 {
@@ -98,6 +98,19 @@ bool mesh_crypto_packet_decode(const uint8_t *packet, uint8_t packet_len,
 				bool proxy, uint8_t *out, uint32_t iv_index,
 				const uint8_t network_key[16],
 				const uint8_t privacy_key[16]);
+
+struct mesh_crypto_net_ctx;
+
+struct mesh_crypto_net_ctx *mesh_crypto_net_ctx_new(const uint8_t enc_key[16],
+					const uint8_t privacy_key[16]);
+void mesh_crypto_net_ctx_free(struct mesh_crypto_net_ctx *ctx);
+bool mesh_crypto_net_ctx_encode(struct mesh_crypto_net_ctx *ctx,
+				uint8_t *packet, uint8_t packet_len,
+				uint32_t iv_index);
+bool mesh_crypto_net_ctx_decode(struct mesh_crypto_net_ctx *ctx,
+				const uint8_t *packet, uint8_t packet_len,
+				bool proxy, uint8_t *out, uint32_t iv_index);
+
 bool mesh_crypto_packet_label(uint8_t *packet, uint8_t packet_len,
 				uint16_t iv_index, uint8_t network_id);
 
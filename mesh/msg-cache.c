@@ -0,0 +1,178 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <ell/ell.h>
+
+#include "mesh/msg-cache.h"
+
+/*
+ * Network message cache
+ *
+ * Entries live in a fixed ring ordered by insertion so that, once the
+ * cache is full, the oldest message is the one evicted. Lookups go through
+ * an open addressing (linear probing) table of ring positions sized to at
+ * least twice the number of entries, which keeps probe sequences short.
+ */
+
+#define SLOT_EMPTY	0
+
+struct cache_entry {
+	uint32_t seq;
+	uint32_t mic;
+	uint16_t src;
+};
+
+struct mesh_msg_cache {
+	unsigned int size;
+	unsigned int len;
+	unsigned int oldest;
+	unsigned int mask;
+	struct cache_entry *entries;
+	uint16_t *slots;		/* Ring position + 1 or SLOT_EMPTY */
+};
+
+static unsigned int entry_hash(uint16_t src, uint32_t seq, uint32_t mic)
+{
+	uint32_t h;
+
+	h = (seq << 8 | seq >> 24) ^ mic ^ ((uint32_t) src << 16 | src);
+	h ^= h >> 16;
+	h *= 0x45d9f3b;
+	h ^= h >> 16;
+
+	return h;
+}
+
+static bool entry_match(const struct cache_entry *entry, uint16_t src,
+						uint32_t seq, uint32_t mic)
+{
+	return entry->seq == seq && entry->mic == mic && entry->src == src;
+}
+
+static void slot_remove(struct mesh_msg_cache *cache, unsigned int pos)
+{
+	const struct cache_entry *entry = &cache->entries[pos];
+	unsigned int i, j, home;
+
+	i = entry_hash(entry->src, entry->seq, entry->mic) & cache->mask;
+
+	while (cache->slots[i] != pos + 1)
+		i = (i + 1) & cache->mask;
+
+	/* Backward shift deletion keeps probe chains intact */
+	for (j = (i + 1) & cache->mask; cache->slots[j] != SLOT_EMPTY;
+						j = (j + 1) & cache->mask) {
+		entry = &cache->entries[cache->slots[j] - 1];
+		home = entry_hash(entry->src, entry->seq, entry->mic) &
+								cache->mask;
+
+		/* Entries whose home slot lies cyclically in (i, j] stay */
+		if (((j - home) & cache->mask) >= ((j - i) & cache->mask)) {
+			cache->slots[i] = cache->slots[j];
+			i = j;
+		}
+	}
+
+	cache->slots[i] = SLOT_EMPTY;
+}
+
+struct mesh_msg_cache *msg_cache_new(unsigned int size)
+{
+	struct mesh_msg_cache *cache;
+	unsigned int slots = 1;
+
+	if (!size || size >= UINT16_MAX / 2)
+		return NULL;
+
+	while (slots < size * 2)
+		slots <<= 1;
+
+	cache = l_new(struct mesh_msg_cache, 1);
+	cache->size = size;
+	cache->mask = slots - 1;
+	cache->entries = l_new(struct cache_entry, size);
+	cache->slots = l_new(uint16_t, slots);
+
+	return cache;
+}
+
+void msg_cache_free(struct mesh_msg_cache *cache)
+{
+	if (!cache)
+		return;
+
+	l_free(cache->entries);
+	l_free(cache->slots);
+	l_free(cache);
+}
+
+void msg_cache_clear(struct mesh_msg_cache *cache)
+{
+	if (!cache)
+		return;
+
+	memset(cache->slots, 0, (cache->mask + 1) * sizeof(*cache->slots));
+	cache->len = 0;
+	cache->oldest = 0;
+}
+
+unsigned int msg_cache_len(struct mesh_msg_cache *cache)
+{
+	return cache ? cache->len : 0;
+}
+
+/*
+ * Returns true if the message is already cached, otherwise adds it to the
+ * cache (evicting the oldest entry when full) and returns false.
+ */
+bool msg_cache_check(struct mesh_msg_cache *cache, uint16_t src, uint32_t seq,
+								uint32_t mic)
+{
+	struct cache_entry *entry;
+	unsigned int i, pos;
+
+	if (!cache)
+		return false;
+
+	i = entry_hash(src, seq, mic) & cache->mask;
+
+	for (; cache->slots[i] != SLOT_EMPTY; i = (i + 1) & cache->mask) {
+		entry = &cache->entries[cache->slots[i] - 1];
+
+		if (entry_match(entry, src, seq, mic))
+			return true;
+	}
+
+	if (cache->len == cache->size) {
+		pos = cache->oldest;
+		slot_remove(cache, pos);
+		cache->oldest = (cache->oldest + 1) % cache->size;
+
+		/* Removal may have shifted an entry into the free slot */
+		i = entry_hash(src, seq, mic) & cache->mask;
+		while (cache->slots[i] != SLOT_EMPTY)
+			i = (i + 1) & cache->mask;
+	} else {
+		pos = (cache->oldest + cache->len) % cache->size;
+		cache->len++;
+	}
+
+	entry = &cache->entries[pos];
+	entry->src = src;
+	entry->seq = seq;
+	entry->mic = mic;
+	cache->slots[i] = pos + 1;
+
+	return false;
+}
@@ -0,0 +1,16 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+struct mesh_msg_cache;
+
+struct mesh_msg_cache *msg_cache_new(unsigned int size);
+void msg_cache_free(struct mesh_msg_cache *cache);
+void msg_cache_clear(struct mesh_msg_cache *cache);
+unsigned int msg_cache_len(struct mesh_msg_cache *cache);
+bool msg_cache_check(struct mesh_msg_cache *cache, uint16_t src, uint32_t seq,
+								uint32_t mic);
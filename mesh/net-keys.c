@@ -63,6 +63,7 @@ struct net_key {
 	uint8_t snb_key[16];
 	uint8_t pvt_key[16];
 	uint8_t net_id[8];
+	struct mesh_crypto_net_ctx *net_ctx;
 	bool kr;
 	bool ivu;
 };
@@ -129,6 +130,10 @@ uint32_t net_key_add(const uint8_t flooding[16])
 	if (!result)
 		goto fail;
 
+	key->net_ctx = mesh_crypto_net_ctx_new(key->enc_key, key->prv_key);
+	if (!key->net_ctx)
+		goto fail;
+
 	result = mesh_crypto_k3(flooding, key->net_id);
 	if (!result)
 		goto fail;
@@ -146,6 +151,7 @@ uint32_t net_key_add(const uint8_t flooding[16])
 	return key->id;
 
 fail:
+	mesh_crypto_net_ctx_free(key->net_ctx);
 	l_free(key);
 	return 0;
 }
@@ -172,6 +178,12 @@ uint32_t net_key_frnd_add(uint32_t flooding_id, uint16_t lpn, uint16_t frnd,
 	result = mesh_crypto_k2(key->flooding, p, sizeof(p), &frnd_key->nid,
 				frnd_key->enc_key, frnd_key->prv_key);
 
+	if (result) {
+		frnd_key->net_ctx = mesh_crypto_net_ctx_new(frnd_key->enc_key,
+							frnd_key->prv_key);
+		result = !!frnd_key->net_ctx;
+	}
+
 	if (!result) {
 		l_free(frnd_key);
 		return 0;
@@ -193,6 +205,7 @@ void net_key_unref(uint32_t id)
 		if (--key->ref_cnt == 0) {
 			l_timeout_remove(key->observe.timeout);
 			l_queue_remove(keys, key);
+			mesh_crypto_net_ctx_free(key->net_ctx);
 			l_free(key);
 		}
 	}
@@ -228,9 +241,8 @@ static void decrypt_net_pkt(void *a, void *b)
 	if (cache_id || !key->ref_cnt || (cache_pkt[0] & 0x7f) != key->nid)
 		return;
 
-	result = mesh_crypto_packet_decode(cache_pkt, cache_len, false,
-						cache_plain, cache_iv_index,
-						key->enc_key, key->prv_key);
+	result = mesh_crypto_net_ctx_decode(key->net_ctx, cache_pkt, cache_len,
+					false, cache_plain, cache_iv_index);
 
 	if (result) {
 		cache_id = key->id;
@@ -278,8 +290,7 @@ bool net_key_encrypt(uint32_t id, uint32_t iv_index, uint8_t *pkt, size_t len)
 	if (!key)
 		return false;
 
-	result = mesh_crypto_packet_encode(pkt, len, iv_index, key->enc_key,
-							key->prv_key);
+	result = mesh_crypto_net_ctx_encode(key->net_ctx, pkt, len, iv_index);
 
 	if (!result)
 		return false;
@@ -786,6 +797,7 @@ static void free_key(void *data)
 	l_timeout_remove(key->mpb_to);
 	l_free(key->snb);
 	l_free(key->mpb);
+	mesh_crypto_net_ctx_free(key->net_ctx);
 	l_free(key);
 }
 
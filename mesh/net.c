@@ -30,6 +30,7 @@
 #include "mesh/model.h"
 #include "mesh/appkey.h"
 #include "mesh/rpl.h"
+#include "mesh/msg-cache.h"
 
 #define abs_diff(a, b) ((a) > (b) ? (a) - (b) : (b) - (a))
 
@@ -134,8 +135,9 @@ struct mesh_net {
 	uint16_t features;
 
 	struct l_queue *subnets;
-	struct l_queue *msg_cache;
+	struct mesh_msg_cache *msg_cache;
 	struct l_queue *replay_cache;
+	struct l_hashmap *replay_index;
 	struct l_queue *sar_in;
 	struct l_queue *sar_out;
 	struct l_queue *sar_queue;
@@ -145,12 +147,6 @@ struct mesh_net {
 	struct l_queue *destinations;
 };
 
-struct mesh_msg {
-	uint16_t src;
-	uint32_t seq;
-	uint32_t mic;
-};
-
 struct mesh_sar {
 	unsigned int id;
 	struct l_timeout *seg_timeout;
@@ -222,7 +218,11 @@ struct net_beacon_data {
 	bool local;
 };
 
-static struct l_queue *fast_cache;
+static struct {
+	uint64_t hash[FAST_CACHE_SIZE];
+	unsigned int len;
+	unsigned int next;
+} fast_cache;
 static struct l_queue *nets;
 
 static void net_rx(void *net_ptr, void *user_data);
@@ -642,7 +642,7 @@ struct mesh_net *mesh_net_new(struct mesh_node *node)
 	net->tx_interval = DEFAULT_TRANSMIT_INTERVAL;
 
 	net->subnets = l_queue_new();
-	net->msg_cache = l_queue_new();
+	net->msg_cache = msg_cache_new(MSG_CACHE_SIZE);
 	net->sar_in = l_queue_new();
 	net->sar_out = l_queue_new();
 	net->sar_queue = l_queue_new();
@@ -650,13 +650,11 @@ struct mesh_net *mesh_net_new(struct mesh_node *node)
 	net->destinations = l_queue_new();
 	net->app_keys = l_queue_new();
 	net->replay_cache = l_queue_new();
+	net->replay_index = l_hashmap_new();
 
 	if (!nets)
 		nets = l_queue_new();
 
-	if (!fast_cache)
-		fast_cache = l_queue_new();
-
 	return net;
 }
 
@@ -668,7 +666,8 @@ void mesh_net_free(void *user_data)
 		return;
 
 	l_queue_destroy(net->subnets, subnet_free);
-	l_queue_destroy(net->msg_cache, l_free);
+	msg_cache_free(net->msg_cache);
+	l_hashmap_destroy(net->replay_index, NULL);
 	l_queue_destroy(net->replay_cache, l_free);
 	l_queue_destroy(net->sar_in, mesh_sar_free);
 	l_queue_destroy(net->sar_out, mesh_sar_free);
@@ -684,8 +683,7 @@ void mesh_net_free(void *user_data)
 
 void mesh_net_cleanup(void)
 {
-	l_queue_destroy(fast_cache, l_free);
-	fast_cache = NULL;
+	memset(&fast_cache, 0, sizeof(fast_cache));
 	l_queue_destroy(nets, mesh_net_free);
 	nets = NULL;
 }
@@ -1033,50 +1031,17 @@ void mesh_net_set_frnd_seq(struct mesh_net *net, bool seq)
 	net->friend_seq = seq;
 }
 
-static bool match_cache(const void *a, const void *b)
-{
-	const struct mesh_msg *msg = a;
-	const struct mesh_msg *tst = b;
-
-	if (msg->seq != tst->seq || msg->mic != tst->mic ||
-					msg->src != tst->src)
-		return false;
-
-	return true;
-}
-
 static bool msg_in_cache(struct mesh_net *net, uint16_t src, uint32_t seq,
 								uint32_t mic)
 {
-	struct mesh_msg *msg;
-	struct mesh_msg tst = {
-		.src = src,
-		.seq = seq,
-		.mic = mic,
-	};
-
-	msg = l_queue_find(net->msg_cache, match_cache, &tst);
-
-	if (msg) {
+	if (msg_cache_check(net->msg_cache, src, seq, mic)) {
 		l_debug("Supressing duplicate %4.4x + %6.6x + %8.8x",
 							src, seq, mic);
 		return true;
 	}
 
-	msg = l_new(struct mesh_msg, 1);
-	*msg = tst;
-	l_queue_push_head(net->msg_cache, msg);
 	l_debug("Add %4.4x + %6.6x + %8.8x", src, seq, mic);
 
-	if (l_queue_length(net->msg_cache) > MSG_CACHE_SIZE) {
-		msg = l_queue_peek_tail(net->msg_cache);
-		/* Remove Tail (oldest msg in cache) */
-		l_debug("Remove %4.4x + %6.6x + %8.8x",
-						msg->src, msg->seq, msg->mic);
-		if (l_queue_remove(net->msg_cache, msg))
-			l_free(msg);
-	}
-
 	return false;
 }
 
@@ -1653,23 +1618,23 @@ static void outseg_to(struct l_timeout *seg_timeout, void *user_data)
 					sar->seqZero, sar->last_nak);
 }
 
-static bool match_replay_cache(const void *a, const void *b)
-{
-	const struct mesh_rpl *rpe = a;
-	uint16_t src = L_PTR_TO_UINT(b);
-
-	return src == rpe->src;
-}
+struct clean_iv_data {
+	struct mesh_net *net;
+	uint32_t iv_index;
+};
 
 static bool clean_old_iv_index(void *a, void *b)
 {
 	struct mesh_rpl *rpe = a;
-	uint32_t iv_index = L_PTR_TO_UINT(b);
+	struct clean_iv_data *data = b;
+	uint32_t iv_index = data->iv_index;
 
 	if (iv_index < 2)
 		return false;
 
 	if (rpe->iv_index < iv_index - 1) {
+		l_hashmap_remove(data->net->replay_index,
+						L_UINT_TO_PTR(rpe->src));
 		l_free(rpe);
 		return true;
 	}
@@ -1686,8 +1651,7 @@ static bool msg_check_replay_cache(struct mesh_net *net, uint16_t src,
 	if (!net || !net->node)
 		return true;
 
-	rpe = l_queue_find(net->replay_cache, match_replay_cache,
-						L_UINT_TO_PTR(src));
+	rpe = l_hashmap_lookup(net->replay_index, L_UINT_TO_PTR(src));
 
 	if (rpe) {
 		if (iv_index > rpe->iv_index)
@@ -1700,9 +1664,13 @@ static bool msg_check_replay_cache(struct mesh_net *net, uint16_t src,
 		}
 	} else if (l_queue_length(net->replay_cache) >= crpl) {
 		/* SRC not in Replay Cache... see if there is space for it */
+		struct clean_iv_data data = {
+			.net = net,
+			.iv_index = iv_index,
+		};
 
 		int ret = l_queue_foreach_remove(net->replay_cache,
-				clean_old_iv_index, L_UINT_TO_PTR(iv_index));
+						clean_old_iv_index, &data);
 
 		/* Return true if no space could be freed */
 		if (!ret) {
@@ -1722,20 +1690,18 @@ static void msg_add_replay_cache(struct mesh_net *net, uint16_t src,
 	if (!net || !net->replay_cache)
 		return;
 
-	rpe = l_queue_remove_if(net->replay_cache, match_replay_cache,
-						L_UINT_TO_PTR(src));
+	rpe = l_hashmap_lookup(net->replay_index, L_UINT_TO_PTR(src));
 
 	if (!rpe) {
 		rpe = l_new(struct mesh_rpl, 1);
 		rpe->src = src;
+		l_queue_push_head(net->replay_cache, rpe);
+		l_hashmap_insert(net->replay_index, L_UINT_TO_PTR(src), rpe);
 	}
 
 	rpe->seq = seq;
 	rpe->iv_index = iv_index;
 	rpl_put_entry(net->node, src, iv_index, seq);
-
-	/* Optimize so that most recent conversations stay earliest in cache */
-	l_queue_push_head(net->replay_cache, rpe);
 }
 
 static bool msg_rxed(struct mesh_net *net, bool frnd, uint32_t iv_index,
@@ -2216,29 +2182,21 @@ static bool ctl_received(struct mesh_net *net, uint32_t net_key_id,
 	return true;
 }
 
-static bool find_fast_hash(const void *a, const void *b)
-{
-	const uint64_t *entry = a;
-	const uint64_t *test = b;
-
-	return *entry == *test;
-}
-
 static bool check_fast_cache(uint64_t hash)
 {
-	void *found = l_queue_find(fast_cache, find_fast_hash, &hash);
-	uint64_t *new_hash;
+	unsigned int i;
 
-	if (found)
-		return false;
+	for (i = 0; i < fast_cache.len; i++) {
+		if (fast_cache.hash[i] == hash)
+			return false;
+	}
 
-	if (l_queue_length(fast_cache) >= FAST_CACHE_SIZE)
-		new_hash = l_queue_pop_head(fast_cache);
-	else
-		new_hash = l_malloc(sizeof(hash));
+	/* Overwrite the oldest entry once the cache is full */
+	fast_cache.hash[fast_cache.next] = hash;
+	fast_cache.next = (fast_cache.next + 1) % FAST_CACHE_SIZE;
 
-	*new_hash = hash;
-	l_queue_push_tail(fast_cache, new_hash);
+	if (fast_cache.len < FAST_CACHE_SIZE)
+		fast_cache.len++;
 
 	return true;
 }
@@ -2584,7 +2542,7 @@ static void iv_upd_to(struct l_timeout *upd_timeout, void *user_data)
 							net->iv_index, false);
 		l_queue_foreach(net->subnets, refresh_beacon, net);
 		queue_friend_update(net);
-		l_queue_clear(net->msg_cache, l_free);
+		msg_cache_clear(net->msg_cache);
 		break;
 
 	case IV_UPD_INIT:
@@ -3019,9 +2977,6 @@ bool mesh_net_attach(struct mesh_net *net, struct mesh_io *io)
 		if (!nets)
 			nets = l_queue_new();
 
-		if (!fast_cache)
-			fast_cache = l_queue_new();
-
 		mesh_io_register_recv_cb(io, snb, sizeof(snb),
 							beacon_recv, NULL);
 		mesh_io_register_recv_cb(io, mpb, sizeof(mpb),
@@ -3074,7 +3029,7 @@ bool mesh_net_iv_index_update(struct mesh_net *net)
 		return false;
 
 	l_debug("iv_upd_state = IV_UPD_UPDATING");
-	l_queue_clear(net->msg_cache, l_free);
+	msg_cache_clear(net->msg_cache);
 
 	if (!mesh_config_write_iv_index(node_config_get(net->node),
 						net->iv_index + 1, true))
@@ -3871,7 +3826,20 @@ int mesh_net_set_heartbeat_pub(struct mesh_net *net, uint16_t dst,
 	return MESH_STATUS_SUCCESS;
 }
 
+static void index_rpl_entry(void *data, void *user_data)
+{
+	struct mesh_rpl *rpe = data;
+	struct mesh_net *net = user_data;
+
+	l_hashmap_insert(net->replay_index, L_UINT_TO_PTR(rpe->src), rpe);
+}
+
 bool mesh_net_load_rpl(struct mesh_net *net)
 {
-	return rpl_get_list(net->node, net->replay_cache);
+	if (!rpl_get_list(net->node, net->replay_cache))
+		return false;
+
+	l_queue_foreach(net->replay_cache, index_rpl_entry, net);
+
+	return true;
 }
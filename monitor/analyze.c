@@ -15,9 +15,11 @@
 
 #define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include "lib/bluetooth.h"
 
@@ -32,6 +34,31 @@
 #define TIMEVAL_MSEC(_tv) \
 	(long long)((_tv)->tv_sec * 1000 + (_tv)->tv_usec / 1000)
 
+#define CONN_BR_ACL	0x01
+#define CONN_BR_SCO	0x02
+#define CONN_BR_ESCO	0x03
+#define CONN_LE_ACL	0x04
+#define CONN_LE_ISO	0x05
+
+struct hci_stats {
+	size_t bytes;
+	size_t num;
+	size_t num_comp;
+	struct packet_latency latency;
+	struct queue *plot;
+	uint16_t min;
+	uint16_t max;
+};
+
+/*
+ * Packet of a connection whose statistics are accounted later by one of the
+ * worker threads, count is only used for Number Of Completed Packets.
+ */
+struct conn_work {
+	uint32_t pos;
+	uint16_t count;
+};
+
 struct hci_dev {
 	uint16_t index;
 	uint8_t type;
@@ -51,22 +78,8 @@ struct hci_dev {
 	unsigned long unknown;
 	uint16_t manufacturer;
 	struct queue *conn_list;
-};
-
-#define CONN_BR_ACL	0x01
-#define CONN_BR_SCO	0x02
-#define CONN_BR_ESCO	0x03
-#define CONN_LE_ACL	0x04
-#define CONN_LE_ISO	0x05
-
-struct hci_stats {
-	size_t bytes;
-	size_t num;
-	size_t num_comp;
-	struct packet_latency latency;
-	struct queue *plot;
-	uint16_t min;
-	uint16_t max;
+	struct queue *cmd_queue;
+	struct hci_stats cmd;
 };
 
 struct hci_conn {
@@ -81,6 +94,9 @@ struct hci_conn {
 	struct queue *chan_list;
 	struct hci_stats rx;
 	struct hci_stats tx;
+	struct conn_work *work;
+	size_t work_len;
+	size_t work_size;
 };
 
 struct hci_conn_tx {
@@ -88,6 +104,14 @@ struct hci_conn_tx {
 	struct l2cap_chan *chan;
 };
 
+struct hci_cmd {
+	struct timeval tv;
+	uint16_t opcode;
+};
+
+/* Commands that never get a response are dropped after this many */
+#define CMD_QUEUE_MAX	64
+
 struct plot {
 	long long x_msec;
 	size_t y_count;
@@ -104,6 +128,21 @@ struct l2cap_chan {
 
 static struct queue *dev_list;
 
+/* Only set while connection statistics are deferred to worker threads */
+static struct btsnoop_index *work_idx;
+static size_t work_pos;
+static struct queue *dev_removed;
+static struct hci_conn **work_conns;
+static unsigned int work_conns_len;
+static unsigned int work_next;
+static bool work_failed;
+
+/* Only set while streaming metrics instead of printing a summary */
+static unsigned int metrics_interval;
+static struct timeval metrics_start;
+static struct timeval metrics_next;
+static struct timeval metrics_last;
+
 static void tmp_write(void *data, void *user_data)
 {
 	struct plot *plot = data;
@@ -158,6 +197,15 @@ static void print_stats(struct hci_stats *stats, const char *label)
 	plot_draw(stats->plot, label);
 }
 
+static void chan_free(void *data)
+{
+	struct l2cap_chan *chan = data;
+
+	queue_destroy(chan->rx.plot, free);
+	queue_destroy(chan->tx.plot, free);
+	free(chan);
+}
+
 static void chan_destroy(void *data)
 {
 	struct l2cap_chan *chan = data;
@@ -174,7 +222,7 @@ static void chan_destroy(void *data)
 	print_stats(&chan->tx, "TX");
 
 done:
-	free(chan);
+	chan_free(chan);
 }
 
 static struct l2cap_chan *chan_alloc(struct hci_conn *conn, uint16_t cid,
@@ -217,33 +265,43 @@ static struct l2cap_chan *chan_lookup(struct hci_conn *conn, uint16_t cid,
 	return chan;
 }
 
-static void conn_destroy(void *data)
+static void conn_free(void *data)
 {
 	struct hci_conn *conn = data;
-	const char *str;
 
-	switch (conn->type) {
+	queue_destroy(conn->rx.plot, free);
+	queue_destroy(conn->tx.plot, free);
+	queue_destroy(conn->chan_list, chan_free);
+
+	queue_destroy(conn->tx_queue, free);
+	free(conn->work);
+	free(conn);
+}
+
+static const char *conn_type_str(uint8_t type)
+{
+	switch (type) {
 	case CONN_BR_ACL:
-		str = "BR-ACL";
-		break;
+		return "BR-ACL";
 	case CONN_BR_SCO:
-		str = "BR-SCO";
-		break;
+		return "BR-SCO";
 	case CONN_BR_ESCO:
-		str = "BR-ESCO";
-		break;
+		return "BR-ESCO";
 	case CONN_LE_ACL:
-		str = "LE-ACL";
-		break;
+		return "LE-ACL";
 	case CONN_LE_ISO:
-		str = "LE-ISO";
-		break;
-	default:
-		str = "unknown";
-		break;
+		return "LE-ISO";
 	}
 
-	printf("  Found %s connection with handle %u\n", str, conn->handle);
+	return "unknown";
+}
+
+static void conn_destroy(void *data)
+{
+	struct hci_conn *conn = data;
+
+	printf("  Found %s connection with handle %u\n",
+				conn_type_str(conn->type), conn->handle);
 	/* TODO: Store address type */
 	packet_print_addr("Address", conn->bdaddr, 0x00);
 	if (!conn->setup_seen)
@@ -251,12 +309,10 @@ static void conn_destroy(void *data)
 	print_stats(&conn->rx, "RX");
 	print_stats(&conn->tx, "TX");
 
-	queue_destroy(conn->rx.plot, free);
-	queue_destroy(conn->tx.plot, free);
 	queue_destroy(conn->chan_list, chan_destroy);
+	conn->chan_list = NULL;
 
-	queue_destroy(conn->tx_queue, free);
-	free(conn);
+	conn_free(conn);
 }
 
 static struct hci_conn *conn_alloc(struct hci_dev *dev, uint16_t handle,
@@ -320,6 +376,16 @@ static struct hci_conn *conn_lookup_type(struct hci_dev *dev, uint16_t handle,
 	return conn;
 }
 
+static void dev_free(void *data)
+{
+	struct hci_dev *dev = data;
+
+	queue_destroy(dev->conn_list, conn_free);
+	queue_destroy(dev->cmd_queue, free);
+	queue_destroy(dev->cmd.plot, free);
+	free(dev);
+}
+
 static void dev_destroy(void *data)
 {
 	struct hci_dev *dev = data;
@@ -357,9 +423,10 @@ static void dev_destroy(void *data)
 	printf("  %lu control messages \n", dev->ctrl_msg);
 	printf("  %lu unknown opcodes\n", dev->unknown);
 	queue_destroy(dev->conn_list, conn_destroy);
+	dev->conn_list = NULL;
 	printf("\n");
 
-	free(dev);
+	dev_free(dev);
 }
 
 static struct hci_dev *dev_alloc(uint16_t index)
@@ -372,6 +439,8 @@ static struct hci_dev *dev_alloc(uint16_t index)
 	dev->manufacturer = 0xffff;
 
 	dev->conn_list = queue_new();
+	dev->cmd_queue = queue_new();
+	dev->cmd.plot = queue_new();
 
 	return dev;
 }
@@ -451,6 +520,15 @@ static void del_index(struct timeval *tv, uint16_t index,
 		return;
 	}
 
+	/*
+	 * Statistics are only complete once the workers are done or the
+	 * metrics of the current interval have been reported.
+	 */
+	if (work_idx || metrics_interval) {
+		queue_push_tail(dev_removed, dev);
+		return;
+	}
+
 	dev_destroy(dev);
 }
 
@@ -458,6 +536,7 @@ static void command_pkt(struct timeval *tv, uint16_t index,
 					const void *data, uint16_t size)
 {
 	struct hci_dev *dev;
+	struct hci_cmd *cmd;
 
 	dev = dev_lookup(index);
 	if (!dev)
@@ -465,6 +544,17 @@ static void command_pkt(struct timeval *tv, uint16_t index,
 
 	dev->num_hci++;
 	dev->num_cmd++;
+
+	if (size < sizeof(struct bt_hci_cmd_hdr))
+		return;
+
+	if (queue_length(dev->cmd_queue) >= CMD_QUEUE_MAX)
+		free(queue_pop_head(dev->cmd_queue));
+
+	cmd = new0(struct hci_cmd, 1);
+	cmd->tv = *tv;
+	cmd->opcode = get_le16(data);
+	queue_push_tail(dev->cmd_queue, cmd);
 }
 
 static void evt_conn_complete(struct hci_dev *dev, struct timeval *tv,
@@ -511,24 +601,6 @@ static void rsp_read_bd_addr(struct hci_dev *dev, struct timeval *tv,
 	memcpy(dev->bdaddr, rsp->bdaddr, 6);
 }
 
-static void evt_cmd_complete(struct hci_dev *dev, struct timeval *tv,
-					const void *data, uint16_t size)
-{
-	const struct bt_hci_evt_cmd_complete *evt = data;
-	uint16_t opcode;
-
-	data += sizeof(*evt);
-	size -= sizeof(*evt);
-
-	opcode = le16_to_cpu(evt->opcode);
-
-	switch (opcode) {
-	case BT_HCI_CMD_READ_BD_ADDR:
-		rsp_read_bd_addr(dev, tv, data, size);
-		break;
-	}
-}
-
 static bool match_plot_latency(const void *data, const void *user_data)
 {
 	const struct plot *plot = data;
@@ -557,6 +629,61 @@ static void plot_add(struct queue *queue, struct timeval *latency,
 	queue_push_tail(queue, plot);
 }
 
+static bool match_cmd_opcode(const void *data, const void *user_data)
+{
+	const struct hci_cmd *cmd = data;
+
+	return cmd->opcode == PTR_TO_UINT(user_data);
+}
+
+static void cmd_done(struct hci_dev *dev, struct timeval *tv, uint16_t opcode)
+{
+	struct hci_cmd *cmd;
+	struct timeval res;
+
+	cmd = queue_remove_if(dev->cmd_queue, match_cmd_opcode,
+							UINT_TO_PTR(opcode));
+	if (!cmd)
+		return;
+
+	timersub(tv, &cmd->tv, &res);
+
+	dev->cmd.num++;
+	dev->cmd.num_comp++;
+	packet_latency_add(&dev->cmd.latency, &res);
+	plot_add(dev->cmd.plot, &res, 1);
+
+	free(cmd);
+}
+
+static void evt_cmd_complete(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_evt_cmd_complete *evt = data;
+	uint16_t opcode;
+
+	data += sizeof(*evt);
+	size -= sizeof(*evt);
+
+	opcode = le16_to_cpu(evt->opcode);
+
+	cmd_done(dev, tv, opcode);
+
+	switch (opcode) {
+	case BT_HCI_CMD_READ_BD_ADDR:
+		rsp_read_bd_addr(dev, tv, data, size);
+		break;
+	}
+}
+
+static void evt_cmd_status(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_evt_cmd_status *evt = data;
+
+	cmd_done(dev, tv, le16_to_cpu(evt->opcode));
+}
+
 static void evt_le_conn_complete(struct hci_dev *dev, struct timeval *tv,
 					struct iovec *iov)
 {
@@ -593,6 +720,57 @@ static void evt_le_enh_conn_complete(struct hci_dev *dev, struct timeval *tv,
 	conn->setup_seen = true;
 }
 
+static void conn_work_add(struct hci_conn *conn, uint16_t count)
+{
+	if (conn->work_len == conn->work_size) {
+		size_t size = conn->work_size ? conn->work_size * 2 : 64;
+		void *work;
+
+		work = realloc(conn->work, size * sizeof(*conn->work));
+		if (!work) {
+			work_failed = true;
+			return;
+		}
+
+		conn->work = work;
+		conn->work_size = size;
+	}
+
+	conn->work[conn->work_len].pos = work_pos;
+	conn->work[conn->work_len].count = count;
+	conn->work_len++;
+}
+
+static void conn_pkt_completed(struct hci_conn *conn, struct timeval *tv,
+							uint16_t count)
+{
+	struct timeval res;
+	struct hci_conn_tx *last_tx;
+	int j;
+
+	conn->tx.num_comp += count;
+
+	for (j = 0; j < count; j++) {
+		last_tx = queue_pop_head(conn->tx_queue);
+		if (last_tx) {
+			struct l2cap_chan *chan = last_tx->chan;
+
+			timersub(tv, &last_tx->tv, &res);
+
+			packet_latency_add(&conn->tx.latency, &res);
+			plot_add(conn->tx.plot, &res, 1);
+
+			if (chan) {
+				chan->tx.num_comp += count;
+				packet_latency_add(&chan->tx.latency, &res);
+				plot_add(chan->tx.plot, &res, 1);
+			}
+
+			free(last_tx);
+		}
+	}
+}
+
 static void evt_num_completed_packets(struct hci_dev *dev, struct timeval *tv,
 					const void *data, uint16_t size)
 {
@@ -606,9 +784,6 @@ static void evt_num_completed_packets(struct hci_dev *dev, struct timeval *tv,
 		uint16_t handle = get_le16(data);
 		uint16_t count = get_le16(data + 2);
 		struct hci_conn *conn;
-		struct timeval res;
-		struct hci_conn_tx *last_tx;
-		int j;
 
 		data += 4;
 		size -= 4;
@@ -617,28 +792,10 @@ static void evt_num_completed_packets(struct hci_dev *dev, struct timeval *tv,
 		if (!conn)
 			continue;
 
-		conn->tx.num_comp += count;
-
-		for (j = 0; j < count; j++) {
-			last_tx = queue_pop_head(conn->tx_queue);
-			if (last_tx) {
-				struct l2cap_chan *chan = last_tx->chan;
-
-				timersub(tv, &last_tx->tv, &res);
-
-				packet_latency_add(&conn->tx.latency, &res);
-				plot_add(conn->tx.plot, &res, 1);
-
-				if (chan) {
-					chan->tx.num_comp += count;
-					packet_latency_add(&chan->tx.latency,
-									&res);
-					plot_add(chan->tx.plot, &res, 1);
-				}
-
-				free(last_tx);
-			}
-		}
+		if (work_idx)
+			conn_work_add(conn, count);
+		else
+			conn_pkt_completed(conn, tv, count);
 	}
 }
 
@@ -804,6 +961,9 @@ static void event_pkt(struct timeval *tv, uint16_t index,
 	case BT_HCI_EVT_CMD_COMPLETE:
 		evt_cmd_complete(dev, tv, data, size);
 		break;
+	case BT_HCI_EVT_CMD_STATUS:
+		evt_cmd_status(dev, tv, data, size);
+		break;
 	case BT_HCI_EVT_NUM_COMPLETED_PACKETS:
 		evt_num_completed_packets(dev, tv, data, size);
 		break;
@@ -873,29 +1033,16 @@ static void conn_pkt_rx(struct hci_conn *conn, struct timeval *tv,
 	}
 }
 
-static void acl_pkt(struct timeval *tv, uint16_t index, bool out,
+static void conn_acl_pkt(struct hci_conn *conn, struct timeval *tv, bool out,
 					const void *data, uint16_t size)
 {
 	const struct bt_hci_acl_hdr *hdr = data;
-	struct hci_dev *dev;
-	struct hci_conn *conn;
 	struct l2cap_chan *chan = NULL;
 	uint16_t cid;
 
 	data += sizeof(*hdr);
 	size -= sizeof(*hdr);
 
-	dev = dev_lookup(index);
-	if (!dev)
-		return;
-
-	dev->num_hci++;
-	dev->num_acl++;
-
-	conn = conn_lookup_type(dev, le16_to_cpu(hdr->handle) & 0x0fff, 0x00);
-	if (!conn)
-		return;
-
 	switch (le16_to_cpu(hdr->handle) >> 12) {
 	case 0x00:
 	case 0x02:
@@ -913,6 +1060,30 @@ static void acl_pkt(struct timeval *tv, uint16_t index, bool out,
 	}
 }
 
+static void acl_pkt(struct timeval *tv, uint16_t index, bool out,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_acl_hdr *hdr = data;
+	struct hci_dev *dev;
+	struct hci_conn *conn;
+
+	dev = dev_lookup(index);
+	if (!dev)
+		return;
+
+	dev->num_hci++;
+	dev->num_acl++;
+
+	conn = conn_lookup_type(dev, le16_to_cpu(hdr->handle) & 0x0fff, 0x00);
+	if (!conn)
+		return;
+
+	if (work_idx)
+		conn_work_add(conn, 0);
+	else
+		conn_acl_pkt(conn, tv, out, data, size);
+}
+
 static void sco_pkt(struct timeval *tv, uint16_t index, bool out,
 					const void *data, uint16_t size)
 {
@@ -932,7 +1103,9 @@ static void sco_pkt(struct timeval *tv, uint16_t index, bool out,
 	if (!conn)
 		return;
 
-	if (out) {
+	if (work_idx)
+		conn_work_add(conn, 0);
+	else if (out) {
 		conn_pkt_tx(conn, tv, size - sizeof(*hdr), NULL);
 	} else {
 		conn_pkt_rx(conn, tv, size - sizeof(*hdr), NULL);
@@ -1019,7 +1192,9 @@ static void iso_pkt(struct timeval *tv, uint16_t index, bool out,
 	if (!conn)
 		return;
 
-	if (out) {
+	if (work_idx)
+		conn_work_add(conn, 0);
+	else if (out) {
 		conn_pkt_tx(conn, tv, size - sizeof(*hdr), NULL);
 	} else {
 		conn_pkt_rx(conn, tv, size - sizeof(*hdr), NULL);
@@ -1038,17 +1213,250 @@ static void unknown_opcode(struct timeval *tv, uint16_t index,
 	dev->unknown++;
 }
 
-void analyze_trace(const char *path)
+static void analyze_record(struct timeval *tv, uint16_t index,
+				uint16_t opcode, const void *data, uint16_t size)
+{
+	switch (opcode) {
+	case BTSNOOP_OPCODE_NEW_INDEX:
+		new_index(tv, index, data, size);
+		break;
+	case BTSNOOP_OPCODE_DEL_INDEX:
+		del_index(tv, index, data, size);
+		break;
+	case BTSNOOP_OPCODE_COMMAND_PKT:
+		command_pkt(tv, index, data, size);
+		break;
+	case BTSNOOP_OPCODE_EVENT_PKT:
+		event_pkt(tv, index, data, size);
+		break;
+	case BTSNOOP_OPCODE_ACL_TX_PKT:
+		acl_pkt(tv, index, true, data, size);
+		break;
+	case BTSNOOP_OPCODE_ACL_RX_PKT:
+		acl_pkt(tv, index, false, data, size);
+		break;
+	case BTSNOOP_OPCODE_SCO_TX_PKT:
+		sco_pkt(tv, index, true, data, size);
+		break;
+	case BTSNOOP_OPCODE_SCO_RX_PKT:
+		sco_pkt(tv, index, false, data, size);
+		break;
+	case BTSNOOP_OPCODE_OPEN_INDEX:
+	case BTSNOOP_OPCODE_CLOSE_INDEX:
+		break;
+	case BTSNOOP_OPCODE_INDEX_INFO:
+		info_index(tv, index, data, size);
+		break;
+	case BTSNOOP_OPCODE_VENDOR_DIAG:
+		vendor_diag(tv, index, data, size);
+		break;
+	case BTSNOOP_OPCODE_SYSTEM_NOTE:
+		system_note(tv, index, data, size);
+		break;
+	case BTSNOOP_OPCODE_USER_LOGGING:
+		user_log(tv, index, data, size);
+		break;
+	case BTSNOOP_OPCODE_CTRL_OPEN:
+	case BTSNOOP_OPCODE_CTRL_CLOSE:
+	case BTSNOOP_OPCODE_CTRL_COMMAND:
+	case BTSNOOP_OPCODE_CTRL_EVENT:
+		ctrl_msg(tv, index, data, size);
+		break;
+	case BTSNOOP_OPCODE_ISO_TX_PKT:
+		iso_pkt(tv, index, true, data, size);
+		break;
+	case BTSNOOP_OPCODE_ISO_RX_PKT:
+		iso_pkt(tv, index, false, data, size);
+		break;
+	default:
+		unknown_opcode(tv, index, data, size);
+		break;
+	}
+}
+
+static void conn_work_run(struct hci_conn *conn)
+{
+	struct btsnoop_record rec;
+	size_t i;
+
+	for (i = 0; i < conn->work_len; i++) {
+		struct conn_work *work = &conn->work[i];
+
+		if (!btsnoop_index_get(work_idx, work->pos, &rec))
+			continue;
+
+		switch (rec.opcode) {
+		case BTSNOOP_OPCODE_EVENT_PKT:
+			conn_pkt_completed(conn, &rec.tv, work->count);
+			break;
+		case BTSNOOP_OPCODE_ACL_TX_PKT:
+			conn_acl_pkt(conn, &rec.tv, true, rec.data, rec.size);
+			break;
+		case BTSNOOP_OPCODE_ACL_RX_PKT:
+			conn_acl_pkt(conn, &rec.tv, false, rec.data, rec.size);
+			break;
+		case BTSNOOP_OPCODE_SCO_TX_PKT:
+			conn_pkt_tx(conn, &rec.tv, rec.size -
+					sizeof(struct bt_hci_acl_hdr), NULL);
+			break;
+		case BTSNOOP_OPCODE_SCO_RX_PKT:
+			conn_pkt_rx(conn, &rec.tv, rec.size -
+					sizeof(struct bt_hci_acl_hdr), NULL);
+			break;
+		case BTSNOOP_OPCODE_ISO_TX_PKT:
+			conn_pkt_tx(conn, &rec.tv, rec.size -
+					sizeof(struct bt_hci_iso_hdr), NULL);
+			break;
+		case BTSNOOP_OPCODE_ISO_RX_PKT:
+			conn_pkt_rx(conn, &rec.tv, rec.size -
+					sizeof(struct bt_hci_iso_hdr), NULL);
+			break;
+		}
+	}
+
+	free(conn->work);
+	conn->work = NULL;
+	conn->work_len = 0;
+	conn->work_size = 0;
+}
+
+static void *conn_work_thread(void *user_data)
+{
+	while (1) {
+		unsigned int i = __sync_fetch_and_add(&work_next, 1);
+
+		if (i >= work_conns_len)
+			break;
+
+		conn_work_run(work_conns[i]);
+	}
+
+	return NULL;
+}
+
+static void conn_collect(void *data, void *user_data)
+{
+	struct hci_conn *conn = data;
+
+	if (conn->work_len)
+		work_conns[work_conns_len++] = conn;
+}
+
+static void dev_collect(void *data, void *user_data)
+{
+	struct hci_dev *dev = data;
+	struct hci_conn **conns;
+
+	conns = realloc(work_conns, (work_conns_len +
+			queue_length(dev->conn_list)) * sizeof(*work_conns));
+	if (!conns) {
+		work_failed = true;
+		return;
+	}
+
+	work_conns = conns;
+
+	queue_foreach(dev->conn_list, conn_collect, NULL);
+}
+
+static int work_cmp(const void *a, const void *b)
+{
+	const struct hci_conn *conn_a = *(struct hci_conn **) a;
+	const struct hci_conn *conn_b = *(struct hci_conn **) b;
+
+	if (conn_a->work_len > conn_b->work_len)
+		return -1;
+
+	return conn_a->work_len < conn_b->work_len;
+}
+
+/*
+ * Controllers and connection setup are tracked in a first pass over the
+ * trace, queueing each data packet and completion on the connection it
+ * belongs to. Every connection is then accounted on its own by the
+ * workers, so the results are the same as for a single pass.
+ */
+static unsigned long analyze_parallel(struct btsnoop_index *idx,
+							unsigned int jobs)
 {
-	struct btsnoop *btsnoop_file;
+	struct btsnoop_record rec;
+	pthread_t *threads;
+	unsigned long num_packets = 0;
+	unsigned int i;
+
+	work_idx = idx;
+	dev_removed = queue_new();
+
+	for (work_pos = 0; btsnoop_index_get(idx, work_pos, &rec); work_pos++) {
+		analyze_record(&rec.tv, rec.index, rec.opcode, rec.data,
+								rec.size);
+		num_packets++;
+	}
+
+	queue_foreach(dev_removed, dev_collect, NULL);
+	queue_foreach(dev_list, dev_collect, NULL);
+
+	/* Start with the busiest connections to balance the workers */
+	qsort(work_conns, work_conns_len, sizeof(*work_conns), work_cmp);
+
+	if (jobs > work_conns_len)
+		jobs = work_conns_len;
+
+	threads = new0(pthread_t, jobs);
+
+	for (i = 1; i < jobs; i++) {
+		if (pthread_create(&threads[i], NULL, conn_work_thread, NULL))
+			break;
+	}
+
+	conn_work_thread(NULL);
+
+	while (--i > 0)
+		pthread_join(threads[i], NULL);
+
+	free(threads);
+	free(work_conns);
+	work_conns = NULL;
+	work_conns_len = 0;
+	work_next = 0;
+	work_idx = NULL;
+
+	if (work_failed) {
+		fprintf(stderr, "Out of memory, connection statistics "
+						"are incomplete\n");
+		work_failed = false;
+	}
+
+	queue_destroy(dev_removed, dev_destroy);
+	dev_removed = NULL;
+
+	return num_packets;
+}
+
+void analyze_trace(const char *path, unsigned int jobs)
+{
+	struct btsnoop *btsnoop_file = NULL;
+	struct btsnoop_index *idx = NULL;
 	unsigned long num_packets = 0;
 	uint32_t format;
 
-	btsnoop_file = btsnoop_open(path, BTSNOOP_FLAG_PKLG_SUPPORT);
-	if (!btsnoop_file)
-		return;
+	if (jobs > 1) {
+		idx = btsnoop_index_open(path, BTSNOOP_FLAG_PKLG_SUPPORT);
+		if (idx && !btsnoop_index_load(idx)) {
+			btsnoop_index_close(idx);
+			idx = NULL;
+		}
+	}
 
-	format = btsnoop_get_format(btsnoop_file);
+	if (idx) {
+		format = btsnoop_index_get_format(idx);
+	} else {
+		btsnoop_file = btsnoop_open(path, BTSNOOP_FLAG_PKLG_SUPPORT);
+		if (!btsnoop_file)
+			return;
+
+		format = btsnoop_get_format(btsnoop_file);
+	}
 
 	switch (format) {
 	case BTSNOOP_FORMAT_HCI:
@@ -1062,7 +1470,10 @@ void analyze_trace(const char *path)
 
 	dev_list = queue_new();
 
-	while (1) {
+	if (idx)
+		num_packets = analyze_parallel(idx, jobs);
+
+	while (btsnoop_file) {
 		unsigned char buf[BTSNOOP_MAX_PACKET_SIZE];
 		struct timeval tv;
 		uint16_t index, opcode, pktlen;
@@ -1071,62 +1482,7 @@ void analyze_trace(const char *path)
 								buf, &pktlen))
 			break;
 
-		switch (opcode) {
-		case BTSNOOP_OPCODE_NEW_INDEX:
-			new_index(&tv, index, buf, pktlen);
-			break;
-		case BTSNOOP_OPCODE_DEL_INDEX:
-			del_index(&tv, index, buf, pktlen);
-			break;
-		case BTSNOOP_OPCODE_COMMAND_PKT:
-			command_pkt(&tv, index, buf, pktlen);
-			break;
-		case BTSNOOP_OPCODE_EVENT_PKT:
-			event_pkt(&tv, index, buf, pktlen);
-			break;
-		case BTSNOOP_OPCODE_ACL_TX_PKT:
-			acl_pkt(&tv, index, true, buf, pktlen);
-			break;
-		case BTSNOOP_OPCODE_ACL_RX_PKT:
-			acl_pkt(&tv, index, false, buf, pktlen);
-			break;
-		case BTSNOOP_OPCODE_SCO_TX_PKT:
-			sco_pkt(&tv, index, true, buf, pktlen);
-			break;
-		case BTSNOOP_OPCODE_SCO_RX_PKT:
-			sco_pkt(&tv, index, false, buf, pktlen);
-			break;
-		case BTSNOOP_OPCODE_OPEN_INDEX:
-		case BTSNOOP_OPCODE_CLOSE_INDEX:
-			break;
-		case BTSNOOP_OPCODE_INDEX_INFO:
-			info_index(&tv, index, buf, pktlen);
-			break;
-		case BTSNOOP_OPCODE_VENDOR_DIAG:
-			vendor_diag(&tv, index, buf, pktlen);
-			break;
-		case BTSNOOP_OPCODE_SYSTEM_NOTE:
-			system_note(&tv, index, buf, pktlen);
-			break;
-		case BTSNOOP_OPCODE_USER_LOGGING:
-			user_log(&tv, index, buf, pktlen);
-			break;
-		case BTSNOOP_OPCODE_CTRL_OPEN:
-		case BTSNOOP_OPCODE_CTRL_CLOSE:
-		case BTSNOOP_OPCODE_CTRL_COMMAND:
-		case BTSNOOP_OPCODE_CTRL_EVENT:
-			ctrl_msg(&tv, index, buf, pktlen);
-			break;
-		case BTSNOOP_OPCODE_ISO_TX_PKT:
-			iso_pkt(&tv, index, true, buf, pktlen);
-			break;
-		case BTSNOOP_OPCODE_ISO_RX_PKT:
-			iso_pkt(&tv, index, false, buf, pktlen);
-			break;
-		default:
-			unknown_opcode(&tv, index, buf, pktlen);
-			break;
-		}
+		analyze_record(&tv, index, opcode, buf, pktlen);
 
 		num_packets++;
 	}
@@ -1136,5 +1492,272 @@ void analyze_trace(const char *path)
 	queue_destroy(dev_list, dev_destroy);
 
 done:
+	btsnoop_index_close(idx);
 	btsnoop_unref(btsnoop_file);
 }
+
+static void stats_reset(struct hci_stats *stats)
+{
+	queue_remove_all(stats->plot, NULL, NULL, free);
+
+	stats->bytes = 0;
+	stats->num = 0;
+	stats->num_comp = 0;
+	stats->min = 0;
+	stats->max = 0;
+	memset(&stats->latency, 0, sizeof(stats->latency));
+}
+
+static void plot_collect(void *data, void *user_data)
+{
+	struct plot ***plots = user_data;
+
+	*(*plots)++ = data;
+}
+
+static int plot_cmp(const void *a, const void *b)
+{
+	const struct plot *plot_a = *(struct plot **) a;
+	const struct plot *plot_b = *(struct plot **) b;
+
+	if (plot_a->x_msec < plot_b->x_msec)
+		return -1;
+
+	return plot_a->x_msec > plot_b->x_msec;
+}
+
+/* Percentiles come from the per millisecond plot of the latencies */
+static void print_json_latency(const char *label, struct hci_stats *stats)
+{
+	static const unsigned int pct[] = { 50, 90, 99 };
+	struct plot **plots, **ptr;
+	unsigned int len, i, j;
+	size_t total = 0, sum = 0;
+
+	len = queue_length(stats->plot);
+	if (!len)
+		return;
+
+	plots = new0(struct plot *, len);
+	ptr = plots;
+	queue_foreach(stats->plot, plot_collect, &ptr);
+	qsort(plots, len, sizeof(*plots), plot_cmp);
+
+	for (i = 0; i < len; i++)
+		total += plots[i]->y_count;
+
+	printf(",\"%s\":{\"count\":%zu,\"min\":%lld,\"max\":%lld,"
+			"\"avg\":%lld", label, total,
+			TV_MSEC(stats->latency.min),
+			TV_MSEC(stats->latency.max),
+			TV_MSEC(stats->latency.total) / (long long) total);
+
+	for (i = 0, j = 0; i < len && j < ARRAY_SIZE(pct); i++) {
+		sum += plots[i]->y_count;
+
+		while (j < ARRAY_SIZE(pct) && sum * 100 >= total * pct[j])
+			printf(",\"p%u\":%lld", pct[j++], plots[i]->x_msec);
+	}
+
+	printf("}");
+
+	free(plots);
+}
+
+static double kbps(size_t bytes, double secs)
+{
+	return secs > 0 ? bytes * 8 / secs / 1000 : 0;
+}
+
+struct metrics_dev {
+	struct hci_dev *dev;
+	const struct timeval *tv;
+	double secs;
+	size_t acl_tx, acl_rx, iso_tx, iso_rx;
+	unsigned int unacked;
+};
+
+static void metrics_conn(void *data, void *user_data)
+{
+	struct hci_conn *conn = data;
+	struct metrics_dev *m = user_data;
+	unsigned int unacked = queue_length(conn->tx_queue);
+
+	if (conn->type == CONN_LE_ISO) {
+		m->iso_tx += conn->tx.bytes;
+		m->iso_rx += conn->rx.bytes;
+	} else if (conn->type != CONN_BR_SCO && conn->type != CONN_BR_ESCO) {
+		m->acl_tx += conn->tx.bytes;
+		m->acl_rx += conn->rx.bytes;
+	}
+
+	if (!conn->terminated)
+		m->unacked += unacked;
+
+	/* Idle connections are not reported */
+	if (!conn->rx.num && !conn->tx.num && !conn->tx.num_comp &&
+					!unacked && !conn->terminated)
+		return;
+
+	printf("{\"time\":%lld.%06lld,\"type\":\"connection\","
+		"\"index\":%u,\"handle\":%u,\"link\":\"%s\","
+		"\"address\":\"%2.2X:%2.2X:%2.2X:%2.2X:%2.2X:%2.2X\"",
+		(long long) m->tv->tv_sec, (long long) m->tv->tv_usec,
+		m->dev->index, conn->handle, conn_type_str(conn->type),
+		conn->bdaddr[5], conn->bdaddr[4], conn->bdaddr[3],
+		conn->bdaddr[2], conn->bdaddr[1], conn->bdaddr[0]);
+	printf(",\"rx_packets\":%zu,\"rx_bytes\":%zu,\"rx_kbps\":%.1f",
+			conn->rx.num, conn->rx.bytes,
+			kbps(conn->rx.bytes, m->secs));
+	printf(",\"tx_packets\":%zu,\"tx_bytes\":%zu,\"tx_kbps\":%.1f",
+			conn->tx.num, conn->tx.bytes,
+			kbps(conn->tx.bytes, m->secs));
+	printf(",\"tx_completed\":%zu,\"unacked\":%u",
+			conn->tx.num_comp, unacked);
+	print_json_latency("tx_latency", &conn->tx);
+	if (conn->terminated)
+		printf(",\"terminated\":true");
+	printf("}\n");
+}
+
+static void chan_reset(void *data, void *user_data)
+{
+	struct l2cap_chan *chan = data;
+
+	stats_reset(&chan->rx);
+	stats_reset(&chan->tx);
+}
+
+static bool conn_reset(const void *data, const void *user_data)
+{
+	struct hci_conn *conn = (void *) data;
+
+	/* Terminated connections have been reported for the last time */
+	if (conn->terminated)
+		return true;
+
+	stats_reset(&conn->rx);
+	stats_reset(&conn->tx);
+	queue_foreach(conn->chan_list, chan_reset, NULL);
+
+	return false;
+}
+
+static void metrics_dev(void *data, void *user_data)
+{
+	struct hci_dev *dev = data;
+	const struct metrics_dev *ctx = user_data;
+	struct metrics_dev m = { .dev = dev, .tv = ctx->tv, .secs = ctx->secs };
+
+	queue_foreach(dev->conn_list, metrics_conn, &m);
+
+	printf("{\"time\":%lld.%06lld,\"type\":\"controller\","
+		"\"index\":%u,\"address\":\"%2.2X:%2.2X:%2.2X:%2.2X:"
+		"%2.2X:%2.2X\",\"interval\":%.3f",
+		(long long) m.tv->tv_sec, (long long) m.tv->tv_usec,
+		dev->index, dev->bdaddr[5], dev->bdaddr[4], dev->bdaddr[3],
+		dev->bdaddr[2], dev->bdaddr[1], dev->bdaddr[0], m.secs);
+	printf(",\"packets\":%lu,\"packet_rate\":%.1f",
+			dev->num_hci, m.secs > 0 ? dev->num_hci / m.secs : 0);
+	printf(",\"commands\":%lu,\"events\":%lu,\"acl_packets\":%lu,"
+		"\"sco_packets\":%lu,\"iso_packets\":%lu",
+		dev->num_cmd, dev->num_evt, dev->num_acl, dev->num_sco,
+		dev->num_iso);
+	printf(",\"acl_tx_kbps\":%.1f,\"acl_rx_kbps\":%.1f,"
+		"\"iso_tx_kbps\":%.1f,\"iso_rx_kbps\":%.1f",
+		kbps(m.acl_tx, m.secs), kbps(m.acl_rx, m.secs),
+		kbps(m.iso_tx, m.secs), kbps(m.iso_rx, m.secs));
+	printf(",\"unacked\":%u,\"pending_commands\":%u",
+			m.unacked, queue_length(dev->cmd_queue));
+	print_json_latency("cmd_rtt", &dev->cmd);
+	printf("}\n");
+
+	dev->num_hci = 0;
+	dev->num_cmd = 0;
+	dev->num_evt = 0;
+	dev->num_acl = 0;
+	dev->num_sco = 0;
+	dev->num_iso = 0;
+	dev->vendor_diag = 0;
+	dev->system_note = 0;
+	dev->user_log = 0;
+	dev->ctrl_msg = 0;
+	dev->unknown = 0;
+	stats_reset(&dev->cmd);
+
+	queue_remove_all(dev->conn_list, conn_reset, NULL, conn_free);
+}
+
+static void metrics_print(const struct timeval *tv, double secs)
+{
+	struct metrics_dev m = { .tv = tv, .secs = secs };
+
+	queue_foreach(dev_removed, metrics_dev, &m);
+	queue_remove_all(dev_removed, NULL, NULL, dev_free);
+
+	queue_foreach(dev_list, metrics_dev, &m);
+
+	fflush(stdout);
+}
+
+void analyze_metrics(unsigned int interval)
+{
+	metrics_interval = interval;
+
+	dev_list = queue_new();
+	dev_removed = queue_new();
+}
+
+void analyze_metrics_tick(struct timeval *tv)
+{
+	struct timeval step;
+
+	if (!metrics_interval || !timerisset(&metrics_next))
+		return;
+
+	if (timercmp(tv, &metrics_next, <))
+		return;
+
+	metrics_print(&metrics_next, metrics_interval);
+
+	/* Intervals without any traffic are skipped */
+	step.tv_sec = metrics_interval;
+	step.tv_usec = 0;
+
+	while (!timercmp(tv, &metrics_next, <))
+		timeradd(&metrics_next, &step, &metrics_next);
+}
+
+void analyze_packet(struct timeval *tv, uint16_t index, uint16_t opcode,
+					const void *data, uint16_t size)
+{
+	if (!timerisset(&metrics_next)) {
+		metrics_start = *tv;
+		metrics_next = *tv;
+		metrics_next.tv_sec += metrics_interval;
+	}
+
+	analyze_metrics_tick(tv);
+
+	analyze_record(tv, index, opcode, data, size);
+
+	metrics_last = *tv;
+}
+
+void analyze_metrics_flush(void)
+{
+	struct timeval start, res;
+
+	if (!metrics_interval || !timerisset(&metrics_next))
+		return;
+
+	/* Report the partial last interval */
+	start = metrics_next;
+	start.tv_sec -= metrics_interval;
+	if (timercmp(&start, &metrics_start, <))
+		start = metrics_start;
+
+	timersub(&metrics_last, &start, &res);
+
+	metrics_print(&metrics_last, res.tv_sec + res.tv_usec / 1000000.0);
+}
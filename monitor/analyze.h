@@ -9,4 +9,13 @@
  *
  */
 
-void analyze_trace(const char *path);
+#include <stdint.h>
+#include <sys/time.h>
+
+void analyze_trace(const char *path, unsigned int jobs);
+
+void analyze_metrics(unsigned int interval);
+void analyze_metrics_tick(struct timeval *tv);
+void analyze_metrics_flush(void);
+void analyze_packet(struct timeval *tv, uint16_t index, uint16_t opcode,
+					const void *data, uint16_t size);
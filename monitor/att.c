@@ -22,6 +22,9 @@
 #include <inttypes.h>
 #include <stdbool.h>
 #include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
 #include <linux/limits.h>
 #include <sys/stat.h>
 
@@ -54,15 +57,34 @@ struct att_read {
 	struct iovec *iov;
 };
 
+/* Remote database learned from traffic or loaded from the cache directory */
+struct gatt_cache {
+	uint8_t addr[6];
+	uint8_t hash[16];
+	bool has_hash;
+	bool used;
+	time_t mtime;
+	char *filename;
+	struct gatt_db *db;
+};
+
 struct att_conn_data {
 	struct gatt_db *ldb;
 	struct timespec ldb_mtim;
 	struct gatt_db *rdb;
 	struct timespec rdb_mtim;
+	struct timespec load_time;
+	struct gatt_cache *cache;
 	struct queue *reads;
 	uint16_t mtu;
 };
 
+/* Settings files are checked for updates at most once per second */
+#define GATT_DB_RELOAD_INTERVAL	1
+
+static char *cache_dir;
+static struct queue *cache_list;
+
 static void print_uuid(const char *label, const void *data, uint16_t size)
 {
 	const char *str;
@@ -450,26 +472,288 @@ static void gatt_load_db(struct gatt_db *db, const char *filename,
 	btd_settings_gatt_db_load(db, filename);
 }
 
+static struct gatt_cache *cache_lookup(const uint8_t addr[6],
+						const uint8_t *hash)
+{
+	const struct queue_entry *entry;
+	struct gatt_cache *found = NULL;
+
+	for (entry = queue_get_entries(cache_list); entry;
+						entry = entry->next) {
+		struct gatt_cache *cache = entry->data;
+
+		if (memcmp(cache->addr, addr, 6))
+			continue;
+
+		if (hash) {
+			if (cache->has_hash && !memcmp(cache->hash, hash, 16))
+				return cache;
+
+			continue;
+		}
+
+		/* Without a hash use the most recently updated database */
+		if (!found || cache->mtime > found->mtime)
+			found = cache;
+	}
+
+	return found;
+}
+
+static struct gatt_cache *cache_new(const uint8_t addr[6],
+					const uint8_t *hash,
+					struct gatt_db *db)
+{
+	struct gatt_cache *cache;
+
+	cache = new0(struct gatt_cache, 1);
+	memcpy(cache->addr, addr, 6);
+
+	if (hash) {
+		memcpy(cache->hash, hash, 16);
+		cache->has_hash = true;
+	}
+
+	cache->mtime = time(NULL);
+	cache->db = db ? gatt_db_ref(db) : gatt_db_new();
+
+	queue_push_tail(cache_list, cache);
+
+	return cache;
+}
+
+static void cache_attach(struct att_conn_data *data, struct gatt_cache *cache)
+{
+	cache->used = true;
+	data->cache = cache;
+
+	if (data->rdb == cache->db)
+		return;
+
+	/* The previous database stays referenced by its cache entry */
+	gatt_db_unref(data->rdb);
+	data->rdb = gatt_db_ref(cache->db);
+}
+
 static void load_gatt_db(struct packet_conn_data *conn)
 {
 	struct att_conn_data *data = att_get_conn_data(conn);
+	struct gatt_cache *cache;
+	struct timespec now;
 	char filename[PATH_MAX];
 	char local[18];
 	char peer[18];
 	uint8_t id[6], id_type;
 
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	if (data->load_time.tv_sec &&
+			now.tv_sec - data->load_time.tv_sec <
+						GATT_DB_RELOAD_INTERVAL)
+		return;
+
+	data->load_time = now;
+
 	ba2str((bdaddr_t *)conn->src, local);
 
-	if (keys_resolve_identity(conn->dst, id, &id_type))
-		ba2str((bdaddr_t *)id, peer);
-	else
-		ba2str((bdaddr_t *)conn->dst, peer);
+	if (!keys_resolve_identity(conn->dst, id, &id_type))
+		memcpy(id, conn->dst, 6);
+
+	ba2str((bdaddr_t *)id, peer);
 
 	create_filename(filename, PATH_MAX, "/%s/attributes", local);
 	gatt_load_db(data->ldb, filename, &data->ldb_mtim);
 
-	create_filename(filename, PATH_MAX, "/%s/cache/%s", local, peer);
-	gatt_load_db(data->rdb, filename, &data->rdb_mtim);
+	/* Prefer the binary cache, older bluetoothd only has the key file */
+	create_filename(filename, PATH_MAX, "/%s/cache/%s.gatt", local, peer);
+	if (access(filename, F_OK) < 0)
+		create_filename(filename, PATH_MAX, "/%s/cache/%s", local,
+									peer);
+
+	if (!cache_list) {
+		gatt_load_db(data->rdb, filename, &data->rdb_mtim);
+		return;
+	}
+
+	if (data->cache)
+		return;
+
+	cache = cache_lookup(id, NULL);
+	if (!cache) {
+		/* Seed new entries from the bluetoothd cache if present */
+		gatt_load_db(data->rdb, filename, &data->rdb_mtim);
+		cache = cache_new(id, NULL, data->rdb);
+	}
+
+	cache_attach(data, cache);
+}
+
+static void db_hash_read(const struct l2cap_frame *frame)
+{
+	struct packet_conn_data *conn;
+	struct att_conn_data *data;
+	struct gatt_cache *cache;
+
+	/* Only the remote database is cached */
+	if (!frame->in || frame->size != 16)
+		return;
+
+	conn = packet_get_conn_data(frame->handle);
+	if (!conn)
+		return;
+
+	data = conn->data;
+	if (!data || !data->cache)
+		return;
+
+	if (data->cache->has_hash &&
+			!memcmp(data->cache->hash, frame->data, 16))
+		return;
+
+	cache = cache_lookup(data->cache->addr, frame->data);
+	if (!cache) {
+		/* Database learned so far now has a known hash */
+		if (!data->cache->has_hash) {
+			memcpy(data->cache->hash, frame->data, 16);
+			data->cache->has_hash = true;
+			return;
+		}
+
+		cache = cache_new(data->cache->addr, frame->data, NULL);
+	}
+
+	cache_attach(data, cache);
+}
+
+static bool parse_cache_name(const char *name, struct gatt_cache *cache)
+{
+	char addr[18];
+	int i;
+
+	if (strlen(name) < 17)
+		return false;
+
+	memcpy(addr, name, 17);
+	addr[17] = '\0';
+
+	if (bachk(addr) < 0)
+		return false;
+
+	str2ba(addr, (bdaddr_t *) cache->addr);
+
+	name += 17;
+	if (!*name)
+		return true;
+
+	if (*name++ != '_' || strlen(name) != 32)
+		return false;
+
+	for (i = 0; i < 16; i++) {
+		if (!isxdigit(name[i * 2]) || !isxdigit(name[i * 2 + 1]) ||
+				sscanf(name + i * 2, "%2hhx", &cache->hash[i]) != 1)
+			return false;
+	}
+
+	cache->has_hash = true;
+
+	return true;
+}
+
+void att_cache_open(const char *path)
+{
+	struct dirent *d;
+	DIR *dir;
+
+	cache_dir = strdup(path);
+	cache_list = queue_new();
+
+	if (mkdir(path, 0700) < 0 && errno != EEXIST) {
+		fprintf(stderr, "Failed to create GATT cache %s: %s\n", path,
+							strerror(errno));
+		return;
+	}
+
+	dir = opendir(path);
+	if (!dir)
+		return;
+
+	/* Load every cached database so lookups never touch the disk */
+	while ((d = readdir(dir))) {
+		char filename[PATH_MAX];
+		struct gatt_cache *cache;
+		struct stat st;
+
+		cache = new0(struct gatt_cache, 1);
+
+		snprintf(filename, sizeof(filename), "%s/%s", path, d->d_name);
+
+		if (!parse_cache_name(d->d_name, cache) ||
+					stat(filename, &st) < 0 ||
+					!S_ISREG(st.st_mode)) {
+			free(cache);
+			continue;
+		}
+
+		cache->db = gatt_db_new();
+
+		if (btd_settings_gatt_db_load(cache->db, filename) < 0) {
+			gatt_db_unref(cache->db);
+			free(cache);
+			continue;
+		}
+
+		cache->mtime = st.st_mtime;
+		cache->filename = strdup(filename);
+		queue_push_tail(cache_list, cache);
+	}
+
+	closedir(dir);
+}
+
+static void cache_store(void *data)
+{
+	struct gatt_cache *cache = data;
+	char filename[PATH_MAX];
+	char addr[18];
+	int len, i;
+
+	if (!cache->used || gatt_db_isempty(cache->db))
+		goto done;
+
+	ba2str((bdaddr_t *) cache->addr, addr);
+
+	len = snprintf(filename, sizeof(filename), "%s/%s", cache_dir, addr);
+
+	if (cache->has_hash) {
+		len += snprintf(filename + len, sizeof(filename) - len, "_");
+
+		for (i = 0; i < 16; i++)
+			len += snprintf(filename + len, sizeof(filename) - len,
+						"%2.2x", cache->hash[i]);
+	}
+
+	/* Entry loaded before its hash was known */
+	if (cache->filename && strcmp(cache->filename, filename))
+		unlink(cache->filename);
+
+	btd_settings_gatt_db_store(cache->db, filename);
+
+done:
+	gatt_db_unref(cache->db);
+	free(cache->filename);
+	free(cache);
+}
+
+void att_cache_close(void)
+{
+	if (!cache_list)
+		return;
+
+	queue_destroy(cache_list, cache_store);
+	cache_list = NULL;
+
+	free(cache_dir);
+	cache_dir = NULL;
 }
 
 static struct gatt_db *get_db(const struct l2cap_frame *frame, bool rsp)
@@ -558,12 +842,18 @@ static struct gatt_db_attribute *insert_svc(const struct l2cap_frame *frame,
 						bool rsp, uint16_t num_handles)
 {
 	struct gatt_db *db;
+	struct gatt_db_attribute *attr;
 
 	db = get_db(frame, rsp);
 	if (!db)
 		return NULL;
 
-	return gatt_db_insert_service(db, handle, uuid, primary, num_handles);
+	attr = gatt_db_insert_service(db, handle, uuid, primary, num_handles);
+	if (attr)
+		/* Mark active so the service is saved to the GATT cache */
+		gatt_db_service_set_active(attr, true);
+
+	return attr;
 }
 
 static void pri_svc_read(const struct l2cap_frame *frame)
@@ -4013,6 +4303,7 @@ static const struct gatt_handler {
 	GATT_HANDLER(0x2801, sec_svc_read, NULL, NULL),
 	GATT_HANDLER(0x2803, chrc_read, NULL, NULL),
 	GATT_HANDLER(0x2902, ccc_read, ccc_write, NULL),
+	GATT_HANDLER(0x2b2a, db_hash_read, NULL, NULL),
 	GATT_HANDLER(0x2bc4, ase_read, NULL, ase_notify),
 	GATT_HANDLER(0x2bc5, ase_read, NULL, ase_notify),
 	GATT_HANDLER(0x2bc6, NULL, ase_cp_write, ase_cp_notify),
@@ -4602,7 +4893,12 @@ static void print_notify(const struct l2cap_frame *frame, uint16_t handle,
 	const struct gatt_handler *handler;
 	struct l2cap_frame clone;
 
-	print_handle(frame, handle, true);
+	attr = get_attribute(frame, handle, true);
+	if (attr)
+		print_attribute(attr);
+	else
+		print_field("Handle: 0x%4.4x", handle);
+
 	print_hex_field("  Data", frame->data, len);
 
 	if (len > frame->size) {
@@ -4610,7 +4906,6 @@ static void print_notify(const struct l2cap_frame *frame, uint16_t handle,
 		return;
 	}
 
-	attr = get_attribute(frame, handle, true);
 	if (!attr)
 		return;
 
@@ -4823,6 +5118,9 @@ void att_packet(uint16_t index, bool in, uint16_t handle, uint16_t cid,
 	print_indent(6, opcode_color, "ATT: ", opcode_str, COLOR_OFF,
 				" (0x%2.2x) len %d", opcode, size - 1);
 
+	if (packet_get_depth(PACKET_LAYER_ATT) == PACKET_DEPTH_SUMMARY)
+		return;
+
 	if (!opcode_data || !opcode_data->func) {
 		packet_hexdump(data + 1, size - 1);
 		return;
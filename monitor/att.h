@@ -14,3 +14,6 @@
 
 void att_packet(uint16_t index, bool in, uint16_t handle, uint16_t cid,
 					const void *data, uint16_t size);
+
+void att_cache_open(const char *path);
+void att_cache_close(void);
@@ -2535,6 +2535,9 @@ void avctp_packet(const struct l2cap_frame *frame)
 				avctp_frame.hdr & 0x0c, avctp_frame.hdr >> 4,
 				avctp_frame.pid);
 
+	if (packet_get_depth(PACKET_LAYER_AVCTP) == PACKET_DEPTH_SUMMARY)
+		return;
+
 	if (avctp_frame.pid == 0x110e || avctp_frame.pid == 0x110c)
 		avrcp_packet(&avctp_frame);
 	else
@@ -708,6 +708,9 @@ static bool avdtp_signalling_packet(struct avdtp_frame *avdtp_frame)
 			sig_id, msgtype2str(hdr & 0x03), hdr & 0x03,
 			hdr & 0x0c, hdr >> 4, nosp);
 
+	if (packet_get_depth(PACKET_LAYER_AVDTP) == PACKET_DEPTH_SUMMARY)
+		return true;
+
 	/* Start Packet */
 	if ((hdr & 0x0c) == 0x04) {
 		/* TODO: handle fragmentation */
@@ -748,6 +751,23 @@ static bool avdtp_signalling_packet(struct avdtp_frame *avdtp_frame)
 	return true;
 }
 
+/* RTP header of media packets without their payload */
+static void media_summary(const struct l2cap_frame *frame)
+{
+	const uint8_t *data = frame->data;
+
+	if (frame->size < 12) {
+		print_text(COLOR_ERROR, "Media packet too short");
+		return;
+	}
+
+	print_indent(6, frame->in ? COLOR_MAGENTA : COLOR_BLUE, "AVDTP: ",
+			"Media", COLOR_OFF,
+			" seq %u timestamp %u ssrc 0x%8.8x len %u",
+			get_be16(data + 2), get_be32(data + 4),
+			get_be32(data + 8), frame->size - 12);
+}
+
 void avdtp_packet(const struct l2cap_frame *frame)
 {
 	struct avdtp_frame avdtp_frame;
@@ -760,6 +780,11 @@ void avdtp_packet(const struct l2cap_frame *frame)
 		ret = avdtp_signalling_packet(&avdtp_frame);
 		break;
 	default:
+		if (packet_get_depth(PACKET_LAYER_A2DP) == PACKET_DEPTH_SUMMARY) {
+			media_summary(frame);
+			return;
+		}
+
 		if (packet_has_filter(PACKET_FILTER_SHOW_A2DP_STREAM))
 			packet_hexdump(frame->data, frame->size);
 		return;
@@ -442,6 +442,9 @@ void bnep_packet(const struct l2cap_frame *frame)
 				" (0x%02x|%s)", bnep_frame.type,
 				bnep_frame.extension ? "1" : "0");
 
+	if (packet_get_depth(PACKET_LAYER_BNEP) == PACKET_DEPTH_SUMMARY)
+		return;
+
 	if (!bnep_data || !bnep_data->func) {
 		packet_hexdump(l2cap_frame->data, l2cap_frame->size);
 		return;
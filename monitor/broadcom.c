@@ -632,16 +632,29 @@ static const struct vendor_ocf vendor_ocf_table[] = {
 	{ }
 };
 
+/* Vendor commands are looked up for every packet, index them by OCF */
+static const struct vendor_ocf *vendor_ocf_index[1024];
+static bool vendor_ocf_index_ready;
+
 const struct vendor_ocf *broadcom_vendor_ocf(uint16_t ocf)
 {
 	int i;
 
-	for (i = 0; vendor_ocf_table[i].str; i++) {
-		if (vendor_ocf_table[i].ocf == ocf)
-			return &vendor_ocf_table[i];
+	if (!vendor_ocf_index_ready) {
+		for (i = 0; vendor_ocf_table[i].str; i++) {
+			uint16_t n = vendor_ocf_table[i].ocf & 0x03ff;
+
+			if (!vendor_ocf_index[n])
+				vendor_ocf_index[n] = &vendor_ocf_table[i];
+		}
+
+		vendor_ocf_index_ready = true;
 	}
 
-	return NULL;
+	if (ocf > 0x03ff)
+		return NULL;
+
+	return vendor_ocf_index[ocf];
 }
 
 void broadcom_lm_diag(const void *data, uint8_t size)
@@ -21,6 +21,7 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <sys/time.h>
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -44,12 +45,19 @@
 #include "ellisys.h"
 #include "tty.h"
 #include "control.h"
+#include "analyze.h"
 #include "jlink.h"
+#include "filter.h"
 
 static struct btsnoop *btsnoop_file = NULL;
+static struct btsnoop_index *btsnoop_index = NULL;
+static double reader_from = -1;
+static double reader_to = -1;
+static uint16_t reader_handle = 0xffff;
 static bool hcidump_fallback = false;
 static bool decode_control = true;
 static uint16_t filter_index = HCI_DEV_NONE;
+static bool metrics = false;
 
 struct control_data {
 	uint16_t channel;
@@ -900,6 +908,28 @@ void control_message(uint16_t opcode, const void *data, uint16_t size)
 	}
 }
 
+static void monitor_packet(struct timeval *tv, struct ucred *cred,
+					uint16_t index, uint16_t opcode,
+					const void *data, uint16_t size)
+{
+	struct timeval now;
+
+	if (!filter_packet(index, opcode, data, size))
+		return;
+
+	if (!metrics) {
+		packet_monitor(tv, cred, index, opcode, data, size);
+		return;
+	}
+
+	if (!tv) {
+		gettimeofday(&now, NULL);
+		tv = &now;
+	}
+
+	analyze_packet(tv, index, opcode, data, size);
+}
+
 static void data_callback(int fd, uint32_t events, void *user_data)
 {
 	struct control_data *data = user_data;
@@ -962,7 +992,8 @@ static void data_callback(int fd, uint32_t events, void *user_data)
 
 		switch (data->channel) {
 		case HCI_CHANNEL_CONTROL:
-			packet_control(tv, cred, index, opcode,
+			if (!metrics)
+				packet_control(tv, cred, index, opcode,
 							data->buf, pktlen);
 			break;
 		case HCI_CHANNEL_MONITOR:
@@ -970,7 +1001,7 @@ static void data_callback(int fd, uint32_t events, void *user_data)
 							data->buf, pktlen);
 			ellisys_inject_hci(tv, index, opcode,
 							data->buf, pktlen);
-			packet_monitor(tv, cred, index, opcode,
+			monitor_packet(tv, cred, index, opcode,
 							data->buf, pktlen);
 			break;
 		}
@@ -1068,7 +1099,10 @@ static int open_channel(uint16_t channel)
 		return -1;
 	}
 
-	if (filter_index != HCI_DEV_NONE)
+	/* Filter expressions are evaluated by the kernel when possible */
+	if (channel == HCI_CHANNEL_MONITOR && filter_enabled())
+		filter_attach(data->fd, filter_index);
+	else if (filter_index != HCI_DEV_NONE)
 		attach_index_filter(data->fd, filter_index);
 
 	if (mainloop_add_fd(data->fd, EPOLLIN, data_callback,
@@ -1109,7 +1143,7 @@ static void client_callback(int fd, uint32_t events, void *user_data)
 		opcode = le16_to_cpu(hdr->opcode);
 		index = le16_to_cpu(hdr->index);
 
-		packet_monitor(NULL, NULL, index, opcode,
+		monitor_packet(NULL, NULL, index, opcode,
 					data->buf + MGMT_HDR_SIZE, pktlen);
 
 		data->offset -= pktlen + MGMT_HDR_SIZE;
@@ -1327,7 +1361,7 @@ static void process_data(struct control_data *data)
 					hdr->ext_hdr + hdr->hdr_len, pktlen);
 		ellisys_inject_hci(tv, 0, opcode, hdr->ext_hdr + hdr->hdr_len,
 					pktlen);
-		packet_monitor(tv, NULL, 0, opcode,
+		monitor_packet(tv, NULL, 0, opcode,
 					hdr->ext_hdr + hdr->hdr_len, pktlen);
 
 		data->offset -= 2 + data_len;
@@ -1465,25 +1499,55 @@ int control_rtt(char *jlink, char *rtt)
 	return 0;
 }
 
-bool control_writer(const char *path)
+static void flush_callback(int id, void *user_data)
 {
-	btsnoop_file = btsnoop_create(path, 0, 0, BTSNOOP_FORMAT_MONITOR);
+	btsnoop_flush(btsnoop_file);
 
-	return !!btsnoop_file;
+	mainloop_modify_timeout(id, BTSNOOP_FLUSH_INTERVAL * 1000);
 }
 
-void control_reader(const char *path, bool pager)
+bool control_writer(const char *path, bool compress)
 {
-	unsigned char buf[BTSNOOP_MAX_PACKET_SIZE];
-	uint16_t pktlen;
-	uint32_t format;
-	struct timeval tv;
+	if (!compress) {
+		btsnoop_file = btsnoop_create(path, 0, 0,
+							BTSNOOP_FORMAT_MONITOR);
+		return !!btsnoop_file;
+	}
 
-	btsnoop_file = btsnoop_open(path, BTSNOOP_FLAG_PKLG_SUPPORT);
+	btsnoop_file = btsnoop_create_compressed(path, 0, 0,
+							BTSNOOP_FORMAT_MONITOR);
 	if (!btsnoop_file)
-		return;
+		return false;
 
-	format = btsnoop_get_format(btsnoop_file);
+	/* Do not keep records of a quiet link only in memory */
+	mainloop_add_timeout(BTSNOOP_FLUSH_INTERVAL * 1000, flush_callback,
+								NULL, NULL);
+
+	return true;
+}
+
+void control_cleanup(void)
+{
+	/* Compressed traces keep the last block in memory until closed */
+	btsnoop_unref(btsnoop_file);
+	btsnoop_file = NULL;
+}
+
+static uint32_t reader_open(const char *path)
+{
+	uint32_t format;
+
+	/* Map the file when possible, pipes and PHY traces are streamed */
+	btsnoop_index = btsnoop_index_open(path, BTSNOOP_FLAG_PKLG_SUPPORT);
+	if (btsnoop_index) {
+		format = btsnoop_index_get_format(btsnoop_index);
+	} else {
+		btsnoop_file = btsnoop_open(path, BTSNOOP_FLAG_PKLG_SUPPORT);
+		if (!btsnoop_file)
+			return BTSNOOP_FORMAT_INVALID;
+
+		format = btsnoop_get_format(btsnoop_file);
+	}
 
 	switch (format) {
 	case BTSNOOP_FORMAT_HCI:
@@ -1497,8 +1561,123 @@ void control_reader(const char *path, bool pager)
 		break;
 	}
 
-	if (pager)
-		open_pager();
+	return format;
+}
+
+static void reader_close(void)
+{
+	btsnoop_index_close(btsnoop_index);
+	btsnoop_index = NULL;
+
+	btsnoop_unref(btsnoop_file);
+	btsnoop_file = NULL;
+}
+
+static void reader_record(struct btsnoop_record *rec)
+{
+	monitor_packet(&rec->tv, NULL, rec->index, rec->opcode,
+						rec->data, rec->size);
+	ellisys_inject_hci(&rec->tv, rec->index, rec->opcode,
+						rec->data, rec->size);
+}
+
+static bool is_index_record(uint16_t opcode)
+{
+	switch (opcode) {
+	case BTSNOOP_OPCODE_NEW_INDEX:
+	case BTSNOOP_OPCODE_DEL_INDEX:
+	case BTSNOOP_OPCODE_OPEN_INDEX:
+	case BTSNOOP_OPCODE_CLOSE_INDEX:
+	case BTSNOOP_OPCODE_INDEX_INFO:
+		return true;
+	}
+
+	return false;
+}
+
+static void offset_to_tv(time_t base, double offset, struct timeval *tv)
+{
+	tv->tv_sec = base + (time_t) offset;
+	tv->tv_usec = (offset - (time_t) offset) * 1000000 + 0.5;
+}
+
+/*
+ * Only decode the records inside the time window and, if selected, those of
+ * a single connection. Controller records are always decoded so the index
+ * names and manufacturers are known to the decoder.
+ */
+static unsigned long reader_run_filtered(void)
+{
+	struct btsnoop_record rec;
+	struct timeval tv;
+	unsigned long count = 0;
+	size_t pos, start, end;
+
+	if (!btsnoop_index_load(btsnoop_index) ||
+			!btsnoop_index_get(btsnoop_index, 0, &rec))
+		return 0;
+
+	/* Keep time offsets relative to the start of the whole trace */
+	packet_set_time_offset(rec.tv.tv_sec);
+
+	start = 0;
+	end = btsnoop_index_count(btsnoop_index);
+
+	if (reader_from >= 0) {
+		offset_to_tv(rec.tv.tv_sec, reader_from, &tv);
+		start = btsnoop_index_find_time(btsnoop_index, &tv);
+	}
+
+	if (reader_to >= 0) {
+		offset_to_tv(rec.tv.tv_sec, reader_to, &tv);
+		tv.tv_usec++;
+		end = btsnoop_index_find_time(btsnoop_index, &tv);
+	}
+
+	for (pos = 0; pos < end; pos++) {
+		if (!btsnoop_index_get(btsnoop_index, pos, &rec))
+			break;
+
+		if (rec.opcode == 0xffff)
+			continue;
+
+		if (pos < start || (reader_handle != 0xffff &&
+				!btsnoop_record_has_handle(&rec,
+							reader_handle))) {
+			if (!is_index_record(rec.opcode))
+				continue;
+		}
+
+		reader_record(&rec);
+		count++;
+	}
+
+	return count;
+}
+
+static unsigned long reader_run(uint32_t format)
+{
+	unsigned char buf[BTSNOOP_MAX_PACKET_SIZE];
+	struct btsnoop_record rec;
+	unsigned long count = 0;
+	uint16_t pktlen;
+	struct timeval tv;
+
+	if (btsnoop_index) {
+		if (reader_from >= 0 || reader_to >= 0 ||
+						reader_handle != 0xffff)
+			return reader_run_filtered();
+
+		while (btsnoop_index_next(btsnoop_index, &rec)) {
+			if (rec.opcode == 0xffff)
+				continue;
+
+			reader_record(&rec);
+			count++;
+		}
+
+		return count;
+	}
 
 	switch (format) {
 	case BTSNOOP_FORMAT_HCI:
@@ -1514,8 +1693,9 @@ void control_reader(const char *path, bool pager)
 			if (opcode == 0xffff)
 				continue;
 
-			packet_monitor(&tv, NULL, index, opcode, buf, pktlen);
+			monitor_packet(&tv, NULL, index, opcode, buf, pktlen);
 			ellisys_inject_hci(&tv, index, opcode, buf, pktlen);
+			count++;
 		}
 		break;
 
@@ -1528,14 +1708,95 @@ void control_reader(const char *path, bool pager)
 				break;
 
 			packet_simulator(&tv, frequency, buf, pktlen);
+			count++;
 		}
 		break;
 	}
 
+	return count;
+}
+
+void control_reader(const char *path, bool pager)
+{
+	uint32_t format;
+
+	format = reader_open(path);
+	if (format == BTSNOOP_FORMAT_INVALID)
+		return;
+
+	if (pager)
+		open_pager();
+
+	reader_run(format);
+
 	if (pager)
 		close_pager();
 
-	btsnoop_unref(btsnoop_file);
+	analyze_metrics_flush();
+
+	reader_close();
+}
+
+void control_reader_range(double from, double to)
+{
+	reader_from = from;
+	reader_to = to;
+}
+
+void control_reader_handle(uint16_t handle)
+{
+	reader_handle = handle;
+}
+
+void control_bench(const char *path)
+{
+	struct timespec start, end;
+	unsigned long count;
+	uint32_t format;
+	double secs;
+	int fd, null_fd;
+
+	format = reader_open(path);
+	if (format == BTSNOOP_FORMAT_INVALID)
+		return;
+
+	/* Decode everything as usual, but throw the text away */
+	fflush(stdout);
+
+	fd = dup(STDOUT_FILENO);
+	if (fd < 0) {
+		perror("Failed to duplicate stdout");
+		goto done;
+	}
+
+	null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+	if (null_fd < 0) {
+		perror("Failed to open /dev/null");
+		close(fd);
+		goto done;
+	}
+
+	dup2(null_fd, STDOUT_FILENO);
+	close(null_fd);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	count = reader_run(format);
+	fflush(stdout);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	dup2(fd, STDOUT_FILENO);
+	close(fd);
+
+	secs = (end.tv_sec - start.tv_sec) +
+				(end.tv_nsec - start.tv_nsec) / 1000000000.0;
+
+	printf("Decoded %lu packets in %.3f seconds", count, secs);
+	if (secs > 0)
+		printf(" (%.0f packets/sec)", count / secs);
+	printf("\n");
+
+done:
+	reader_close();
 }
 
 int control_tracing(void)
@@ -1559,6 +1820,26 @@ int control_tracing(void)
 	return 0;
 }
 
+static void metrics_callback(int id, void *user_data)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	analyze_metrics_tick(&now);
+
+	mainloop_modify_timeout(id, 1000);
+}
+
+void control_metrics(unsigned int interval)
+{
+	metrics = true;
+
+	analyze_metrics(interval);
+
+	/* Report intervals without traffic when tracing live */
+	mainloop_add_timeout(1000, metrics_callback, NULL, NULL);
+}
+
 void control_disable_decoding(void)
 {
 	decode_control = false;
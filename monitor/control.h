@@ -11,12 +11,17 @@
 
 #include <stdint.h>
 
-bool control_writer(const char *path);
+bool control_writer(const char *path, bool compress);
+void control_cleanup(void);
 void control_reader(const char *path, bool pager);
+void control_reader_range(double from, double to);
+void control_reader_handle(uint16_t handle);
+void control_bench(const char *path);
 void control_server(const char *path);
 int control_tty(const char *path, unsigned int speed);
 int control_rtt(char *jlink, char *rtt);
 int control_tracing(void);
+void control_metrics(unsigned int interval);
 void control_disable_decoding(void);
 void control_filter_index(uint16_t index);
 
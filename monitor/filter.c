@@ -0,0 +1,872 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+
+#include "lib/bluetooth.h"
+#include "lib/hci.h"
+
+#include "src/shared/util.h"
+#include "src/shared/btsnoop.h"
+#include "filter.h"
+
+/*
+ * Filter expressions are compiled into a classic BPF program that runs
+ * on the monitor header followed by the HCI packet, which is what the
+ * kernel queues on the monitor socket. The same program is attached to
+ * the socket for live tracing and interpreted for traces read from file.
+ *
+ * Every primitive leaves 1 or 0 in A. Operands of and/or are kept in the
+ * scratch memory, so the nesting depth is limited to BPF_MEMWORDS.
+ */
+
+#define MON_HDR_SIZE	6
+#define PKT(offset)	(MON_HDR_SIZE + (offset))
+
+/* Addresses are searched for in the first octets of a packet only */
+#define ADDR_SCAN	40
+
+#define FILTER_ACCEPT	0x0fffffff
+#define FILTER_DROP	0
+
+#define MAX_FIXUPS	512
+
+/* Jump targets, negative values are plain offsets */
+enum {
+	L_TRUE,
+	L_FALSE,
+	L_1,
+	L_2,
+	L_3,
+	L_4,
+	L_5,
+	L_6,
+	L_7,
+	L_MAX
+};
+
+#define L_NEXT		(-1)
+#define L_SKIP(n)	(-1 - (n))
+
+struct fixup {
+	unsigned int pos;
+	int jt;
+	int jf;
+};
+
+struct compiler {
+	const char *pos;
+	const char *token_start;
+	char token[32];
+	struct sock_filter *insns;
+	unsigned int len;
+	unsigned int size;
+	int labels[L_MAX];
+	struct fixup fixups[MAX_FIXUPS];
+	unsigned int num_fixups;
+	bool failed;
+};
+
+static struct sock_filter *prog;
+static unsigned int prog_len;
+
+static const uint32_t ops_cmd[] = { BTSNOOP_OPCODE_COMMAND_PKT };
+static const uint32_t ops_evt[] = { BTSNOOP_OPCODE_EVENT_PKT };
+static const uint32_t ops_acl[] = { BTSNOOP_OPCODE_ACL_TX_PKT,
+					BTSNOOP_OPCODE_ACL_RX_PKT };
+static const uint32_t ops_sco[] = { BTSNOOP_OPCODE_SCO_TX_PKT,
+					BTSNOOP_OPCODE_SCO_RX_PKT };
+static const uint32_t ops_iso[] = { BTSNOOP_OPCODE_ISO_TX_PKT,
+					BTSNOOP_OPCODE_ISO_RX_PKT };
+static const uint32_t ops_tx[] = { BTSNOOP_OPCODE_COMMAND_PKT,
+					BTSNOOP_OPCODE_ACL_TX_PKT,
+					BTSNOOP_OPCODE_SCO_TX_PKT,
+					BTSNOOP_OPCODE_ISO_TX_PKT };
+static const uint32_t ops_rx[] = { BTSNOOP_OPCODE_EVENT_PKT,
+					BTSNOOP_OPCODE_ACL_RX_PKT,
+					BTSNOOP_OPCODE_SCO_RX_PKT,
+					BTSNOOP_OPCODE_ISO_RX_PKT };
+static const uint32_t ops_data[] = { BTSNOOP_OPCODE_ACL_TX_PKT,
+					BTSNOOP_OPCODE_ACL_RX_PKT,
+					BTSNOOP_OPCODE_SCO_TX_PKT,
+					BTSNOOP_OPCODE_SCO_RX_PKT,
+					BTSNOOP_OPCODE_ISO_TX_PKT,
+					BTSNOOP_OPCODE_ISO_RX_PKT };
+static const uint32_t ops_hci[] = { BTSNOOP_OPCODE_COMMAND_PKT,
+					BTSNOOP_OPCODE_EVENT_PKT,
+					BTSNOOP_OPCODE_ACL_TX_PKT,
+					BTSNOOP_OPCODE_ACL_RX_PKT,
+					BTSNOOP_OPCODE_SCO_TX_PKT,
+					BTSNOOP_OPCODE_SCO_RX_PKT,
+					BTSNOOP_OPCODE_ISO_TX_PKT,
+					BTSNOOP_OPCODE_ISO_RX_PKT };
+
+/* Packet fields are little endian while BPF loads are big endian */
+static uint32_t le16(uint16_t val)
+{
+	return ((val & 0xff) << 8) | (val >> 8);
+}
+
+static void emit_insn(struct compiler *c, uint16_t code, uint32_t k,
+						uint8_t jt, uint8_t jf)
+{
+	struct sock_filter *insn;
+
+	if (c->failed)
+		return;
+
+	if (c->len == c->size) {
+		unsigned int size = c->size ? c->size * 2 : 64;
+
+		insn = realloc(c->insns, size * sizeof(*insn));
+		if (!insn) {
+			c->failed = true;
+			return;
+		}
+
+		c->insns = insn;
+		c->size = size;
+	}
+
+	insn = &c->insns[c->len++];
+	insn->code = code;
+	insn->k = k;
+	insn->jt = jt;
+	insn->jf = jf;
+}
+
+static void emit(struct compiler *c, uint16_t code, uint32_t k)
+{
+	emit_insn(c, code, k, 0, 0);
+}
+
+static void emit_jump(struct compiler *c, uint16_t code, uint32_t k,
+							int jt, int jf)
+{
+	struct fixup *fixup;
+
+	if (c->num_fixups == MAX_FIXUPS) {
+		c->failed = true;
+		return;
+	}
+
+	fixup = &c->fixups[c->num_fixups++];
+	fixup->pos = c->len;
+	fixup->jt = jt;
+	fixup->jf = jf;
+
+	emit_insn(c, BPF_JMP | code | BPF_K, k, 0, 0);
+}
+
+static void set_label(struct compiler *c, int label)
+{
+	c->labels[label] = c->len;
+}
+
+static bool resolve(struct compiler *c, struct fixup *fixup, int target,
+								uint8_t *off)
+{
+	int val;
+
+	if (target < 0)
+		val = -1 - target;
+	else if (c->labels[target] < 0)
+		return false;
+	else
+		val = c->labels[target] - (int) fixup->pos - 1;
+
+	if (val < 0 || val > 255)
+		return false;
+
+	*off = val;
+
+	return true;
+}
+
+static void begin_primitive(struct compiler *c)
+{
+	int i;
+
+	for (i = 0; i < L_MAX; i++)
+		c->labels[i] = -1;
+
+	c->num_fixups = 0;
+}
+
+static void end_primitive(struct compiler *c)
+{
+	unsigned int i;
+
+	set_label(c, L_FALSE);
+	emit(c, BPF_LD | BPF_IMM, 0);
+	emit(c, BPF_JMP | BPF_JA, 1);
+	set_label(c, L_TRUE);
+	emit(c, BPF_LD | BPF_IMM, 1);
+
+	if (c->failed)
+		return;
+
+	for (i = 0; i < c->num_fixups; i++) {
+		struct fixup *fixup = &c->fixups[i];
+		struct sock_filter *insn = &c->insns[fixup->pos];
+		uint8_t off;
+
+		/* Unconditional jumps take the offset from k */
+		if (BPF_OP(insn->code) == BPF_JA) {
+			if (!resolve(c, fixup, fixup->jt, &off))
+				c->failed = true;
+			else
+				insn->k = off;
+			continue;
+		}
+
+		if (!resolve(c, fixup, fixup->jt, &insn->jt) ||
+				!resolve(c, fixup, fixup->jf, &insn->jf))
+			c->failed = true;
+	}
+}
+
+/* Go to L_FALSE unless the packet has at least len octets */
+static void need(struct compiler *c, uint32_t len)
+{
+	emit(c, BPF_LD | BPF_W | BPF_LEN, 0);
+	emit_jump(c, BPF_JGE, len, L_NEXT, L_FALSE);
+}
+
+static void match_set(struct compiler *c, const uint32_t *vals,
+					size_t count, int match, int nomatch)
+{
+	size_t i;
+
+	/* Falling through on a match must skip the remaining compares */
+	for (i = 0; i + 1 < count; i++)
+		emit_jump(c, BPF_JEQ, vals[i],
+				match == L_NEXT ?
+					L_SKIP((int) (count - 1 - i)) : match,
+				L_NEXT);
+
+	emit_jump(c, BPF_JEQ, vals[i], match, nomatch);
+}
+
+static void match_opcode(struct compiler *c, const uint32_t *ops,
+					size_t count, int match, int nomatch)
+{
+	uint32_t vals[8];
+	size_t i;
+
+	for (i = 0; i < count; i++)
+		vals[i] = le16(ops[i]);
+
+	emit(c, BPF_LD | BPF_H | BPF_ABS, 0);
+	match_set(c, vals, count, match, nomatch);
+}
+
+/* Loads are big endian, so 16 bit codes such as opcodes need swapping */
+static void match_handle_set(struct compiler *c,
+				const struct btsnoop_handle_set *set,
+				bool swap, int match, int nomatch)
+{
+	uint32_t vals[64];
+	unsigned int i;
+
+	if (!set->count || set->count > ARRAY_SIZE(vals)) {
+		c->failed = true;
+		return;
+	}
+
+	for (i = 0; i < set->count; i++)
+		vals[i] = swap ? le16(set->codes[i]) : set->codes[i];
+
+	match_set(c, vals, set->count, match, nomatch);
+}
+
+static void load_handle(struct compiler *c, int label,
+				const struct btsnoop_handle_set *set)
+{
+	set_label(c, label);
+	need(c, PKT(set->offset + 2));
+	emit(c, BPF_LD | BPF_H | BPF_ABS, PKT(set->offset));
+	emit_jump(c, BPF_JA, 0, L_3, L_3);
+}
+
+/* Continuation fragments carry no L2CAP header */
+static void match_l2cap_start(struct compiler *c)
+{
+	match_opcode(c, ops_acl, ARRAY_SIZE(ops_acl), L_NEXT, L_FALSE);
+	emit(c, BPF_LD | BPF_B | BPF_ABS, PKT(1));
+	emit(c, BPF_ALU | BPF_AND | BPF_K, 0x30);
+	emit_jump(c, BPF_JEQ, 0x10, L_FALSE, L_NEXT);
+}
+
+static void gen_opcodes(struct compiler *c, const uint32_t *ops, size_t count)
+{
+	match_opcode(c, ops, count, L_TRUE, L_FALSE);
+}
+
+static void gen_index(struct compiler *c, uint16_t index)
+{
+	emit(c, BPF_LD | BPF_H | BPF_ABS, 2);
+	emit_jump(c, BPF_JEQ, le16(index), L_TRUE, L_FALSE);
+}
+
+static void gen_command(struct compiler *c, int opcode)
+{
+	if (opcode < 0) {
+		gen_opcodes(c, ops_cmd, ARRAY_SIZE(ops_cmd));
+		return;
+	}
+
+	need(c, PKT(3));
+	match_opcode(c, ops_cmd, ARRAY_SIZE(ops_cmd), L_NEXT, L_FALSE);
+	emit(c, BPF_LD | BPF_H | BPF_ABS, PKT(0));
+	emit_jump(c, BPF_JEQ, le16(opcode), L_TRUE, L_FALSE);
+}
+
+static void gen_event(struct compiler *c, int event)
+{
+	if (event < 0) {
+		gen_opcodes(c, ops_evt, ARRAY_SIZE(ops_evt));
+		return;
+	}
+
+	need(c, PKT(2));
+	match_opcode(c, ops_evt, ARRAY_SIZE(ops_evt), L_NEXT, L_FALSE);
+	emit(c, BPF_LD | BPF_B | BPF_ABS, PKT(0));
+	emit_jump(c, BPF_JEQ, event, L_TRUE, L_FALSE);
+}
+
+static void gen_le_meta(struct compiler *c, int subevent)
+{
+	need(c, PKT(3));
+	match_opcode(c, ops_evt, ARRAY_SIZE(ops_evt), L_NEXT, L_FALSE);
+	emit(c, BPF_LD | BPF_B | BPF_ABS, PKT(0));
+
+	if (subevent < 0) {
+		emit_jump(c, BPF_JEQ, 0x3e, L_TRUE, L_FALSE);
+		return;
+	}
+
+	emit_jump(c, BPF_JEQ, 0x3e, L_NEXT, L_FALSE);
+	emit(c, BPF_LD | BPF_B | BPF_ABS, PKT(2));
+	emit_jump(c, BPF_JEQ, subevent, L_TRUE, L_FALSE);
+}
+
+/*
+ * Same packets as the handle of btsnoop_index records, except for Number
+ * Of Completed Packets which can carry several handles.
+ */
+static void gen_handle(struct compiler *c, uint16_t handle)
+{
+	need(c, PKT(2));
+	match_opcode(c, ops_data, ARRAY_SIZE(ops_data), L_1, L_NEXT);
+	emit_jump(c, BPF_JEQ, le16(BTSNOOP_OPCODE_COMMAND_PKT), L_2, L_NEXT);
+	emit_jump(c, BPF_JEQ, le16(BTSNOOP_OPCODE_EVENT_PKT), L_NEXT, L_FALSE);
+
+	emit(c, BPF_LD | BPF_B | BPF_ABS, PKT(0));
+	match_handle_set(c, &btsnoop_evt_handle, false, L_4, L_NEXT);
+	emit_jump(c, BPF_JEQ, 0x3e, L_NEXT, L_FALSE);
+	need(c, PKT(3));
+	emit(c, BPF_LD | BPF_B | BPF_ABS, PKT(2));
+	match_handle_set(c, &btsnoop_le_handle, false, L_5, L_NEXT);
+	match_handle_set(c, &btsnoop_le_handle_status, false, L_6, L_FALSE);
+
+	set_label(c, L_2);
+	emit(c, BPF_LD | BPF_H | BPF_ABS, PKT(0));
+	match_handle_set(c, &btsnoop_cmd_handle, true, L_7, L_FALSE);
+
+	load_handle(c, L_4, &btsnoop_evt_handle);
+	load_handle(c, L_5, &btsnoop_le_handle);
+	load_handle(c, L_6, &btsnoop_le_handle_status);
+	load_handle(c, L_7, &btsnoop_cmd_handle);
+
+	set_label(c, L_1);
+	emit(c, BPF_LD | BPF_H | BPF_ABS, PKT(0));
+
+	set_label(c, L_3);
+	emit(c, BPF_ALU | BPF_AND | BPF_K, 0xff0f);
+	emit_jump(c, BPF_JEQ, le16(handle), L_TRUE, L_FALSE);
+}
+
+static void gen_cid(struct compiler *c, uint16_t cid)
+{
+	need(c, PKT(8));
+	match_l2cap_start(c);
+	emit(c, BPF_LD | BPF_H | BPF_ABS, PKT(6));
+	emit_jump(c, BPF_JEQ, le16(cid), L_TRUE, L_FALSE);
+}
+
+/* Connection requests on the BR/EDR and LE signaling channels */
+static void gen_psm(struct compiler *c, uint16_t psm)
+{
+	need(c, PKT(16));
+	match_l2cap_start(c);
+	emit(c, BPF_LD | BPF_H | BPF_ABS, PKT(6));
+	emit_jump(c, BPF_JEQ, le16(0x0001), L_1, L_NEXT);
+	emit_jump(c, BPF_JEQ, le16(0x0005), L_1, L_FALSE);
+
+	set_label(c, L_1);
+	emit(c, BPF_LD | BPF_B | BPF_ABS, PKT(8));
+	emit_jump(c, BPF_JEQ, 0x02, L_2, L_NEXT);	/* Connection */
+	emit_jump(c, BPF_JEQ, 0x14, L_2, L_NEXT);	/* LE Credit Based */
+	emit_jump(c, BPF_JEQ, 0x17, L_2, L_FALSE);	/* Enhanced Credit */
+
+	set_label(c, L_2);
+	emit(c, BPF_LD | BPF_H | BPF_ABS, PKT(12));
+	emit_jump(c, BPF_JEQ, le16(psm), L_TRUE, L_FALSE);
+}
+
+static void gen_att(struct compiler *c, int opcode)
+{
+	need(c, PKT(9));
+	match_l2cap_start(c);
+	emit(c, BPF_LD | BPF_H | BPF_ABS, PKT(6));
+
+	if (opcode < 0) {
+		emit_jump(c, BPF_JEQ, le16(0x0004), L_TRUE, L_FALSE);
+		return;
+	}
+
+	emit_jump(c, BPF_JEQ, le16(0x0004), L_NEXT, L_FALSE);
+	emit(c, BPF_LD | BPF_B | BPF_ABS, PKT(8));
+	emit_jump(c, BPF_JEQ, opcode, L_TRUE, L_FALSE);
+}
+
+static void gen_addr(struct compiler *c, const bdaddr_t *bdaddr)
+{
+	const uint8_t *b = bdaddr->b;
+	uint32_t word, half;
+	unsigned int offset;
+
+	/* Addresses are stored in little endian order as well */
+	word = b[0] << 24 | b[1] << 16 | b[2] << 8 | b[3];
+	half = b[4] << 8 | b[5];
+
+	for (offset = PKT(0); offset + 6 <= PKT(ADDR_SCAN); offset++) {
+		emit(c, BPF_LD | BPF_W | BPF_LEN, 0);
+		emit_jump(c, BPF_JGE, offset + 6, L_NEXT, L_FALSE);
+		emit(c, BPF_LD | BPF_W | BPF_ABS, offset);
+		emit_jump(c, BPF_JEQ, word, L_NEXT, L_SKIP(2));
+		emit(c, BPF_LD | BPF_H | BPF_ABS, offset + 4);
+		emit_jump(c, BPF_JEQ, half, L_TRUE, L_NEXT);
+	}
+
+	emit_jump(c, BPF_JA, 0, L_FALSE, L_FALSE);
+}
+
+static const char *next_token(struct compiler *c)
+{
+	const char *start;
+	size_t len;
+
+	while (isspace(*c->pos))
+		c->pos++;
+
+	start = c->pos;
+	c->token_start = start;
+
+	if (!*start) {
+		c->token[0] = '\0';
+		return c->token;
+	}
+
+	if (!strncmp(start, "&&", 2) || !strncmp(start, "||", 2))
+		len = 2;
+	else if (strchr("()!", *start))
+		len = 1;
+	else {
+		len = 0;
+		while (isalnum(start[len]) || start[len] == ':' ||
+							start[len] == '-')
+			len++;
+
+		if (!len)
+			len = 1;
+	}
+
+	if (len >= sizeof(c->token)) {
+		c->failed = true;
+		len = sizeof(c->token) - 1;
+	}
+
+	memcpy(c->token, start, len);
+	c->token[len] = '\0';
+	c->pos = start + len;
+
+	return c->token;
+}
+
+static bool peek_number(struct compiler *c)
+{
+	const char *pos = c->pos;
+
+	while (isspace(*pos))
+		pos++;
+
+	return isdigit(*pos);
+}
+
+static bool parse_number(struct compiler *c, unsigned long max,
+							unsigned long *val)
+{
+	const char *token = next_token(c);
+	char *end;
+
+	if (!isdigit(*token))
+		return false;
+
+	*val = strtoul(token, &end, 0);
+	if (*end || *val > max)
+		return false;
+
+	return true;
+}
+
+static int parse_optional(struct compiler *c, unsigned long max)
+{
+	unsigned long val;
+
+	if (!peek_number(c))
+		return -1;
+
+	if (!parse_number(c, max, &val)) {
+		c->failed = true;
+		return -1;
+	}
+
+	return val;
+}
+
+static void parse_primitive(struct compiler *c)
+{
+	const char *token = next_token(c);
+	unsigned long val;
+	bdaddr_t bdaddr;
+
+	begin_primitive(c);
+
+	if (!strcmp(token, "cmd"))
+		gen_command(c, parse_optional(c, 0xffff));
+	else if (!strcmp(token, "evt"))
+		gen_event(c, parse_optional(c, 0xff));
+	else if (!strcmp(token, "acl"))
+		gen_opcodes(c, ops_acl, ARRAY_SIZE(ops_acl));
+	else if (!strcmp(token, "sco"))
+		gen_opcodes(c, ops_sco, ARRAY_SIZE(ops_sco));
+	else if (!strcmp(token, "iso"))
+		gen_opcodes(c, ops_iso, ARRAY_SIZE(ops_iso));
+	else if (!strcmp(token, "tx"))
+		gen_opcodes(c, ops_tx, ARRAY_SIZE(ops_tx));
+	else if (!strcmp(token, "rx"))
+		gen_opcodes(c, ops_rx, ARRAY_SIZE(ops_rx));
+	else if (!strcmp(token, "le-meta"))
+		gen_le_meta(c, parse_optional(c, 0xff));
+	else if (!strcmp(token, "att"))
+		gen_att(c, parse_optional(c, 0xff));
+	else if (!strcmp(token, "index") && parse_number(c, 0xffff, &val))
+		gen_index(c, val);
+	else if (!strcmp(token, "handle") && parse_number(c, 0x0eff, &val))
+		gen_handle(c, val);
+	else if (!strcmp(token, "cid") && parse_number(c, 0xffff, &val))
+		gen_cid(c, val);
+	else if (!strcmp(token, "psm") && parse_number(c, 0xffff, &val))
+		gen_psm(c, val);
+	else if (!strcmp(token, "addr") && !bachk(next_token(c))) {
+		str2ba(c->token, &bdaddr);
+		gen_addr(c, &bdaddr);
+	} else {
+		c->failed = true;
+		return;
+	}
+
+	end_primitive(c);
+}
+
+static void parse_expr(struct compiler *c, unsigned int depth);
+
+static void parse_factor(struct compiler *c, unsigned int depth)
+{
+	const char *pos = c->pos;
+	const char *token = next_token(c);
+
+	if (!strcmp(token, "not") || !strcmp(token, "!")) {
+		parse_factor(c, depth);
+		emit(c, BPF_ALU | BPF_XOR | BPF_K, 1);
+		return;
+	}
+
+	if (!strcmp(token, "(")) {
+		parse_expr(c, depth);
+
+		if (strcmp(next_token(c), ")"))
+			c->failed = true;
+		return;
+	}
+
+	c->pos = pos;
+	parse_primitive(c);
+}
+
+static void parse_binary(struct compiler *c, unsigned int depth,
+				const char *word, const char *symbol,
+				uint16_t alu,
+				void (*parse)(struct compiler *c,
+							unsigned int depth))
+{
+	parse(c, depth);
+
+	while (!c->failed) {
+		const char *pos = c->pos;
+		const char *token = next_token(c);
+
+		if (strcmp(token, word) && strcmp(token, symbol)) {
+			c->pos = pos;
+			break;
+		}
+
+		if (depth + 1 >= BPF_MEMWORDS) {
+			c->failed = true;
+			break;
+		}
+
+		/* Left operand is kept in scratch memory */
+		emit(c, BPF_ST, depth);
+		parse(c, depth + 1);
+		emit(c, BPF_LDX | BPF_MEM, depth);
+		emit(c, BPF_ALU | alu | BPF_X, 0);
+	}
+}
+
+static void parse_term(struct compiler *c, unsigned int depth)
+{
+	parse_binary(c, depth, "and", "&&", BPF_AND, parse_factor);
+}
+
+static void parse_expr(struct compiler *c, unsigned int depth)
+{
+	parse_binary(c, depth, "or", "||", BPF_OR, parse_term);
+}
+
+/* Packets other than HCI traffic are always accepted */
+static void gen_prologue(struct compiler *c)
+{
+	size_t i, count = ARRAY_SIZE(ops_hci);
+
+	emit(c, BPF_LD | BPF_W | BPF_LEN, 0);
+	emit_insn(c, BPF_JMP | BPF_JGE | BPF_K, MON_HDR_SIZE, 1, 0);
+	emit(c, BPF_RET | BPF_K, FILTER_ACCEPT);
+	emit(c, BPF_LD | BPF_H | BPF_ABS, 0);
+
+	for (i = 0; i < count; i++)
+		emit_insn(c, BPF_JMP | BPF_JEQ | BPF_K, le16(ops_hci[i]),
+							count - i, 0);
+
+	emit(c, BPF_RET | BPF_K, FILTER_ACCEPT);
+}
+
+static void gen_epilogue(struct compiler *c)
+{
+	emit_insn(c, BPF_JMP | BPF_JEQ | BPF_K, 0, 1, 0);
+	emit(c, BPF_RET | BPF_K, FILTER_ACCEPT);
+	emit(c, BPF_RET | BPF_K, FILTER_DROP);
+}
+
+bool filter_compile(const char *expr)
+{
+	struct compiler *c;
+
+	c = new0(struct compiler, 1);
+	c->pos = expr;
+
+	gen_prologue(c);
+	parse_expr(c, 0);
+
+	if (!c->failed && *next_token(c))
+		c->failed = true;
+
+	gen_epilogue(c);
+
+	/* Leave room for the index selection added by filter_attach */
+	if (c->failed || c->len + 4 > BPF_MAXINSNS) {
+		fprintf(stderr, "Invalid filter expression at '%s'\n",
+							c->token_start);
+		free(c->insns);
+		free(c);
+		return false;
+	}
+
+	free(prog);
+	prog = c->insns;
+	prog_len = c->len;
+
+	free(c);
+
+	return true;
+}
+
+bool filter_enabled(void)
+{
+	return prog != NULL;
+}
+
+static bool load(const uint8_t *hdr, const uint8_t *data, uint32_t len,
+				uint32_t offset, unsigned int size,
+				uint32_t *val)
+{
+	unsigned int i;
+
+	if (offset > len || size > len - offset)
+		return false;
+
+	*val = 0;
+
+	for (i = 0; i < size; i++, offset++) {
+		uint8_t octet;
+
+		if (offset < MON_HDR_SIZE)
+			octet = hdr[offset];
+		else
+			octet = data[offset - MON_HDR_SIZE];
+
+		*val = *val << 8 | octet;
+	}
+
+	return true;
+}
+
+/* Interpreter for the instructions generated above */
+static uint32_t run(const uint8_t *hdr, const uint8_t *data, uint32_t len)
+{
+	uint32_t a = 0, x = 0, mem[BPF_MEMWORDS] = { };
+	unsigned int pc;
+
+	for (pc = 0; pc < prog_len; pc++) {
+		const struct sock_filter *insn = &prog[pc];
+
+		switch (insn->code) {
+		case BPF_LD | BPF_W | BPF_ABS:
+			if (!load(hdr, data, len, insn->k, 4, &a))
+				return 0;
+			break;
+		case BPF_LD | BPF_H | BPF_ABS:
+			if (!load(hdr, data, len, insn->k, 2, &a))
+				return 0;
+			break;
+		case BPF_LD | BPF_B | BPF_ABS:
+			if (!load(hdr, data, len, insn->k, 1, &a))
+				return 0;
+			break;
+		case BPF_LD | BPF_W | BPF_LEN:
+			a = len;
+			break;
+		case BPF_LD | BPF_IMM:
+			a = insn->k;
+			break;
+		case BPF_LDX | BPF_MEM:
+			x = mem[insn->k];
+			break;
+		case BPF_ST:
+			mem[insn->k] = a;
+			break;
+		case BPF_ALU | BPF_AND | BPF_K:
+			a &= insn->k;
+			break;
+		case BPF_ALU | BPF_XOR | BPF_K:
+			a ^= insn->k;
+			break;
+		case BPF_ALU | BPF_AND | BPF_X:
+			a &= x;
+			break;
+		case BPF_ALU | BPF_OR | BPF_X:
+			a |= x;
+			break;
+		case BPF_JMP | BPF_JA:
+			pc += insn->k;
+			break;
+		case BPF_JMP | BPF_JEQ | BPF_K:
+			pc += (a == insn->k) ? insn->jt : insn->jf;
+			break;
+		case BPF_JMP | BPF_JGE | BPF_K:
+			pc += (a >= insn->k) ? insn->jt : insn->jf;
+			break;
+		case BPF_RET | BPF_K:
+			return insn->k;
+		default:
+			return 0;
+		}
+	}
+
+	return 0;
+}
+
+bool filter_packet(uint16_t index, uint16_t opcode, const void *data,
+							uint16_t size)
+{
+	uint8_t hdr[MON_HDR_SIZE];
+
+	if (!prog)
+		return true;
+
+	put_le16(opcode, hdr);
+	put_le16(index, hdr + 2);
+	put_le16(size, hdr + 4);
+
+	return run(hdr, data, MON_HDR_SIZE + size) != FILTER_DROP;
+}
+
+bool filter_attach(int fd, uint16_t index)
+{
+	struct sock_filter *insns;
+	struct sock_fprog fprog;
+	unsigned int len = 0;
+	int err;
+
+	if (!prog)
+		return false;
+
+	insns = new0(struct sock_filter, prog_len + 4);
+
+	/* Same controller selection as with a plain index filter */
+	if (index != HCI_DEV_NONE) {
+		insns[len++] = (struct sock_filter)
+				BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 2);
+		insns[len++] = (struct sock_filter)
+				BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+						le16(index), 2, 0);
+		insns[len++] = (struct sock_filter)
+				BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+						le16(HCI_DEV_NONE), 1, 0);
+		insns[len++] = (struct sock_filter)
+				BPF_STMT(BPF_RET | BPF_K, FILTER_DROP);
+	}
+
+	memcpy(insns + len, prog, prog_len * sizeof(*prog));
+	len += prog_len;
+
+	fprog.len = len;
+	fprog.filter = insns;
+
+	err = setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog,
+								sizeof(fprog));
+	free(insns);
+
+	if (err < 0) {
+		perror("Failed to attach filter");
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,16 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+bool filter_compile(const char *expr);
+bool filter_enabled(void);
+bool filter_packet(uint16_t index, uint16_t opcode, const void *data,
+							uint16_t size);
+bool filter_attach(int fd, uint16_t index);
@@ -0,0 +1,190 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "src/shared/util.h"
+#include "display.h"
+#include "histogram.h"
+
+/*
+ * Log-linear buckets: every power of two range is split into 16 linear
+ * sub-buckets, so any recorded value is known within 6.25% while the
+ * whole 32-bit range fits into a few hundred counters.
+ */
+#define SUB_BITS	4
+#define SUB_COUNT	(1 << SUB_BITS)
+#define MAX_VALUE	UINT32_MAX
+#define NUM_BUCKETS	((32 - SUB_BITS + 1) * SUB_COUNT)
+
+#define BAR_WIDTH	40
+
+struct histogram {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+	uint64_t buckets[NUM_BUCKETS];
+};
+
+static unsigned int bucket_index(uint64_t value)
+{
+	unsigned int msb;
+
+	if (value < SUB_COUNT)
+		return value;
+
+	msb = 63 - __builtin_clzll(value);
+
+	return (msb - SUB_BITS + 1) * SUB_COUNT +
+			((value >> (msb - SUB_BITS)) & (SUB_COUNT - 1));
+}
+
+static uint64_t bucket_value(unsigned int index)
+{
+	unsigned int msb;
+
+	if (index < SUB_COUNT)
+		return index;
+
+	msb = index / SUB_COUNT + SUB_BITS - 1;
+
+	return (uint64_t) (SUB_COUNT + index % SUB_COUNT) <<
+							(msb - SUB_BITS);
+}
+
+struct histogram *histogram_new(void)
+{
+	struct histogram *hist;
+
+	hist = new0(struct histogram, 1);
+
+	return hist;
+}
+
+void histogram_free(struct histogram *hist)
+{
+	free(hist);
+}
+
+void histogram_reset(struct histogram *hist)
+{
+	memset(hist, 0, sizeof(*hist));
+}
+
+void histogram_add(struct histogram *hist, uint64_t value)
+{
+	if (value > MAX_VALUE)
+		value = MAX_VALUE;
+
+	if (!hist->count || value < hist->min)
+		hist->min = value;
+
+	if (value > hist->max)
+		hist->max = value;
+
+	hist->count++;
+	hist->sum += value;
+	hist->buckets[bucket_index(value)]++;
+}
+
+uint64_t histogram_count(const struct histogram *hist)
+{
+	return hist->count;
+}
+
+uint64_t histogram_percentile(const struct histogram *hist, double percentile)
+{
+	uint64_t target, total = 0;
+	unsigned int i;
+
+	if (!hist->count)
+		return 0;
+
+	target = hist->count * percentile / 100.0 + 0.5;
+	if (!target)
+		target = 1;
+
+	for (i = 0; i < NUM_BUCKETS; i++) {
+		total += hist->buckets[i];
+		if (total >= target)
+			break;
+	}
+
+	/* Report the upper end of the bucket, never beyond the maximum */
+	if (i + 1 < NUM_BUCKETS && bucket_value(i + 1) - 1 < hist->max)
+		return bucket_value(i + 1) - 1;
+
+	return hist->max;
+}
+
+void histogram_print(const struct histogram *hist, const char *label,
+							const char *unit)
+{
+	uint64_t counts[33], peak = 0;
+	unsigned int i, first = 33, last = 0;
+
+	if (!hist->count)
+		return;
+
+	print_field("%s: %" PRIu64 " samples, avg %" PRIu64 " %s",
+				label, hist->count, hist->sum / hist->count,
+				unit);
+	print_field("  min %" PRIu64 " p50 %" PRIu64 " p90 %" PRIu64
+			" p99 %" PRIu64 " p99.9 %" PRIu64 " max %" PRIu64,
+			hist->min, histogram_percentile(hist, 50),
+			histogram_percentile(hist, 90),
+			histogram_percentile(hist, 99),
+			histogram_percentile(hist, 99.9), hist->max);
+
+	/* Display power of two ranges only to keep the output short */
+	memset(counts, 0, sizeof(counts));
+
+	for (i = 0; i < NUM_BUCKETS; i++) {
+		unsigned int range;
+		uint64_t value = bucket_value(i);
+
+		if (!hist->buckets[i])
+			continue;
+
+		range = value ? 64 - __builtin_clzll(value) : 0;
+		counts[range] += hist->buckets[i];
+
+		if (range < first)
+			first = range;
+
+		if (range > last)
+			last = range;
+	}
+
+	for (i = first; i <= last; i++) {
+		if (counts[i] > peak)
+			peak = counts[i];
+	}
+
+	for (i = first; i <= last; i++) {
+		uint64_t low = i ? 1ULL << (i - 1) : 0;
+		uint64_t high = 1ULL << i;
+		unsigned int width = counts[i] * BAR_WIDTH / peak;
+		char bar[BAR_WIDTH + 2];
+
+		bar[0] = ' ';
+		memset(bar + 1, '#', width);
+		bar[width ? width + 1 : 0] = '\0';
+
+		print_field("  %10" PRIu64 " - %-10" PRIu64 " %10" PRIu64 "%s",
+						low, high - 1, counts[i], bar);
+	}
+}
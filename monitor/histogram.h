@@ -0,0 +1,22 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#include <stdint.h>
+
+struct histogram;
+
+struct histogram *histogram_new(void);
+void histogram_free(struct histogram *hist);
+void histogram_reset(struct histogram *hist);
+
+void histogram_add(struct histogram *hist, uint64_t value);
+uint64_t histogram_count(const struct histogram *hist);
+uint64_t histogram_percentile(const struct histogram *hist, double percentile);
+
+void histogram_print(const struct histogram *hist, const char *label,
+							const char *unit);
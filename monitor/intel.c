@@ -806,16 +806,29 @@ static const struct vendor_ocf vendor_ocf_table[] = {
 	{ }
 };
 
+/* Vendor commands are looked up for every packet, index them by OCF */
+static const struct vendor_ocf *vendor_ocf_index[1024];
+static bool vendor_ocf_index_ready;
+
 const struct vendor_ocf *intel_vendor_ocf(uint16_t ocf)
 {
 	int i;
 
-	for (i = 0; vendor_ocf_table[i].str; i++) {
-		if (vendor_ocf_table[i].ocf == ocf)
-			return &vendor_ocf_table[i];
+	if (!vendor_ocf_index_ready) {
+		for (i = 0; vendor_ocf_table[i].str; i++) {
+			uint16_t n = vendor_ocf_table[i].ocf & 0x03ff;
+
+			if (!vendor_ocf_index[n])
+				vendor_ocf_index[n] = &vendor_ocf_table[i];
+		}
+
+		vendor_ocf_index_ready = true;
 	}
 
-	return NULL;
+	if (ocf > 0x03ff)
+		return NULL;
+
+	return vendor_ocf_index[ocf];
 }
 
 static void startup_evt(struct timeval *tv, uint16_t index,
@@ -1846,20 +1859,32 @@ static const struct vendor_evt *intel_vendor_prefix_evt(const void *data,
 	return NULL;
 }
 
+static const struct vendor_evt *vendor_evt_index[256];
+static bool vendor_evt_index_ready;
+
 const struct vendor_evt *intel_vendor_evt(const void *data, int *consumed_size)
 {
 	uint8_t evt = *((const uint8_t *) data);
 	int i;
 
+	if (!vendor_evt_index_ready) {
+		for (i = 0; vendor_evt_table[i].str; i++) {
+			uint8_t n = vendor_evt_table[i].evt;
+
+			if (!vendor_evt_index[n])
+				vendor_evt_index[n] = &vendor_evt_table[i];
+		}
+
+		vendor_evt_index_ready = true;
+	}
+
 	/*
 	 * Handle the vendor event without a vendor prefix.
 	 *   0xff <length> <evt> <data>
-	 * This loop checks whether the <evt> exists in the vendor_evt_table.
+	 * This checks whether the <evt> exists in the vendor_evt_table.
 	 */
-	for (i = 0; vendor_evt_table[i].str; i++) {
-		if (vendor_evt_table[i].evt == evt)
-			return &vendor_evt_table[i];
-	}
+	if (vendor_evt_index[evt])
+		return vendor_evt_index[evt];
 
 	/*
 	 * It is not a regular event. Check whether it is a vendor extended
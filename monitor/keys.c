@@ -17,14 +17,16 @@
 
 #include "src/shared/util.h"
 #include "src/shared/queue.h"
-#include "src/shared/crypto.h"
+#include "src/shared/rpa.h"
 
 #include "keys.h"
 
 static const uint8_t empty_key[16] = { 0x00, };
 static const uint8_t empty_addr[6] = { 0x00, };
 
-static struct bt_crypto *crypto;
+#define RPA_CACHE_SIZE 64
+
+static struct bt_rpa_resolver *resolver;
 
 struct irk_data {
 	uint8_t key[16];
@@ -36,14 +38,14 @@ static struct queue *irk_list;
 
 void keys_setup(void)
 {
-	crypto = bt_crypto_new();
-
 	irk_list = queue_new();
+	resolver = bt_rpa_resolver_new(RPA_CACHE_SIZE);
 }
 
 void keys_cleanup(void)
 {
-	bt_crypto_unref(crypto);
+	bt_rpa_resolver_free(resolver);
+	resolver = NULL;
 
 	queue_destroy(irk_list, free);
 }
@@ -55,14 +57,19 @@ void keys_update_identity_key(const uint8_t key[16])
 	irk = queue_peek_tail(irk_list);
 	if (irk && !memcmp(irk->key, empty_key, 16)) {
 		memcpy(irk->key, key, 16);
+		bt_rpa_resolver_add(resolver, irk->key, irk);
 		return;
 	}
 
 	irk = new0(struct irk_data, 1);
 	if (irk) {
 		memcpy(irk->key, key, 16);
-		if (!queue_push_tail(irk_list, irk))
+		if (!queue_push_tail(irk_list, irk)) {
 			free(irk);
+			return;
+		}
+
+		bt_rpa_resolver_add(resolver, irk->key, irk);
 	}
 }
 
@@ -86,31 +93,21 @@ void keys_update_identity_addr(const uint8_t addr[6], uint8_t addr_type)
 	}
 }
 
-static bool match_resolve_irk(const void *data, const void *match_data)
-{
-	const struct irk_data *irk = data;
-	const uint8_t *addr = match_data;
-	uint8_t local_hash[3];
-
-	bt_crypto_ah(crypto, irk->key, addr + 3, local_hash);
-
-	return !memcmp(addr, local_hash, 3);
-}
-
 bool keys_resolve_identity(const uint8_t addr[6], uint8_t ident[6],
 							uint8_t *ident_type)
 {
+	void *data;
 	struct irk_data *irk;
 
-	irk = queue_find(irk_list, match_resolve_irk, addr);
+	if (!bt_rpa_resolver_resolve(resolver, addr, &data))
+		return false;
 
-	if (irk) {
-		memcpy(ident, irk->addr, 6);
-		*ident_type = irk->addr_type;
-		return true;
-	}
+	irk = data;
+
+	memcpy(ident, irk->addr, 6);
+	*ident_type = irk->addr_type;
 
-	return false;
+	return true;
 }
 
 static bool match_key(const void *data, const void *match_data)
@@ -131,6 +128,7 @@ bool keys_add_identity(const uint8_t addr[6], uint8_t addr_type,
 		irk = new0(struct irk_data, 1);
 		memcpy(irk->key, key, 16);
 		queue_push_tail(irk_list, irk);
+		bt_rpa_resolver_add(resolver, irk->key, irk);
 	}
 
 	memcpy(irk->addr, addr, 6);
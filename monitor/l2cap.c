@@ -2520,6 +2520,9 @@ static void smp_packet(uint16_t index, bool in, uint16_t handle,
 				opcode_str, COLOR_OFF, " (0x%2.2x) len %d",
 				opcode, size - 1);
 
+	if (packet_get_depth(PACKET_LAYER_SMP) == PACKET_DEPTH_SUMMARY)
+		return;
+
 	if (!opcode_data || !opcode_data->func) {
 		packet_hexdump(data + 1, size - 1);
 		return;
@@ -2544,6 +2547,13 @@ static void smp_packet(uint16_t index, bool in, uint16_t handle,
 	opcode_data->func(&frame);
 }
 
+/* Payloads are decoded only when L2CAP and the protocol are both enabled */
+static bool decode_layer(enum packet_layer layer)
+{
+	return packet_get_depth(PACKET_LAYER_L2CAP) == PACKET_DEPTH_FULL &&
+			packet_get_depth(layer) != PACKET_DEPTH_NONE;
+}
+
 void l2cap_frame(uint16_t index, bool in, uint16_t handle, uint16_t cid,
 			uint16_t psm, const void *data, uint16_t size)
 {
@@ -2564,14 +2574,16 @@ void l2cap_frame(uint16_t index, bool in, uint16_t handle, uint16_t cid,
 		amp_packet(index, in, handle, cid, data, size);
 		break;
 	case 0x0004:
-		att_packet(index, in, handle, cid, data, size);
+		if (decode_layer(PACKET_LAYER_ATT))
+			att_packet(index, in, handle, cid, data, size);
 		break;
 	case 0x0005:
 		le_sig_packet(index, in, handle, cid, data, size);
 		break;
 	case 0x0006:
 	case 0x0007:
-		smp_packet(index, in, handle, cid, data, size);
+		if (decode_layer(PACKET_LAYER_SMP))
+			smp_packet(index, in, handle, cid, data, size);
 		break;
 	default:
 		l2cap_frame_init(&frame, index, in, handle, 0, cid, psm,
@@ -2640,29 +2652,41 @@ void l2cap_frame(uint16_t index, bool in, uint16_t handle, uint16_t cid,
 
 		switch (frame.psm) {
 		case 0x0001:
-			sdp_packet(&frame);
+			if (decode_layer(PACKET_LAYER_SDP))
+				sdp_packet(&frame);
 			break;
 		case 0x0003:
-			rfcomm_packet(&frame);
+			if (decode_layer(PACKET_LAYER_RFCOMM))
+				rfcomm_packet(&frame);
 			break;
 		case 0x000f:
-			bnep_packet(&frame);
+			if (decode_layer(PACKET_LAYER_BNEP))
+				bnep_packet(&frame);
 			break;
 		case 0x001f:
-			att_packet(index, in, handle, cid, data, size);
+			if (decode_layer(PACKET_LAYER_ATT))
+				att_packet(index, in, handle, cid, data, size);
 			break;
 		case 0x0027:
-			att_packet(index, in, handle, cid, data + 2, size - 2);
+			if (decode_layer(PACKET_LAYER_ATT))
+				att_packet(index, in, handle, cid, data + 2,
+								size - 2);
 			break;
 		case 0x0017:
 		case 0x001B:
-			avctp_packet(&frame);
+			if (decode_layer(PACKET_LAYER_AVCTP))
+				avctp_packet(&frame);
 			break;
 		case 0x0019:
-			avdtp_packet(&frame);
+			/* Media packets are handled as the A2DP layer */
+			if (decode_layer(frame.seq_num == 1 ?
+						PACKET_LAYER_AVDTP :
+						PACKET_LAYER_A2DP))
+				avdtp_packet(&frame);
 			break;
 		default:
-			packet_hexdump(data, size);
+			if (decode_layer(PACKET_LAYER_L2CAP))
+				packet_hexdump(data, size);
 			break;
 		}
 		break;
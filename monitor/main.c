@@ -31,6 +31,8 @@
 #include "ellisys.h"
 #include "control.h"
 #include "display.h"
+#include "filter.h"
+#include "att.h"
 
 static void signal_callback(int signum, void *user_data)
 {
@@ -39,6 +41,9 @@ static void signal_callback(int signum, void *user_data)
 	case SIGTERM:
 		mainloop_quit();
 		break;
+	case SIGUSR1:
+		packet_print_histograms(NULL);
+		break;
 	}
 }
 
@@ -50,10 +55,21 @@ static void usage(void)
 	printf("options:\n"
 		"\t-r, --read <file>      Read traces in btsnoop format\n"
 		"\t-w, --write <file>     Save traces in btsnoop format\n"
+		"\t-z, --compress         Compress saved traces\n"
 		"\t-a, --analyze <file>   Analyze traces in btsnoop format\n"
 		"\t                       If gnuplot is installed on the\n"
                 "\t                       system it will also attempt to plot\n"
 		"\t                       packet latency graph.\n"
+		"\t-j, --jobs <num>       Analyze connections in parallel\n"
+		"\t-b, --bench <file>     Measure decoding speed of traces\n"
+		"\t-m, --metrics <secs>   Print JSON metrics every interval\n"
+		"\t    --histogram <secs> Print histograms every interval\n"
+		"\t    --from <seconds>   Show only traces after time offset\n"
+		"\t    --to <seconds>     Show only traces before time offset\n"
+		"\t    --handle <handle>  Show only traces of a connection\n"
+		"\t-f, --filter <expr>    Show only traces matching filter\n"
+		"\t    --depth <list>     Set decode depth of protocol layers\n"
+		"\t    --gatt-cache <dir> Load and save GATT databases in dir\n"
 		"\t-s, --server <socket>  Start monitor server socket\n"
 		"\t-p, --priority <level> Show only priority or lower\n"
 		"\t-i, --index <num>      Show only specified controller\n"
@@ -80,7 +96,18 @@ static void usage(void)
 static const struct option main_options[] = {
 	{ "read",      required_argument, NULL, 'r' },
 	{ "write",     required_argument, NULL, 'w' },
+	{ "compress",  no_argument,       NULL, 'z' },
 	{ "analyze",   required_argument, NULL, 'a' },
+	{ "jobs",      required_argument, NULL, 'j' },
+	{ "bench",     required_argument, NULL, 'b' },
+	{ "metrics",   required_argument, NULL, 'm' },
+	{ "histogram", required_argument, NULL, 'G' },
+	{ "from",      required_argument, NULL, 'F' },
+	{ "to",        required_argument, NULL, 'U' },
+	{ "handle",    required_argument, NULL, 'H' },
+	{ "filter",    required_argument, NULL, 'f' },
+	{ "depth",     required_argument, NULL, 'D' },
+	{ "gatt-cache", required_argument, NULL, 'K' },
 	{ "server",    required_argument, NULL, 's' },
 	{ "priority",  required_argument, NULL, 'p' },
 	{ "index",     required_argument, NULL, 'i' },
@@ -112,7 +139,16 @@ int main(int argc, char *argv[])
 	bool use_pager = true;
 	const char *reader_path = NULL;
 	const char *writer_path = NULL;
+	bool writer_compress = false;
+	const char *filter_expr = NULL;
+	const char *gatt_cache = NULL;
 	const char *analyze_path = NULL;
+	unsigned int analyze_jobs = 1;
+	unsigned int metrics_interval = 0;
+	unsigned int histogram_interval = 0;
+	const char *bench_path = NULL;
+	double reader_from = -1, reader_to = -1;
+	long reader_handle = -1;
 	const char *ellisys_server = NULL;
 	const char *tty = NULL;
 	unsigned int tty_speed = B115200;
@@ -120,6 +156,7 @@ int main(int argc, char *argv[])
 	const char *str;
 	char *jlink = NULL;
 	char *rtt = NULL;
+	sigset_t mask;
 	int exit_status;
 
 	mainloop_init();
@@ -131,7 +168,7 @@ int main(int argc, char *argv[])
 		struct sockaddr_un addr;
 
 		opt = getopt_long(argc, argv,
-				"r:w:a:s:p:i:d:B:V:MNtTSAIE:PJ:R:C:c:vh",
+				"r:w:za:j:b:m:f:s:p:i:d:B:V:MNtTSAIE:PJ:R:C:c:vh",
 				main_options, NULL);
 		if (opt < 0)
 			break;
@@ -143,9 +180,73 @@ int main(int argc, char *argv[])
 		case 'w':
 			writer_path = optarg;
 			break;
+		case 'z':
+			writer_compress = true;
+			break;
 		case 'a':
 			analyze_path = optarg;
 			break;
+		case 'j':
+			if (!isdigit(*optarg) || !atoi(optarg)) {
+				fprintf(stderr, "Invalid number of jobs: %s\n",
+									optarg);
+				return EXIT_FAILURE;
+			}
+			analyze_jobs = atoi(optarg);
+			break;
+		case 'b':
+			bench_path = optarg;
+			break;
+		case 'm':
+			if (!isdigit(*optarg) || !atoi(optarg)) {
+				fprintf(stderr, "Invalid metrics interval: %s\n",
+									optarg);
+				return EXIT_FAILURE;
+			}
+			metrics_interval = atoi(optarg);
+			break;
+		case 'G':
+			if (!isdigit(*optarg) || !atoi(optarg)) {
+				fprintf(stderr, "Invalid histogram interval: %s\n",
+									optarg);
+				return EXIT_FAILURE;
+			}
+			histogram_interval = atoi(optarg);
+			break;
+		case 'F':
+		case 'U':
+			str = optarg;
+			if (!isdigit(*str)) {
+				fprintf(stderr, "Invalid time offset: %s\n",
+									optarg);
+				return EXIT_FAILURE;
+			}
+			if (opt == 'F')
+				reader_from = strtod(str, NULL);
+			else
+				reader_to = strtod(str, NULL);
+			break;
+		case 'H':
+			reader_handle = strtol(optarg, NULL, 0);
+			if (reader_handle < 0 || reader_handle > 0x0eff) {
+				fprintf(stderr, "Invalid handle: %s\n",
+									optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'f':
+			filter_expr = optarg;
+			break;
+		case 'K':
+			gatt_cache = optarg;
+			break;
+		case 'D':
+			if (!packet_set_depth(optarg)) {
+				fprintf(stderr, "Invalid decode depth: %s\n",
+									optarg);
+				return EXIT_FAILURE;
+			}
+			break;
 		case 's':
 			if (strlen(optarg) > sizeof(addr.sun_path) - 1) {
 				fprintf(stderr, "Socket name too long\n");
@@ -259,14 +360,62 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
-	printf("Bluetooth monitor ver %s\n", VERSION);
+	if (bench_path && (reader_path || analyze_path)) {
+		fprintf(stderr, "Benchmark can't be combined with display "
+							"or analyze\n");
+		return EXIT_FAILURE;
+	}
+
+	if ((reader_from >= 0 || reader_to >= 0 || reader_handle >= 0) &&
+							!reader_path) {
+		fprintf(stderr, "Time range and handle require display\n");
+		return EXIT_FAILURE;
+	}
+
+	if (filter_expr && !filter_compile(filter_expr))
+		return EXIT_FAILURE;
+
+	if (writer_compress && !writer_path) {
+		fprintf(stderr, "Compression requires saving traces\n");
+		return EXIT_FAILURE;
+	}
+
+	if (metrics_interval && (analyze_path || bench_path)) {
+		fprintf(stderr, "Metrics can't be combined with analyze "
+							"or benchmark\n");
+		return EXIT_FAILURE;
+	}
+
+	if (histogram_interval && (metrics_interval || analyze_path ||
+								bench_path)) {
+		fprintf(stderr, "Histograms require decoding traces\n");
+		return EXIT_FAILURE;
+	}
+
+	/* Keep the metrics output valid JSON lines */
+	if (!metrics_interval)
+		printf("Bluetooth monitor ver %s\n", VERSION);
 
 	keys_setup();
 
+	if (gatt_cache)
+		att_cache_open(gatt_cache);
+
 	packet_set_filter(filter_mask);
+	packet_set_histogram_interval(histogram_interval);
+
+	if (metrics_interval) {
+		control_metrics(metrics_interval);
+		use_pager = false;
+	}
 
 	if (analyze_path) {
-		analyze_trace(analyze_path);
+		analyze_trace(analyze_path, analyze_jobs);
+		return EXIT_SUCCESS;
+	}
+
+	if (bench_path) {
+		control_bench(bench_path);
 		return EXIT_SUCCESS;
 	}
 
@@ -274,11 +423,22 @@ int main(int argc, char *argv[])
 		if (ellisys_server)
 			ellisys_enable(ellisys_server, ellisys_port);
 
+		control_reader_range(reader_from, reader_to);
+		if (reader_handle >= 0)
+			control_reader_handle(reader_handle);
+
 		control_reader(reader_path, use_pager);
+
+		if (histogram_interval)
+			packet_print_histograms(NULL);
+
+		packet_cleanup();
+		att_cache_close();
+
 		return EXIT_SUCCESS;
 	}
 
-	if (writer_path && !control_writer(writer_path)) {
+	if (writer_path && !control_writer(writer_path, writer_compress)) {
 		printf("Failed to open '%s'\n", writer_path);
 		return EXIT_FAILURE;
 	}
@@ -295,8 +455,19 @@ int main(int argc, char *argv[])
 	if (jlink && control_rtt(jlink, rtt) < 0)
 		return EXIT_FAILURE;
 
-	exit_status = mainloop_run_with_signal(signal_callback, NULL);
+	/* Histograms are printed on request as well */
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGUSR1);
+
+	exit_status = mainloop_run_with_signal_mask(&mask, signal_callback,
+									NULL);
+
+	if (histogram_interval)
+		packet_print_histograms(NULL);
 
+	control_cleanup();
+	packet_cleanup();
+	att_cache_close();
 	keys_cleanup();
 
 	return exit_status;
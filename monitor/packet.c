@@ -103,6 +103,9 @@ static time_t time_offset = ((time_t) -1);
 static int priority_level = BTSNOOP_PRIORITY_INFO;
 static unsigned long filter_mask = 0;
 static bool index_filter = false;
+static enum packet_depth layer_depth[PACKET_LAYER_MAX] = {
+	[0 ... PACKET_LAYER_MAX - 1] = PACKET_DEPTH_FULL
+};
 static uint16_t index_current = 0;
 static uint16_t fallback_manufacturer = UNKNOWN_MANUFACTURER;
 
@@ -202,6 +205,8 @@ static struct packet_conn_data *release_handle(uint16_t handle)
 
 			queue_destroy(conn->tx_q, free);
 			queue_destroy(conn->chan_q, free);
+			histogram_free(conn->tx_h);
+			histogram_free(conn->credits_h);
 			memset(conn, 0, sizeof(*conn));
 			conn->handle = 0xffff;
 			return conn;
@@ -309,6 +314,79 @@ void packet_set_priority(const char *priority)
 		priority_level = atoi(priority);
 }
 
+static const char *layer_str[PACKET_LAYER_MAX] = {
+	[PACKET_LAYER_L2CAP]	= "l2cap",
+	[PACKET_LAYER_ATT]	= "att",
+	[PACKET_LAYER_SMP]	= "smp",
+	[PACKET_LAYER_SDP]	= "sdp",
+	[PACKET_LAYER_RFCOMM]	= "rfcomm",
+	[PACKET_LAYER_BNEP]	= "bnep",
+	[PACKET_LAYER_AVCTP]	= "avctp",
+	[PACKET_LAYER_AVDTP]	= "avdtp",
+	[PACKET_LAYER_A2DP]	= "a2dp",
+	[PACKET_LAYER_ISO]	= "iso",
+};
+
+static const char *depth_str[] = {
+	[PACKET_DEPTH_NONE]	= "none",
+	[PACKET_DEPTH_SUMMARY]	= "summary",
+	[PACKET_DEPTH_FULL]	= "full",
+};
+
+static bool set_layer_depth(const char *str, size_t len)
+{
+	const char *sep = memchr(str, '=', len);
+	size_t name_len;
+	int layer, depth;
+
+	if (!sep)
+		return false;
+
+	name_len = sep - str;
+	len -= name_len + 1;
+
+	for (layer = 0; layer < PACKET_LAYER_MAX; layer++) {
+		if (strlen(layer_str[layer]) == name_len &&
+				!strncmp(str, layer_str[layer], name_len))
+			break;
+	}
+
+	for (depth = 0; depth < (int) ARRAY_SIZE(depth_str); depth++) {
+		if (strlen(depth_str[depth]) == len &&
+				!strncmp(sep + 1, depth_str[depth], len))
+			break;
+	}
+
+	if (layer == PACKET_LAYER_MAX || depth == ARRAY_SIZE(depth_str))
+		return false;
+
+	layer_depth[layer] = depth;
+
+	return true;
+}
+
+/* Parse a list like "att=summary,a2dp=none" */
+bool packet_set_depth(const char *depth)
+{
+	while (*depth) {
+		size_t len = strcspn(depth, ",");
+
+		if (!set_layer_depth(depth, len))
+			return false;
+
+		depth += len;
+		if (*depth == ',')
+			depth++;
+	}
+
+	return true;
+}
+
+enum packet_depth packet_get_depth(enum packet_layer layer)
+{
+	return layer_depth[layer];
+}
+
 void packet_select_index(uint16_t index)
 {
 	filter_mask &= ~PACKET_FILTER_SHOW_INDEX;
@@ -318,6 +396,11 @@ void packet_select_index(uint16_t index)
 	index_filter = true;
 }
 
+void packet_set_time_offset(time_t offset)
+{
+	time_offset = offset;
+}
+
 #define print_space(x) printf("%*c", (x), ' ');
 
 #define MAX_INDEX 16
@@ -330,6 +413,15 @@ struct index_data {
 	uint8_t  msft_evt_prefix[8];
 	uint8_t  msft_evt_len;
 	size_t   frame;
+	struct histogram *acl_h;
+	struct histogram *iso_h;
+	struct queue *cmd_q;
+};
+
+struct cmd_latency {
+	uint16_t opcode;
+	struct timeval tv;
+	struct histogram *hist;
 };
 
 static struct index_data index_list[MAX_INDEX];
@@ -4191,6 +4283,9 @@ static int addr2str(const uint8_t *addr, char *str)
 			addr[5], addr[4], addr[3], addr[2], addr[1], addr[0]);
 }
 
+static void histogram_tick(struct timeval *tv);
+static void histogram_release(struct index_data *idx);
+
 void packet_monitor(struct timeval *tv, struct ucred *cred,
 					uint16_t index, uint16_t opcode,
 					const void *data, uint16_t size)
@@ -4214,11 +4309,16 @@ void packet_monitor(struct timeval *tv, struct ucred *cred,
 	if (tv && time_offset == ((time_t) -1))
 		time_offset = tv->tv_sec;
 
+	if (tv)
+		histogram_tick(tv);
+
 	switch (opcode) {
 	case BTSNOOP_OPCODE_NEW_INDEX:
 		ni = data;
 
 		if (index < MAX_INDEX) {
+			/* A reused index belongs to a different controller */
+			histogram_release(&index_list[index]);
 			index_list[index].type = ni->type;
 			memcpy(index_list[index].bdaddr, ni->bdaddr, 6);
 			index_list[index].manufacturer = fallback_manufacturer;
@@ -9941,16 +10041,77 @@ static const struct opcode_data opcode_table[] = {
 	{ }
 };
 
-static const char *get_supported_command(int bit)
+/*
+ * Decoders are looked up for every command, Command Complete and Command
+ * Status, so opcode_table is indexed directly by OGF and OCF. The index
+ * is built from the table the first time it is needed.
+ */
+#define OPCODE_OGF_MAX		64
+#define OPCODE_BIT_MAX		512
+
+static const struct opcode_data **opcode_index[OPCODE_OGF_MAX];
+static uint16_t opcode_index_len[OPCODE_OGF_MAX];
+static const struct opcode_data *opcode_bit_index[OPCODE_BIT_MAX];
+static bool opcode_index_ready;
+
+static void opcode_index_setup(void)
 {
 	int i;
 
 	for (i = 0; opcode_table[i].str; i++) {
-		if (opcode_table[i].bit == bit)
-			return opcode_table[i].str;
+		uint16_t ogf = cmd_opcode_ogf(opcode_table[i].opcode);
+		uint16_t ocf = cmd_opcode_ocf(opcode_table[i].opcode);
+
+		if (ocf >= opcode_index_len[ogf])
+			opcode_index_len[ogf] = ocf + 1;
 	}
 
-	return NULL;
+	for (i = 0; i < OPCODE_OGF_MAX; i++) {
+		if (opcode_index_len[i])
+			opcode_index[i] = calloc(opcode_index_len[i],
+						sizeof(*opcode_index[i]));
+	}
+
+	/* Keep the first entry on duplicates, like a linear scan would */
+	for (i = 0; opcode_table[i].str; i++) {
+		const struct opcode_data *data = &opcode_table[i];
+		uint16_t ogf = cmd_opcode_ogf(data->opcode);
+		uint16_t ocf = cmd_opcode_ocf(data->opcode);
+
+		if (opcode_index[ogf] && !opcode_index[ogf][ocf])
+			opcode_index[ogf][ocf] = data;
+
+		if (data->bit >= 0 && data->bit < OPCODE_BIT_MAX &&
+						!opcode_bit_index[data->bit])
+			opcode_bit_index[data->bit] = data;
+	}
+
+	opcode_index_ready = true;
+}
+
+static const struct opcode_data *find_opcode(uint16_t opcode)
+{
+	uint16_t ogf = cmd_opcode_ogf(opcode);
+	uint16_t ocf = cmd_opcode_ocf(opcode);
+
+	if (!opcode_index_ready)
+		opcode_index_setup();
+
+	if (!opcode_index[ogf] || ocf >= opcode_index_len[ogf])
+		return NULL;
+
+	return opcode_index[ogf][ocf];
+}
+
+static const char *get_supported_command(int bit)
+{
+	if (!opcode_index_ready)
+		opcode_index_setup();
+
+	if (bit < 0 || bit >= OPCODE_BIT_MAX || !opcode_bit_index[bit])
+		return NULL;
+
+	return opcode_bit_index[bit]->str;
 }
 
 static const char *current_vendor_str(uint16_t ocf)
@@ -10209,6 +10370,234 @@ static void qos_setup_complete_evt(struct timeval *tv, uint16_t index,
 	print_field("Delay variation: %d", le32_to_cpu(evt->delay_variation));
 }
 
+static unsigned int histogram_interval;
+static struct timeval histogram_next;
+
+static uint64_t tv_usec(const struct timeval *tv)
+{
+	return (uint64_t) tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+static struct histogram *histogram_get(struct histogram **hist)
+{
+	if (!*hist)
+		*hist = histogram_new();
+
+	return *hist;
+}
+
+static bool match_cmd_latency(const void *data, const void *user_data)
+{
+	const struct cmd_latency *cmd = data;
+
+	return cmd->opcode == PTR_TO_UINT(user_data);
+}
+
+static void cmd_latency_free(void *data)
+{
+	struct cmd_latency *cmd = data;
+
+	histogram_free(cmd->hist);
+	free(cmd);
+}
+
+static void histogram_release(struct index_data *idx)
+{
+	queue_destroy(idx->cmd_q, cmd_latency_free);
+	idx->cmd_q = NULL;
+
+	histogram_free(idx->acl_h);
+	idx->acl_h = NULL;
+
+	histogram_free(idx->iso_h);
+	idx->iso_h = NULL;
+}
+
+static void histogram_cmd_sent(struct timeval *tv, uint16_t index,
+							uint16_t opcode)
+{
+	struct index_data *idx = &index_list[index];
+	struct cmd_latency *cmd;
+
+	if (!tv)
+		return;
+
+	if (!idx->cmd_q)
+		idx->cmd_q = queue_new();
+
+	cmd = queue_find(idx->cmd_q, match_cmd_latency, UINT_TO_PTR(opcode));
+	if (!cmd) {
+		cmd = new0(struct cmd_latency, 1);
+		cmd->opcode = opcode;
+		cmd->hist = histogram_new();
+		queue_push_tail(idx->cmd_q, cmd);
+	}
+
+	cmd->tv = *tv;
+}
+
+static void histogram_cmd_done(struct timeval *tv, uint16_t index,
+							uint16_t opcode)
+{
+	struct cmd_latency *cmd;
+	struct timeval delta;
+
+	if (!tv || index >= MAX_INDEX)
+		return;
+
+	cmd = queue_find(index_list[index].cmd_q, match_cmd_latency,
+							UINT_TO_PTR(opcode));
+	if (!cmd || !timerisset(&cmd->tv))
+		return;
+
+	timersub(tv, &cmd->tv, &delta);
+	timerclear(&cmd->tv);
+
+	if (delta.tv_sec < 0)
+		return;
+
+	histogram_add(cmd->hist, tv_usec(&delta));
+}
+
+/* Completion latency and packets in flight of ACL and ISO links */
+static void histogram_tx_enqueued(struct packet_conn_data *conn)
+{
+	if (conn->type != 0x01 && conn->type != 0x05)
+		return;
+
+	histogram_add(histogram_get(&conn->credits_h),
+					queue_length(conn->tx_q));
+}
+
+static void histogram_tx_completed(struct packet_conn_data *conn,
+						struct timeval *delta)
+{
+	struct index_data *idx;
+
+	if (conn->index >= MAX_INDEX || delta->tv_sec < 0)
+		return;
+
+	idx = &index_list[conn->index];
+
+	switch (conn->type) {
+	case 0x01:
+		histogram_add(histogram_get(&idx->acl_h), tv_usec(delta));
+		break;
+	case 0x05:
+		histogram_add(histogram_get(&idx->iso_h), tv_usec(delta));
+		break;
+	default:
+		return;
+	}
+
+	histogram_add(histogram_get(&conn->tx_h), tv_usec(delta));
+}
+
+static void print_cmd_latency(void *data, void *user_data)
+{
+	struct cmd_latency *cmd = data;
+	const struct opcode_data *opcode_data;
+	char label[96];
+
+	if (!histogram_count(cmd->hist))
+		return;
+
+	opcode_data = find_opcode(cmd->opcode);
+
+	snprintf(label, sizeof(label), "%s (0x%2.2x|0x%4.4x) round trip",
+			opcode_data ? opcode_data->str : "Unknown",
+			cmd_opcode_ogf(cmd->opcode),
+			cmd_opcode_ocf(cmd->opcode));
+
+	histogram_print(cmd->hist, label, "usec");
+}
+
+static void print_conn_histograms(struct packet_conn_data *conn)
+{
+	char label[64];
+
+	if (!conn->tx_h && !conn->credits_h)
+		return;
+
+	snprintf(label, sizeof(label), "Handle %d %s completion latency",
+				conn->handle, conn->type == 0x05 ? "ISO" : "ACL");
+
+	if (conn->tx_h)
+		histogram_print(conn->tx_h, label, "usec");
+
+	snprintf(label, sizeof(label), "Handle %d packets in flight",
+							conn->handle);
+
+	if (conn->credits_h)
+		histogram_print(conn->credits_h, label, "packets");
+}
+
+void packet_print_histograms(struct timeval *tv)
+{
+	uint16_t index;
+	int i;
+
+	for (index = 0; index < MAX_INDEX; index++) {
+		struct index_data *idx = &index_list[index];
+
+		if (!idx->acl_h && !idx->iso_h && queue_isempty(idx->cmd_q))
+			continue;
+
+		print_packet(tv, NULL, '=', index, NULL, COLOR_INFO,
+						"Histograms", NULL, NULL);
+
+		if (idx->acl_h)
+			histogram_print(idx->acl_h, "ACL completion latency",
+									"usec");
+
+		if (idx->iso_h)
+			histogram_print(idx->iso_h, "ISO completion latency",
+									"usec");
+
+		queue_foreach(idx->cmd_q, print_cmd_latency, NULL);
+
+		for (i = 0; i < MAX_CONN; i++) {
+			if (conn_list[i].handle != 0xffff &&
+						conn_list[i].index == index)
+				print_conn_histograms(&conn_list[i]);
+		}
+	}
+}
+
+void packet_cleanup(void)
+{
+	uint16_t index;
+
+	for (index = 0; index < MAX_INDEX; index++)
+		histogram_release(&index_list[index]);
+}
+
+void packet_set_histogram_interval(unsigned int interval)
+{
+	histogram_interval = interval;
+}
+
+/* Intervals follow the packet timestamps so traces read back match */
+static void histogram_tick(struct timeval *tv)
+{
+	if (!histogram_interval)
+		return;
+
+	if (!timerisset(&histogram_next)) {
+		histogram_next = *tv;
+		histogram_next.tv_sec += histogram_interval;
+		return;
+	}
+
+	if (timercmp(tv, &histogram_next, <))
+		return;
+
+	packet_print_histograms(&histogram_next);
+
+	while (!timercmp(tv, &histogram_next, <))
+		histogram_next.tv_sec += histogram_interval;
+}
+
 static void cmd_complete_evt(struct timeval *tv, uint16_t index,
 				const void *data, uint8_t size)
 {
@@ -10220,14 +10609,10 @@ static void cmd_complete_evt(struct timeval *tv, uint16_t index,
 	const struct opcode_data *opcode_data = NULL;
 	const char *opcode_color, *opcode_str;
 	char vendor_str[150];
-	int i;
 
-	for (i = 0; opcode_table[i].str; i++) {
-		if (opcode_table[i].opcode == opcode) {
-			opcode_data = &opcode_table[i];
-			break;
-		}
-	}
+	histogram_cmd_done(tv, index, opcode);
+
+	opcode_data = find_opcode(opcode);
 
 	if (opcode_data) {
 		if (opcode_data->rsp_func)
@@ -10316,14 +10701,10 @@ static void cmd_status_evt(struct timeval *tv, uint16_t index,
 	const struct opcode_data *opcode_data = NULL;
 	const char *opcode_color, *opcode_str;
 	char vendor_str[150];
-	int i;
 
-	for (i = 0; opcode_table[i].str; i++) {
-		if (opcode_table[i].opcode == opcode) {
-			opcode_data = &opcode_table[i];
-			break;
-		}
-	}
+	histogram_cmd_done(tv, index, opcode);
+
+	opcode_data = find_opcode(opcode);
 
 	if (opcode_data) {
 		opcode_color = COLOR_HCI_COMMAND;
@@ -10433,6 +10814,7 @@ static void packet_dequeue_tx(struct timeval *tv, uint16_t handle)
 	timersub(tv, &frame->tv, &delta);
 
 	packet_latency_add(&conn->tx_l, &delta);
+	histogram_tx_completed(conn, &delta);
 
 	if (TV_MSEC(delta)) {
 		print_field("#%zu: len %zu (%lld Kb/s)", frame->num, frame->len,
@@ -11884,13 +12266,34 @@ static const struct subevent_data le_meta_event_table[] = {
 	{ }
 };
 
+static const struct subevent_data *le_meta_event_index[256];
+static bool le_meta_event_index_ready;
+
+static const struct subevent_data *find_le_meta_event(uint8_t subevent)
+{
+	int i;
+
+	if (!le_meta_event_index_ready) {
+		for (i = 0; le_meta_event_table[i].str; i++) {
+			const struct subevent_data *data;
+
+			data = &le_meta_event_table[i];
+			if (!le_meta_event_index[data->subevent])
+				le_meta_event_index[data->subevent] = data;
+		}
+
+		le_meta_event_index_ready = true;
+	}
+
+	return le_meta_event_index[subevent];
+}
+
 static void le_meta_event_evt(struct timeval *tv, uint16_t index,
 				const void *data, uint8_t size)
 {
 	uint8_t subevent = *((const uint8_t *) data);
 	struct subevent_data unknown;
 	const struct subevent_data *subevent_data = &unknown;
-	int i;
 
 	unknown.subevent = subevent;
 	unknown.str = "Unknown";
@@ -11898,12 +12301,8 @@ static void le_meta_event_evt(struct timeval *tv, uint16_t index,
 	unknown.size = 0;
 	unknown.fixed = true;
 
-	for (i = 0; le_meta_event_table[i].str; i++) {
-		if (le_meta_event_table[i].subevent == subevent) {
-			subevent_data = &le_meta_event_table[i];
-			break;
-		}
-	}
+	if (find_le_meta_event(subevent))
+		subevent_data = le_meta_event_index[subevent];
 
 	print_subevent(tv, index, subevent_data, data + 1, size - 1);
 }
@@ -12264,7 +12663,6 @@ void packet_hci_command(struct timeval *tv, struct ucred *cred, uint16_t index,
 	const struct opcode_data *opcode_data = NULL;
 	const char *opcode_color, *opcode_str;
 	char extra_str[25], vendor_str[150];
-	int i;
 
 	if (index >= MAX_INDEX) {
 		print_field("Invalid index (%d).", index);
@@ -12283,12 +12681,9 @@ void packet_hci_command(struct timeval *tv, struct ucred *cred, uint16_t index,
 	data += HCI_COMMAND_HDR_SIZE;
 	size -= HCI_COMMAND_HDR_SIZE;
 
-	for (i = 0; opcode_table[i].str; i++) {
-		if (opcode_table[i].opcode == opcode) {
-			opcode_data = &opcode_table[i];
-			break;
-		}
-	}
+	histogram_cmd_sent(tv, index, opcode);
+
+	opcode_data = find_opcode(opcode);
 
 	if (opcode_data) {
 		if (opcode_data->cmd_func)
@@ -12364,6 +12759,26 @@ void packet_hci_command(struct timeval *tv, struct ucred *cred, uint16_t index,
 	opcode_data->cmd_func(index, data, hdr->plen);
 }
 
+static const struct event_data *event_index[256];
+static bool event_index_ready;
+
+static const struct event_data *find_event(uint8_t event)
+{
+	int i;
+
+	if (!event_index_ready) {
+		for (i = 0; event_table[i].str; i++) {
+			if (!event_index[event_table[i].event])
+				event_index[event_table[i].event] =
+							&event_table[i];
+		}
+
+		event_index_ready = true;
+	}
+
+	return event_index[event];
+}
+
 void packet_hci_event(struct timeval *tv, struct ucred *cred, uint16_t index,
 					const void *data, uint16_t size)
 {
@@ -12371,7 +12786,6 @@ void packet_hci_event(struct timeval *tv, struct ucred *cred, uint16_t index,
 	const struct event_data *event_data = NULL;
 	const char *event_color, *event_str;
 	char extra_str[25];
-	int i;
 
 	if (index >= MAX_INDEX) {
 		print_field("Invalid index (%d).", index);
@@ -12392,12 +12806,7 @@ void packet_hci_event(struct timeval *tv, struct ucred *cred, uint16_t index,
 	data += HCI_EVENT_HDR_SIZE;
 	size -= HCI_EVENT_HDR_SIZE;
 
-	for (i = 0; event_table[i].str; i++) {
-		if (event_table[i].event == hdr->evt) {
-			event_data = &event_table[i];
-			break;
-		}
-	}
+	event_data = find_event(hdr->evt);
 
 	if (event_data) {
 		if (event_data->func)
@@ -12463,6 +12872,8 @@ static void packet_enqueue_tx(struct timeval *tv, uint16_t handle,
 	frame->num = num;
 	frame->len = len;
 	queue_push_tail(conn->tx_q, frame);
+
+	histogram_tx_enqueued(conn);
 }
 
 void packet_hci_acldata(struct timeval *tv, struct ucred *cred, uint16_t index,
@@ -12516,6 +12927,9 @@ void packet_hci_acldata(struct timeval *tv, struct ucred *cred, uint16_t index,
 	if (filter_mask & PACKET_FILTER_SHOW_ACL_DATA)
 		packet_hexdump(data, size);
 
+	if (layer_depth[PACKET_LAYER_L2CAP] == PACKET_DEPTH_NONE)
+		return;
+
 	l2cap_packet(index, in, acl_handle(handle), flags, data, size);
 }
 
@@ -12599,6 +13013,14 @@ void packet_hci_isodata(struct timeval *tv, struct ucred *cred, uint16_t index,
 	data += sizeof(*hdr);
 	size -= sizeof(*hdr);
 
+	/* Keep the flow control accounting without any formatting */
+	if (layer_depth[PACKET_LAYER_ISO] == PACKET_DEPTH_NONE) {
+		if (!in)
+			packet_enqueue_tx(tv, acl_handle(handle),
+					index_list[index].frame, hdr->dlen);
+		return;
+	}
+
 	sprintf(handle_str, "Handle %d", acl_handle(handle));
 	sprintf(extra_str, "flags 0x%2.2x dlen %d", flags, hdr->dlen);
 
@@ -12617,7 +13039,8 @@ void packet_hci_isodata(struct timeval *tv, struct ucred *cred, uint16_t index,
 		return;
 	}
 
-	if (filter_mask & PACKET_FILTER_SHOW_ISO_DATA)
+	if ((filter_mask & PACKET_FILTER_SHOW_ISO_DATA) &&
+			layer_depth[PACKET_LAYER_ISO] == PACKET_DEPTH_FULL)
 		packet_hexdump(data, size);
 }
 
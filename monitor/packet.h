@@ -14,6 +14,8 @@
 #include <sys/time.h>
 #include <sys/socket.h>
 
+#include "histogram.h"
+
 #define PACKET_FILTER_SHOW_INDEX	(1 << 0)
 #define PACKET_FILTER_SHOW_DATE		(1 << 1)
 #define PACKET_FILTER_SHOW_TIME		(1 << 2)
@@ -23,6 +25,26 @@
 #define PACKET_FILTER_SHOW_A2DP_STREAM	(1 << 6)
 #define PACKET_FILTER_SHOW_MGMT_SOCKET	(1 << 7)
 #define PACKET_FILTER_SHOW_ISO_DATA	(1 << 8)
+enum packet_layer {
+	PACKET_LAYER_L2CAP,
+	PACKET_LAYER_ATT,
+	PACKET_LAYER_SMP,
+	PACKET_LAYER_SDP,
+	PACKET_LAYER_RFCOMM,
+	PACKET_LAYER_BNEP,
+	PACKET_LAYER_AVCTP,
+	PACKET_LAYER_AVDTP,
+	PACKET_LAYER_A2DP,
+	PACKET_LAYER_ISO,
+	PACKET_LAYER_MAX
+};
+
+enum packet_depth {
+	PACKET_DEPTH_NONE,
+	PACKET_DEPTH_SUMMARY,
+	PACKET_DEPTH_FULL
+};
+
 #define TV_MSEC(_tv) (long long)((_tv).tv_sec * 1000 + (_tv).tv_usec / 1000)
 
 struct packet_latency {
@@ -49,6 +71,8 @@ struct packet_conn_data {
 	struct queue *tx_q;
 	struct queue *chan_q;
 	struct packet_latency tx_l;
+	struct histogram *tx_h;
+	struct histogram *credits_h;
 	void     *data;
 	void     (*destroy)(void *data);
 };
@@ -56,13 +80,20 @@ struct packet_conn_data {
 struct packet_conn_data *packet_get_conn_data(uint16_t handle);
 void packet_latency_add(struct packet_latency *latency, struct timeval *delta);
 
+void packet_set_histogram_interval(unsigned int interval);
+void packet_print_histograms(struct timeval *tv);
+void packet_cleanup(void);
+
 bool packet_has_filter(unsigned long filter);
 void packet_set_filter(unsigned long filter);
 void packet_add_filter(unsigned long filter);
 void packet_del_filter(unsigned long filter);
 
 void packet_set_priority(const char *priority);
+bool packet_set_depth(const char *depth);
+enum packet_depth packet_get_depth(enum packet_layer layer);
 void packet_select_index(uint16_t index);
+void packet_set_time_offset(time_t offset);
 void packet_set_fallback_manufacturer(uint16_t manufacturer);
 void packet_set_msft_evt_prefix(const uint8_t *prefix, uint8_t len);
 
@@ -490,6 +490,9 @@ void rfcomm_packet(const struct l2cap_frame *frame)
 	print_indent(6, frame_color, "RFCOMM: ", frame_str, COLOR_OFF,
 						" (0x%2.2x)", ctype);
 
+	if (packet_get_depth(PACKET_LAYER_RFCOMM) == PACKET_DEPTH_SUMMARY)
+		return;
+
 	rfcomm_frame.hdr = hdr;
 	print_rfcomm_hdr(&rfcomm_frame, indent);
 
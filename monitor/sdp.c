@@ -761,6 +761,9 @@ void sdp_packet(const struct l2cap_frame *frame)
 	print_indent(6, pdu_color, "SDP: ", pdu_str, COLOR_OFF,
 				" (0x%2.2x) tid %d len %d", pdu, tid, plen);
 
+	if (packet_get_depth(PACKET_LAYER_SDP) == PACKET_DEPTH_SUMMARY)
+		return;
+
 	tid_info = get_tid(tid, frame->chan);
 
 	if (!sdp_data || !sdp_data->func || !tid_info) {
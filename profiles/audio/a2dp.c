@@ -40,6 +40,7 @@
 #include "src/service.h"
 #include "src/log.h"
 #include "src/sdpd.h"
+#include "src/store.h"
 #include "src/textfile.h"
 #include "src/shared/queue.h"
 #include "src/shared/timeout.h"
@@ -839,7 +840,6 @@ static void store_remote_seps(struct a2dp_channel *chan)
 	GKeyFile *key_file;
 	GError *gerr = NULL;
 	char *data;
-	gsize length = 0;
 
 	ba2str(device_get_address(device), dst_addr);
 
@@ -847,8 +847,8 @@ static void store_remote_seps(struct a2dp_channel *chan)
 			btd_adapter_get_storage_dir(device_get_adapter(device)),
 			dst_addr);
 
-	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	key_file = btd_store_load(filename, &gerr);
+	if (gerr) {
 		error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 		g_clear_error(&gerr);
@@ -868,15 +868,9 @@ static void store_remote_seps(struct a2dp_channel *chan)
 		g_free(data);
 	}
 
-	data = g_key_file_to_data(key_file, &length, NULL);
-	if (!g_file_set_contents(filename, data, length, &gerr)) {
-		error("Unable set contents for %s: (%s)", filename,
-								gerr->message);
-		g_error_free(gerr);
-	}
+	btd_store_save(filename, key_file);
 
-	g_free(data);
-	g_key_file_free(key_file);
+	g_key_file_unref(key_file);
 }
 
 static void invalidate_remote_cache(struct a2dp_setup *setup,
@@ -1011,8 +1005,6 @@ static void store_last_used(struct a2dp_channel *chan, uint8_t lseid,
 	char filename[PATH_MAX];
 	char dst_addr[18];
 	char value[6];
-	char *data;
-	size_t len = 0;
 
 	ba2str(device_get_address(chan->device), dst_addr);
 
@@ -1020,8 +1012,8 @@ static void store_last_used(struct a2dp_channel *chan, uint8_t lseid,
 		btd_adapter_get_storage_dir(device_get_adapter(chan->device)),
 		dst_addr);
 
-	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	key_file = btd_store_load(filename, &gerr);
+	if (gerr) {
 		error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 		g_clear_error(&gerr);
@@ -1031,15 +1023,9 @@ static void store_last_used(struct a2dp_channel *chan, uint8_t lseid,
 
 	g_key_file_set_string(key_file, "Endpoints", "LastUsed", value);
 
-	data = g_key_file_to_data(key_file, &len, NULL);
-	if (!g_file_set_contents(filename, data, len, &gerr)) {
-		error("Unable set contents for %s: (%s)", filename,
-								gerr->message);
-		g_error_free(gerr);
-	}
+	btd_store_save(filename, key_file);
 
-	g_free(data);
-	g_key_file_free(key_file);
+	g_key_file_unref(key_file);
 }
 
 static void add_last_used(struct a2dp_channel *chan, struct a2dp_sep *lsep,
@@ -2287,8 +2273,8 @@ static void load_remote_seps(struct a2dp_channel *chan)
 			btd_adapter_get_storage_dir(device_get_adapter(device)),
 			dst_addr);
 
-	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	key_file = btd_store_load(filename, &gerr);
+	if (gerr) {
 		error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 		g_error_free(gerr);
@@ -2298,7 +2284,7 @@ static void load_remote_seps(struct a2dp_channel *chan)
 	load_remote_sep(chan, key_file, keys);
 
 	g_strfreev(keys);
-	g_key_file_free(key_file);
+	g_key_file_unref(key_file);
 }
 
 static void avdtp_state_cb(struct btd_device *dev, struct avdtp *session,
@@ -24,6 +24,7 @@
 #include <sys/file.h>
 #include <sys/stat.h>
 #include <dirent.h>
+#include <time.h>
 
 #include <glib.h>
 #include <dbus/dbus.h>
@@ -59,6 +60,7 @@
 #include "uuid-helper.h"
 #include "agent.h"
 #include "storage.h"
+#include "store.h"
 #include "attrib/gattrib.h"
 #include "attrib/att.h"
 #include "attrib/gatt.h"
@@ -66,6 +68,7 @@
 #include "advertising.h"
 #include "adv_monitor.h"
 #include "eir.h"
+#include "device-index.h"
 #include "battery.h"
 
 #define MODE_OFF		0x00
@@ -77,6 +80,7 @@
 #define IDLE_DISCOV_TIMEOUT (5)
 #define TEMP_DEV_TIMEOUT (3 * 60)
 #define BONDING_TIMEOUT (2 * 60)
+#define STORED_DEVICES_BATCH (16)
 
 #define SCAN_TYPE_BREDR (1 << BDADDR_BREDR)
 #define SCAN_TYPE_LE ((1 << BDADDR_LE_PUBLIC) | (1 << BDADDR_LE_RANDOM))
@@ -318,7 +322,14 @@ struct btd_adapter {
 	bool pincode_requested;		/* PIN requested during last bonding */
 	GSList *connections;		/* Connected devices */
 	GSList *devices;		/* Devices structure pointers */
+	struct device_index *device_index;	/* by address and path */
 	GSList *load_keys;		/* Devices keys to be loaded */
+	GHashTable *stored_devices;	/* bdaddr -> bonded device not yet
+					 * created
+					 */
+	guint stored_devices_id;	/* Idle creation of stored devices */
+	unsigned int load_keys_pending;	/* Key loading commands pending */
+	struct timespec start_time;	/* Cleared once keys are loaded */
 	GSList *connect_list;		/* Devices to connect when found */
 	struct btd_device *connect_le;	/* LE device waiting to be connected */
 	sdp_list_t *services;		/* Services associated to adapter */
@@ -607,6 +618,35 @@ static void trigger_passive_scanning(struct btd_adapter *adapter);
 static bool set_mode(struct btd_adapter *adapter, uint16_t opcode,
 							uint8_t mode);
 
+/*
+ * Startup metric: time from adapter creation until it is powered and the
+ * stored keys have been accepted by the kernel, which is the point where
+ * bonded devices can reconnect.
+ */
+static void check_keys_loaded(struct btd_adapter *adapter)
+{
+	struct timespec now;
+	long msec;
+
+	if (!adapter->start_time.tv_sec && !adapter->start_time.tv_nsec)
+		return;
+
+	if (!adapter->initialized || adapter->load_keys_pending)
+		return;
+
+	if (!btd_adapter_get_powered(adapter))
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	msec = (now.tv_sec - adapter->start_time.tv_sec) * 1000L +
+		(now.tv_nsec - adapter->start_time.tv_nsec) / 1000000L;
+
+	btd_info(adapter->dev_id, "Powered with keys loaded in %ld ms", msec);
+
+	memset(&adapter->start_time, 0, sizeof(adapter->start_time));
+}
+
 static void settings_changed(struct btd_adapter *adapter, uint32_t settings)
 {
 	uint32_t changed_mask;
@@ -625,6 +665,7 @@ static void settings_changed(struct btd_adapter *adapter, uint32_t settings)
 
 		if (adapter->current_settings & MGMT_SETTING_POWERED) {
 			adapter_start(adapter);
+			check_keys_loaded(adapter);
 		} else {
 			adapter_stop(adapter);
 
@@ -1009,27 +1050,59 @@ int adapter_set_name(struct btd_adapter *adapter, const char *name)
 	return set_name(adapter, name);
 }
 
+static guint bdaddr_hash(gconstpointer key)
+{
+	const bdaddr_t *ba = key;
+
+	return (ba->b[0] | ba->b[1] << 8 | ba->b[2] << 16 |
+			(guint) ba->b[3] << 24) ^ (ba->b[4] | ba->b[5] << 8);
+}
+
+static gboolean bdaddr_equal(gconstpointer a, gconstpointer b)
+{
+	return !bacmp(a, b);
+}
+
+static void device_index_add_device(struct btd_adapter *adapter,
+						struct btd_device *device)
+{
+	device_index_add(adapter->device_index, device,
+					device_get_path(device),
+					device_get_address(device),
+					device_get_conn_address(device));
+}
+
+void adapter_update_device_index(struct btd_adapter *adapter,
+						struct btd_device *device)
+{
+	device_index_update(adapter->device_index, device,
+					device_get_address(device),
+					device_get_conn_address(device));
+}
+
+static void load_stored_address(struct btd_adapter *adapter,
+						const bdaddr_t *bdaddr);
+
 struct btd_device *btd_adapter_find_device(struct btd_adapter *adapter,
 							const bdaddr_t *dst,
 							uint8_t bdaddr_type)
 {
 	struct device_addr_type addr;
 	struct btd_device *device;
-	GSList *list;
 
 	if (!adapter)
 		return NULL;
 
+	load_stored_address(adapter, dst);
+
 	bacpy(&addr.bdaddr, dst);
 	addr.bdaddr_type = bdaddr_type;
 
-	list = g_slist_find_custom(adapter->devices, &addr,
+	device = device_index_find(adapter->device_index, dst, &addr,
 							device_addr_type_cmp);
-	if (!list)
+	if (!device)
 		return NULL;
 
-	device = list->data;
-
 	/*
 	 * If we're looking up based on public address and the address
 	 * was not previously used over this bearer we may need to
@@ -1043,28 +1116,13 @@ struct btd_device *btd_adapter_find_device(struct btd_adapter *adapter,
 	return device;
 }
 
-static int device_path_cmp(gconstpointer a, gconstpointer b)
-{
-	const struct btd_device *device = a;
-	const char *path = b;
-	const char *dev_path = device_get_path(device);
-
-	return strcasecmp(dev_path, path);
-}
-
 struct btd_device *btd_adapter_find_device_by_path(struct btd_adapter *adapter,
 						   const char *path)
 {
-	GSList *list;
-
-	if (!adapter)
+	if (!adapter || !path)
 		return NULL;
 
-	list = g_slist_find_custom(adapter->devices, path, device_path_cmp);
-	if (!list)
-		return NULL;
-
-	return list->data;
+	return device_index_find_by_path(adapter->device_index, path);
 }
 
 static void uuid_to_uuid128(uuid_t *uuid128, const uuid_t *uuid)
@@ -3591,15 +3649,13 @@ static DBusMessage *remove_device(DBusConnection *conn,
 						DBUS_TYPE_INVALID) == FALSE)
 		return btd_error_invalid_args(msg);
 
-	list = g_slist_find_custom(adapter->devices, path, device_path_cmp);
-	if (!list)
+	device = btd_adapter_find_device_by_path(adapter, path);
+	if (!device)
 		return btd_error_does_not_exist(msg);
 
 	if (!btd_adapter_get_powered(adapter))
 		return btd_error_not_ready(msg);
 
-	device = list->data;
-
 	btd_device_set_temporary(device, true);
 
 	if (!btd_device_is_connected(device)) {
@@ -4291,6 +4347,15 @@ static int set_privacy(struct btd_adapter *adapter, uint8_t privacy)
 	return -1;
 }
 
+static void load_keys_destroy(void *user_data)
+{
+	struct btd_adapter *adapter = user_data;
+
+	adapter->load_keys_pending--;
+
+	check_keys_loaded(adapter);
+}
+
 static void load_link_keys(struct btd_adapter *adapter, bool debug_keys,
 							bool retry);
 
@@ -4385,7 +4450,8 @@ static void load_link_keys(struct btd_adapter *adapter, bool debug_keys,
 
 	id = mgmt_send(adapter->mgmt, MGMT_OP_LOAD_LINK_KEYS,
 				adapter->dev_id, cp_size, cp,
-				load_link_keys_complete, adapter, NULL);
+				load_link_keys_complete, adapter,
+				load_keys_destroy);
 
 	g_free(cp);
 
@@ -4394,7 +4460,10 @@ static void load_link_keys(struct btd_adapter *adapter, bool debug_keys,
 							adapter->dev_id);
 		g_slist_free_full(adapter->load_keys, g_free);
 		adapter->load_keys = NULL;
+		return;
 	}
+
+	adapter->load_keys_pending++;
 }
 
 static void load_ltks_complete(uint8_t status, uint16_t length,
@@ -4411,11 +4480,21 @@ static void load_ltks_complete(uint8_t status, uint16_t length,
 	DBG("LTKs loaded for hci%u", adapter->dev_id);
 }
 
+/* Mark device as paired as their LTKs can be loaded. */
+static void device_ltk_loaded(struct btd_device *device,
+					const struct smp_ltk_info *info)
+{
+	device_set_paired(device, info->bdaddr_type);
+	device_set_bonded(device, info->bdaddr_type);
+	device_set_ltk(device, info->val, info->central, info->enc_size);
+}
+
 static void load_ltks(struct btd_adapter *adapter, GSList *keys)
 {
 	struct mgmt_cp_load_long_term_keys *cp;
 	struct mgmt_ltk_info *key;
 	size_t key_count, max_key_count, cp_size;
+	unsigned int id;
 	GSList *l;
 	uint16_t mtu;
 
@@ -4458,7 +4537,8 @@ static void load_ltks(struct btd_adapter *adapter, GSList *keys)
 	for (l = keys, key = cp->keys; l && key_count;
 			l = g_slist_next(l), key++, key_count--) {
 		struct smp_ltk_info *info = l->data;
-		struct btd_device *dev;
+		struct device_addr_type addr;
+		struct btd_device *device;
 
 		bacpy(&key->addr.bdaddr, &info->bdaddr);
 		key->addr.type = info->bdaddr_type;
@@ -4469,15 +4549,15 @@ static void load_ltks(struct btd_adapter *adapter, GSList *keys)
 		key->central = info->central;
 		key->enc_size = info->enc_size;
 
-		/* Mark device as paired as their LTKs can be loaded. */
-		dev = btd_adapter_find_device(adapter, &info->bdaddr,
-							info->bdaddr_type);
-		if (dev) {
-			device_set_paired(dev, info->bdaddr_type);
-			device_set_bonded(dev, info->bdaddr_type);
-			device_set_ltk(dev, info->val, info->central,
-						info->enc_size);
-		}
+		/* Only devices already loaded, do not load stored ones here */
+		bacpy(&addr.bdaddr, &info->bdaddr);
+		addr.bdaddr_type = info->bdaddr_type;
+
+		device = device_index_find(adapter->device_index,
+						&info->bdaddr, &addr,
+						device_addr_type_cmp);
+		if (device)
+			device_ltk_loaded(device, info);
 	}
 
 	/*
@@ -4485,13 +4565,19 @@ static void load_ltks(struct btd_adapter *adapter, GSList *keys)
 	 * and forgets to send a command complete response. However in
 	 * case of failures it does send a command status.
 	 */
-	if (!mgmt_send_timeout(adapter->mgmt, MGMT_OP_LOAD_LONG_TERM_KEYS,
+	id = mgmt_send_timeout(adapter->mgmt, MGMT_OP_LOAD_LONG_TERM_KEYS,
 			adapter->dev_id, cp_size, cp, load_ltks_complete,
-			adapter, NULL, 2))
+			adapter, load_keys_destroy, 2);
+
+	g_free(cp);
+
+	if (id == 0) {
 		btd_error(adapter->dev_id, "Failed to load LTKs for hci%u",
 							adapter->dev_id);
+		return;
+	}
 
-	g_free(cp);
+	adapter->load_keys_pending++;
 }
 
 static void load_irks_complete(uint8_t status, uint16_t length,
@@ -4560,13 +4646,18 @@ static void load_irks(struct btd_adapter *adapter, GSList *irks)
 	}
 
 	id = mgmt_send(adapter->mgmt, MGMT_OP_LOAD_IRKS, adapter->dev_id,
-			cp_size, cp, load_irks_complete, adapter, NULL);
+			cp_size, cp, load_irks_complete, adapter,
+			load_keys_destroy);
 
 	g_free(cp);
 
-	if (id == 0)
+	if (id == 0) {
 		btd_error(adapter->dev_id, "Failed to IRKs for hci%u",
 							adapter->dev_id);
+		return;
+	}
+
+	adapter->load_keys_pending++;
 }
 
 static void load_conn_params_complete(uint8_t status, uint16_t length,
@@ -4903,13 +4994,153 @@ done:
 	mgmt_tlv_list_free(list);
 }
 
+struct stored_device {
+	bdaddr_t bdaddr;
+	char address[18];
+};
+
+static void load_stored_device(struct btd_adapter *adapter,
+						const char *address)
+{
+	struct btd_device *device;
+	char filename[PATH_MAX];
+	GKeyFile *key_file;
+	struct link_key_info *key_info;
+	struct smp_ltk_info *ltk_info;
+	struct smp_ltk_info *peripheral_ltk_info;
+	struct irk_info *irk_info;
+	uint8_t bdaddr_type;
+	GError *gerr = NULL;
+
+	create_filename(filename, PATH_MAX, "/%s/%s/info",
+					btd_adapter_get_storage_dir(adapter),
+					address);
+
+	key_file = btd_store_load(filename, &gerr);
+	if (gerr) {
+		error("Unable to load key file from %s: (%s)", filename,
+								gerr->message);
+		g_clear_error(&gerr);
+	}
+
+	device = device_create_from_storage(adapter, address, key_file);
+	if (!device)
+		goto done;
+
+	bdaddr_type = get_addr_type(key_file);
+
+	irk_info = get_irk_info(key_file, address, bdaddr_type);
+	if (irk_info)
+		device_set_rpa(device, true);
+
+	btd_device_set_temporary(device, false);
+	adapter_add_device(adapter, device);
+
+	key_info = get_key_info(key_file, address, bdaddr_type);
+	if (key_info) {
+		device_set_paired(device, BDADDR_BREDR);
+		device_set_bonded(device, BDADDR_BREDR);
+	}
+
+	/* The LTKs were loaded before the device existed */
+	if (adapter->supported_settings & MGMT_SETTING_LE) {
+		ltk_info = get_ltk_info(key_file, address, bdaddr_type);
+		if (ltk_info)
+			device_ltk_loaded(device, ltk_info);
+
+		peripheral_ltk_info = get_peripheral_ltk_info(key_file,
+							address, bdaddr_type);
+		if (peripheral_ltk_info)
+			device_ltk_loaded(device, peripheral_ltk_info);
+
+		g_free(ltk_info);
+		g_free(peripheral_ltk_info);
+	}
+
+	g_free(key_info);
+	g_free(irk_info);
+
+	probe_devices(device);
+
+done:
+	g_key_file_unref(key_file);
+}
+
+static void load_stored_address(struct btd_adapter *adapter,
+						const bdaddr_t *bdaddr)
+{
+	struct stored_device *stored;
+
+	if (!adapter->stored_devices)
+		return;
+
+	stored = g_hash_table_lookup(adapter->stored_devices, bdaddr);
+	if (!stored)
+		return;
+
+	g_hash_table_steal(adapter->stored_devices, bdaddr);
+
+	DBG("hci%u %s", adapter->dev_id, stored->address);
+
+	load_stored_device(adapter, stored->address);
+	g_free(stored);
+}
+
+static gboolean load_stored_devices(gpointer user_data)
+{
+	struct btd_adapter *adapter = user_data;
+	GHashTableIter iter;
+	gpointer value;
+	unsigned int count;
+
+	for (count = 0; count < STORED_DEVICES_BATCH; count++) {
+		struct stored_device *stored;
+
+		/*
+		 * Creating a device may look up and thereby create other
+		 * stored devices, so start over for every entry.
+		 */
+		g_hash_table_iter_init(&iter, adapter->stored_devices);
+		if (!g_hash_table_iter_next(&iter, NULL, &value))
+			break;
+
+		g_hash_table_iter_steal(&iter);
+
+		stored = value;
+		load_stored_device(adapter, stored->address);
+		g_free(stored);
+	}
+
+	btd_store_flush();
+
+	if (g_hash_table_size(adapter->stored_devices))
+		return TRUE;
+
+	DBG("hci%u stored devices loaded", adapter->dev_id);
+
+	adapter->stored_devices_id = 0;
+	g_hash_table_destroy(adapter->stored_devices);
+	adapter->stored_devices = NULL;
+
+	/* restore Service Changed CCC value for bonded devices */
+	btd_gatt_database_restore_svc_chng_ccc(adapter->database);
+
+	return FALSE;
+}
+
+/*
+ * Only the keys are loaded into the kernel here. The objects of bonded
+ * devices are created afterwards from idle batches, or right away when
+ * one of them is looked up, so that reconnections are not held back by
+ * the number of stored devices.
+ */
 static void load_devices(struct btd_adapter *adapter)
 {
 	char dirname[PATH_MAX];
 	GSList *ltks = NULL;
 	GSList *irks = NULL;
 	GSList *params = NULL;
-	GSList *added_devices = NULL;
+	GHashTable *stored;
 	GError *gerr = NULL;
 	DIR *dir;
 	struct dirent *entry;
@@ -4925,17 +5156,20 @@ static void load_devices(struct btd_adapter *adapter)
 		return;
 	}
 
+	stored = g_hash_table_new_full(bdaddr_hash, bdaddr_equal, NULL, g_free);
+
 	while ((entry = readdir(dir)) != NULL) {
+		struct stored_device *stored_device;
 		struct btd_device *device;
 		char filename[PATH_MAX];
 		GKeyFile *key_file;
 		struct link_key_info *key_info;
 		struct smp_ltk_info *ltk_info;
 		struct smp_ltk_info *peripheral_ltk_info;
-		GSList *list;
 		struct irk_info *irk_info;
 		struct conn_param *param;
 		uint8_t bdaddr_type;
+		bdaddr_t addr;
 
 		if (entry->d_type == DT_UNKNOWN)
 			entry->d_type = util_get_dt(dirname, entry->d_name);
@@ -4947,8 +5181,8 @@ static void load_devices(struct btd_adapter *adapter)
 					btd_adapter_get_storage_dir(adapter),
 					entry->d_name);
 
-		key_file = g_key_file_new();
-		if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+		key_file = btd_store_load(filename, &gerr);
+		if (gerr) {
 			error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 			g_clear_error(&gerr);
@@ -5012,36 +5246,30 @@ static void load_devices(struct btd_adapter *adapter)
 		if (param)
 			params = g_slist_append(params, param);
 
-		list = g_slist_find_custom(adapter->devices, entry->d_name,
-							device_address_cmp);
-		if (list) {
-			device = list->data;
-			goto device_exist;
-		}
+		str2ba(entry->d_name, &addr);
+		device = device_index_find(adapter->device_index, &addr,
+					entry->d_name, device_address_cmp);
+		if (device) {
+			if (key_info) {
+				device_set_paired(device, BDADDR_BREDR);
+				device_set_bonded(device, BDADDR_BREDR);
+			}
 
-		device = device_create_from_storage(adapter, entry->d_name,
-							key_file);
-		if (!device)
 			goto free;
-
-		if (irk_info)
-			device_set_rpa(device, true);
-
-		btd_device_set_temporary(device, false);
-		adapter_add_device(adapter, device);
-
-		/* TODO: register services from pre-loaded list of primaries */
-
-		added_devices = g_slist_append(added_devices, device);
-
-device_exist:
-		if (key_info) {
-			device_set_paired(device, BDADDR_BREDR);
-			device_set_bonded(device, BDADDR_BREDR);
 		}
 
+		stored_device = g_new0(struct stored_device, 1);
+		bacpy(&stored_device->bdaddr, &addr);
+		g_strlcpy(stored_device->address, entry->d_name,
+					sizeof(stored_device->address));
+		g_hash_table_replace(stored, &stored_device->bdaddr,
+							stored_device);
+
 free:
-		g_key_file_free(key_file);
+		g_key_file_unref(key_file);
+
+		/* Only keep the files of one device in memory at a time */
+		btd_store_flush();
 	}
 
 	closedir(dir);
@@ -5055,7 +5283,16 @@ free:
 	load_conn_params(adapter, params);
 	g_slist_free_full(params, g_free);
 
-	g_slist_free_full(added_devices, probe_devices);
+	if (!g_hash_table_size(stored)) {
+		g_hash_table_destroy(stored);
+		return;
+	}
+
+	DBG("hci%u %u stored devices", adapter->dev_id,
+						g_hash_table_size(stored));
+
+	adapter->stored_devices = stored;
+	adapter->stored_devices_id = g_idle_add(load_stored_devices, adapter);
 }
 
 int btd_adapter_block_address(struct btd_adapter *adapter,
@@ -5223,6 +5460,7 @@ static void adapter_add_device(struct btd_adapter *adapter,
 						struct btd_device *device)
 {
 	adapter->devices = g_slist_append(adapter->devices, device);
+	device_index_add_device(adapter, device);
 	device_added_drivers(adapter, device);
 }
 
@@ -5230,6 +5468,7 @@ static void adapter_remove_device(struct btd_adapter *adapter,
 						struct btd_device *device)
 {
 	adapter->devices = g_slist_remove(adapter->devices, device);
+	device_index_remove(adapter->device_index, device);
 	device_removed_drivers(adapter, device);
 }
 
@@ -5905,6 +6144,8 @@ static void adapter_free(gpointer user_data)
 	if (adapter->allowed_uuid_set)
 		g_hash_table_destroy(adapter->allowed_uuid_set);
 
+	device_index_free(adapter->device_index);
+
 	g_free(adapter);
 }
 
@@ -6904,6 +7145,7 @@ static struct btd_adapter *btd_adapter_new(uint16_t index)
 
 	adapter->dev_id = index;
 	adapter->mgmt = mgmt_ref(mgmt_primary);
+	clock_gettime(CLOCK_MONOTONIC, &adapter->start_time);
 	adapter->pincode_requested = false;
 	blocked = rfkill_get_blocked(index);
 	if (blocked > 0)
@@ -6938,6 +7180,7 @@ static struct btd_adapter *btd_adapter_new(uint16_t index)
 			adapter_power_state_str(adapter->power_state));
 
 	adapter->auths = g_queue_new();
+	adapter->device_index = device_index_new();
 	adapter->exps = queue_new();
 	adapter->exp_pending = queue_new();
 
@@ -6954,6 +7197,16 @@ static void adapter_remove(struct btd_adapter *adapter)
 	g_slist_free(adapter->connect_list);
 	adapter->connect_list = NULL;
 
+	if (adapter->stored_devices_id > 0) {
+		g_source_remove(adapter->stored_devices_id);
+		adapter->stored_devices_id = 0;
+	}
+
+	if (adapter->stored_devices) {
+		g_hash_table_destroy(adapter->stored_devices);
+		adapter->stored_devices = NULL;
+	}
+
 	for (l = adapter->devices; l; l = l->next) {
 		device_removed_drivers(adapter, l->data);
 		device_remove(l->data, FALSE);
@@ -6961,6 +7214,7 @@ static void adapter_remove(struct btd_adapter *adapter)
 
 	g_slist_free(adapter->devices);
 	adapter->devices = NULL;
+	device_index_clear(adapter->device_index);
 
 	g_slist_free(adapter->load_keys);
 	adapter->load_keys = NULL;
@@ -8564,23 +8818,20 @@ static void store_link_key(struct btd_adapter *adapter,
 	char filename[PATH_MAX];
 	GKeyFile *key_file;
 	GError *gerr = NULL;
-	gsize length = 0;
 	char key_str[33];
-	char *str;
 	int i;
 
 	ba2str(device_get_address(device), device_addr);
 
 	create_filename(filename, PATH_MAX, "/%s/%s/info",
 			btd_adapter_get_storage_dir(adapter), device_addr);
-	create_file(filename, 0600);
 
-	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	key_file = btd_store_load(filename, &gerr);
+	if (gerr) {
 		error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 		g_error_free(gerr);
-		g_key_file_free(key_file);
+		g_key_file_unref(key_file);
 		return;
 	}
 
@@ -8592,15 +8843,9 @@ static void store_link_key(struct btd_adapter *adapter,
 	g_key_file_set_integer(key_file, "LinkKey", "Type", type);
 	g_key_file_set_integer(key_file, "LinkKey", "PINLength", pin_length);
 
-	str = g_key_file_to_data(key_file, &length, NULL);
-	if (!g_file_set_contents(filename, str, length, &gerr)) {
-		error("Unable set contents for %s: (%s)", filename,
-								gerr->message);
-		g_error_free(gerr);
-	}
-	g_free(str);
+	btd_store_commit(filename, key_file);
 
-	g_key_file_free(key_file);
+	g_key_file_unref(key_file);
 }
 
 static void new_link_key_callback(uint16_t index, uint16_t length,
@@ -8660,16 +8905,14 @@ static void store_ltk_group(struct btd_adapter *adapter, const bdaddr_t *peer,
 	GKeyFile *key_file;
 	GError *gerr = NULL;
 	char key_str[33];
-	gsize length = 0;
-	char *str;
 	int i;
 
 	ba2str(peer, device_addr);
 
 	create_filename(filename, PATH_MAX, "/%s/%s/info",
 			btd_adapter_get_storage_dir(adapter), device_addr);
-	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	key_file = btd_store_load(filename, &gerr);
+	if (gerr) {
 		error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 		g_clear_error(&gerr);
@@ -8687,17 +8930,9 @@ static void store_ltk_group(struct btd_adapter *adapter, const bdaddr_t *peer,
 	g_key_file_set_integer(key_file, group, "EDiv", ediv);
 	g_key_file_set_uint64(key_file, group, "Rand", rand);
 
-	create_file(filename, 0600);
+	btd_store_commit(filename, key_file);
 
-	str = g_key_file_to_data(key_file, &length, NULL);
-	if (!g_file_set_contents(filename, str, length, &gerr)) {
-		error("Unable set contents for %s: (%s)", filename,
-								gerr->message);
-		g_error_free(gerr);
-	}
-	g_free(str);
-
-	g_key_file_free(key_file);
+	g_key_file_unref(key_file);
 }
 
 static void store_longtermkey(struct btd_adapter *adapter, const bdaddr_t *peer,
@@ -8829,23 +9064,20 @@ static void store_irk(struct btd_adapter *adapter, const bdaddr_t *peer,
 	char filename[PATH_MAX];
 	GKeyFile *key_file;
 	GError *gerr = NULL;
-	char *store_data;
 	char str[33];
-	size_t length = 0;
 	int i;
 
 	ba2str(peer, device_addr);
 
 	create_filename(filename, PATH_MAX, "/%s/%s/info",
 			btd_adapter_get_storage_dir(adapter), device_addr);
-	create_file(filename, 0600);
 
-	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	key_file = btd_store_load(filename, &gerr);
+	if (gerr) {
 		error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 		g_error_free(gerr);
-		g_key_file_free(key_file);
+		g_key_file_unref(key_file);
 		return;
 	}
 
@@ -8854,15 +9086,9 @@ static void store_irk(struct btd_adapter *adapter, const bdaddr_t *peer,
 
 	g_key_file_set_string(key_file, "IdentityResolvingKey", "Key", str);
 
-	store_data = g_key_file_to_data(key_file, &length, NULL);
-	if (!g_file_set_contents(filename, store_data, length, &gerr)) {
-		error("Unable set contents for %s: (%s)", filename,
-								gerr->message);
-		g_error_free(gerr);
-	}
-	g_free(store_data);
+	btd_store_commit(filename, key_file);
 
-	g_key_file_free(key_file);
+	g_key_file_unref(key_file);
 }
 
 static void new_irk_callback(uint16_t index, uint16_t length,
@@ -8928,8 +9154,6 @@ static void store_conn_param(struct btd_adapter *adapter, const bdaddr_t *peer,
 	char filename[PATH_MAX];
 	GKeyFile *key_file;
 	GError *gerr = NULL;
-	char *store_data;
-	size_t length = 0;
 
 	ba2str(peer, device_addr);
 
@@ -8937,8 +9161,8 @@ static void store_conn_param(struct btd_adapter *adapter, const bdaddr_t *peer,
 
 	create_filename(filename, PATH_MAX, "/%s/%s/info",
 			btd_adapter_get_storage_dir(adapter), device_addr);
-	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	key_file = btd_store_load(filename, &gerr);
+	if (gerr) {
 		error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 		g_clear_error(&gerr);
@@ -8953,17 +9177,9 @@ static void store_conn_param(struct btd_adapter *adapter, const bdaddr_t *peer,
 	g_key_file_set_integer(key_file, "ConnectionParameters",
 						"Timeout", timeout);
 
-	create_file(filename, 0600);
+	btd_store_save(filename, key_file);
 
-	store_data = g_key_file_to_data(key_file, &length, NULL);
-	if (!g_file_set_contents(filename, store_data, length, &gerr)) {
-		error("Unable set contents for %s: (%s)", filename,
-								gerr->message);
-		g_error_free(gerr);
-	}
-	g_free(store_data);
-
-	g_key_file_free(key_file);
+	g_key_file_unref(key_file);
 }
 
 static void new_conn_param(uint16_t index, uint16_t length,
@@ -9316,8 +9532,12 @@ load:
 	load_defaults(adapter);
 	load_devices(adapter);
 
-	/* restore Service Changed CCC value for bonded devices */
-	btd_gatt_database_restore_svc_chng_ccc(adapter->database);
+	/*
+	 * restore Service Changed CCC value for bonded devices, or once
+	 * all of them have been created
+	 */
+	if (!adapter->stored_devices)
+		btd_gatt_database_restore_svc_chng_ccc(adapter->database);
 
 	/* retrieve the active connections: address the scenario where
 	 * the are active connections before the daemon've started */
@@ -9326,6 +9546,8 @@ load:
 
 	adapter->initialized = TRUE;
 
+	check_keys_loaded(adapter);
+
 	if (btd_opts.did_source) {
 		/* DeviceID record is added by sdpd-server before any other
 		 * record is registered. */
@@ -9588,16 +9810,14 @@ static void remove_keys(struct btd_adapter *adapter,
 	char filename[PATH_MAX];
 	GKeyFile *key_file;
 	GError *gerr = NULL;
-	gsize length = 0;
-	char *str;
 
 	ba2str(device_get_address(device), device_addr);
 
 	create_filename(filename, PATH_MAX, "/%s/%s/info",
 			btd_adapter_get_storage_dir(adapter), device_addr);
 
-	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	key_file = btd_store_load(filename, &gerr);
+	if (gerr) {
 		error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 		g_clear_error(&gerr);
@@ -9612,15 +9832,9 @@ static void remove_keys(struct btd_adapter *adapter,
 		g_key_file_remove_group(key_file, "IdentityResolvingKey", NULL);
 	}
 
-	str = g_key_file_to_data(key_file, &length, NULL);
-	if (!g_file_set_contents(filename, str, length, &gerr)) {
-		error("Unable set contents for %s: (%s)", filename,
-								gerr->message);
-		g_error_free(gerr);
-	}
-	g_free(str);
+	btd_store_commit(filename, key_file);
 
-	g_key_file_free(key_file);
+	g_key_file_unref(key_file);
 }
 
 static void unpaired_callback(uint16_t index, uint16_t length,
@@ -134,6 +134,8 @@ struct btd_adapter_driver {
 
 void device_resolved_drivers(struct btd_adapter *adapter,
 						struct btd_device *device);
+void adapter_update_device_index(struct btd_adapter *adapter,
+						struct btd_device *device);
 typedef void (*service_auth_cb) (DBusError *derr, void *user_data);
 
 void adapter_add_profile(struct btd_adapter *adapter, gpointer p);
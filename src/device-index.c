@@ -0,0 +1,279 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <glib.h>
+
+#include "lib/bluetooth.h"
+
+#include "src/shared/util.h"
+#include "device-index.h"
+
+/*
+ * Devices are indexed by both their current address and the address used
+ * when the last connection was established, since a lookup by address and
+ * type may match against either of them. Each bucket holds the devices
+ * sharing that address and callers filter it with their own compare
+ * function (e.g. device_addr_type_cmp()), so lookups keep the exact same
+ * semantics as a full scan of the device list.
+ */
+struct device_index {
+	GHashTable *by_addr;	/* bdaddr -> GSList of devices */
+	GHashTable *by_path;	/* object path -> device */
+	GHashTable *keys;	/* device -> struct device_key */
+};
+
+struct device_key {
+	bdaddr_t bdaddr;
+	bdaddr_t conn_bdaddr;
+	char *path;
+};
+
+static guint bdaddr_hash(gconstpointer key)
+{
+	const bdaddr_t *ba = key;
+
+	return (ba->b[0] | ba->b[1] << 8 | ba->b[2] << 16 |
+			(guint) ba->b[3] << 24) ^ (ba->b[4] | ba->b[5] << 8);
+}
+
+static gboolean bdaddr_equal(gconstpointer a, gconstpointer b)
+{
+	return !bacmp(a, b);
+}
+
+static guint path_hash(gconstpointer key)
+{
+	const char *p = key;
+	guint h = 5381;
+
+	for (; *p; p++)
+		h = (h << 5) + h + g_ascii_tolower(*p);
+
+	return h;
+}
+
+static gboolean path_equal(gconstpointer a, gconstpointer b)
+{
+	return !g_ascii_strcasecmp(a, b);
+}
+
+static void device_key_free(gpointer data)
+{
+	struct device_key *key = data;
+
+	g_free(key->path);
+	g_free(key);
+}
+
+static void bucket_set(struct device_index *index, const bdaddr_t *bdaddr,
+							GSList *bucket)
+{
+	if (!bucket) {
+		g_hash_table_remove(index->by_addr, bdaddr);
+		return;
+	}
+
+	/* Buckets are not owned by the table as their head can change */
+	g_hash_table_replace(index->by_addr,
+				util_memdup(bdaddr, sizeof(*bdaddr)), bucket);
+}
+
+static void bucket_add(struct device_index *index, const bdaddr_t *bdaddr,
+							void *device)
+{
+	GSList *bucket;
+
+	bucket = g_hash_table_lookup(index->by_addr, bdaddr);
+	if (g_slist_find(bucket, device))
+		return;
+
+	bucket_set(index, bdaddr, g_slist_append(bucket, device));
+}
+
+static void bucket_remove(struct device_index *index, const bdaddr_t *bdaddr,
+							void *device)
+{
+	GSList *bucket;
+
+	bucket = g_hash_table_lookup(index->by_addr, bdaddr);
+	if (!bucket)
+		return;
+
+	bucket_set(index, bdaddr, g_slist_remove(bucket, device));
+}
+
+static void bucket_free(gpointer key, gpointer value, gpointer user_data)
+{
+	g_slist_free(value);
+}
+
+static void index_addresses(struct device_index *index, void *device,
+						struct device_key *key)
+{
+	bucket_add(index, &key->bdaddr, device);
+
+	if (bacmp(&key->conn_bdaddr, BDADDR_ANY) &&
+				bacmp(&key->conn_bdaddr, &key->bdaddr))
+		bucket_add(index, &key->conn_bdaddr, device);
+}
+
+static void unindex_addresses(struct device_index *index, void *device,
+						struct device_key *key)
+{
+	bucket_remove(index, &key->bdaddr, device);
+	bucket_remove(index, &key->conn_bdaddr, device);
+}
+
+struct device_index *device_index_new(void)
+{
+	struct device_index *index;
+
+	index = g_new0(struct device_index, 1);
+	index->by_addr = g_hash_table_new_full(bdaddr_hash, bdaddr_equal,
+								free, NULL);
+	index->by_path = g_hash_table_new(path_hash, path_equal);
+	index->keys = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+						NULL, device_key_free);
+
+	return index;
+}
+
+void device_index_clear(struct device_index *index)
+{
+	if (!index)
+		return;
+
+	g_hash_table_foreach(index->by_addr, bucket_free, NULL);
+	g_hash_table_remove_all(index->by_addr);
+	g_hash_table_remove_all(index->by_path);
+	g_hash_table_remove_all(index->keys);
+}
+
+void device_index_free(struct device_index *index)
+{
+	if (!index)
+		return;
+
+	device_index_clear(index);
+
+	g_hash_table_destroy(index->by_addr);
+	g_hash_table_destroy(index->by_path);
+	g_hash_table_destroy(index->keys);
+	g_free(index);
+}
+
+bool device_index_add(struct device_index *index, void *device,
+					const char *path, const bdaddr_t *bdaddr,
+					const bdaddr_t *conn_bdaddr)
+{
+	struct device_key *key;
+
+	if (!index || !device || !path || !bdaddr)
+		return false;
+
+	if (g_hash_table_lookup(index->keys, device))
+		return false;
+
+	key = g_new0(struct device_key, 1);
+	bacpy(&key->bdaddr, bdaddr);
+	bacpy(&key->conn_bdaddr, conn_bdaddr ? conn_bdaddr : BDADDR_ANY);
+	key->path = g_strdup(path);
+
+	g_hash_table_insert(index->keys, device, key);
+	g_hash_table_insert(index->by_path, key->path, device);
+
+	index_addresses(index, device, key);
+
+	return true;
+}
+
+void device_index_remove(struct device_index *index, void *device)
+{
+	struct device_key *key;
+
+	if (!index)
+		return;
+
+	key = g_hash_table_lookup(index->keys, device);
+	if (!key)
+		return;
+
+	unindex_addresses(index, device, key);
+
+	g_hash_table_remove(index->by_path, key->path);
+	g_hash_table_remove(index->keys, device);
+}
+
+bool device_index_update(struct device_index *index, void *device,
+					const bdaddr_t *bdaddr,
+					const bdaddr_t *conn_bdaddr)
+{
+	struct device_key *key;
+
+	if (!index || !bdaddr)
+		return false;
+
+	key = g_hash_table_lookup(index->keys, device);
+	if (!key)
+		return false;
+
+	unindex_addresses(index, device, key);
+
+	bacpy(&key->bdaddr, bdaddr);
+	bacpy(&key->conn_bdaddr, conn_bdaddr ? conn_bdaddr : BDADDR_ANY);
+
+	index_addresses(index, device, key);
+
+	return true;
+}
+
+GSList *device_index_lookup(struct device_index *index,
+					const bdaddr_t *bdaddr)
+{
+	if (!index || !bdaddr)
+		return NULL;
+
+	return g_hash_table_lookup(index->by_addr, bdaddr);
+}
+
+void *device_index_find(struct device_index *index, const bdaddr_t *bdaddr,
+				gconstpointer match_data, GCompareFunc func)
+{
+	GSList *list;
+
+	list = g_slist_find_custom(device_index_lookup(index, bdaddr),
+							match_data, func);
+	if (!list)
+		return NULL;
+
+	return list->data;
+}
+
+void *device_index_find_by_path(struct device_index *index,
+					const char *path)
+{
+	if (!index || !path)
+		return NULL;
+
+	return g_hash_table_lookup(index->by_path, path);
+}
+
+unsigned int device_index_count(struct device_index *index)
+{
+	if (!index)
+		return 0;
+
+	return g_hash_table_size(index->keys);
+}
@@ -0,0 +1,29 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+struct device_index;
+
+struct device_index *device_index_new(void);
+void device_index_free(struct device_index *index);
+void device_index_clear(struct device_index *index);
+
+bool device_index_add(struct device_index *index, void *device,
+					const char *path, const bdaddr_t *bdaddr,
+					const bdaddr_t *conn_bdaddr);
+void device_index_remove(struct device_index *index, void *device);
+bool device_index_update(struct device_index *index, void *device,
+					const bdaddr_t *bdaddr,
+					const bdaddr_t *conn_bdaddr);
+
+GSList *device_index_lookup(struct device_index *index,
+					const bdaddr_t *bdaddr);
+void *device_index_find(struct device_index *index, const bdaddr_t *bdaddr,
+				gconstpointer match_data, GCompareFunc func);
+void *device_index_find_by_path(struct device_index *index,
+					const char *path);
+unsigned int device_index_count(struct device_index *index);
@@ -39,6 +39,7 @@
 #include "src/shared/att.h"
 #include "src/shared/queue.h"
 #include "src/shared/gatt-db.h"
+#include "src/shared/gatt-cache.h"
 #include "src/shared/gatt-client.h"
 #include "src/shared/gatt-server.h"
 #include "src/shared/ad.h"
@@ -64,6 +65,7 @@
 #include "storage.h"
 #include "eir.h"
 #include "settings.h"
+#include "store.h"
 #include "set.h"
 
 #define DISCONNECT_TIMER	2
@@ -440,14 +442,13 @@ static gboolean store_device_info_cb(gpointer user_data)
 	create_filename(filename, PATH_MAX, "/%s/%s/info",
 				btd_adapter_get_storage_dir(device->adapter),
 				device_addr);
-	create_file(filename, 0600);
 
-	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	key_file = btd_store_load(filename, &gerr);
+	if (gerr) {
 		error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 		g_error_free(gerr);
-		g_key_file_free(key_file);
+		g_key_file_unref(key_file);
 		return FALSE;
 	}
 
@@ -531,16 +532,9 @@ static gboolean store_device_info_cb(gpointer user_data)
 		}
 	}
 
-	str = g_key_file_to_data(key_file, &length, NULL);
-	if (!g_file_set_contents(filename, str, length, &gerr)) {
-		error("Unable set contents for %s: (%s)", filename,
-								gerr->message);
-		g_error_free(gerr);
-	}
-
-	g_free(str);
+	btd_store_save(filename, key_file);
 
-	g_key_file_free(key_file);
+	g_key_file_unref(key_file);
 	g_free(uuids);
 
 	return FALSE;
@@ -580,10 +574,7 @@ void device_store_cached_name(struct btd_device *dev, const char *name)
 	char d_addr[18];
 	GKeyFile *key_file;
 	GError *gerr = NULL;
-	char *data;
-	char *data_old;
-	gsize length = 0;
-	gsize length_old = 0;
+	char *name_old;
 
 	if (device_address_is_private(dev)) {
 		DBG("Can't store name for private addressed device %s",
@@ -594,32 +585,24 @@ void device_store_cached_name(struct btd_device *dev, const char *name)
 	ba2str(&dev->bdaddr, d_addr);
 	create_filename(filename, PATH_MAX, "/%s/cache/%s",
 			btd_adapter_get_storage_dir(dev->adapter), d_addr);
-	create_file(filename, 0600);
 
-	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	key_file = btd_store_load(filename, &gerr);
+	if (gerr) {
 		error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 		g_clear_error(&gerr);
 	}
 
-	data_old = g_key_file_to_data(key_file, &length_old, NULL);
+	name_old = g_key_file_get_string(key_file, "General", "Name", NULL);
 
-	g_key_file_set_string(key_file, "General", "Name", name);
-
-	data = g_key_file_to_data(key_file, &length, NULL);
-
-	if ((length != length_old) || (memcmp(data, data_old, length))) {
-		if (!g_file_set_contents(filename, data, length, &gerr)) {
-			error("Unable set contents for %s: (%s)", filename,
-								gerr->message);
-			g_clear_error(&gerr);
-		}
+	if (g_strcmp0(name, name_old)) {
+		g_key_file_set_string(key_file, "General", "Name", name);
+		btd_store_save(filename, key_file);
 	}
-	g_free(data);
-	g_free(data_old);
 
-	g_key_file_free(key_file);
+	g_free(name_old);
+
+	g_key_file_unref(key_file);
 }
 
 static void device_store_cached_name_resolve(struct btd_device *dev)
@@ -628,10 +611,6 @@ static void device_store_cached_name_resolve(struct btd_device *dev)
 	char d_addr[18];
 	GKeyFile *key_file;
 	GError *gerr = NULL;
-	char *data;
-	char *data_old;
-	gsize length = 0;
-	gsize length_old = 0;
 	uint64_t failed_time;
 
 	if (device_address_is_private(dev)) {
@@ -643,10 +622,9 @@ static void device_store_cached_name_resolve(struct btd_device *dev)
 	ba2str(&dev->bdaddr, d_addr);
 	create_filename(filename, PATH_MAX, "/%s/cache/%s",
 			btd_adapter_get_storage_dir(dev->adapter), d_addr);
-	create_file(filename, 0600);
 
-	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	key_file = btd_store_load(filename, &gerr);
+	if (gerr) {
 		error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 		g_clear_error(&gerr);
@@ -654,25 +632,16 @@ static void device_store_cached_name_resolve(struct btd_device *dev)
 
 	failed_time = (uint64_t) dev->name_resolve_failed_time;
 
-	data_old = g_key_file_to_data(key_file, &length_old, NULL);
-
-	g_key_file_set_uint64(key_file, "NameResolving", "FailedTime",
+	if (!g_key_file_has_key(key_file, "NameResolving", "FailedTime",
+								NULL) ||
+			g_key_file_get_uint64(key_file, "NameResolving",
+					"FailedTime", NULL) != failed_time) {
+		g_key_file_set_uint64(key_file, "NameResolving", "FailedTime",
 								failed_time);
-
-	data = g_key_file_to_data(key_file, &length, NULL);
-
-	if ((length != length_old) || (memcmp(data, data_old, length))) {
-		if (!g_file_set_contents(filename, data, length, &gerr)) {
-			error("Unable set contents for %s: (%s)", filename,
-								gerr->message);
-			g_error_free(gerr);
-		}
+		btd_store_save(filename, key_file);
 	}
 
-	g_free(data);
-	g_free(data_old);
-
-	g_key_file_free(key_file);
+	g_key_file_unref(key_file);
 }
 
 static void browse_request_free(struct browse_req *req)
@@ -2707,10 +2676,7 @@ static void store_services(struct btd_device *device)
 	uuid_t uuid;
 	char *prim_uuid;
 	GKeyFile *key_file;
-	GError *gerr = NULL;
 	GSList *l;
-	char *data;
-	gsize length = 0;
 
 	if (device_address_is_private(device)) {
 		DBG("Can't store services for private addressed device %s",
@@ -2762,25 +2728,20 @@ static void store_services(struct btd_device *device)
 					primary->range.end);
 	}
 
-	data = g_key_file_to_data(key_file, &length, NULL);
-	if (length > 0) {
-		create_file(filename, 0600);
-		if (!g_file_set_contents(filename, data, length, &gerr)) {
-			error("Unable set contents for %s: (%s)", filename,
-								gerr->message);
-			g_error_free(gerr);
-		}
-	}
+	if (device->primaries)
+		btd_store_save(filename, key_file);
 
 	free(prim_uuid);
-	g_free(data);
-	g_key_file_free(key_file);
+	g_key_file_unref(key_file);
 }
 
 static void store_gatt_db(struct btd_device *device)
 {
 	char filename[PATH_MAX];
 	char dst_addr[18];
+	GKeyFile *key_file;
+	GError *gerr = NULL;
+	int err;
 
 	if (device_address_is_private(device)) {
 		DBG("Can't store GATT db for private addressed device %s",
@@ -2793,12 +2754,34 @@ static void store_gatt_db(struct btd_device *device)
 
 	ba2str(&device->bdaddr, dst_addr);
 
-	create_filename(filename, PATH_MAX, "/%s/cache/%s",
+	create_filename(filename, PATH_MAX, "/%s/cache/%s.gatt",
 				btd_adapter_get_storage_dir(device->adapter),
 				dst_addr);
 	create_file(filename, 0600);
 
-	btd_settings_gatt_db_store(device->db, filename);
+	err = gatt_cache_store(device->db, filename);
+	if (err < 0) {
+		error("Unable to store GATT cache to %s: %s (%d)", filename,
+							strerror(-err), -err);
+		return;
+	}
+
+	/* Drop attributes left over in the key file by older versions */
+	create_filename(filename, PATH_MAX, "/%s/cache/%s",
+				btd_adapter_get_storage_dir(device->adapter),
+				dst_addr);
+
+	key_file = btd_store_load(filename, &gerr);
+	if (gerr) {
+		g_clear_error(&gerr);
+		g_key_file_unref(key_file);
+		return;
+	}
+
+	if (g_key_file_remove_group(key_file, "Attributes", NULL))
+		btd_store_save(filename, key_file);
+
+	g_key_file_unref(key_file);
 }
 
 static void browse_request_complete(struct browse_req *req, uint8_t type,
@@ -3309,6 +3292,7 @@ void device_add_connection(struct btd_device *dev, uint8_t bdaddr_type,
 
 	bacpy(&dev->conn_bdaddr, &dev->bdaddr);
 	dev->conn_bdaddr_type = dev->bdaddr_type;
+	adapter_update_device_index(dev->adapter, dev);
 
 	/* If this is the first connection over this bearer */
 	if (bdaddr_type == BDADDR_BREDR)
@@ -3506,10 +3490,7 @@ static char *load_cached_name(struct btd_device *device, const char *local,
 
 	create_filename(filename, PATH_MAX, "/%s/cache/%s", local, peer);
 
-	key_file = g_key_file_new();
-
-	if (!g_key_file_load_from_file(key_file, filename, 0, NULL))
-		goto failed;
+	key_file = btd_store_load(filename, NULL);
 
 	str = g_key_file_get_string(key_file, "General", "Name", NULL);
 	if (str) {
@@ -3518,8 +3499,7 @@ static char *load_cached_name(struct btd_device *device, const char *local,
 			str[HCI_MAX_NAME_LENGTH] = '\0';
 	}
 
-failed:
-	g_key_file_free(key_file);
+	g_key_file_unref(key_file);
 
 	return str;
 }
@@ -3536,18 +3516,14 @@ static void load_cached_name_resolve(struct btd_device *device,
 
 	create_filename(filename, PATH_MAX, "/%s/cache/%s", local, peer);
 
-	key_file = g_key_file_new();
-
-	if (!g_key_file_load_from_file(key_file, filename, 0, NULL))
-		goto failed;
+	key_file = btd_store_load(filename, NULL);
 
 	failed_time = g_key_file_get_uint64(key_file, "NameResolving",
 							"FailedTime", NULL);
 
 	device->name_resolve_failed_time = failed_time;
 
-failed:
-	g_key_file_free(key_file);
+	g_key_file_unref(key_file);
 }
 
 static struct csrk_info *load_csrk(GKeyFile *key_file, const char *group)
@@ -3663,9 +3639,6 @@ static void convert_info(struct btd_device *device, GKeyFile *key_file)
 	char adapter_addr[18];
 	char device_addr[18];
 	char **uuids;
-	char *str;
-	gsize length = 0;
-	GError *gerr = NULL;
 
 	/* Load device profile list from legacy properties */
 	uuids = g_key_file_get_string_list(key_file, "General", "SDPServices",
@@ -3690,13 +3663,7 @@ static void convert_info(struct btd_device *device, GKeyFile *key_file)
 	create_filename(filename, PATH_MAX, "/%s/%s/info", adapter_addr,
 			device_addr);
 
-	str = g_key_file_to_data(key_file, &length, NULL);
-	if (!g_file_set_contents(filename, str, length, &gerr)) {
-		error("Unable set contents for %s: (%s)", filename,
-								gerr->message);
-		g_error_free(gerr);
-	}
-	g_free(str);
+	btd_store_save(filename, key_file);
 
 	store_device_info(device);
 }
@@ -3842,7 +3809,6 @@ static void load_att_info(struct btd_device *device, const char *local,
 				const char *peer)
 {
 	char filename[PATH_MAX];
-	struct stat st;
 	GKeyFile *key_file;
 	GError *gerr = NULL;
 	char *prim_uuid, *str;
@@ -3854,12 +3820,8 @@ static void load_att_info(struct btd_device *device, const char *local,
 
 	create_filename(filename, PATH_MAX, "/%s/%s/attributes", local, peer);
 
-	/* Check if attributes file exists */
-	if (stat(filename, &st) < 0)
-		return;
-
-	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	key_file = btd_store_load(filename, &gerr);
+	if (gerr) {
 		error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 		g_clear_error(&gerr);
@@ -3931,7 +3893,7 @@ static void load_att_info(struct btd_device *device, const char *local,
 	}
 
 	g_strfreev(groups);
-	g_key_file_free(key_file);
+	g_key_file_unref(key_file);
 	free(prim_uuid);
 }
 
@@ -3965,6 +3927,7 @@ static void load_gatt_db(struct btd_device *device, const char *local,
 							const char *peer)
 {
 	char filename[PATH_MAX];
+	GKeyFile *key_file;
 	int err;
 
 	if (!gatt_cache_is_enabled(device))
@@ -3972,9 +3935,23 @@ static void load_gatt_db(struct btd_device *device, const char *local,
 
 	DBG("Restoring %s gatt database from file", peer);
 
-	create_filename(filename, PATH_MAX, "/%s/cache/%s", local, peer);
+	create_filename(filename, PATH_MAX, "/%s/cache/%s.gatt", local, peer);
+
+	err = gatt_cache_load(device->db, filename);
+	if (err == -ENOENT || err == -ENOMSG) {
+		/* Fall back to the key file written by older versions */
+		create_filename(filename, PATH_MAX, "/%s/cache/%s", local,
+									peer);
+
+		key_file = btd_store_load(filename, NULL);
+		err = btd_settings_gatt_db_read(device->db, key_file);
+		g_key_file_unref(key_file);
+
+		/* Convert it so the key file is parsed only once */
+		if (!err)
+			store_gatt_db(device);
+	}
 
-	err = btd_settings_gatt_db_load(device->db, filename);
 	if (err < 0) {
 		if (err == -ENOENT)
 			return;
@@ -4513,6 +4490,7 @@ void device_update_addr(struct btd_device *device, const bdaddr_t *bdaddr,
 
 	bacpy(&device->bdaddr, bdaddr);
 	device->bdaddr_type = bdaddr_type;
+	adapter_update_device_index(device->adapter, device);
 
 	if (device->temporary)
 		btd_device_set_temporary(device, false);
@@ -4684,8 +4662,6 @@ static void device_remove_stored(struct btd_device *device)
 	char filename[PATH_MAX];
 	GKeyFile *key_file;
 	GError *gerr = NULL;
-	char *data;
-	gsize length = 0;
 
 	if (device->bredr_state.bonded)
 		device_remove_bonding(device, BDADDR_BREDR);
@@ -4704,33 +4680,33 @@ static void device_remove_stored(struct btd_device *device)
 	create_filename(filename, PATH_MAX, "/%s/%s",
 				btd_adapter_get_storage_dir(device->adapter),
 				device_addr);
+	btd_store_remove(filename);
 	delete_folder_tree(filename);
 
+	create_filename(filename, PATH_MAX, "/%s/cache/%s.gatt",
+				btd_adapter_get_storage_dir(device->adapter),
+				device_addr);
+	unlink(filename);
+
 	create_filename(filename, PATH_MAX, "/%s/cache/%s",
 				btd_adapter_get_storage_dir(device->adapter),
 				device_addr);
 
-	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	key_file = btd_store_load(filename, &gerr);
+	if (gerr) {
 		g_error_free(gerr);
-		g_key_file_free(key_file);
+		g_key_file_unref(key_file);
 		return;
 	}
-	g_key_file_remove_group(key_file, "ServiceRecords", NULL);
-	g_key_file_remove_group(key_file, "Attributes", NULL);
 
-	data = g_key_file_to_data(key_file, &length, NULL);
-	if (length > 0) {
-		create_file(filename, 0600);
-		if (!g_file_set_contents(filename, data, length, &gerr)) {
-			error("Unable set contents for %s: (%s)", filename,
-								gerr->message);
-			g_error_free(gerr);
-		}
+	if (g_key_file_has_group(key_file, "ServiceRecords") ||
+			g_key_file_has_group(key_file, "Attributes")) {
+		g_key_file_remove_group(key_file, "ServiceRecords", NULL);
+		g_key_file_remove_group(key_file, "Attributes", NULL);
+		btd_store_save(filename, key_file);
 	}
 
-	g_free(data);
-	g_key_file_free(key_file);
+	g_key_file_unref(key_file);
 }
 
 void device_remove(struct btd_device *device, gboolean remove_stored)
@@ -5122,34 +5098,29 @@ static void update_bredr_services(struct browse_req *req, sdp_list_t *recs)
 	GKeyFile *att_key_file;
 	GError *gerr = NULL;
 
-	char *data;
-	gsize length = 0;
-
 	ba2str(btd_adapter_get_address(device->adapter), srcaddr);
 	ba2str(&device->bdaddr, dstaddr);
 
 	create_filename(sdp_file, PATH_MAX, "/%s/cache/%s", srcaddr, dstaddr);
-	create_file(sdp_file, 0600);
 
-	sdp_key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(sdp_key_file, sdp_file, 0, &gerr)) {
+	sdp_key_file = btd_store_load(sdp_file, &gerr);
+	if (gerr) {
 		error("Unable to load key file from %s: (%s)", sdp_file,
 								gerr->message);
 		g_clear_error(&gerr);
-		g_key_file_free(sdp_key_file);
+		g_key_file_unref(sdp_key_file);
 		sdp_key_file = NULL;
 	}
 
 	create_filename(att_file, PATH_MAX, "/%s/%s/attributes", srcaddr,
 							dstaddr);
-	create_file(att_file, 0600);
 
-	att_key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(att_key_file, att_file, 0, &gerr)) {
+	att_key_file = btd_store_load(att_file, &gerr);
+	if (gerr) {
 		error("Unable to load key file from %s: (%s)", att_file,
 								gerr->message);
 		g_clear_error(&gerr);
-		g_key_file_free(att_key_file);
+		g_key_file_unref(att_key_file);
 		att_key_file = NULL;
 	}
 
@@ -5203,33 +5174,13 @@ next:
 	}
 
 	if (sdp_key_file) {
-		data = g_key_file_to_data(sdp_key_file, &length, NULL);
-		if (length > 0) {
-			if (!g_file_set_contents(sdp_file, data, length,
-								&gerr)) {
-				error("Unable set contents for %s: (%s)",
-						sdp_file, gerr->message);
-				g_clear_error(&gerr);
-			}
-		}
-
-		g_free(data);
-		g_key_file_free(sdp_key_file);
+		btd_store_save(sdp_file, sdp_key_file);
+		g_key_file_unref(sdp_key_file);
 	}
 
 	if (att_key_file) {
-		data = g_key_file_to_data(att_key_file, &length, NULL);
-		if (length > 0) {
-			if (!g_file_set_contents(att_file, data, length,
-								&gerr)) {
-				error("Unable set contents for %s: (%s)",
-						att_file, gerr->message);
-				g_clear_error(&gerr);
-			}
-		}
-
-		g_free(data);
-		g_key_file_free(att_key_file);
+		btd_store_save(att_file, att_key_file);
+		g_key_file_unref(att_key_file);
 	}
 }
 
@@ -6016,6 +5967,12 @@ const bdaddr_t *device_get_address(struct btd_device *device)
 {
 	return &device->bdaddr;
 }
+
+const bdaddr_t *device_get_conn_address(struct btd_device *device)
+{
+	return &device->conn_bdaddr;
+}
+
 uint8_t device_get_le_address_type(struct btd_device *device)
 {
 	return device->bdaddr_type;
@@ -6144,16 +6101,14 @@ void device_store_svc_chng_ccc(struct btd_device *device, uint8_t bdaddr_type,
 	GKeyFile *key_file;
 	GError *gerr = NULL;
 	uint16_t old_value;
-	gsize length = 0;
-	char *str;
 
 	ba2str(&device->bdaddr, device_addr);
 	create_filename(filename, PATH_MAX, "/%s/%s/info",
 				btd_adapter_get_storage_dir(device->adapter),
 				device_addr);
 
-	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	key_file = btd_store_load(filename, &gerr);
+	if (gerr) {
 		error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 		g_clear_error(&gerr);
@@ -6180,18 +6135,10 @@ void device_store_svc_chng_ccc(struct btd_device *device, uint8_t bdaddr_type,
 									value);
 	}
 
-	create_file(filename, 0600);
-
-	str = g_key_file_to_data(key_file, &length, NULL);
-	if (!g_file_set_contents(filename, str, length, &gerr)) {
-		error("Unable set contents for %s: (%s)", filename,
-								gerr->message);
-		g_error_free(gerr);
-	}
-	g_free(str);
+	btd_store_save(filename, key_file);
 
 done:
-	g_key_file_free(key_file);
+	g_key_file_unref(key_file);
 }
 void device_load_svc_chng_ccc(struct btd_device *device, uint16_t *ccc_le,
 							uint16_t *ccc_bredr)
@@ -6206,8 +6153,8 @@ void device_load_svc_chng_ccc(struct btd_device *device, uint16_t *ccc_le,
 				btd_adapter_get_storage_dir(device->adapter),
 				device_addr);
 
-	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	key_file = btd_store_load(filename, &gerr);
+	if (gerr) {
 		error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 		g_error_free(gerr);
@@ -6218,7 +6165,7 @@ void device_load_svc_chng_ccc(struct btd_device *device, uint16_t *ccc_le,
 			*ccc_le = 0x0000;
 		if (ccc_bredr)
 			*ccc_bredr = 0x0000;
-		g_key_file_free(key_file);
+		g_key_file_unref(key_file);
 		return;
 	}
 
@@ -6230,7 +6177,7 @@ void device_load_svc_chng_ccc(struct btd_device *device, uint16_t *ccc_le,
 		*ccc_bredr = g_key_file_get_integer(key_file, "ServiceChanged",
 							"CCC_BR/EDR", NULL);
 
-	g_key_file_free(key_file);
+	g_key_file_unref(key_file);
 }
 
 void device_set_rssi_with_delta(struct btd_device *device, int8_t rssi,
@@ -7059,8 +7006,8 @@ static sdp_list_t *read_device_records(struct btd_device *device)
 
 	create_filename(filename, PATH_MAX, "/%s/cache/%s", local, peer);
 
-	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
+	key_file = btd_store_load(filename, &gerr);
+	if (gerr) {
 		error("Unable to load key file from %s: (%s)", filename,
 								gerr->message);
 		g_error_free(gerr);
@@ -7079,7 +7026,7 @@ static sdp_list_t *read_device_records(struct btd_device *device)
 	}
 
 	g_strfreev(keys);
-	g_key_file_free(key_file);
+	g_key_file_unref(key_file);
 
 	return recs;
 }
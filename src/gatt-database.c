@@ -79,6 +79,8 @@ struct btd_gatt_database {
 	struct gatt_db_attribute *eatt;
 	struct queue *apps;
 	struct queue *profiles;
+	unsigned int nfy_sent;		/* Notifications sent */
+	unsigned int nfy_coalesced;	/* Sent as Multiple Notifications */
 };
 
 struct gatt_app {
@@ -170,6 +172,15 @@ struct notify {
 	uint16_t len;
 	bt_gatt_server_conf_func_t conf;
 	void *user_data;
+	struct queue *pdus;		/* Shared PDUs by value length */
+	unsigned int sent;
+	unsigned int coalesced;
+	unsigned int encoded;
+};
+
+struct notify_pdu {
+	uint16_t len;
+	struct bt_att_pdu *pdu;
 };
 
 #define CLI_FEAT_SIZE 1
@@ -1381,10 +1392,65 @@ static void state_set_pending(struct device_state *state, struct notify *notify)
 	/* Copy notify contents to pending */
 	state->pending = new0(struct notify, 1);
 	memcpy(state->pending, notify, sizeof(*notify));
+	state->pending->pdus = NULL;
 	state->pending->value = malloc(notify->len);
 	memcpy(state->pending->value, notify->value, notify->len);
 }
 
+static bool match_notify_pdu_len(const void *data, const void *match_data)
+{
+	const struct notify_pdu *np = data;
+
+	return np->len == PTR_TO_UINT(match_data);
+}
+
+static void notify_pdu_free(void *data)
+{
+	struct notify_pdu *np = data;
+
+	bt_att_pdu_unref(np->pdu);
+	free(np);
+}
+
+/*
+ * Subscribers whose MTU fits the same amount of the value get the very same
+ * encoded PDU, so it is only built once per MTU class.
+ */
+static bool send_shared_notification(struct bt_gatt_server *server,
+						struct notify *notify)
+{
+	struct bt_att *att = bt_gatt_server_get_att(server);
+	struct notify_pdu *np;
+	uint16_t len;
+
+	len = MIN(notify->len, bt_att_get_mtu(att) - 3);
+
+	np = queue_find(notify->pdus, match_notify_pdu_len, UINT_TO_PTR(len));
+	if (!np) {
+		struct iovec iov[2];
+		uint8_t hdr[2];
+
+		put_le16(notify->handle, hdr);
+		iov[0].iov_base = hdr;
+		iov[0].iov_len = sizeof(hdr);
+		iov[1].iov_base = notify->value;
+		iov[1].iov_len = len;
+
+		np = new0(struct notify_pdu, 1);
+		np->len = len;
+		np->pdu = bt_att_pdu_new(BT_ATT_OP_HANDLE_NFY, iov, 2);
+		if (!np->pdu) {
+			free(np);
+			return false;
+		}
+
+		queue_push_tail(notify->pdus, np);
+		notify->encoded++;
+	}
+
+	return !!bt_att_send_pdu(att, np->pdu, NULL, NULL, NULL);
+}
+
 static void send_notification_to_device(void *data, void *user_data)
 {
 	struct device_state *device_state = data;
@@ -1430,11 +1496,22 @@ static void send_notification_to_device(void *data, void *user_data)
 	 * notification/indication when it becomes connected.
 	 */
 	if (!(ccc->value & 0x0002)) {
+		bool multiple = device_state->cli_feat[0] &
+					BT_GATT_CHRC_CLI_FEAT_NFY_MULTI;
+
 		DBG("GATT server sending notification");
-		bt_gatt_server_send_notification(server,
-					notify->handle, notify->value,
-					notify->len, device_state->cli_feat[0] &
-					BT_GATT_CHRC_CLI_FEAT_NFY_MULTI);
+		if (!multiple && notify->pdus) {
+			if (!send_shared_notification(server, notify))
+				return;
+		} else if (!bt_gatt_server_send_notification(server,
+						notify->handle, notify->value,
+						notify->len, multiple))
+			return;
+
+		notify->sent++;
+		if (multiple)
+			notify->coalesced++;
+
 		return;
 	}
 
@@ -1454,6 +1531,30 @@ remove:
 	}
 }
 
+static void send_notification_to_all(struct btd_gatt_database *database,
+						struct notify *notify)
+{
+	notify->pdus = queue_new();
+
+	queue_foreach(database->device_states, send_notification_to_device,
+								notify);
+
+	queue_destroy(notify->pdus, notify_pdu_free);
+	notify->pdus = NULL;
+
+	if (!notify->sent)
+		return;
+
+	database->nfy_sent += notify->sent;
+	database->nfy_coalesced += notify->coalesced;
+
+	DBG("handle 0x%04x: %u subscribers notified, %u PDUs encoded, "
+			"%u coalesced (total %u sent, %u coalesced)",
+			notify->handle, notify->sent, notify->encoded,
+			notify->coalesced, database->nfy_sent,
+			database->nfy_coalesced);
+}
+
 static void gatt_notify_cb(struct gatt_db_attribute *attrib,
 					struct gatt_db_attribute *ccc,
 					const uint8_t *value, size_t len,
@@ -1483,8 +1584,7 @@ static void gatt_notify_cb(struct gatt_db_attribute *attrib,
 
 		send_notification_to_device(state, &notify);
 	} else
-		queue_foreach(database->device_states,
-				send_notification_to_device, &notify);
+		send_notification_to_all(database, &notify);
 }
 
 static void register_core_services(struct btd_gatt_database *database)
@@ -1515,8 +1615,7 @@ static void send_notification_to_devices(struct btd_gatt_database *database,
 	notify.conf = conf;
 	notify.user_data = user_data;
 
-	queue_foreach(database->device_states, send_notification_to_device,
-								&notify);
+	send_notification_to_all(database, &notify);
 }
 
 static void send_service_changed(struct btd_gatt_database *database,
@@ -3480,19 +3579,31 @@ fail:
 
 static bool database_add_app(struct gatt_app *app)
 {
+	struct gatt_db *db = app->database->db;
 	const struct queue_entry *entry;
+	unsigned int updates, saved;
+	bool ret = true;
+
+	/* Update the Database Hash once for all services of the app */
+	gatt_db_hash_hold(db);
 
 	entry = queue_get_entries(app->services);
 	while (entry) {
 		if (!database_add_service(entry->data)) {
 			error("Failed to add service");
-			return false;
+			ret = false;
+			break;
 		}
 
 		entry = entry->next;
 	}
 
-	return true;
+	gatt_db_hash_release(db);
+
+	if (gatt_db_get_hash_stats(db, &updates, &saved))
+		DBG("Database Hash updates %u (%u saved)", updates, saved);
+
+	return ret;
 }
 
 static int profile_device_probe(struct btd_service *service)
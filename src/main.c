@@ -53,6 +53,7 @@
 #include "dbus-common.h"
 #include "agent.h"
 #include "profile.h"
+#include "store.h"
 
 #define BLUEZ_NAME "org.bluez"
 
@@ -1473,6 +1474,8 @@ int main(int argc, char *argv[])
 
 	adapter_cleanup();
 
+	btd_store_cleanup();
+
 	rfkill_exit();
 
 	if (btd_opts.mode != BT_MODE_LE)
@@ -23,6 +23,7 @@
 #include "src/shared/queue.h"
 #include "src/shared/att.h"
 #include "src/shared/gatt-db.h"
+#include "src/shared/gatt-cache.h"
 #include "settings.h"
 
 #define GATT_PRIM_SVC_UUID_STR "2800"
@@ -292,13 +293,33 @@ static int gatt_db_load(struct gatt_db *db, GKeyFile *key_file, char **keys)
 	return 0;
 }
 
-int btd_settings_gatt_db_load(struct gatt_db *db, const char *filename)
+int btd_settings_gatt_db_read(struct gatt_db *db, GKeyFile *key_file)
 {
 	char **keys;
+	int err;
+
+	keys = g_key_file_get_keys(key_file, "Attributes", NULL, NULL);
+
+	if (!keys)
+		return -ENOENT;
+
+	err = gatt_db_load(db, key_file, keys);
+
+	g_strfreev(keys);
+
+	return err;
+}
+
+int btd_settings_gatt_db_load(struct gatt_db *db, const char *filename)
+{
 	GKeyFile *key_file;
 	GError *gerr = NULL;
 	int err;
 
+	err = gatt_cache_load(db, filename);
+	if (err != -ENOMSG)
+		return err;
+
 	key_file = g_key_file_new();
 	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
 		DBG("Unable to load key file from %s: (%s)", filename,
@@ -306,16 +327,8 @@ int btd_settings_gatt_db_load(struct gatt_db *db, const char *filename)
 		g_clear_error(&gerr);
 	}
 
-	keys = g_key_file_get_keys(key_file, "Attributes", NULL, NULL);
-
-	if (!keys) {
-		g_key_file_free(key_file);
-		return -ENOENT;
-	}
-
-	err = gatt_db_load(db, key_file, keys);
+	err = btd_settings_gatt_db_read(db, key_file);
 
-	g_strfreev(keys);
 	g_key_file_free(key_file);
 
 	return err;
@@ -477,13 +490,25 @@ static void store_service(struct gatt_db_attribute *attr, void *user_data)
 	gatt_db_service_foreach_char(attr, store_chrc, saver);
 }
 
+void btd_settings_gatt_db_write(struct gatt_db *db, GKeyFile *key_file)
+{
+	struct gatt_saver saver;
+
+	/* Remove current attributes since it might have changed */
+	g_key_file_remove_group(key_file, "Attributes", NULL);
+
+	saver.key_file = key_file;
+	saver.db = db;
+
+	gatt_db_foreach_service(db, NULL, store_service, &saver);
+}
+
 void btd_settings_gatt_db_store(struct gatt_db *db, const char *filename)
 {
 	GKeyFile *key_file;
 	GError *gerr = NULL;
 	char *data;
 	gsize length = 0;
-	struct gatt_saver saver;
 
 	key_file = g_key_file_new();
 	if (!g_key_file_load_from_file(key_file, filename, 0, &gerr)) {
@@ -492,13 +517,7 @@ void btd_settings_gatt_db_store(struct gatt_db *db, const char *filename)
 		g_clear_error(&gerr);
 	}
 
-	/* Remove current attributes since it might have changed */
-	g_key_file_remove_group(key_file, "Attributes", NULL);
-
-	saver.key_file = key_file;
-	saver.db = db;
-
-	gatt_db_foreach_service(db, NULL, store_service, &saver);
+	btd_settings_gatt_db_write(db, key_file);
 
 	data = g_key_file_to_data(key_file, &length, NULL);
 	if (!g_file_set_contents(filename, data, length, &gerr)) {
@@ -9,3 +9,5 @@
 
 int btd_settings_gatt_db_load(struct gatt_db *db, const char *filename);
 void btd_settings_gatt_db_store(struct gatt_db *db, const char *filename);
+int btd_settings_gatt_db_read(struct gatt_db *db, GKeyFile *key_file);
+void btd_settings_gatt_db_write(struct gatt_db *db, GKeyFile *key_file);
@@ -0,0 +1,324 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <wmmintrin.h>
+#define HAVE_AESNI
+#endif
+
+#include "src/shared/aes.h"
+
+static const uint8_t sbox[256] = {
+	0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5,
+	0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+	0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0,
+	0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+	0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc,
+	0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+	0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a,
+	0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+	0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0,
+	0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+	0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b,
+	0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+	0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85,
+	0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+	0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5,
+	0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+	0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17,
+	0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+	0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88,
+	0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+	0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c,
+	0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+	0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9,
+	0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+	0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6,
+	0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+	0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e,
+	0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+	0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94,
+	0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+	0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68,
+	0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16,
+};
+
+static inline uint8_t xtime(uint8_t x)
+{
+	return (x << 1) ^ ((x & 0x80) ? 0x1b : 0x00);
+}
+
+static void soft_encrypt(const uint8_t *rk, const uint8_t in[16],
+							uint8_t out[16])
+{
+	uint8_t s[16], t[16];
+	int i, r;
+
+	for (i = 0; i < 16; i++)
+		s[i] = in[i] ^ rk[i];
+
+	for (r = 1; r <= 10; r++) {
+		/* SubBytes and ShiftRows, the state is stored column first */
+		for (i = 0; i < 16; i++)
+			t[i] = sbox[s[(i + 4 * (i & 3)) & 15]];
+
+		/* MixColumns, skipped in the final round */
+		if (r < 10) {
+			for (i = 0; i < 16; i += 4) {
+				uint8_t a0 = t[i], a1 = t[i + 1];
+				uint8_t a2 = t[i + 2], a3 = t[i + 3];
+				uint8_t all = a0 ^ a1 ^ a2 ^ a3;
+
+				t[i] ^= all ^ xtime(a0 ^ a1);
+				t[i + 1] ^= all ^ xtime(a1 ^ a2);
+				t[i + 2] ^= all ^ xtime(a2 ^ a3);
+				t[i + 3] ^= all ^ xtime(a3 ^ a0);
+			}
+		}
+
+		for (i = 0; i < 16; i++)
+			s[i] = t[i] ^ rk[16 * r + i];
+	}
+
+	memcpy(out, s, 16);
+}
+
+#ifdef HAVE_AESNI
+static int aesni = -1;
+
+static bool aesni_supported(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (aesni < 0) {
+		if (__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+			aesni = !!(ecx & bit_AES);
+		else
+			aesni = 0;
+	}
+
+	return aesni;
+}
+
+__attribute__((target("aes,sse2")))
+static void aesni_encrypt(const uint8_t *rk, const uint8_t in[16],
+							uint8_t out[16])
+{
+	const __m128i *k = (const __m128i *) rk;
+	__m128i m;
+	int r;
+
+	m = _mm_loadu_si128((const __m128i *) in);
+	m = _mm_xor_si128(m, _mm_loadu_si128(&k[0]));
+
+	for (r = 1; r < 10; r++)
+		m = _mm_aesenc_si128(m, _mm_loadu_si128(&k[r]));
+
+	m = _mm_aesenclast_si128(m, _mm_loadu_si128(&k[10]));
+
+	_mm_storeu_si128((__m128i *) out, m);
+}
+
+/* Encrypt the same block under four keys at once to keep the AES units
+ * busy, a single aesenc has several cycles of latency.
+ */
+__attribute__((target("aes,sse2")))
+static void aesni_encrypt_keys(const struct bt_aes128 *aes, size_t n,
+					const uint8_t in[16], uint8_t out[][16])
+{
+	__m128i p = _mm_loadu_si128((const __m128i *) in);
+	size_t i;
+	int r;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		const __m128i *k0 = (const __m128i *) aes[i].rk;
+		const __m128i *k1 = (const __m128i *) aes[i + 1].rk;
+		const __m128i *k2 = (const __m128i *) aes[i + 2].rk;
+		const __m128i *k3 = (const __m128i *) aes[i + 3].rk;
+		__m128i m0, m1, m2, m3;
+
+		m0 = _mm_xor_si128(p, _mm_loadu_si128(&k0[0]));
+		m1 = _mm_xor_si128(p, _mm_loadu_si128(&k1[0]));
+		m2 = _mm_xor_si128(p, _mm_loadu_si128(&k2[0]));
+		m3 = _mm_xor_si128(p, _mm_loadu_si128(&k3[0]));
+
+		for (r = 1; r < 10; r++) {
+			m0 = _mm_aesenc_si128(m0, _mm_loadu_si128(&k0[r]));
+			m1 = _mm_aesenc_si128(m1, _mm_loadu_si128(&k1[r]));
+			m2 = _mm_aesenc_si128(m2, _mm_loadu_si128(&k2[r]));
+			m3 = _mm_aesenc_si128(m3, _mm_loadu_si128(&k3[r]));
+		}
+
+		m0 = _mm_aesenclast_si128(m0, _mm_loadu_si128(&k0[10]));
+		m1 = _mm_aesenclast_si128(m1, _mm_loadu_si128(&k1[10]));
+		m2 = _mm_aesenclast_si128(m2, _mm_loadu_si128(&k2[10]));
+		m3 = _mm_aesenclast_si128(m3, _mm_loadu_si128(&k3[10]));
+
+		_mm_storeu_si128((__m128i *) out[i], m0);
+		_mm_storeu_si128((__m128i *) out[i + 1], m1);
+		_mm_storeu_si128((__m128i *) out[i + 2], m2);
+		_mm_storeu_si128((__m128i *) out[i + 3], m3);
+	}
+
+	for (; i < n; i++)
+		aesni_encrypt(aes[i].rk, in, out[i]);
+}
+#else
+static bool aesni_supported(void)
+{
+	return false;
+}
+#endif
+
+bool bt_aes128_accel(void)
+{
+	return aesni_supported();
+}
+
+void bt_aes128_set_key(struct bt_aes128 *aes, const uint8_t key[16])
+{
+	uint8_t *rk = aes->rk;
+	uint8_t rcon = 0x01;
+	int i;
+
+	memcpy(rk, key, 16);
+
+	for (i = 16; i < 176; i += 4) {
+		uint8_t t0 = rk[i - 4], t1 = rk[i - 3];
+		uint8_t t2 = rk[i - 2], t3 = rk[i - 1];
+
+		if (!(i & 15)) {
+			uint8_t tmp = t0;
+
+			/* RotWord, SubWord and Rcon */
+			t0 = sbox[t1] ^ rcon;
+			t1 = sbox[t2];
+			t2 = sbox[t3];
+			t3 = sbox[tmp];
+			rcon = xtime(rcon);
+		}
+
+		rk[i] = rk[i - 16] ^ t0;
+		rk[i + 1] = rk[i - 15] ^ t1;
+		rk[i + 2] = rk[i - 14] ^ t2;
+		rk[i + 3] = rk[i - 13] ^ t3;
+	}
+}
+
+void bt_aes128_encrypt(const struct bt_aes128 *aes, const uint8_t in[16],
+							uint8_t out[16])
+{
+#ifdef HAVE_AESNI
+	if (aesni_supported()) {
+		aesni_encrypt(aes->rk, in, out);
+		return;
+	}
+#endif
+
+	soft_encrypt(aes->rk, in, out);
+}
+
+void bt_aes128_encrypt_keys(const struct bt_aes128 *aes, size_t n,
+					const uint8_t in[16], uint8_t out[][16])
+{
+	size_t i;
+
+#ifdef HAVE_AESNI
+	if (aesni_supported()) {
+		aesni_encrypt_keys(aes, n, in, out);
+		return;
+	}
+#endif
+
+	for (i = 0; i < n; i++)
+		soft_encrypt(aes[i].rk, in, out[i]);
+}
+
+/* Multiply by x in GF(2^128) as used to derive the CMAC subkeys */
+static void cmac_dbl(const uint8_t in[16], uint8_t out[16])
+{
+	uint8_t msb = in[0] & 0x80;
+	int i;
+
+	for (i = 0; i < 15; i++)
+		out[i] = (in[i] << 1) | (in[i + 1] >> 7);
+
+	out[15] = (in[15] << 1) ^ (msb ? 0x87 : 0x00);
+}
+
+/*
+ * AES-CMAC as specified in RFC 4493. The message is given as an iovec so
+ * callers can hash scattered buffers without copying them first.
+ */
+void bt_aes128_cmac(const uint8_t key[16], const struct iovec *iov,
+					size_t iovcnt, uint8_t mac[16])
+{
+	struct bt_aes128 aes;
+	uint8_t x[16] = {}, k[16], buf[16];
+	size_t i, len = 0;
+
+	bt_aes128_set_key(&aes, key);
+
+	for (i = 0; i < iovcnt; i++) {
+		const uint8_t *data = iov[i].iov_base;
+		size_t data_len = iov[i].iov_len;
+
+		while (data_len) {
+			size_t n;
+
+			/* Only process a full block once more data follows,
+			 * the last block needs to be mixed with a subkey.
+			 */
+			if (len == 16) {
+				int j;
+
+				for (j = 0; j < 16; j++)
+					x[j] ^= buf[j];
+
+				bt_aes128_encrypt(&aes, x, x);
+				len = 0;
+			}
+
+			n = 16 - len;
+			if (n > data_len)
+				n = data_len;
+
+			memcpy(buf + len, data, n);
+			len += n;
+			data += n;
+			data_len -= n;
+		}
+	}
+
+	/* K1 = dbl(E(K, 0)), K2 = dbl(K1) */
+	memset(k, 0, 16);
+	bt_aes128_encrypt(&aes, k, k);
+	cmac_dbl(k, k);
+
+	if (len < 16) {
+		cmac_dbl(k, k);
+
+		buf[len] = 0x80;
+		memset(buf + len + 1, 0, 15 - len);
+	}
+
+	for (i = 0; i < 16; i++)
+		x[i] ^= buf[i] ^ k[i];
+
+	bt_aes128_encrypt(&aes, x, mac);
+
+	memset(&aes, 0, sizeof(aes));
+	memset(k, 0, sizeof(k));
+}
@@ -0,0 +1,27 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+/* Expanded AES-128 key, most significant octet first as in FIPS-197 */
+struct bt_aes128 {
+	uint8_t rk[176] __attribute__((aligned(16)));
+};
+
+bool bt_aes128_accel(void);
+
+void bt_aes128_set_key(struct bt_aes128 *aes, const uint8_t key[16]);
+void bt_aes128_encrypt(const struct bt_aes128 *aes, const uint8_t in[16],
+							uint8_t out[16]);
+void bt_aes128_encrypt_keys(const struct bt_aes128 *aes, size_t n,
+					const uint8_t in[16], uint8_t out[][16]);
+
+void bt_aes128_cmac(const uint8_t key[16], const struct iovec *iov,
+					size_t iovcnt, uint8_t mac[16]);
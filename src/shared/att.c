@@ -12,9 +12,11 @@
 #include <config.h>
 #endif
 
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <sys/socket.h>
 
 #include "src/shared/io.h"
 #include "src/shared/queue.h"
@@ -31,6 +33,10 @@
 #define ATT_OP_SIGNED_MASK		0x80
 #define ATT_TIMEOUT_INTERVAL		30000  /* 30000 ms */
 
+/* Maximum number of PDUs written per writer wakeup */
+#define ATT_WRITE_BATCH_DEFAULT		8
+#define ATT_WRITE_BATCH_MAX		32
+
 /* Length of signature in write signed packet */
 #define BT_ATT_SIGNATURE_LEN		12
 
@@ -48,6 +54,8 @@ struct bt_att_chan {
 	struct att_send_op *pending_req;
 	struct att_send_op *pending_ind;
 	bool writer_active;
+	uint8_t write_batch;		/* Max PDUs written per wakeup */
+	unsigned int batches;		/* Wakeups writing multiple PDUs */
 
 	bool in_req;			/* There's a pending incoming request */
 
@@ -61,6 +69,7 @@ struct bt_att {
 	struct queue *chans;
 	uint8_t enc_size;
 	uint16_t mtu;			/* Biggest possible MTU */
+	uint8_t write_batch;		/* Default write batch of channels */
 
 	struct queue *notify_list;	/* List of registered callbacks */
 	struct queue *disconn_list;	/* List of disconnect handlers */
@@ -186,6 +195,12 @@ static uint8_t get_req_opcode(uint8_t rsp_opcode)
 	return 0;
 }
 
+struct bt_att_pdu {
+	int ref_count;
+	uint16_t len;
+	uint8_t data[];
+};
+
 struct att_send_op {
 	unsigned int id;
 	unsigned int timeout_id;
@@ -193,12 +208,23 @@ struct att_send_op {
 	uint8_t opcode;
 	void *pdu;
 	uint16_t len;
+	struct bt_att_pdu *shared;	/* Owner of pdu if shared */
 	bool retry;
 	bt_att_response_func_t callback;
 	bt_att_destroy_func_t destroy;
 	void *user_data;
 };
 
+static void free_att_send_op(struct att_send_op *op)
+{
+	if (op->shared)
+		bt_att_pdu_unref(op->shared);
+	else
+		free(op->pdu);
+
+	free(op);
+}
+
 static void destroy_att_send_op(void *data)
 {
 	struct att_send_op *op = data;
@@ -209,8 +235,7 @@ static void destroy_att_send_op(void *data)
 	if (op->destroy)
 		op->destroy(op->user_data);
 
-	free(op->pdu);
-	free(op);
+	free_att_send_op(op);
 }
 
 static void cancel_att_send_op(void *data)
@@ -326,29 +351,42 @@ static void att_hexdump(struct bt_att *att, char dir, const void *data,
 }
 
 static bool encode_pdu(struct bt_att *att, struct att_send_op *op,
-					const void *pdu, uint16_t length)
+					const struct iovec *iov, int iovcnt)
 {
 	uint16_t pdu_len = 1;
+	size_t length = 0;
 	struct sign_info *sign = att->local_sign;
 	uint32_t sign_cnt;
+	uint8_t *ptr;
+	int i;
+
+	for (i = 0; i < iovcnt; i++)
+		length += iov[i].iov_len;
 
 	if (sign && (op->opcode & ATT_OP_SIGNED_MASK))
 		pdu_len += BT_ATT_SIGNATURE_LEN;
 
-	if (length && pdu)
-		pdu_len += length;
-
-	if (pdu_len > att->mtu)
+	if (length + pdu_len > att->mtu)
 		return false;
 
+	pdu_len += length;
+
 	op->len = pdu_len;
 	op->pdu = malloc(op->len);
 	if (!op->pdu)
 		return false;
 
-	((uint8_t *) op->pdu)[0] = op->opcode;
-	if (pdu_len > 1)
-		memcpy(op->pdu + 1, pdu, length);
+	ptr = op->pdu;
+	*ptr++ = op->opcode;
+
+	/* Gather the parameters straight into the PDU buffer */
+	for (i = 0; i < iovcnt; i++) {
+		if (!iov[i].iov_len)
+			continue;
+
+		memcpy(ptr, iov[i].iov_base, iov[i].iov_len);
+		ptr += iov[i].iov_len;
+	}
 
 	if (!sign || !(op->opcode & ATT_OP_SIGNED_MASK) || !att->crypto)
 		return true;
@@ -367,10 +405,22 @@ fail:
 	return false;
 }
 
-static struct att_send_op *create_att_send_op(struct bt_att *att,
-						uint8_t opcode,
-						const void *pdu,
-						uint16_t length,
+static bool iov_is_valid(const struct iovec *iov, int iovcnt)
+{
+	int i;
+
+	if (iovcnt < 0 || (iovcnt && !iov))
+		return false;
+
+	for (i = 0; i < iovcnt; i++) {
+		if (iov[i].iov_len && !iov[i].iov_base)
+			return false;
+	}
+
+	return true;
+}
+
+static struct att_send_op *new_att_send_op(uint8_t opcode,
 						bt_att_response_func_t callback,
 						void *user_data,
 						bt_att_destroy_func_t destroy)
@@ -378,9 +428,6 @@ static struct att_send_op *create_att_send_op(struct bt_att *att,
 	struct att_send_op *op;
 	enum att_op_type type;
 
-	if (length && !pdu)
-		return NULL;
-
 	type = get_op_type(opcode);
 	if (type == ATT_OP_TYPE_UNKNOWN)
 		return NULL;
@@ -405,7 +452,27 @@ static struct att_send_op *create_att_send_op(struct bt_att *att,
 	op->destroy = destroy;
 	op->user_data = user_data;
 
-	if (!encode_pdu(att, op, pdu, length)) {
+	return op;
+}
+
+static struct att_send_op *create_att_send_opv(struct bt_att *att,
+						uint8_t opcode,
+						const struct iovec *iov,
+						int iovcnt,
+						bt_att_response_func_t callback,
+						void *user_data,
+						bt_att_destroy_func_t destroy)
+{
+	struct att_send_op *op;
+
+	if (!iov_is_valid(iov, iovcnt))
+		return NULL;
+
+	op = new_att_send_op(opcode, callback, user_data, destroy);
+	if (!op)
+		return NULL;
+
+	if (!encode_pdu(att, op, iov, iovcnt)) {
 		free(op);
 		return NULL;
 	}
@@ -413,17 +480,44 @@ static struct att_send_op *create_att_send_op(struct bt_att *att,
 	return op;
 }
 
-static struct att_send_op *pick_next_send_op(struct bt_att_chan *chan)
+static struct att_send_op *create_att_send_op(struct bt_att *att,
+						uint8_t opcode,
+						const void *pdu,
+						uint16_t length,
+						bt_att_response_func_t callback,
+						void *user_data,
+						bt_att_destroy_func_t destroy)
+{
+	struct iovec iov;
+
+	iov.iov_base = (void *) pdu;
+	iov.iov_len = pdu ? length : 0;
+
+	if (length && !pdu)
+		return NULL;
+
+	return create_att_send_opv(att, opcode, &iov, 1, callback, user_data,
+								destroy);
+}
+
+/*
+ * Pick the next operation to be written on the channel, returning in @queue
+ * the queue it was taken from so it can be put back if it cannot be written.
+ */
+static struct att_send_op *pick_next_send_op(struct bt_att_chan *chan,
+							struct queue **queue)
 {
 	struct bt_att *att = chan->att;
 	struct att_send_op *op;
 
 	/* Check if there is anything queued on the channel */
+	*queue = chan->queue;
 	op = queue_pop_head(chan->queue);
 	if (op)
 		return op;
 
 	/* See if any operations are already in the write queue */
+	*queue = att->write_queue;
 	op = queue_peek_head(att->write_queue);
 	if (op && op->len <= chan->mtu)
 		return queue_pop_head(att->write_queue);
@@ -432,6 +526,7 @@ static struct att_send_op *pick_next_send_op(struct bt_att_chan *chan)
 	 * request queue.
 	 */
 	if (!chan->pending_req) {
+		*queue = att->req_queue;
 		op = queue_peek_head(att->req_queue);
 		if (op && op->len <= chan->mtu) {
 			/* Don't send Exchange MTU over EATT */
@@ -448,11 +543,14 @@ indicate:
 	 * no pending indication, pick an operation from the indication queue.
 	 */
 	if (!chan->pending_ind) {
+		*queue = att->ind_queue;
 		op = queue_peek_head(att->ind_queue);
 		if (op && op->len <= chan->mtu)
 			return queue_pop_head(att->ind_queue);
 	}
 
+	*queue = NULL;
+
 	return NULL;
 }
 
@@ -541,24 +639,84 @@ static ssize_t bt_att_chan_write(struct bt_att_chan *chan, uint8_t opcode,
 	return ret;
 }
 
-static bool can_write_data(struct io *io, void *user_data)
+/*
+ * Write several PDUs in a single system call. ATT bearers preserve message
+ * boundaries so each PDU is sent as its own message with sendmmsg, falling
+ * back to one write per PDU if the transport is not a socket.
+ *
+ * Returns the number of PDUs written, or a negative error if not even the
+ * first one could be written.
+ */
+static int bt_att_chan_write_batch(struct bt_att_chan *chan,
+					struct att_send_op **ops,
+					unsigned int count)
 {
-	struct bt_att_chan *chan = user_data;
-	struct att_send_op *op;
-	struct timeout_data *timeout;
+	struct bt_att *att = chan->att;
+	struct mmsghdr msgs[ATT_WRITE_BATCH_MAX];
+	struct iovec iov[ATT_WRITE_BATCH_MAX];
+	unsigned int i;
+	int ret;
 
-	op = pick_next_send_op(chan);
-	if (!op)
-		return false;
+	if (count == 1) {
+		ret = bt_att_chan_write(chan, ops[0]->opcode, ops[0]->pdu,
+								ops[0]->len);
+		if (ret <= 0)
+			return ret;
 
-	if (!bt_att_chan_write(chan, op->opcode, op->pdu, op->len)) {
-		if (op->callback)
-			op->callback(BT_ATT_OP_ERROR_RSP, NULL, 0,
-							op->user_data);
-		destroy_att_send_op(op);
-		return true;
+		return 1;
 	}
 
+	memset(msgs, 0, sizeof(msgs));
+
+	for (i = 0; i < count; i++) {
+		iov[i].iov_base = ops[i]->pdu;
+		iov[i].iov_len = ops[i]->len;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+
+		VERBOSE(att, "(chan %p) ATT op 0x%02x", chan, ops[i]->opcode);
+	}
+
+	do {
+		ret = sendmmsg(chan->fd, msgs, count, MSG_NOSIGNAL);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0 && errno == ENOTSOCK) {
+		for (i = 0; i < count; i++) {
+			ret = bt_att_chan_write(chan, ops[i]->opcode,
+						ops[i]->pdu, ops[i]->len);
+			if (ret <= 0)
+				break;
+		}
+
+		return i ? (int) i : ret;
+	}
+
+	if (ret < 0) {
+		ret = -errno;
+		DBG(att, "(chan %p) write failed: %s", chan, strerror(-ret));
+		return ret;
+	}
+
+	chan->batches++;
+
+	DBG(att, "(chan %p) batch %u: %d/%u PDUs written", chan,
+						chan->batches, ret, count);
+
+	if (att->debug_level) {
+		for (i = 0; i < (unsigned int) ret; i++)
+			util_hexdump('<', ops[i]->pdu, msgs[i].msg_len,
+					att->debug_callback, att->debug_data);
+	}
+
+	return ret;
+}
+
+static void write_op_complete(struct bt_att_chan *chan,
+						struct att_send_op *op)
+{
+	struct timeout_data *timeout;
+
 	/* Based on the operation type, set either the pending request or the
 	 * pending indication. If it came from the write queue, then there is
 	 * no need to keep it around.
@@ -580,7 +738,7 @@ static bool can_write_data(struct io *io, void *user_data)
 	case ATT_OP_TYPE_UNKNOWN:
 	default:
 		destroy_att_send_op(op);
-		return true;
+		return;
 	}
 
 	timeout = new0(struct timeout_data, 1);
@@ -588,6 +746,76 @@ static bool can_write_data(struct io *io, void *user_data)
 	timeout->id = op->id;
 	op->timeout_id = timeout_add(ATT_TIMEOUT_INTERVAL, timeout_cb,
 								timeout, free);
+}
+
+static void release_op_slot(struct bt_att_chan *chan, struct att_send_op *op)
+{
+	if (chan->pending_req == op)
+		chan->pending_req = NULL;
+	else if (chan->pending_ind == op)
+		chan->pending_ind = NULL;
+}
+
+static bool can_write_data(struct io *io, void *user_data)
+{
+	struct bt_att_chan *chan = user_data;
+	struct att_send_op *ops[ATT_WRITE_BATCH_MAX];
+	struct queue *queues[ATT_WRITE_BATCH_MAX];
+	struct att_send_op *op;
+	unsigned int count = 0, written = 0, failed = 0, i;
+	int ret;
+
+	while (count < chan->write_batch) {
+		op = pick_next_send_op(chan, &queues[count]);
+		if (!op)
+			break;
+
+		ops[count++] = op;
+
+		/* Reserve the request/indication slot while the batch is
+		 * being assembled so at most one of each is outstanding.
+		 */
+		if (op->type == ATT_OP_TYPE_REQ)
+			chan->pending_req = op;
+		else if (op->type == ATT_OP_TYPE_IND)
+			chan->pending_ind = op;
+	}
+
+	if (!count)
+		return false;
+
+	ret = bt_att_chan_write_batch(chan, ops, count);
+	if (ret > 0)
+		written = ret;
+	else if (!ret)
+		failed = 1;
+	else if (ret != -EAGAIN)
+		failed = count;
+
+	/* Put back whatever didn't make it where it came from, keeping the
+	 * original order; nothing at all is written on -EAGAIN.
+	 */
+	for (i = count; i > written + failed; i--) {
+		op = ops[i - 1];
+
+		release_op_slot(chan, op);
+		queue_push_head(queues[i - 1], op);
+	}
+
+	for (i = 0; i < written; i++)
+		write_op_complete(chan, ops[i]);
+
+	/* Fail the operations the transport refused to send */
+	for (i = written; i < written + failed; i++) {
+		op = ops[i];
+
+		release_op_slot(chan, op);
+
+		if (op->callback)
+			op->callback(BT_ATT_OP_ERROR_RSP, NULL, 0,
+							op->user_data);
+		destroy_att_send_op(op);
+	}
 
 	/* Return true as there may be more operations ready to write. */
 	return true;
@@ -1225,6 +1453,7 @@ static struct bt_att_chan *bt_att_chan_new(int fd, uint8_t type)
 		goto fail;
 
 	chan->queue = queue_new();
+	chan->write_batch = ATT_WRITE_BATCH_DEFAULT;
 
 	return chan;
 
@@ -1240,6 +1469,9 @@ static void bt_att_attach_chan(struct bt_att *att, struct bt_att_chan *chan)
 	queue_push_head(att->chans, chan);
 	chan->att = att;
 
+	if (att->write_batch)
+		chan->write_batch = att->write_batch;
+
 	if (chan->mtu > att->mtu)
 		att->mtu = chan->mtu;
 
@@ -1434,6 +1666,32 @@ bool bt_att_set_mtu(struct bt_att *att, uint16_t mtu)
 	return true;
 }
 
+bool bt_att_chan_set_write_batch(struct bt_att_chan *chan, uint8_t count)
+{
+	if (!chan || !count || count > ATT_WRITE_BATCH_MAX)
+		return false;
+
+	chan->write_batch = count;
+
+	return true;
+}
+
+static void set_chan_write_batch(void *data, void *user_data)
+{
+	bt_att_chan_set_write_batch(data, PTR_TO_UINT(user_data));
+}
+
+bool bt_att_set_write_batch(struct bt_att *att, uint8_t count)
+{
+	if (!att || !count || count > ATT_WRITE_BATCH_MAX)
+		return false;
+
+	att->write_batch = count;
+	queue_foreach(att->chans, set_chan_write_batch, UINT_TO_PTR(count));
+
+	return true;
+}
+
 uint8_t bt_att_get_link_type(struct bt_att *att)
 {
 	struct bt_att_chan *chan;
@@ -1580,16 +1838,21 @@ unsigned int bt_att_send(struct bt_att *att, uint8_t opcode,
 				bt_att_response_func_t callback, void *user_data,
 				bt_att_destroy_func_t destroy)
 {
-	struct att_send_op *op;
-	bool result;
+	struct iovec iov;
 
-	if (!att || queue_isempty(att->chans))
+	if (length && !pdu)
 		return 0;
 
-	op = create_att_send_op(att, opcode, pdu, length, callback, user_data,
+	iov.iov_base = (void *) pdu;
+	iov.iov_len = pdu ? length : 0;
+
+	return bt_att_sendv(att, opcode, &iov, 1, callback, user_data,
 								destroy);
-	if (!op)
-		return 0;
+}
+
+static unsigned int queue_send_op(struct bt_att *att, struct att_send_op *op)
+{
+	bool result;
 
 	if (att->next_send_id < 1)
 		att->next_send_id = 1;
@@ -1597,7 +1860,7 @@ unsigned int bt_att_send(struct bt_att *att, uint8_t opcode,
 	op->id = att->next_send_id++;
 
 	/* Always use fixed channel for BT_ATT_OP_MTU_REQ */
-	if (opcode == BT_ATT_OP_MTU_REQ) {
+	if (op->opcode == BT_ATT_OP_MTU_REQ) {
 		struct bt_att_chan *chan = queue_peek_tail(att->chans);
 
 		result = queue_push_tail(chan->queue, op);
@@ -1624,8 +1887,7 @@ unsigned int bt_att_send(struct bt_att *att, uint8_t opcode,
 
 done:
 	if (!result) {
-		free(op->pdu);
-		free(op);
+		free_att_send_op(op);
 		return 0;
 	}
 
@@ -1634,6 +1896,112 @@ done:
 	return op->id;
 }
 
+unsigned int bt_att_sendv(struct bt_att *att, uint8_t opcode,
+				const struct iovec *iov, int iovcnt,
+				bt_att_response_func_t callback, void *user_data,
+				bt_att_destroy_func_t destroy)
+{
+	struct att_send_op *op;
+
+	if (!att || queue_isempty(att->chans))
+		return 0;
+
+	op = create_att_send_opv(att, opcode, iov, iovcnt, callback, user_data,
+								destroy);
+	if (!op)
+		return 0;
+
+	return queue_send_op(att, op);
+}
+
+struct bt_att_pdu *bt_att_pdu_new(uint8_t opcode, const struct iovec *iov,
+								int iovcnt)
+{
+	struct bt_att_pdu *pdu;
+	size_t len = 1;
+	uint8_t *ptr;
+	int i;
+
+	/* Signatures depend on the bearer so signed PDUs cannot be shared */
+	if ((opcode & ATT_OP_SIGNED_MASK) ||
+				get_op_type(opcode) == ATT_OP_TYPE_UNKNOWN)
+		return NULL;
+
+	if (!iov_is_valid(iov, iovcnt))
+		return NULL;
+
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+
+	if (len > UINT16_MAX)
+		return NULL;
+
+	pdu = malloc(sizeof(*pdu) + len);
+	if (!pdu)
+		return NULL;
+
+	pdu->ref_count = 1;
+	pdu->len = len;
+
+	ptr = pdu->data;
+	*ptr++ = opcode;
+
+	for (i = 0; i < iovcnt; i++) {
+		if (!iov[i].iov_len)
+			continue;
+
+		memcpy(ptr, iov[i].iov_base, iov[i].iov_len);
+		ptr += iov[i].iov_len;
+	}
+
+	return pdu;
+}
+
+struct bt_att_pdu *bt_att_pdu_ref(struct bt_att_pdu *pdu)
+{
+	if (!pdu)
+		return NULL;
+
+	__sync_fetch_and_add(&pdu->ref_count, 1);
+
+	return pdu;
+}
+
+void bt_att_pdu_unref(struct bt_att_pdu *pdu)
+{
+	if (!pdu)
+		return;
+
+	if (__sync_sub_and_fetch(&pdu->ref_count, 1))
+		return;
+
+	free(pdu);
+}
+
+unsigned int bt_att_send_pdu(struct bt_att *att, struct bt_att_pdu *pdu,
+				bt_att_response_func_t callback, void *user_data,
+				bt_att_destroy_func_t destroy)
+{
+	struct att_send_op *op;
+
+	if (!att || !pdu || queue_isempty(att->chans))
+		return 0;
+
+	if (pdu->len > att->mtu)
+		return 0;
+
+	op = new_att_send_op(pdu->data[0], callback, user_data, destroy);
+	if (!op)
+		return 0;
+
+	/* The buffer is shared, the op only holds a reference to it */
+	op->shared = bt_att_pdu_ref(pdu);
+	op->pdu = pdu->data;
+	op->len = pdu->len;
+
+	return queue_send_op(att, op);
+}
+
 int bt_att_resend(struct bt_att *att, unsigned int id, uint8_t opcode,
 				const void *pdu, uint16_t length,
 				bt_att_response_func_t callback,
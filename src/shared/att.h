@@ -10,6 +10,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <sys/uio.h>
 
 #include "src/shared/att-types.h"
 
@@ -19,6 +20,7 @@
 
 struct bt_att;
 struct bt_att_chan;
+struct bt_att_pdu;
 
 struct bt_att *bt_att_new(int fd, bool ext_signed);
 
@@ -53,6 +55,8 @@ bool bt_att_set_debug(struct bt_att *att, uint8_t level,
 uint16_t bt_att_get_mtu(struct bt_att *att);
 bool bt_att_set_mtu(struct bt_att *att, uint16_t mtu);
 uint8_t bt_att_get_link_type(struct bt_att *att);
+bool bt_att_set_write_batch(struct bt_att *att, uint8_t count);
+bool bt_att_chan_set_write_batch(struct bt_att_chan *chan, uint8_t count);
 
 bool bt_att_set_timeout_cb(struct bt_att *att, bt_att_timeout_func_t callback,
 						void *user_data,
@@ -63,6 +67,24 @@ unsigned int bt_att_send(struct bt_att *att, uint8_t opcode,
 					bt_att_response_func_t callback,
 					void *user_data,
 					bt_att_destroy_func_t destroy);
+unsigned int bt_att_sendv(struct bt_att *att, uint8_t opcode,
+					const struct iovec *iov, int iovcnt,
+					bt_att_response_func_t callback,
+					void *user_data,
+					bt_att_destroy_func_t destroy);
+
+/*
+ * Encoded PDU which can be queued on several bearers, e.g. the same Handle
+ * Value Notification sent to all subscribers of a characteristic.
+ */
+struct bt_att_pdu *bt_att_pdu_new(uint8_t opcode, const struct iovec *iov,
+								int iovcnt);
+struct bt_att_pdu *bt_att_pdu_ref(struct bt_att_pdu *pdu);
+void bt_att_pdu_unref(struct bt_att_pdu *pdu);
+unsigned int bt_att_send_pdu(struct bt_att *att, struct bt_att_pdu *pdu,
+					bt_att_response_func_t callback,
+					void *user_data,
+					bt_att_destroy_func_t destroy);
 int bt_att_resend(struct bt_att *att, unsigned int id, uint8_t opcode,
 					const void *pdu, uint16_t length,
 					bt_att_response_func_t callback,
@@ -21,8 +21,11 @@
 #include <stdio.h>
 #include <limits.h>
 #include <arpa/inet.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
+#include "src/shared/util.h"
+#include "src/shared/lz4.h"
 #include "src/shared/btsnoop.h"
 
 struct btsnoop_hdr {
@@ -47,6 +50,46 @@ static const uint8_t btsnoop_id[] = { 0x62, 0x74, 0x73, 0x6e,
 
 static const uint32_t btsnoop_version = 1;
 
+/*
+ * Compressed files start with their own identification pattern and
+ * otherwise the same header. Records are grouped into independently
+ * compressed blocks and the file ends with an index of all blocks.
+ */
+static const uint8_t btsnoop_lz4_id[] = { 0x62, 0x74, 0x73, 0x6e,
+					  0x6c, 0x7a, 0x34, 0x00 };
+
+struct btsnoop_block {
+	uint32_t	type;		/* Block Type */
+	uint32_t	len;		/* Stored Length */
+	uint32_t	size;		/* Uncompressed Length */
+	uint32_t	count;		/* Number of Records */
+	uint64_t	ts;		/* Timestamp of First Record */
+} __attribute__ ((packed));
+#define BTSNOOP_BLOCK_HDR_SIZE (sizeof(struct btsnoop_block))
+
+#define BTSNOOP_BLOCK_STORED	0
+#define BTSNOOP_BLOCK_LZ4	1
+#define BTSNOOP_BLOCK_INDEX	2
+
+/* Uncompressed size limit of a block */
+#define BTSNOOP_BLOCK_MAX	(64 * 1024)
+
+/* Records are not kept in memory for longer than this on a busy link */
+#define BTSNOOP_BLOCK_USEC	(BTSNOOP_FLUSH_INTERVAL * 1000000ull)
+
+struct btsnoop_block_entry {
+	uint64_t	offset;		/* Offset of the block header */
+	uint64_t	ts;		/* Timestamp of first record */
+	uint32_t	count;		/* Number of records */
+} __attribute__ ((packed));
+#define BTSNOOP_BLOCK_ENTRY_SIZE (sizeof(struct btsnoop_block_entry))
+
+struct btsnoop_block_trailer {
+	uint64_t	offset;		/* Offset of the index block */
+	uint8_t		id[8];		/* Identification Pattern */
+} __attribute__ ((packed));
+#define BTSNOOP_BLOCK_TRAILER_SIZE (sizeof(struct btsnoop_block_trailer))
+
 struct pklg_pkt {
 	uint32_t	len;
 	uint64_t	ts;
@@ -68,8 +111,34 @@ struct btsnoop {
 	size_t cur_size;
 	unsigned int max_count;
 	unsigned int cur_count;
+	bool compress;
+	bool decompress;
+	uint8_t *block;
+	size_t block_len;
+	size_t block_pos;
+	uint32_t block_count;
+	uint64_t block_ts;
+	uint8_t *zblock;
+	struct btsnoop_block_entry *blocks;
+	size_t num_blocks;
+	size_t max_blocks;
 };
 
+static bool alloc_blocks(struct btsnoop *btsnoop)
+{
+	btsnoop->block = malloc(BTSNOOP_BLOCK_MAX);
+	btsnoop->zblock = malloc(LZ4_COMPRESS_BOUND(BTSNOOP_BLOCK_MAX));
+
+	return btsnoop->block && btsnoop->zblock;
+}
+
+static void free_blocks(struct btsnoop *btsnoop)
+{
+	free(btsnoop->block);
+	free(btsnoop->zblock);
+	free(btsnoop->blocks);
+}
+
 struct btsnoop *btsnoop_open(const char *path, unsigned long flags)
 {
 	struct btsnoop *btsnoop;
@@ -99,6 +168,16 @@ struct btsnoop *btsnoop_open(const char *path, unsigned long flags)
 
 		btsnoop->format = be32toh(hdr.type);
 		btsnoop->index = 0xffff;
+	} else if (!memcmp(hdr.id, btsnoop_lz4_id, sizeof(btsnoop_lz4_id))) {
+		if (be32toh(hdr.version) != btsnoop_version)
+			goto failed;
+
+		btsnoop->format = be32toh(hdr.type);
+		btsnoop->index = 0xffff;
+		btsnoop->decompress = true;
+
+		if (!alloc_blocks(btsnoop))
+			goto failed;
 	} else {
 		if (!(btsnoop->flags & BTSNOOP_FLAG_PKLG_SUPPORT))
 			goto failed;
@@ -121,19 +200,41 @@ struct btsnoop *btsnoop_open(const char *path, unsigned long flags)
 
 failed:
 	close(btsnoop->fd);
+	free_blocks(btsnoop);
 	free(btsnoop);
 
 	return NULL;
 }
 
-struct btsnoop *btsnoop_create(const char *path, size_t max_size,
-					unsigned int max_count, uint32_t format)
+static bool write_header(struct btsnoop *btsnoop)
 {
-	struct btsnoop *btsnoop;
 	struct btsnoop_hdr hdr;
+	ssize_t written;
+
+	if (btsnoop->compress)
+		memcpy(hdr.id, btsnoop_lz4_id, sizeof(btsnoop_lz4_id));
+	else
+		memcpy(hdr.id, btsnoop_id, sizeof(btsnoop_id));
+
+	hdr.version = htobe32(btsnoop_version);
+	hdr.type = htobe32(btsnoop->format);
+
+	written = write(btsnoop->fd, &hdr, BTSNOOP_HDR_SIZE);
+	if (written < 0)
+		return false;
+
+	btsnoop->cur_size = BTSNOOP_HDR_SIZE;
+
+	return true;
+}
+
+static struct btsnoop *create_file(const char *path, size_t max_size,
+					unsigned int max_count, uint32_t format,
+					bool compress)
+{
+	struct btsnoop *btsnoop;
 	const char *real_path;
 	char tmp[PATH_MAX];
-	ssize_t written;
 
 	if (!max_size && max_count)
 		return NULL;
@@ -162,60 +263,95 @@ struct btsnoop *btsnoop_create(const char *path, size_t max_size,
 	btsnoop->path = path;
 	btsnoop->max_count = max_count;
 	btsnoop->max_size = max_size;
+	btsnoop->compress = compress;
 
-	memcpy(hdr.id, btsnoop_id, sizeof(btsnoop_id));
-	hdr.version = htobe32(btsnoop_version);
-	hdr.type = htobe32(btsnoop->format);
-
-	written = write(btsnoop->fd, &hdr, BTSNOOP_HDR_SIZE);
-	if (written < 0) {
+	if ((compress && !alloc_blocks(btsnoop)) || !write_header(btsnoop)) {
 		close(btsnoop->fd);
+		free_blocks(btsnoop);
 		free(btsnoop);
 		return NULL;
 	}
 
-	btsnoop->cur_size = BTSNOOP_HDR_SIZE;
-
 	return btsnoop_ref(btsnoop);
 }
 
-struct btsnoop *btsnoop_ref(struct btsnoop *btsnoop)
+struct btsnoop *btsnoop_create(const char *path, size_t max_size,
+					unsigned int max_count, uint32_t format)
 {
-	if (!btsnoop)
-		return NULL;
-
-	__sync_fetch_and_add(&btsnoop->ref_count, 1);
+	return create_file(path, max_size, max_count, format, false);
+}
 
-	return btsnoop;
+struct btsnoop *btsnoop_create_compressed(const char *path, size_t max_size,
+					unsigned int max_count, uint32_t format)
+{
+	return create_file(path, max_size, max_count, format, true);
 }
 
-void btsnoop_unref(struct btsnoop *btsnoop)
+static bool write_all(int fd, const uint8_t *data, size_t size)
 {
-	if (!btsnoop)
-		return;
+	while (size) {
+		ssize_t written = write(fd, data, size);
 
-	if (__sync_sub_and_fetch(&btsnoop->ref_count, 1))
-		return;
+		if (written < 0)
+			return false;
 
-	if (btsnoop->fd >= 0)
-		close(btsnoop->fd);
+		data += written;
+		size -= written;
+	}
 
-	free(btsnoop);
+	return true;
 }
 
-uint32_t btsnoop_get_format(struct btsnoop *btsnoop)
+static bool write_index(struct btsnoop *btsnoop)
 {
-	if (!btsnoop)
-		return BTSNOOP_FORMAT_INVALID;
+	struct btsnoop_block_entry *entries;
+	struct btsnoop_block_trailer trailer;
+	struct btsnoop_block blk;
+	size_t i, len;
+	bool result;
 
-	return btsnoop->format;
+	len = btsnoop->num_blocks * BTSNOOP_BLOCK_ENTRY_SIZE;
+
+	entries = malloc(len + 1);
+	if (!entries)
+		return false;
+
+	for (i = 0; i < btsnoop->num_blocks; i++) {
+		entries[i].offset = htobe64(btsnoop->blocks[i].offset);
+		entries[i].ts = htobe64(btsnoop->blocks[i].ts);
+		entries[i].count = htobe32(btsnoop->blocks[i].count);
+	}
+
+	blk.type = htobe32(BTSNOOP_BLOCK_INDEX);
+	blk.len = htobe32(len);
+	blk.size = htobe32(len);
+	blk.count = htobe32(btsnoop->num_blocks);
+	blk.ts = 0;
+
+	trailer.offset = htobe64(btsnoop->cur_size);
+	memcpy(trailer.id, btsnoop_lz4_id, sizeof(btsnoop_lz4_id));
+
+	result = write_all(btsnoop->fd, (void *) &blk,
+						BTSNOOP_BLOCK_HDR_SIZE) &&
+			write_all(btsnoop->fd, (void *) entries, len) &&
+			write_all(btsnoop->fd, (void *) &trailer,
+						BTSNOOP_BLOCK_TRAILER_SIZE);
+
+	free(entries);
+
+	btsnoop->cur_size += BTSNOOP_BLOCK_HDR_SIZE + len +
+						BTSNOOP_BLOCK_TRAILER_SIZE;
+
+	return result;
 }
 
 static bool btsnoop_rotate(struct btsnoop *btsnoop)
 {
-	struct btsnoop_hdr hdr;
 	char path[PATH_MAX];
-	ssize_t written;
+
+	/* Each compressed file carries the index of its own blocks */
+	if (btsnoop->compress && !write_index(btsnoop))
+		return false;
 
 	close(btsnoop->fd);
 
@@ -234,19 +370,152 @@ static bool btsnoop_rotate(struct btsnoop *btsnoop)
 	if (btsnoop->fd < 0)
 		return false;
 
-	memcpy(hdr.id, btsnoop_id, sizeof(btsnoop_id));
-	hdr.version = htobe32(btsnoop_version);
-	hdr.type = htobe32(btsnoop->format);
+	btsnoop->num_blocks = 0;
 
-	written = write(btsnoop->fd, &hdr, BTSNOOP_HDR_SIZE);
-	if (written < 0)
+	return write_header(btsnoop);
+}
+
+static bool block_flush(struct btsnoop *btsnoop)
+{
+	struct btsnoop_block_entry *entry;
+	struct btsnoop_block blk;
+	const uint8_t *data;
+	ssize_t len;
+
+	if (!btsnoop->block_count)
+		return true;
+
+	len = lz4_compress(btsnoop->block, btsnoop->block_len,
+				btsnoop->zblock,
+				LZ4_COMPRESS_BOUND(BTSNOOP_BLOCK_MAX));
+	if (len > 0 && (size_t) len < btsnoop->block_len) {
+		blk.type = htobe32(BTSNOOP_BLOCK_LZ4);
+		data = btsnoop->zblock;
+	} else {
+		blk.type = htobe32(BTSNOOP_BLOCK_STORED);
+		data = btsnoop->block;
+		len = btsnoop->block_len;
+	}
+
+	/* Rotate on the size on disk, leaving room for the index */
+	if (btsnoop->max_size && btsnoop->num_blocks &&
+			btsnoop->max_size < btsnoop->cur_size +
+			BTSNOOP_BLOCK_HDR_SIZE + len +
+			BTSNOOP_BLOCK_HDR_SIZE + BTSNOOP_BLOCK_TRAILER_SIZE +
+			(btsnoop->num_blocks + 1) * BTSNOOP_BLOCK_ENTRY_SIZE)
+		if (!btsnoop_rotate(btsnoop))
+			return false;
+
+	if (btsnoop->num_blocks == btsnoop->max_blocks) {
+		size_t max = btsnoop->max_blocks ? btsnoop->max_blocks * 2 : 64;
+
+		entry = realloc(btsnoop->blocks, max * sizeof(*entry));
+		if (!entry)
+			return false;
+
+		btsnoop->blocks = entry;
+		btsnoop->max_blocks = max;
+	}
+
+	entry = &btsnoop->blocks[btsnoop->num_blocks++];
+	entry->offset = btsnoop->cur_size;
+	entry->ts = btsnoop->block_ts;
+	entry->count = btsnoop->block_count;
+
+	blk.len = htobe32(len);
+	blk.size = htobe32(btsnoop->block_len);
+	blk.count = htobe32(btsnoop->block_count);
+	blk.ts = htobe64(btsnoop->block_ts);
+
+	btsnoop->block_len = 0;
+	btsnoop->block_count = 0;
+
+	if (!write_all(btsnoop->fd, (void *) &blk, BTSNOOP_BLOCK_HDR_SIZE) ||
+				!write_all(btsnoop->fd, data, len))
 		return false;
 
-	btsnoop->cur_size = BTSNOOP_HDR_SIZE;
+	btsnoop->cur_size += BTSNOOP_BLOCK_HDR_SIZE + len;
+
+	return true;
+}
+
+static bool block_append(struct btsnoop *btsnoop,
+				const struct btsnoop_pkt *pkt,
+				const void *data, uint16_t size)
+{
+	if (btsnoop->block_len + BTSNOOP_PKT_SIZE + size > BTSNOOP_BLOCK_MAX &&
+						!block_flush(btsnoop))
+		return false;
+
+	if (!btsnoop->block_count)
+		btsnoop->block_ts = be64toh(pkt->ts);
+
+	memcpy(btsnoop->block + btsnoop->block_len, pkt, BTSNOOP_PKT_SIZE);
+	btsnoop->block_len += BTSNOOP_PKT_SIZE;
+
+	if (data && size > 0) {
+		memcpy(btsnoop->block + btsnoop->block_len, data, size);
+		btsnoop->block_len += size;
+	}
+
+	btsnoop->block_count++;
+
+	if (be64toh(pkt->ts) - btsnoop->block_ts >= BTSNOOP_BLOCK_USEC)
+		return block_flush(btsnoop);
 
 	return true;
 }
 
+struct btsnoop *btsnoop_ref(struct btsnoop *btsnoop)
+{
+	if (!btsnoop)
+		return NULL;
+
+	__sync_fetch_and_add(&btsnoop->ref_count, 1);
+
+	return btsnoop;
+}
+
+void btsnoop_unref(struct btsnoop *btsnoop)
+{
+	if (!btsnoop)
+		return;
+
+	if (__sync_sub_and_fetch(&btsnoop->ref_count, 1))
+		return;
+
+	if (btsnoop->compress && btsnoop->fd >= 0) {
+		block_flush(btsnoop);
+		write_index(btsnoop);
+	}
+
+	if (btsnoop->fd >= 0)
+		close(btsnoop->fd);
+
+	free_blocks(btsnoop);
+	free(btsnoop);
+}
+
+bool btsnoop_flush(struct btsnoop *btsnoop)
+{
+	if (!btsnoop || btsnoop->fd < 0)
+		return false;
+
+	/* Uncompressed records are written right away */
+	if (!btsnoop->compress)
+		return true;
+
+	return block_flush(btsnoop);
+}
+
+uint32_t btsnoop_get_format(struct btsnoop *btsnoop)
+{
+	if (!btsnoop)
+		return BTSNOOP_FORMAT_INVALID;
+
+	return btsnoop->format;
+}
+
 bool btsnoop_write(struct btsnoop *btsnoop, struct timeval *tv,
 			uint32_t flags, uint32_t drops, const void *data,
 			uint16_t size)
@@ -258,7 +527,7 @@ bool btsnoop_write(struct btsnoop *btsnoop, struct timeval *tv,
 	if (!btsnoop || !tv)
 		return false;
 
-	if (btsnoop->max_size && btsnoop->max_size <=
+	if (!btsnoop->compress && btsnoop->max_size && btsnoop->max_size <=
 			btsnoop->cur_size + size + BTSNOOP_PKT_SIZE)
 		if (!btsnoop_rotate(btsnoop))
 			return false;
@@ -271,6 +540,9 @@ bool btsnoop_write(struct btsnoop *btsnoop, struct timeval *tv,
 	pkt.drops = htobe32(drops);
 	pkt.ts    = htobe64(ts + 0x00E03AB44A676000ll);
 
+	if (btsnoop->compress)
+		return block_append(btsnoop, &pkt, data, size);
+
 	written = write(btsnoop->fd, &pkt, BTSNOOP_PKT_SIZE);
 	if (written < 0)
 		return false;
@@ -288,6 +560,81 @@ bool btsnoop_write(struct btsnoop *btsnoop, struct timeval *tv,
 	return true;
 }
 
+void btsnoop_encode_hci(void *buf, struct timeval *tv, uint16_t index,
+				uint16_t opcode, uint32_t drops, uint16_t size)
+{
+	struct btsnoop_pkt pkt;
+	uint64_t ts;
+
+	ts = (tv->tv_sec - 946684800ll) * 1000000ll + tv->tv_usec;
+
+	pkt.size  = htobe32(size);
+	pkt.len   = htobe32(size);
+	pkt.flags = htobe32(((uint32_t) index << 16) | opcode);
+	pkt.drops = htobe32(drops);
+	pkt.ts    = htobe64(ts + 0x00E03AB44A676000ll);
+
+	memcpy(buf, &pkt, BTSNOOP_PKT_SIZE);
+}
+
+ssize_t btsnoop_write_records(struct btsnoop *btsnoop, const void *data,
+								size_t size)
+{
+	const uint8_t *ptr = data;
+	size_t run = 0, total = 0;
+
+	if (!btsnoop || btsnoop->fd < 0)
+		return -1;
+
+	while (size - run >= BTSNOOP_PKT_SIZE) {
+		const struct btsnoop_pkt *pkt = (const void *) (ptr + run);
+		size_t len = BTSNOOP_PKT_SIZE + be32toh(pkt->len);
+
+		/* A trailing partial record is left to the caller */
+		if (size - run < len)
+			break;
+
+		if (btsnoop->compress) {
+			if (!block_append(btsnoop, pkt, pkt->data,
+							len - BTSNOOP_PKT_SIZE))
+				return -1;
+
+			run += len;
+			continue;
+		}
+
+		/* Rotate at the same record as btsnoop_write() would */
+		if (btsnoop->max_size && btsnoop->max_size <=
+					btsnoop->cur_size + run + len) {
+			if (!write_all(btsnoop->fd, ptr, run))
+				return -1;
+
+			btsnoop->cur_size += run;
+			total += run;
+			ptr += run;
+			size -= run;
+
+			if (!btsnoop_rotate(btsnoop))
+				return -1;
+
+			run = len;
+			continue;
+		}
+
+		run += len;
+	}
+
+	if (btsnoop->compress)
+		return run;
+
+	if (!write_all(btsnoop->fd, ptr, run))
+		return -1;
+
+	btsnoop->cur_size += run;
+
+	return total + run;
+}
+
 static uint32_t get_flags_from_opcode(uint16_t opcode)
 {
 	switch (opcode) {
@@ -464,6 +811,94 @@ static bool pklg_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 	return true;
 }
 
+static bool block_load(struct btsnoop *btsnoop)
+{
+	struct btsnoop_block blk;
+	uint32_t len, size;
+	ssize_t result;
+
+	btsnoop->block_len = 0;
+	btsnoop->block_pos = 0;
+
+	result = read(btsnoop->fd, &blk, BTSNOOP_BLOCK_HDR_SIZE);
+	if (result == 0)
+		return false;
+
+	if (result != BTSNOOP_BLOCK_HDR_SIZE)
+		goto failed;
+
+	len = be32toh(blk.len);
+	size = be32toh(blk.size);
+
+	switch (be32toh(blk.type)) {
+	case BTSNOOP_BLOCK_STORED:
+		if (size > BTSNOOP_BLOCK_MAX || len != size)
+			goto failed;
+
+		if (read(btsnoop->fd, btsnoop->block, len) != len)
+			goto failed;
+		break;
+
+	case BTSNOOP_BLOCK_LZ4:
+		if (size > BTSNOOP_BLOCK_MAX ||
+				len > LZ4_COMPRESS_BOUND(BTSNOOP_BLOCK_MAX))
+			goto failed;
+
+		if (read(btsnoop->fd, btsnoop->zblock, len) != len)
+			goto failed;
+
+		if (lz4_decompress(btsnoop->zblock, len, btsnoop->block,
+							size) != size)
+			goto failed;
+		break;
+
+	case BTSNOOP_BLOCK_INDEX:
+		/* No more records */
+		return false;
+
+	default:
+		goto failed;
+	}
+
+	btsnoop->block_len = size;
+
+	return true;
+
+failed:
+	btsnoop->aborted = true;
+	return false;
+}
+
+static ssize_t read_data(struct btsnoop *btsnoop, void *data, size_t size)
+{
+	size_t copied = 0;
+
+	if (!btsnoop->decompress)
+		return read(btsnoop->fd, data, size);
+
+	while (copied < size) {
+		size_t len;
+
+		if (btsnoop->block_pos == btsnoop->block_len &&
+						!block_load(btsnoop))
+			break;
+
+		len = btsnoop->block_len - btsnoop->block_pos;
+		if (len > size - copied)
+			len = size - copied;
+
+		memcpy((uint8_t *) data + copied,
+				btsnoop->block + btsnoop->block_pos, len);
+		btsnoop->block_pos += len;
+		copied += len;
+	}
+
+	if (btsnoop->aborted)
+		return -1;
+
+	return copied;
+}
+
 static uint16_t get_opcode_from_flags(uint8_t type, uint32_t flags)
 {
 	switch (type) {
@@ -520,7 +955,7 @@ bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 	if (btsnoop->pklg_format)
 		return pklg_read_hci(btsnoop, tv, index, opcode, data, size);
 
-	len = read(btsnoop->fd, &pkt, BTSNOOP_PKT_SIZE);
+	len = read_data(btsnoop, &pkt, BTSNOOP_PKT_SIZE);
 	if (len == 0)
 		return false;
 
@@ -548,7 +983,7 @@ bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 		break;
 
 	case BTSNOOP_FORMAT_UART:
-		len = read(btsnoop->fd, &pkt_type, 1);
+		len = read_data(btsnoop, &pkt_type, 1);
 		if (len < 0) {
 			btsnoop->aborted = true;
 			return false;
@@ -569,7 +1004,7 @@ bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 		return false;
 	}
 
-	len = read(btsnoop->fd, data, toread);
+	len = read_data(btsnoop, data, toread);
 	if (len < 0) {
 		btsnoop->aborted = true;
 		return false;
@@ -580,8 +1015,1098 @@ bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 	return true;
 }
 
-bool btsnoop_read_phy(struct btsnoop *btsnoop, struct timeval *tv,
-			uint16_t *frequency, void *data, uint16_t *size)
+static bool read_block_index(struct btsnoop *btsnoop, uint64_t ts,
+							off_t *offset)
 {
-	return false;
+	struct btsnoop_block_trailer trailer;
+	struct btsnoop_block_entry *entries;
+	struct btsnoop_block blk;
+	uint32_t count, first, last;
+	struct stat st;
+	off_t idx_offset;
+
+	if (fstat(btsnoop->fd, &st) < 0 || st.st_size <
+			(off_t) (BTSNOOP_HDR_SIZE + BTSNOOP_BLOCK_HDR_SIZE +
+					BTSNOOP_BLOCK_TRAILER_SIZE))
+		return false;
+
+	if (pread(btsnoop->fd, &trailer, BTSNOOP_BLOCK_TRAILER_SIZE,
+			st.st_size - BTSNOOP_BLOCK_TRAILER_SIZE) !=
+					BTSNOOP_BLOCK_TRAILER_SIZE)
+		return false;
+
+	if (memcmp(trailer.id, btsnoop_lz4_id, sizeof(btsnoop_lz4_id)))
+		return false;
+
+	idx_offset = be64toh(trailer.offset);
+	if (idx_offset < (off_t) BTSNOOP_HDR_SIZE || idx_offset > st.st_size)
+		return false;
+
+	if (pread(btsnoop->fd, &blk, BTSNOOP_BLOCK_HDR_SIZE, idx_offset) !=
+						BTSNOOP_BLOCK_HDR_SIZE)
+		return false;
+
+	count = be32toh(blk.count);
+
+	if (be32toh(blk.type) != BTSNOOP_BLOCK_INDEX ||
+			be32toh(blk.len) != count * BTSNOOP_BLOCK_ENTRY_SIZE ||
+			idx_offset + BTSNOOP_BLOCK_HDR_SIZE + be32toh(blk.len) +
+			BTSNOOP_BLOCK_TRAILER_SIZE != (uint64_t) st.st_size)
+		return false;
+
+	if (!count) {
+		*offset = idx_offset;
+		return true;
+	}
+
+	entries = malloc(count * BTSNOOP_BLOCK_ENTRY_SIZE);
+	if (!entries)
+		return false;
+
+	if (pread(btsnoop->fd, entries, count * BTSNOOP_BLOCK_ENTRY_SIZE,
+			idx_offset + BTSNOOP_BLOCK_HDR_SIZE) !=
+			(ssize_t) (count * BTSNOOP_BLOCK_ENTRY_SIZE)) {
+		free(entries);
+		return false;
+	}
+
+	/* Last block starting at or before ts */
+	first = 0;
+	last = count;
+
+	while (last - first > 1) {
+		uint32_t mid = first + (last - first) / 2;
+
+		if (be64toh(entries[mid].ts) <= ts)
+			first = mid;
+		else
+			last = mid;
+	}
+
+	*offset = be64toh(entries[first].offset);
+
+	free(entries);
+
+	return true;
+}
+
+static off_t scan_blocks(struct btsnoop *btsnoop, uint64_t ts)
+{
+	struct btsnoop_block blk;
+	off_t pos = BTSNOOP_HDR_SIZE, offset = BTSNOOP_HDR_SIZE;
+
+	/* Files without index, e.g. from an unclean shutdown */
+	while (pread(btsnoop->fd, &blk, BTSNOOP_BLOCK_HDR_SIZE, pos) ==
+						BTSNOOP_BLOCK_HDR_SIZE) {
+		if (be32toh(blk.type) == BTSNOOP_BLOCK_INDEX ||
+						be64toh(blk.ts) > ts)
+			break;
+
+		offset = pos;
+		pos += BTSNOOP_BLOCK_HDR_SIZE + be32toh(blk.len);
+	}
+
+	return offset;
+}
+
+bool btsnoop_seek(struct btsnoop *btsnoop, struct timeval *tv)
+{
+	uint64_t ts;
+	off_t offset;
+
+	if (!btsnoop || !btsnoop->decompress)
+		return false;
+
+	ts = (tv->tv_sec - 946684800ll) * 1000000ll + tv->tv_usec;
+	ts += 0x00E03AB44A676000ll;
+
+	if (!read_block_index(btsnoop, ts, &offset))
+		offset = scan_blocks(btsnoop, ts);
+
+	if (lseek(btsnoop->fd, offset, SEEK_SET) < 0)
+		return false;
+
+	btsnoop->aborted = false;
+
+	if (!block_load(btsnoop))
+		return !btsnoop->aborted;
+
+	/* Skip records of the block that are older than tv */
+	while (btsnoop->block_len - btsnoop->block_pos >= BTSNOOP_PKT_SIZE) {
+		const struct btsnoop_pkt *pkt = (const void *) (btsnoop->block +
+							btsnoop->block_pos);
+
+		if (be64toh(pkt->ts) >= ts)
+			break;
+
+		btsnoop->block_pos += BTSNOOP_PKT_SIZE + be32toh(pkt->len);
+	}
+
+	if (btsnoop->block_pos > btsnoop->block_len)
+		btsnoop->block_pos = btsnoop->block_len;
+
+	return true;
+}
+
+bool btsnoop_read_phy(struct btsnoop *btsnoop, struct timeval *tv,
+			uint16_t *frequency, void *data, uint16_t *size)
+{
+	return false;
+}
+
+struct btsnoop_index_hdr {
+	uint8_t		id[8];		/* Identification Pattern */
+	uint32_t	version;	/* Version Number = 1 */
+	uint32_t	count;		/* Number of entries */
+	uint64_t	file_size;	/* Size of the indexed file */
+	uint64_t	file_mtime;	/* Modification time in nanoseconds */
+} __attribute__ ((packed));
+#define BTSNOOP_INDEX_HDR_SIZE (sizeof(struct btsnoop_index_hdr))
+
+struct btsnoop_index_entry {
+	uint64_t	offset;		/* Offset of the record header */
+	int64_t		ts;		/* Timestamp microseconds since epoch */
+	uint16_t	index;
+	uint16_t	opcode;
+	uint16_t	handle;
+	uint16_t	size;
+} __attribute__ ((packed));
+#define BTSNOOP_INDEX_ENTRY_SIZE (sizeof(struct btsnoop_index_entry))
+
+static const uint8_t btsnoop_index_id[] = { 0x62, 0x74, 0x73, 0x6e,
+					    0x69, 0x64, 0x78, 0x00 };
+
+static const uint32_t btsnoop_index_version = 2;
+
+struct btsnoop_index {
+	char *path;
+	const uint8_t *map;
+	size_t map_size;
+	bool inflated;
+	uint64_t mtime;
+	uint32_t format;
+	bool pklg_format;
+	bool pklg_v2;
+	size_t offset;
+	struct btsnoop_index_entry *entries;
+	size_t count;
+	size_t pos;
+	bool sorted;
+};
+
+static char *index_path(const char *path)
+{
+	char *idx_path;
+
+	if (asprintf(&idx_path, "%s.idx", path) < 0)
+		return NULL;
+
+	return idx_path;
+}
+
+/* Expand a compressed file into memory in the uncompressed format */
+static uint8_t *inflate_blocks(const uint8_t *map, size_t map_size,
+							size_t *size)
+{
+	const struct btsnoop_block *blk;
+	struct btsnoop_hdr *hdr;
+	size_t offset, len = BTSNOOP_HDR_SIZE;
+	uint8_t *buf;
+
+	for (offset = BTSNOOP_HDR_SIZE; offset + BTSNOOP_BLOCK_HDR_SIZE <=
+				map_size; offset += be32toh(blk->len)) {
+		blk = (const void *) (map + offset);
+		offset += BTSNOOP_BLOCK_HDR_SIZE;
+
+		if (be32toh(blk->type) == BTSNOOP_BLOCK_INDEX)
+			break;
+
+		if (be32toh(blk->size) > BTSNOOP_BLOCK_MAX)
+			return NULL;
+
+		/* Last block of a file that was not closed cleanly */
+		if (be32toh(blk->len) > map_size - offset)
+			break;
+
+		len += be32toh(blk->size);
+	}
+
+	buf = malloc(len);
+	if (!buf)
+		return NULL;
+
+	hdr = (void *) buf;
+	memcpy(hdr, map, BTSNOOP_HDR_SIZE);
+	memcpy(hdr->id, btsnoop_id, sizeof(btsnoop_id));
+
+	*size = BTSNOOP_HDR_SIZE;
+
+	for (offset = BTSNOOP_HDR_SIZE; *size < len;
+					offset += be32toh(blk->len)) {
+		uint32_t blk_size;
+
+		blk = (const void *) (map + offset);
+		offset += BTSNOOP_BLOCK_HDR_SIZE;
+		blk_size = be32toh(blk->size);
+
+		switch (be32toh(blk->type)) {
+		case BTSNOOP_BLOCK_STORED:
+			if (be32toh(blk->len) != blk_size)
+				goto failed;
+
+			memcpy(buf + *size, map + offset, blk_size);
+			break;
+		case BTSNOOP_BLOCK_LZ4:
+			if (lz4_decompress(map + offset, be32toh(blk->len),
+					buf + *size, blk_size) != blk_size)
+				goto failed;
+			break;
+		default:
+			goto failed;
+		}
+
+		*size += blk_size;
+	}
+
+	return buf;
+
+failed:
+	free(buf);
+	return NULL;
+}
+
+struct btsnoop_index *btsnoop_index_open(const char *path,
+							unsigned long flags)
+{
+	struct btsnoop_index *idx;
+	const struct btsnoop_hdr *hdr;
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+					st.st_size < (off_t) BTSNOOP_HDR_SIZE) {
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED)
+		return NULL;
+
+	/* Records are walked front to back */
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	idx = calloc(1, sizeof(*idx));
+	if (!idx) {
+		munmap(map, st.st_size);
+		return NULL;
+	}
+
+	idx->map = map;
+	idx->map_size = st.st_size;
+	idx->mtime = st.st_mtim.tv_sec * 1000000000ull + st.st_mtim.tv_nsec;
+
+	hdr = map;
+
+	if (!memcmp(hdr->id, btsnoop_lz4_id, sizeof(btsnoop_lz4_id))) {
+		uint8_t *buf;
+		size_t size;
+
+		/* Records are walked in memory, so expand them once */
+		buf = inflate_blocks(map, st.st_size, &size);
+		munmap(map, st.st_size);
+
+		if (!buf) {
+			free(idx);
+			return NULL;
+		}
+
+		map = buf;
+		idx->map = buf;
+		idx->map_size = size;
+		idx->inflated = true;
+		hdr = map;
+	}
+
+	if (!memcmp(hdr->id, btsnoop_id, sizeof(btsnoop_id))) {
+		if (be32toh(hdr->version) != btsnoop_version)
+			goto failed;
+
+		idx->format = be32toh(hdr->type);
+		idx->offset = BTSNOOP_HDR_SIZE;
+	} else {
+		if (!(flags & BTSNOOP_FLAG_PKLG_SUPPORT))
+			goto failed;
+
+		if (hdr->id[0] != 0x00 ||
+				(hdr->id[1] != 0x00 && hdr->id[1] != 0x01))
+			goto failed;
+
+		idx->format = BTSNOOP_FORMAT_MONITOR;
+		idx->pklg_format = true;
+		idx->pklg_v2 = (hdr->id[1] == 0x01);
+		idx->offset = 0;
+	}
+
+	switch (idx->format) {
+	case BTSNOOP_FORMAT_HCI:
+	case BTSNOOP_FORMAT_UART:
+	case BTSNOOP_FORMAT_MONITOR:
+		break;
+	default:
+		goto failed;
+	}
+
+	idx->path = strdup(path);
+	if (!idx->path)
+		goto failed;
+
+	return idx;
+
+failed:
+	if (idx->inflated)
+		free(map);
+	else
+		munmap(map, st.st_size);
+
+	free(idx);
+
+	return NULL;
+}
+
+void btsnoop_index_close(struct btsnoop_index *idx)
+{
+	if (!idx)
+		return;
+
+	if (idx->inflated)
+		free((void *) idx->map);
+	else
+		munmap((void *) idx->map, idx->map_size);
+	free(idx->entries);
+	free(idx->path);
+	free(idx);
+}
+
+uint32_t btsnoop_index_get_format(struct btsnoop_index *idx)
+{
+	if (!idx)
+		return BTSNOOP_FORMAT_INVALID;
+
+	return idx->format;
+}
+
+/* Commands with a connection handle as first parameter */
+static const uint16_t cmd_handle[] = {
+	0x0406,		/* Disconnect */
+	0x040f,		/* Change Connection Packet Type */
+	0x0411,		/* Authentication Requested */
+	0x0413,		/* Set Connection Encryption */
+	0x041b,		/* Read Remote Supported Features */
+	0x041c,		/* Read Remote Extended Features */
+	0x041d,		/* Read Remote Version Information */
+	0x041f,		/* Read Clock Offset */
+	0x0420,		/* Read LMP Handle */
+	0x0428,		/* Setup Synchronous Connection */
+	0x0803,		/* Sniff Mode */
+	0x0804,		/* Exit Sniff Mode */
+	0x0809,		/* Role Discovery */
+	0x080c,		/* Read Link Policy Settings */
+	0x080d,		/* Write Link Policy Settings */
+	0x0811,		/* Sniff Subrating */
+	0x0c08,		/* Flush */
+	0x0c27,		/* Read Automatic Flush Timeout */
+	0x0c28,		/* Write Automatic Flush Timeout */
+	0x0c2d,		/* Read Transmit Power Level */
+	0x0c36,		/* Read Link Supervision Timeout */
+	0x0c37,		/* Write Link Supervision Timeout */
+	0x1401,		/* Read Failed Contact Counter */
+	0x1402,		/* Reset Failed Contact Counter */
+	0x1403,		/* Read Link Quality */
+	0x1405,		/* Read RSSI */
+	0x1406,		/* Read AFH Channel Map */
+	0x1408,		/* Read Encryption Key Size */
+	0x2013,		/* LE Connection Update */
+	0x2015,		/* LE Read Channel Map */
+	0x2016,		/* LE Read Remote Features */
+	0x2019,		/* LE Enable Encryption */
+	0x201a,		/* LE Long Term Key Request Reply */
+	0x201b,		/* LE Long Term Key Request Negative Reply */
+	0x2020,		/* LE Remote Conn Param Request Reply */
+	0x2021,		/* LE Remote Conn Param Request Negative Reply */
+	0x2022,		/* LE Set Data Length */
+	0x2030,		/* LE Read PHY */
+	0x2032,		/* LE Set PHY */
+};
+
+/* Events that establish, change or end a connection */
+static const uint16_t evt_handle[] = {
+	0x03,		/* Connection Complete */
+	0x05,		/* Disconnection Complete */
+	0x08,		/* Encryption Change */
+	0x0b,		/* Read Remote Supported Features */
+	0x0c,		/* Read Remote Version Information */
+	0x30,		/* Encryption Key Refresh Complete */
+	0x59,		/* Encryption Change v2 */
+};
+
+static const uint16_t le_handle_status[] = {
+	0x01,		/* LE Connection Complete */
+	0x03,		/* LE Connection Update Complete */
+	0x04,		/* LE Read Remote Features */
+	0x0a,		/* LE Enhanced Connection Complete */
+	0x0c,		/* LE PHY Update Complete */
+	0x29,		/* LE Enhanced Connection Complete v2 */
+};
+
+static const uint16_t le_handle[] = {
+	0x07,		/* LE Data Length Change */
+	0x14,		/* LE Channel Selection Algorithm */
+};
+
+/* Handle after the command opcode and parameter length */
+const struct btsnoop_handle_set btsnoop_cmd_handle = {
+	.codes = cmd_handle,
+	.count = ARRAY_SIZE(cmd_handle),
+	.offset = 3,
+};
+
+/* Handle after the event code, parameter length and status */
+const struct btsnoop_handle_set btsnoop_evt_handle = {
+	.codes = evt_handle,
+	.count = ARRAY_SIZE(evt_handle),
+	.offset = 3,
+};
+
+/* LE Meta subevents with the handle after the status */
+const struct btsnoop_handle_set btsnoop_le_handle_status = {
+	.codes = le_handle_status,
+	.count = ARRAY_SIZE(le_handle_status),
+	.offset = 4,
+};
+
+/* LE Meta subevents starting with the handle */
+const struct btsnoop_handle_set btsnoop_le_handle = {
+	.codes = le_handle,
+	.count = ARRAY_SIZE(le_handle),
+	.offset = 3,
+};
+
+static uint16_t handle_from_set(const struct btsnoop_handle_set *set,
+				uint16_t code, const uint8_t *data,
+				uint16_t size)
+{
+	unsigned int i;
+
+	if (size < set->offset + 2)
+		return 0xffff;
+
+	for (i = 0; i < set->count; i++) {
+		if (set->codes[i] == code)
+			return (data[set->offset] |
+					data[set->offset + 1] << 8) & 0x0fff;
+	}
+
+	return 0xffff;
+}
+
+static uint16_t get_handle(uint16_t opcode, const uint8_t *data, uint16_t size)
+{
+	uint16_t handle;
+
+	switch (opcode) {
+	case BTSNOOP_OPCODE_COMMAND_PKT:
+		if (size < 2)
+			break;
+
+		return handle_from_set(&btsnoop_cmd_handle,
+					data[0] | data[1] << 8, data, size);
+
+	case BTSNOOP_OPCODE_ACL_TX_PKT:
+	case BTSNOOP_OPCODE_ACL_RX_PKT:
+	case BTSNOOP_OPCODE_SCO_TX_PKT:
+	case BTSNOOP_OPCODE_SCO_RX_PKT:
+	case BTSNOOP_OPCODE_ISO_TX_PKT:
+	case BTSNOOP_OPCODE_ISO_RX_PKT:
+		if (size < 2)
+			break;
+
+		return (data[0] | data[1] << 8) & 0x0fff;
+
+	case BTSNOOP_OPCODE_EVENT_PKT:
+		if (size < 2)
+			break;
+
+		switch (data[0]) {
+		case 0x13:	/* Number Of Completed Packets */
+			if (size < 7 || !data[2])
+				break;
+
+			/* See btsnoop_record_has_handle() */
+			if (data[2] > 1)
+				return BTSNOOP_HANDLE_MULTIPLE;
+
+			return (data[3] | data[4] << 8) & 0x0fff;
+
+		case 0x3e:	/* LE Meta Event */
+			if (size < 3)
+				break;
+
+			handle = handle_from_set(&btsnoop_le_handle, data[2],
+								data, size);
+			if (handle != 0xffff)
+				return handle;
+
+			return handle_from_set(&btsnoop_le_handle_status,
+							data[2], data, size);
+
+		default:
+			return handle_from_set(&btsnoop_evt_handle, data[0],
+								data, size);
+		}
+		break;
+	}
+
+	return 0xffff;
+}
+
+static bool nocp_has_handle(const uint8_t *data, uint16_t size,
+							uint16_t handle)
+{
+	unsigned int i;
+
+	for (i = 0; i < data[2] && 7 + i * 4 <= size; i++) {
+		const uint8_t *ptr = data + 3 + i * 4;
+
+		if (((ptr[0] | ptr[1] << 8) & 0x0fff) == handle)
+			return true;
+	}
+
+	return false;
+}
+
+bool btsnoop_record_has_handle(const struct btsnoop_record *rec,
+							uint16_t handle)
+{
+	if (!rec)
+		return false;
+
+	if (rec->handle != BTSNOOP_HANDLE_MULTIPLE)
+		return rec->handle == handle;
+
+	return nocp_has_handle(rec->data, rec->size, handle);
+}
+
+/* Size of the record header in front of the packet data */
+static size_t record_hdr_size(struct btsnoop_index *idx)
+{
+	if (idx->pklg_format)
+		return PKLG_PKT_SIZE;
+
+	if (idx->format == BTSNOOP_FORMAT_UART)
+		return BTSNOOP_PKT_SIZE + 1;
+
+	return BTSNOOP_PKT_SIZE;
+}
+
+/*
+ * Parse the record at offset straight out of the mapping. Returns the
+ * offset of the next record, or 0 at the end of the file or if the record
+ * is truncated or malformed.
+ */
+static size_t parse_record(struct btsnoop_index *idx, size_t offset,
+						struct btsnoop_record *rec)
+{
+	const uint8_t *ptr = idx->map + offset;
+	size_t avail = idx->map_size - offset;
+	uint32_t len, flags;
+	uint64_t ts;
+
+	if (idx->pklg_format) {
+		const struct pklg_pkt *pkt = (const void *) ptr;
+
+		if (avail < PKLG_PKT_SIZE)
+			return 0;
+
+		if (idx->pklg_v2) {
+			len = le32toh(pkt->len) - (PKLG_PKT_SIZE - 4);
+
+			ts = le64toh(pkt->ts);
+			rec->tv.tv_sec = ts & 0xffffffff;
+			rec->tv.tv_usec = ts >> 32;
+		} else {
+			len = be32toh(pkt->len) - (PKLG_PKT_SIZE - 4);
+
+			ts = be64toh(pkt->ts);
+			rec->tv.tv_sec = ts >> 32;
+			rec->tv.tv_usec = ts & 0xffffffff;
+		}
+
+		if (len > BTSNOOP_MAX_PACKET_SIZE ||
+					len > avail - PKLG_PKT_SIZE)
+			return 0;
+
+		rec->index = 0x0000;
+
+		switch (pkt->type) {
+		case 0x00:
+			rec->opcode = BTSNOOP_OPCODE_COMMAND_PKT;
+			break;
+		case 0x01:
+			rec->opcode = BTSNOOP_OPCODE_EVENT_PKT;
+			break;
+		case 0x02:
+			rec->opcode = BTSNOOP_OPCODE_ACL_TX_PKT;
+			break;
+		case 0x03:
+			rec->opcode = BTSNOOP_OPCODE_ACL_RX_PKT;
+			break;
+		case 0x08:
+			rec->opcode = BTSNOOP_OPCODE_SCO_TX_PKT;
+			break;
+		case 0x09:
+			rec->opcode = BTSNOOP_OPCODE_SCO_RX_PKT;
+			break;
+		case 0x12:
+			rec->opcode = BTSNOOP_OPCODE_ISO_TX_PKT;
+			break;
+		case 0x13:
+			rec->opcode = BTSNOOP_OPCODE_ISO_RX_PKT;
+			break;
+		case 0x0b:
+			rec->opcode = BTSNOOP_OPCODE_VENDOR_DIAG;
+			break;
+		case 0xfc:
+			rec->index = 0xffff;
+			rec->opcode = BTSNOOP_OPCODE_SYSTEM_NOTE;
+			break;
+		default:
+			rec->index = 0xffff;
+			rec->opcode = 0xffff;
+			break;
+		}
+
+		rec->data = ptr + PKLG_PKT_SIZE;
+		rec->size = len;
+		rec->handle = get_handle(rec->opcode, rec->data, rec->size);
+
+		return offset + PKLG_PKT_SIZE + len;
+	} else {
+		const struct btsnoop_pkt *pkt = (const void *) ptr;
+
+		if (avail < BTSNOOP_PKT_SIZE)
+			return 0;
+
+		len = be32toh(pkt->len);
+		if (len > BTSNOOP_MAX_PACKET_SIZE ||
+					len > avail - BTSNOOP_PKT_SIZE)
+			return 0;
+
+		flags = be32toh(pkt->flags);
+
+		ts = be64toh(pkt->ts) - 0x00E03AB44A676000ll;
+		rec->tv.tv_sec = (ts / 1000000ll) + 946684800ll;
+		rec->tv.tv_usec = ts % 1000000ll;
+
+		rec->data = pkt->data;
+		rec->size = len;
+
+		switch (idx->format) {
+		case BTSNOOP_FORMAT_HCI:
+			rec->index = 0;
+			rec->opcode = get_opcode_from_flags(0xff, flags);
+			break;
+
+		case BTSNOOP_FORMAT_UART:
+			if (len < 1)
+				return 0;
+
+			rec->index = 0;
+			rec->opcode = get_opcode_from_flags(pkt->data[0],
+									flags);
+			rec->data++;
+			rec->size--;
+			break;
+
+		case BTSNOOP_FORMAT_MONITOR:
+			rec->index = flags >> 16;
+			rec->opcode = flags & 0xffff;
+			break;
+		}
+
+		rec->handle = get_handle(rec->opcode, rec->data, rec->size);
+
+		return offset + BTSNOOP_PKT_SIZE + len;
+	}
+}
+
+bool btsnoop_index_next(struct btsnoop_index *idx,
+					struct btsnoop_record *rec)
+{
+	size_t next;
+
+	if (!idx || !rec)
+		return false;
+
+	/* With a table the position is a record number, else an offset */
+	if (idx->entries)
+		return btsnoop_index_get(idx, idx->pos++, rec);
+
+	if (idx->offset >= idx->map_size)
+		return false;
+
+	next = parse_record(idx, idx->offset, rec);
+	if (!next) {
+		idx->offset = idx->map_size;
+		return false;
+	}
+
+	idx->offset = next;
+
+	return true;
+}
+
+static int64_t tv_to_ts(const struct timeval *tv)
+{
+	return (int64_t) tv->tv_sec * 1000000ll + tv->tv_usec;
+}
+
+static bool index_build(struct btsnoop_index *idx)
+{
+	struct btsnoop_record rec;
+	size_t offset = idx->pklg_format ? 0 : BTSNOOP_HDR_SIZE;
+	size_t size = 0;
+	int64_t last = INT64_MIN;
+
+	idx->count = 0;
+	idx->sorted = true;
+
+	while (offset < idx->map_size) {
+		struct btsnoop_index_entry *entry;
+		size_t next;
+
+		next = parse_record(idx, offset, &rec);
+		if (!next)
+			break;
+
+		if (idx->count == size) {
+			void *entries;
+
+			size = size ? size * 2 : 1024;
+			entries = realloc(idx->entries,
+					size * BTSNOOP_INDEX_ENTRY_SIZE);
+			if (!entries)
+				return false;
+
+			idx->entries = entries;
+		}
+
+		entry = &idx->entries[idx->count++];
+		entry->offset = offset;
+		entry->ts = tv_to_ts(&rec.tv);
+		entry->index = rec.index;
+		entry->opcode = rec.opcode;
+		entry->handle = rec.handle;
+		entry->size = rec.size;
+
+		if (entry->ts < last)
+			idx->sorted = false;
+
+		last = entry->ts;
+		offset = next;
+	}
+
+	return true;
+}
+
+static bool index_load_file(struct btsnoop_index *idx)
+{
+	struct btsnoop_index_hdr hdr;
+	char *path;
+	ssize_t len;
+	size_t i, size;
+	int64_t last = INT64_MIN;
+	size_t hdr_size = record_hdr_size(idx);
+	int fd;
+
+	path = index_path(idx->path);
+	if (!path)
+		return false;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	free(path);
+
+	if (fd < 0)
+		return false;
+
+	len = read(fd, &hdr, BTSNOOP_INDEX_HDR_SIZE);
+	if (len != BTSNOOP_INDEX_HDR_SIZE)
+		goto failed;
+
+	/* A stale index is ignored and rebuilt */
+	if (memcmp(hdr.id, btsnoop_index_id, sizeof(btsnoop_index_id)) ||
+			le32toh(hdr.version) != btsnoop_index_version ||
+			le64toh(hdr.file_size) != idx->map_size ||
+			le64toh(hdr.file_mtime) != idx->mtime)
+		goto failed;
+
+	idx->count = le32toh(hdr.count);
+	if (idx->count > SIZE_MAX / BTSNOOP_INDEX_ENTRY_SIZE)
+		goto failed;
+
+	size = idx->count * BTSNOOP_INDEX_ENTRY_SIZE;
+
+	idx->entries = malloc(size ? size : 1);
+	if (!idx->entries)
+		goto failed;
+
+	len = read(fd, idx->entries, size);
+	if (len < 0 || (size_t) len != size)
+		goto failed;
+
+	close(fd);
+
+	idx->sorted = true;
+
+	for (i = 0; i < idx->count; i++) {
+		struct btsnoop_index_entry *entry = &idx->entries[i];
+
+		entry->offset = le64toh(entry->offset);
+		entry->ts = le64toh(entry->ts);
+		entry->index = le16toh(entry->index);
+		entry->opcode = le16toh(entry->opcode);
+		entry->handle = le16toh(entry->handle);
+		entry->size = le16toh(entry->size);
+
+		/* Records are read straight out of the mapping */
+		if (entry->offset > idx->map_size ||
+				hdr_size + entry->size >
+					idx->map_size - entry->offset)
+			goto invalid;
+
+		if (entry->ts < last)
+			idx->sorted = false;
+
+		last = entry->ts;
+	}
+
+	return true;
+
+failed:
+	close(fd);
+invalid:
+	free(idx->entries);
+	idx->entries = NULL;
+	idx->count = 0;
+
+	return false;
+}
+
+bool btsnoop_index_load(struct btsnoop_index *idx)
+{
+	if (!idx)
+		return false;
+
+	if (idx->entries)
+		return true;
+
+	if (!index_load_file(idx) && !index_build(idx)) {
+		free(idx->entries);
+		idx->entries = NULL;
+		idx->count = 0;
+		return false;
+	}
+
+	idx->pos = 0;
+
+	return true;
+}
+
+bool btsnoop_index_save(struct btsnoop_index *idx)
+{
+	struct btsnoop_index_hdr hdr;
+	struct btsnoop_index_entry entry;
+	char *path, tmp[PATH_MAX];
+	size_t i;
+	FILE *fp;
+	int fd;
+
+	if (!btsnoop_index_load(idx))
+		return false;
+
+	path = index_path(idx->path);
+	if (!path)
+		return false;
+
+	/* Write to a temporary file so readers never see a partial index */
+	snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+
+	fd = mkostemp(tmp, O_CLOEXEC);
+	if (fd < 0) {
+		free(path);
+		return false;
+	}
+
+	if (fchmod(fd, 0644) < 0) {
+		close(fd);
+		goto failed;
+	}
+
+	fp = fdopen(fd, "w");
+	if (!fp) {
+		close(fd);
+		goto failed;
+	}
+
+	memcpy(hdr.id, btsnoop_index_id, sizeof(btsnoop_index_id));
+	hdr.version = htole32(btsnoop_index_version);
+	hdr.count = htole32(idx->count);
+	hdr.file_size = htole64(idx->map_size);
+	hdr.file_mtime = htole64(idx->mtime);
+
+	if (fwrite(&hdr, BTSNOOP_INDEX_HDR_SIZE, 1, fp) != 1) {
+		fclose(fp);
+		goto failed;
+	}
+
+	for (i = 0; i < idx->count; i++) {
+		entry.offset = htole64(idx->entries[i].offset);
+		entry.ts = htole64(idx->entries[i].ts);
+		entry.index = htole16(idx->entries[i].index);
+		entry.opcode = htole16(idx->entries[i].opcode);
+		entry.handle = htole16(idx->entries[i].handle);
+		entry.size = htole16(idx->entries[i].size);
+
+		if (fwrite(&entry, BTSNOOP_INDEX_ENTRY_SIZE, 1, fp) != 1) {
+			fclose(fp);
+			goto failed;
+		}
+	}
+
+	if (fclose(fp) || rename(tmp, path) < 0)
+		goto failed;
+
+	free(path);
+
+	return true;
+
+failed:
+	unlink(tmp);
+	free(path);
+
+	return false;
+}
+
+size_t btsnoop_index_count(struct btsnoop_index *idx)
+{
+	if (!btsnoop_index_load(idx))
+		return 0;
+
+	return idx->count;
+}
+
+bool btsnoop_index_get(struct btsnoop_index *idx, size_t pos,
+						struct btsnoop_record *rec)
+{
+	const struct btsnoop_index_entry *entry;
+	size_t hdr_size;
+
+	if (!btsnoop_index_load(idx) || !rec || pos >= idx->count)
+		return false;
+
+	entry = &idx->entries[pos];
+
+	/* Only the table is touched, the record itself is not parsed */
+	hdr_size = record_hdr_size(idx);
+
+	rec->tv.tv_sec = entry->ts / 1000000ll;
+	rec->tv.tv_usec = entry->ts % 1000000ll;
+	rec->index = entry->index;
+	rec->opcode = entry->opcode;
+	rec->handle = entry->handle;
+	rec->size = entry->size;
+	rec->data = idx->map + entry->offset + hdr_size;
+
+	return true;
+}
+
+bool btsnoop_index_seek(struct btsnoop_index *idx, size_t pos)
+{
+	if (!btsnoop_index_load(idx) || pos > idx->count)
+		return false;
+
+	idx->pos = pos;
+
+	return true;
+}
+
+size_t btsnoop_index_find_time(struct btsnoop_index *idx,
+						const struct timeval *tv)
+{
+	int64_t ts;
+	size_t lo, hi;
+
+	if (!btsnoop_index_load(idx) || !tv)
+		return 0;
+
+	ts = tv_to_ts(tv);
+
+	if (!idx->sorted) {
+		for (lo = 0; lo < idx->count; lo++) {
+			if (idx->entries[lo].ts >= ts)
+				break;
+		}
+
+		return lo;
+	}
+
+	lo = 0;
+	hi = idx->count;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (idx->entries[mid].ts < ts)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+size_t btsnoop_index_find_handle(struct btsnoop_index *idx, size_t pos,
+					uint16_t index, uint16_t handle)
+{
+	if (!btsnoop_index_load(idx))
+		return 0;
+
+	for (; pos < idx->count; pos++) {
+		const struct btsnoop_index_entry *entry = &idx->entries[pos];
+
+		if (entry->handle != handle) {
+			struct btsnoop_record rec;
+
+			if (entry->handle != BTSNOOP_HANDLE_MULTIPLE)
+				continue;
+
+			btsnoop_index_get(idx, pos, &rec);
+			if (!btsnoop_record_has_handle(&rec, handle))
+				continue;
+		}
+
+		if (index != 0xffff && entry->index != index)
+			continue;
+
+		break;
+	}
+
+	return pos;
 }
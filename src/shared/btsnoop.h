@@ -11,6 +11,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <sys/time.h>
+#include <sys/types.h>
 
 #define BTSNOOP_FORMAT_INVALID		0
 #define BTSNOOP_FORMAT_HCI		1001
@@ -90,12 +91,23 @@ struct btsnoop;
 struct btsnoop *btsnoop_open(const char *path, unsigned long flags);
 struct btsnoop *btsnoop_create(const char *path, size_t max_size,
 				unsigned int max_count, uint32_t format);
+struct btsnoop *btsnoop_create_compressed(const char *path, size_t max_size,
+				unsigned int max_count, uint32_t format);
 
 struct btsnoop *btsnoop_ref(struct btsnoop *btsnoop);
 void btsnoop_unref(struct btsnoop *btsnoop);
 
 uint32_t btsnoop_get_format(struct btsnoop *btsnoop);
 
+/*
+ * Compressed files keep the current block in memory. Writers should call
+ * btsnoop_flush() at this interval in seconds so quiet traces reach the
+ * disk as well.
+ */
+#define BTSNOOP_FLUSH_INTERVAL		5
+
+bool btsnoop_flush(struct btsnoop *btsnoop);
+
 bool btsnoop_write(struct btsnoop *btsnoop, struct timeval *tv, uint32_t flags,
 			uint32_t drops, const void *data, uint16_t size);
 bool btsnoop_write_hci(struct btsnoop *btsnoop, struct timeval *tv,
@@ -104,8 +116,72 @@ bool btsnoop_write_hci(struct btsnoop *btsnoop, struct timeval *tv,
 bool btsnoop_write_phy(struct btsnoop *btsnoop, struct timeval *tv,
 			uint16_t frequency, const void *data, uint16_t size);
 
+/* Record header of monitor format files, followed by size octets of data */
+#define BTSNOOP_RECORD_HDR_SIZE		24
+
+void btsnoop_encode_hci(void *buf, struct timeval *tv, uint16_t index,
+				uint16_t opcode, uint32_t drops, uint16_t size);
+ssize_t btsnoop_write_records(struct btsnoop *btsnoop, const void *data,
+								size_t size);
+
 bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 					uint16_t *index, uint16_t *opcode,
 					void *data, uint16_t *size);
 bool btsnoop_read_phy(struct btsnoop *btsnoop, struct timeval *tv,
 			uint16_t *frequency, void *data, uint16_t *size);
+
+bool btsnoop_seek(struct btsnoop *btsnoop, struct timeval *tv);
+
+struct btsnoop_record {
+	struct timeval tv;
+	uint16_t index;
+	uint16_t opcode;
+	uint16_t handle;	/* 0xffff if not connection related,
+				 * BTSNOOP_HANDLE_MULTIPLE if several */
+	uint16_t size;
+	const void *data;	/* Points into the mapped file */
+};
+
+#define BTSNOOP_HANDLE_MULTIPLE	0xfffe
+
+/*
+ * Packets with a connection handle at a fixed offset, keyed by command
+ * opcode, event code or LE Meta subevent. Number Of Completed Packets
+ * is handled separately since it can carry several handles.
+ */
+struct btsnoop_handle_set {
+	const uint16_t *codes;
+	unsigned int count;
+	uint8_t offset;
+};
+
+extern const struct btsnoop_handle_set btsnoop_cmd_handle;
+extern const struct btsnoop_handle_set btsnoop_evt_handle;
+extern const struct btsnoop_handle_set btsnoop_le_handle_status;
+extern const struct btsnoop_handle_set btsnoop_le_handle;
+
+bool btsnoop_record_has_handle(const struct btsnoop_record *rec,
+							uint16_t handle);
+
+struct btsnoop_index;
+
+struct btsnoop_index *btsnoop_index_open(const char *path,
+							unsigned long flags);
+void btsnoop_index_close(struct btsnoop_index *idx);
+
+uint32_t btsnoop_index_get_format(struct btsnoop_index *idx);
+
+bool btsnoop_index_next(struct btsnoop_index *idx,
+					struct btsnoop_record *rec);
+
+bool btsnoop_index_load(struct btsnoop_index *idx);
+bool btsnoop_index_save(struct btsnoop_index *idx);
+
+size_t btsnoop_index_count(struct btsnoop_index *idx);
+bool btsnoop_index_get(struct btsnoop_index *idx, size_t pos,
+						struct btsnoop_record *rec);
+bool btsnoop_index_seek(struct btsnoop_index *idx, size_t pos);
+size_t btsnoop_index_find_time(struct btsnoop_index *idx,
+						const struct timeval *tv);
+size_t btsnoop_index_find_handle(struct btsnoop_index *idx, size_t pos,
+					uint16_t index, uint16_t handle);
@@ -18,6 +18,7 @@
 #include <sys/socket.h>
 
 #include "src/shared/util.h"
+#include "src/shared/aes.h"
 #include "src/shared/crypto.h"
 
 #ifndef HAVE_LINUX_IF_ALG_H
@@ -69,6 +70,7 @@ struct bt_crypto {
 	int ecb_aes;
 	int urandom;
 	int cmac_aes;
+	enum bt_crypto_backend backend;
 };
 
 static int urandom_setup(void)
@@ -135,30 +137,36 @@ struct bt_crypto *bt_crypto_new(void)
 
 	singleton = new0(struct bt_crypto, 1);
 
-	singleton->ecb_aes = ecb_aes_setup();
-	if (singleton->ecb_aes < 0) {
-		free(singleton);
-		singleton = NULL;
-		return NULL;
-	}
-
 	singleton->urandom = urandom_setup();
 	if (singleton->urandom < 0) {
-		close(singleton->ecb_aes);
 		free(singleton);
 		singleton = NULL;
 		return NULL;
 	}
 
+	/* The kernel ciphers are optional since AES can be done in-process */
+	singleton->ecb_aes = ecb_aes_setup();
 	singleton->cmac_aes = cmac_aes_setup();
-	if (singleton->cmac_aes < 0) {
-		close(singleton->urandom);
-		close(singleton->ecb_aes);
-		free(singleton);
-		singleton = NULL;
-		return NULL;
+
+	if (singleton->ecb_aes < 0 || singleton->cmac_aes < 0) {
+		if (singleton->ecb_aes >= 0)
+			close(singleton->ecb_aes);
+
+		if (singleton->cmac_aes >= 0)
+			close(singleton->cmac_aes);
+
+		singleton->ecb_aes = -1;
+		singleton->cmac_aes = -1;
 	}
 
+	/* Prefer the kernel over the portable C implementation when there
+	 * is no hardware acceleration available.
+	 */
+	if (bt_aes128_accel() || singleton->ecb_aes < 0)
+		singleton->backend = BT_CRYPTO_BACKEND_AES;
+	else
+		singleton->backend = BT_CRYPTO_BACKEND_KERNEL;
+
 	return bt_crypto_ref(singleton);
 }
 
@@ -181,8 +189,12 @@ void bt_crypto_unref(struct bt_crypto *crypto)
 		return;
 
 	close(crypto->urandom);
-	close(crypto->ecb_aes);
-	close(crypto->cmac_aes);
+
+	if (crypto->ecb_aes >= 0)
+		close(crypto->ecb_aes);
+
+	if (crypto->cmac_aes >= 0)
+		close(crypto->cmac_aes);
 
 	free(crypto);
 	singleton = NULL;
@@ -259,17 +271,108 @@ static inline void swap_buf(const uint8_t *src, uint8_t *dst, uint16_t len)
 		dst[len - 1 - i] = src[i];
 }
 
+bool bt_crypto_set_backend(struct bt_crypto *crypto,
+					enum bt_crypto_backend backend)
+{
+	if (!crypto)
+		return false;
+
+	switch (backend) {
+	case BT_CRYPTO_BACKEND_KERNEL:
+		if (crypto->ecb_aes < 0)
+			return false;
+		break;
+	case BT_CRYPTO_BACKEND_AES:
+		break;
+	default:
+		return false;
+	}
+
+	crypto->backend = backend;
+
+	return true;
+}
+
+enum bt_crypto_backend bt_crypto_get_backend(struct bt_crypto *crypto)
+{
+	if (!crypto)
+		return BT_CRYPTO_BACKEND_KERNEL;
+
+	return crypto->backend;
+}
+
+/* AES-128 of a single block, most significant octet first */
+static bool crypto_ecb(struct bt_crypto *crypto, const uint8_t key[16],
+				const uint8_t in[16], uint8_t out[16])
+{
+	struct bt_aes128 aes;
+	int fd;
+
+	if (crypto->backend == BT_CRYPTO_BACKEND_AES) {
+		bt_aes128_set_key(&aes, key);
+		bt_aes128_encrypt(&aes, in, out);
+		memset(&aes, 0, sizeof(aes));
+		return true;
+	}
+
+	fd = alg_new(crypto->ecb_aes, key, 16);
+	if (fd < 0)
+		return false;
+
+	if (!alg_encrypt(fd, in, 16, out, 16)) {
+		close(fd);
+		return false;
+	}
+
+	close(fd);
+
+	return true;
+}
+
+/* AES-CMAC, most significant octet first */
+static bool crypto_cmac(struct bt_crypto *crypto, const uint8_t key[16],
+				const struct iovec *iov, size_t iovcnt,
+				uint8_t res[16])
+{
+	ssize_t len;
+	int fd;
+
+	if (crypto->backend == BT_CRYPTO_BACKEND_AES) {
+		bt_aes128_cmac(key, iov, iovcnt, res);
+		return true;
+	}
+
+	fd = alg_new(crypto->cmac_aes, key, 16);
+	if (fd < 0)
+		return false;
+
+	len = writev(fd, iov, iovcnt);
+	if (len < 0) {
+		close(fd);
+		return false;
+	}
+
+	len = read(fd, res, 16);
+	if (len < 0) {
+		close(fd);
+		return false;
+	}
+
+	close(fd);
+
+	return true;
+}
+
 bool bt_crypto_sign_att(struct bt_crypto *crypto, const uint8_t key[16],
 				const uint8_t *m, uint16_t m_len,
 				uint32_t sign_cnt,
 				uint8_t signature[ATT_SIGN_LEN])
 {
-	int fd;
-	int len;
 	uint8_t tmp[16], out[16];
 	uint16_t msg_len = m_len + sizeof(uint32_t);
 	uint8_t msg[msg_len];
 	uint8_t msg_s[msg_len];
+	struct iovec iov;
 
 	if (!crypto)
 		return false;
@@ -283,26 +386,14 @@ bool bt_crypto_sign_att(struct bt_crypto *crypto, const uint8_t key[16],
 	/* The most significant octet of key corresponds to key[0] */
 	swap_buf(key, tmp, 16);
 
-	fd = alg_new(crypto->cmac_aes, tmp, 16);
-	if (fd < 0)
-		return false;
-
 	/* Swap msg before signing */
 	swap_buf(msg, msg_s, msg_len);
 
-	len = send(fd, msg_s, msg_len, 0);
-	if (len < 0) {
-		close(fd);
-		return false;
-	}
+	iov.iov_base = msg_s;
+	iov.iov_len = msg_len;
 
-	len = read(fd, out, 16);
-	if (len < 0) {
-		close(fd);
+	if (!crypto_cmac(crypto, tmp, &iov, 1, out))
 		return false;
-	}
-
-	close(fd);
 
 	/*
 	 * As to BT spec. 4.1 Vol[3], Part C, chapter 10.4.1 sign counter should
@@ -358,7 +449,6 @@ bool bt_crypto_e(struct bt_crypto *crypto, const uint8_t key[16],
 			const uint8_t plaintext[16], uint8_t encrypted[16])
 {
 	uint8_t tmp[16], in[16], out[16];
-	int fd;
 
 	if (!crypto)
 		return false;
@@ -366,24 +456,15 @@ bool bt_crypto_e(struct bt_crypto *crypto, const uint8_t key[16],
 	/* The most significant octet of key corresponds to key[0] */
 	swap_buf(key, tmp, 16);
 
-	fd = alg_new(crypto->ecb_aes, tmp, 16);
-	if (fd < 0)
-		return false;
-
-
 	/* Most significant octet of plaintextData corresponds to in[0] */
 	swap_buf(plaintext, in, 16);
 
-	if (!alg_encrypt(fd, in, 16, out, 16)) {
-		close(fd);
+	if (!crypto_ecb(crypto, tmp, in, out))
 		return false;
-	}
 
 	/* Most significant octet of encryptedData corresponds to out[0] */
 	swap_buf(out, encrypted, 16);
 
-	close(fd);
-
 	return true;
 }
 
@@ -589,31 +670,15 @@ bool bt_crypto_s1(struct bt_crypto *crypto, const uint8_t k[16],
 static bool aes_cmac_be(struct bt_crypto *crypto, const uint8_t key[16],
 			const uint8_t *msg, size_t msg_len, uint8_t res[16])
 {
-	ssize_t len;
-	int fd;
+	struct iovec iov;
 
 	if (msg_len > CMAC_MSG_MAX)
 		return false;
 
-	fd = alg_new(crypto->cmac_aes, key, 16);
-	if (fd < 0)
-		return false;
-
-	len = send(fd, msg, msg_len, 0);
-	if (len < 0) {
-		close(fd);
-		return false;
-	}
-
-	len = read(fd, res, 16);
-	if (len < 0) {
-		close(fd);
-		return false;
-	}
-
-	close(fd);
+	iov.iov_base = (void *) msg;
+	iov.iov_len = msg_len;
 
-	return true;
+	return crypto_cmac(crypto, key, &iov, 1, res);
 }
 
 static bool aes_cmac(struct bt_crypto *crypto, const uint8_t key[16],
@@ -725,31 +790,11 @@ bool bt_crypto_gatt_hash(struct bt_crypto *crypto, struct iovec *iov,
 				size_t iov_len, uint8_t res[16])
 {
 	const uint8_t key[16] = {};
-	ssize_t len;
-	int fd;
 
 	if (!crypto)
 		return false;
 
-	fd = alg_new(crypto->cmac_aes, key, 16);
-	if (fd < 0)
-		return false;
-
-	len = writev(fd, iov, iov_len);
-	if (len < 0) {
-		close(fd);
-		return false;
-	}
-
-	len = read(fd, res, 16);
-	if (len < 0) {
-		close(fd);
-		return false;
-	}
-
-	close(fd);
-
-	return true;
+	return crypto_cmac(crypto, key, iov, iov_len, res);
 }
 
 /*
@@ -14,11 +14,20 @@
 
 struct bt_crypto;
 
+enum bt_crypto_backend {
+	BT_CRYPTO_BACKEND_KERNEL,	/* AF_ALG sockets */
+	BT_CRYPTO_BACKEND_AES,		/* In-process, AES-NI if supported */
+};
+
 struct bt_crypto *bt_crypto_new(void);
 
 struct bt_crypto *bt_crypto_ref(struct bt_crypto *crypto);
 void bt_crypto_unref(struct bt_crypto *crypto);
 
+bool bt_crypto_set_backend(struct bt_crypto *crypto,
+					enum bt_crypto_backend backend);
+enum bt_crypto_backend bt_crypto_get_backend(struct bt_crypto *crypto);
+
 bool bt_crypto_random_bytes(struct bt_crypto *crypto,
 					void *buf, uint8_t num_bytes);
 
@@ -0,0 +1,583 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "lib/bluetooth.h"
+#include "lib/uuid.h"
+#include "src/shared/util.h"
+#include "src/shared/queue.h"
+#include "src/shared/att.h"
+#include "src/shared/gatt-db.h"
+#include "src/shared/gatt-cache.h"
+
+/*
+ * Binary cache of a remote GATT database. The file starts with a fixed
+ * header followed by a list of records, all values are little endian:
+ *
+ *	Header:	magic "BTGC", version, flags, reserved (2 octets),
+ *		Database Hash (16 octets), payload length (4 octets),
+ *		CRC-32 of the payload (4 octets)
+ *	Record:	type, length, length octets of data
+ *
+ * Every service record is followed by the records of its attributes in
+ * handle order. UUIDs are stored with 2 or 16 octets. The Database Hash
+ * the cache is valid for is kept in the header only and written into the
+ * Database Hash characteristic on load. Unknown record types are skipped.
+ */
+
+#define CACHE_FLAG_HASH		0x01
+
+#define REC_PRIMARY		0x01	/* start, end, uuid */
+#define REC_SECONDARY		0x02	/* start, end, uuid */
+#define REC_INCLUDE		0x03	/* handle, start, end */
+#define REC_CHRC		0x04	/* handle, value handle, props, uuid */
+#define REC_DESC		0x05	/* handle, uuid */
+#define REC_VALUE		0x06	/* handle, value */
+
+struct cache_hdr {
+	uint8_t  magic[4];
+	uint8_t  version;
+	uint8_t  flags;
+	uint16_t reserved;
+	uint8_t  hash[16];
+	uint32_t len;
+	uint32_t crc;
+} __packed;
+
+struct cache_writer {
+	struct gatt_db *db;
+	struct iovec *iov;
+	size_t size;
+	uint16_t ext_props;
+	uint8_t hash[16];
+	bool has_hash;
+	bool failed;
+};
+
+static const uint8_t cache_magic[4] = { 'B', 'T', 'G', 'C' };
+
+/* CRC-32 as used by zlib */
+static uint32_t cache_crc32(const uint8_t *data, size_t len)
+{
+	uint32_t crc = 0xffffffff;
+	size_t i;
+	int bit;
+
+	for (i = 0; i < len; i++) {
+		crc ^= data[i];
+
+		for (bit = 0; bit < 8; bit++)
+			crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+	}
+
+	return ~crc;
+}
+
+static size_t uuid_size(const bt_uuid_t *uuid)
+{
+	return uuid->type == BT_UUID16 ? 2 : 16;
+}
+
+static void push_uuid(struct iovec *iov, const bt_uuid_t *uuid)
+{
+	bt_uuid_t uuid128;
+
+	if (uuid->type == BT_UUID16) {
+		util_iov_push_le16(iov, uuid->value.u16);
+		return;
+	}
+
+	bt_uuid_to_uuid128(uuid, &uuid128);
+	bswap_128(&uuid128.value.u128, util_iov_push(iov, 16));
+}
+
+static bool pull_uuid(struct iovec *iov, bt_uuid_t *uuid)
+{
+	uint128_t u128;
+
+	switch (iov->iov_len) {
+	case 2:
+		bt_uuid16_create(uuid, get_le16(iov->iov_base));
+		break;
+	case 16:
+		bswap_128(iov->iov_base, &u128);
+		bt_uuid128_create(uuid, u128);
+		break;
+	default:
+		return false;
+	}
+
+	util_iov_pull(iov, iov->iov_len);
+
+	return true;
+}
+
+static bool writer_reserve(struct cache_writer *w, size_t len)
+{
+	size_t size = w->size ? w->size : 512;
+	void *base;
+
+	if (w->failed)
+		return false;
+
+	while (size < w->iov->iov_len + len)
+		size *= 2;
+
+	if (size == w->size)
+		return true;
+
+	base = realloc(w->iov->iov_base, size);
+	if (!base) {
+		w->failed = true;
+		return false;
+	}
+
+	w->iov->iov_base = base;
+	w->size = size;
+
+	return true;
+}
+
+static bool writer_record(struct cache_writer *w, uint8_t type, size_t len)
+{
+	if (!writer_reserve(w, 2 + len))
+		return false;
+
+	util_iov_push_u8(w->iov, type);
+	util_iov_push_u8(w->iov, len);
+
+	return true;
+}
+
+static void db_hash_read_value_cb(struct gatt_db_attribute *attrib,
+						int err, const uint8_t *value,
+						size_t length, void *user_data)
+{
+	const uint8_t **hash = user_data;
+
+	if (err || (length != 16))
+		return;
+
+	*hash = value;
+}
+
+static void write_desc(struct gatt_db_attribute *attr, void *user_data)
+{
+	struct cache_writer *w = user_data;
+	const bt_uuid_t *uuid;
+	uint16_t handle;
+
+	handle = gatt_db_attribute_get_handle(attr);
+	uuid = gatt_db_attribute_get_type(attr);
+
+	if (!writer_record(w, REC_DESC, 2 + uuid_size(uuid)))
+		return;
+
+	util_iov_push_le16(w->iov, handle);
+	push_uuid(w->iov, uuid);
+
+	/* Extended Properties are the only descriptor value kept */
+	if (!bt_uuid16_cmp(uuid, GATT_CHARAC_EXT_PROPER_UUID) || !w->ext_props)
+		return;
+
+	if (!writer_record(w, REC_VALUE, 4))
+		return;
+
+	util_iov_push_le16(w->iov, handle);
+	util_iov_push_le16(w->iov, w->ext_props);
+}
+
+static void write_chrc(struct gatt_db_attribute *attr, void *user_data)
+{
+	struct cache_writer *w = user_data;
+	uint16_t handle, value_handle;
+	uint8_t properties;
+	bt_uuid_t uuid;
+
+	if (!gatt_db_attribute_get_char_data(attr, &handle, &value_handle,
+						&properties, &w->ext_props,
+						&uuid))
+		return;
+
+	if (!writer_record(w, REC_CHRC, 5 + uuid_size(&uuid)))
+		return;
+
+	util_iov_push_le16(w->iov, handle);
+	util_iov_push_le16(w->iov, value_handle);
+	util_iov_push_u8(w->iov, properties);
+	push_uuid(w->iov, &uuid);
+
+	if (bt_uuid16_cmp(&uuid, GATT_CHARAC_DB_HASH)) {
+		const uint8_t *hash = NULL;
+
+		gatt_db_attribute_read(gatt_db_get_attribute(w->db,
+							value_handle),
+					0, BT_ATT_OP_READ_REQ, NULL,
+					db_hash_read_value_cb, &hash);
+		if (hash) {
+			memcpy(w->hash, hash, sizeof(w->hash));
+			w->has_hash = true;
+		}
+	}
+
+	gatt_db_service_foreach_desc(attr, write_desc, w);
+}
+
+static void write_incl(struct gatt_db_attribute *attr, void *user_data)
+{
+	struct cache_writer *w = user_data;
+	uint16_t handle, start, end;
+
+	if (!gatt_db_attribute_get_incl_data(attr, &handle, &start, &end))
+		return;
+
+	if (!writer_record(w, REC_INCLUDE, 6))
+		return;
+
+	util_iov_push_le16(w->iov, handle);
+	util_iov_push_le16(w->iov, start);
+	util_iov_push_le16(w->iov, end);
+}
+
+static void write_service(struct gatt_db_attribute *attr, void *user_data)
+{
+	struct cache_writer *w = user_data;
+	uint16_t start, end;
+	bool primary;
+	bt_uuid_t uuid;
+
+	if (!gatt_db_attribute_get_service_data(attr, &start, &end, &primary,
+								&uuid))
+		return;
+
+	if (!writer_record(w, primary ? REC_PRIMARY : REC_SECONDARY,
+							4 + uuid_size(&uuid)))
+		return;
+
+	util_iov_push_le16(w->iov, start);
+	util_iov_push_le16(w->iov, end);
+	push_uuid(w->iov, &uuid);
+
+	gatt_db_service_foreach_incl(attr, write_incl, w);
+	gatt_db_service_foreach_char(attr, write_chrc, w);
+}
+
+bool gatt_cache_encode(struct gatt_db *db, struct iovec *iov)
+{
+	struct cache_writer w;
+	struct cache_hdr *hdr;
+	size_t len;
+
+	if (!db || !iov)
+		return false;
+
+	memset(&w, 0, sizeof(w));
+	w.db = db;
+	w.iov = iov;
+
+	iov->iov_base = NULL;
+	iov->iov_len = 0;
+
+	/* The header is filled in once the length is known */
+	if (writer_reserve(&w, sizeof(*hdr))) {
+		util_iov_push(iov, sizeof(*hdr));
+		gatt_db_foreach_service(db, NULL, write_service, &w);
+	}
+
+	if (w.failed) {
+		free(iov->iov_base);
+		iov->iov_base = NULL;
+		iov->iov_len = 0;
+		return false;
+	}
+
+	len = iov->iov_len - sizeof(*hdr);
+
+	hdr = iov->iov_base;
+	memcpy(hdr->magic, cache_magic, sizeof(hdr->magic));
+	hdr->version = GATT_CACHE_VERSION;
+	hdr->flags = w.has_hash ? CACHE_FLAG_HASH : 0;
+	hdr->reserved = 0;
+	memcpy(hdr->hash, w.hash, sizeof(hdr->hash));
+	hdr->len = cpu_to_le32(len);
+	hdr->crc = cpu_to_le32(cache_crc32(iov->iov_base + sizeof(*hdr), len));
+
+	return true;
+}
+
+static void write_value_cb(struct gatt_db_attribute *attrib, int err,
+							void *user_data)
+{
+}
+
+static bool write_value(struct gatt_db_attribute *attr, const void *value,
+							size_t len)
+{
+	if (!attr)
+		return false;
+
+	return gatt_db_attribute_write(attr, 0, value, len, 0, NULL,
+						write_value_cb, NULL);
+}
+
+static int read_service(struct gatt_db *db, uint8_t type, struct iovec *rec)
+{
+	uint16_t start, end;
+	bt_uuid_t uuid;
+
+	if (!util_iov_pull_le16(rec, &start) ||
+				!util_iov_pull_le16(rec, &end) ||
+				!pull_uuid(rec, &uuid) || end < start)
+		return -EBADMSG;
+
+	if (!gatt_db_insert_service(db, start, &uuid, type == REC_PRIMARY,
+							end - start + 1))
+		return -EIO;
+
+	return 0;
+}
+
+static int read_attribute(struct gatt_db *db, const struct cache_hdr *hdr,
+					uint8_t type, struct iovec *rec,
+					struct gatt_db_attribute **service)
+{
+	struct gatt_db_attribute *attr;
+	uint16_t handle, value_handle, start, end;
+	uint8_t properties;
+	bt_uuid_t uuid;
+
+	switch (type) {
+	case REC_PRIMARY:
+	case REC_SECONDARY:
+		if (!util_iov_pull_le16(rec, &start))
+			return -EBADMSG;
+
+		if (*service)
+			gatt_db_service_set_active(*service, true);
+
+		*service = gatt_db_get_attribute(db, start);
+		return *service ? 0 : -EIO;
+	case REC_INCLUDE:
+		if (!util_iov_pull_le16(rec, &handle) ||
+					!util_iov_pull_le16(rec, &start) ||
+					!util_iov_pull_le16(rec, &end))
+			return -EBADMSG;
+
+		attr = gatt_db_get_attribute(db, start);
+		if (!attr || !*service)
+			return -EIO;
+
+		attr = gatt_db_service_insert_included(*service, handle, attr);
+		break;
+	case REC_CHRC:
+		if (!util_iov_pull_le16(rec, &handle) ||
+				!util_iov_pull_le16(rec, &value_handle) ||
+				!util_iov_pull_u8(rec, &properties) ||
+				!pull_uuid(rec, &uuid))
+			return -EBADMSG;
+
+		if (!*service)
+			return -EIO;
+
+		attr = gatt_db_service_insert_characteristic(*service, handle,
+							value_handle, &uuid,
+							0, properties,
+							NULL, NULL, NULL);
+		if (!attr || gatt_db_attribute_get_handle(attr) != value_handle)
+			return -EIO;
+
+		if ((hdr->flags & CACHE_FLAG_HASH) &&
+				bt_uuid16_cmp(&uuid, GATT_CHARAC_DB_HASH) &&
+				!write_value(attr, hdr->hash,
+							sizeof(hdr->hash)))
+			return -EIO;
+
+		return 0;
+	case REC_DESC:
+		if (!util_iov_pull_le16(rec, &handle) || !pull_uuid(rec, &uuid))
+			return -EBADMSG;
+
+		if (!*service)
+			return -EIO;
+
+		attr = gatt_db_service_insert_descriptor(*service, handle,
+							&uuid, 0, NULL, NULL,
+							NULL);
+		break;
+	case REC_VALUE:
+		if (!util_iov_pull_le16(rec, &handle))
+			return -EBADMSG;
+
+		if (!write_value(gatt_db_get_attribute(db, handle),
+						rec->iov_base, rec->iov_len))
+			return -EIO;
+
+		return 0;
+	default:
+		return 0;
+	}
+
+	if (!attr || gatt_db_attribute_get_handle(attr) != handle)
+		return -EIO;
+
+	return 0;
+}
+
+static int read_records(struct gatt_db *db, const struct cache_hdr *hdr,
+							bool services)
+{
+	struct gatt_db_attribute *service = NULL;
+	struct iovec iov, rec;
+	uint8_t type, len;
+	int err = 0;
+
+	iov.iov_base = (void *) hdr + sizeof(*hdr);
+	iov.iov_len = le32_to_cpu(hdr->len);
+
+	while (iov.iov_len && !err) {
+		if (!util_iov_pull_u8(&iov, &type) ||
+					!util_iov_pull_u8(&iov, &len))
+			return -EBADMSG;
+
+		rec.iov_base = util_iov_pull_mem(&iov, len);
+		rec.iov_len = len;
+
+		if (!rec.iov_base)
+			return -EBADMSG;
+
+		if (services) {
+			if (type == REC_PRIMARY || type == REC_SECONDARY)
+				err = read_service(db, type, &rec);
+		} else
+			err = read_attribute(db, hdr, type, &rec, &service);
+	}
+
+	if (service)
+		gatt_db_service_set_active(service, true);
+
+	return err;
+}
+
+int gatt_cache_decode(struct gatt_db *db, const void *data, size_t len)
+{
+	const struct cache_hdr *hdr = data;
+	int err;
+
+	if (!db || !data)
+		return -EINVAL;
+
+	if (len < sizeof(*hdr) || memcmp(hdr->magic, cache_magic,
+							sizeof(cache_magic)))
+		return -ENOMSG;
+
+	if (hdr->version != GATT_CACHE_VERSION)
+		return -EPROTONOSUPPORT;
+
+	if (le32_to_cpu(hdr->len) != len - sizeof(*hdr) ||
+			le32_to_cpu(hdr->crc) != cache_crc32(data + sizeof(*hdr),
+							len - sizeof(*hdr)))
+		return -EBADMSG;
+
+	/* Services first since an included service may come later */
+	err = read_records(db, hdr, true);
+	if (!err)
+		err = read_records(db, hdr, false);
+
+	if (err)
+		gatt_db_clear(db);
+
+	return err;
+}
+
+int gatt_cache_load(struct gatt_db *db, const char *filename)
+{
+	struct stat st;
+	void *map;
+	int fd, err;
+
+	fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	if (fstat(fd, &st) < 0) {
+		err = -errno;
+		close(fd);
+		return err;
+	}
+
+	if (!S_ISREG(st.st_mode) ||
+				st.st_size < (off_t) sizeof(struct cache_hdr)) {
+		close(fd);
+		return -ENOMSG;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED)
+		return -errno;
+
+	err = gatt_cache_decode(db, map, st.st_size);
+
+	munmap(map, st.st_size);
+
+	return err;
+}
+
+int gatt_cache_store(struct gatt_db *db, const char *filename)
+{
+	char tmp[PATH_MAX];
+	struct iovec iov;
+	ssize_t written;
+	int fd, err = 0;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", filename) >= (int) sizeof(tmp))
+		return -ENAMETOOLONG;
+
+	if (!gatt_cache_encode(db, &iov))
+		return -ENOMEM;
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		err = -errno;
+		goto done;
+	}
+
+	written = write(fd, iov.iov_base, iov.iov_len);
+	if (written < 0)
+		err = -errno;
+	else if ((size_t) written != iov.iov_len)
+		err = -EIO;
+
+	close(fd);
+
+	/* Readers never see a partially written cache */
+	if (!err && rename(tmp, filename) < 0)
+		err = -errno;
+
+	if (err)
+		unlink(tmp);
+
+done:
+	free(iov.iov_base);
+
+	return err;
+}
@@ -0,0 +1,25 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+#define GATT_CACHE_VERSION	1
+
+struct gatt_db;
+
+bool gatt_cache_encode(struct gatt_db *db, struct iovec *iov);
+int gatt_cache_decode(struct gatt_db *db, const void *data, size_t len);
+
+/*
+ * Loading fails with -ENOENT if the file does not exist and with -ENOMSG
+ * if it is not a GATT cache file at all, e.g. a key file.
+ */
+int gatt_cache_load(struct gatt_db *db, const char *filename);
+int gatt_cache_store(struct gatt_db *db, const char *filename);
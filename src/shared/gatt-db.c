@@ -58,6 +58,11 @@ struct gatt_db {
 	struct bt_crypto *crypto;
 	uint8_t hash[16];
 	unsigned int hash_id;
+	bool hash_stale;
+	unsigned int hash_hold;
+	unsigned int hash_changes;
+	unsigned int hash_updates;
+	unsigned int hash_saved;
 	uint16_t last_handle;
 	struct queue *services;
 
@@ -68,6 +73,18 @@ struct gatt_db {
 	void *authorize_data;
 
 	struct gatt_db_ccc *ccc;
+
+	/* Lookup index, updated as attributes are added and removed */
+	unsigned int index_gen;
+	unsigned int index_len;
+	unsigned int index_size;
+	struct gatt_db_attribute **index;	/* Sorted by handle */
+	struct type_entry *type_index;		/* Sorted by type, handle */
+};
+
+struct type_entry {
+	uint128_t type;
+	struct gatt_db_attribute *attrib;
 };
 
 struct notify {
@@ -131,8 +148,179 @@ struct gatt_db_service {
 	bool claimed;
 	uint16_t num_handles;
 	struct gatt_db_attribute **attributes;
+
+	/* Cached Database Hash input of this service */
+	bool hash_dirty;
+	uint8_t *hash_data;
+	size_t hash_len;
+	size_t hash_size;
 };
 
+/* Return the position of the first attribute with handle >= start */
+static unsigned int index_lookup(struct gatt_db *db, uint16_t start)
+{
+	unsigned int lo = 0, hi = db->index_len;
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (db->index[mid]->handle < start)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/* Return the position of the first attribute of the given type with
+ * handle >= start.
+ */
+static unsigned int type_index_lookup(struct gatt_db *db,
+						const uint128_t *type,
+						uint16_t start)
+{
+	unsigned int lo = 0, hi = db->index_len;
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+		const struct type_entry *entry = &db->type_index[mid];
+		int ret;
+
+		ret = memcmp(&entry->type, type, sizeof(*type));
+		if (ret < 0 || (!ret && entry->attrib->handle < start))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static struct gatt_db_attribute *index_get(struct gatt_db *db,
+						const uint128_t *type,
+						unsigned int i)
+{
+	if (i >= db->index_len)
+		return NULL;
+
+	if (!type)
+		return db->index[i];
+
+	if (memcmp(&db->type_index[i].type, type, sizeof(*type)))
+		return NULL;
+
+	return db->type_index[i].attrib;
+}
+
+static void db_index_add(struct gatt_db *db,
+					struct gatt_db_attribute *attrib)
+{
+	struct type_entry *entry;
+	bt_uuid_t uuid;
+	unsigned int i;
+
+	if (db->index_len == db->index_size) {
+		unsigned int size = MAX(db->index_size * 2, 64U);
+		struct gatt_db_attribute **index;
+		struct type_entry *type_index;
+
+		index = new0(struct gatt_db_attribute *, size);
+		type_index = new0(struct type_entry, size);
+
+		if (db->index_len) {
+			memcpy(index, db->index,
+					db->index_len * sizeof(*index));
+			memcpy(type_index, db->type_index,
+					db->index_len * sizeof(*type_index));
+		}
+
+		free(db->index);
+		free(db->type_index);
+
+		db->index = index;
+		db->type_index = type_index;
+		db->index_size = size;
+	}
+
+	i = index_lookup(db, attrib->handle);
+	memmove(&db->index[i + 1], &db->index[i],
+			(db->index_len - i) * sizeof(*db->index));
+	db->index[i] = attrib;
+
+	bt_uuid_to_uuid128(&attrib->uuid, &uuid);
+
+	i = type_index_lookup(db, &uuid.value.u128, attrib->handle);
+	entry = &db->type_index[i];
+	memmove(entry + 1, entry, (db->index_len - i) * sizeof(*entry));
+	entry->type = uuid.value.u128;
+	entry->attrib = attrib;
+
+	db->index_len++;
+	db->index_gen++;
+}
+
+static void db_index_remove(struct gatt_db *db,
+					struct gatt_db_attribute *attrib)
+{
+	bt_uuid_t uuid;
+	unsigned int i;
+
+	if (!db)
+		return;
+
+	i = index_lookup(db, attrib->handle);
+	if (index_get(db, NULL, i) != attrib)
+		return;
+
+	memmove(&db->index[i], &db->index[i + 1],
+			(db->index_len - i - 1) * sizeof(*db->index));
+
+	bt_uuid_to_uuid128(&attrib->uuid, &uuid);
+
+	i = type_index_lookup(db, &uuid.value.u128, attrib->handle);
+	memmove(&db->type_index[i], &db->type_index[i + 1],
+			(db->index_len - i - 1) * sizeof(*db->type_index));
+
+	db->index_len--;
+	db->index_gen++;
+}
+
+/* The attributes of a service occupy a contiguous range of the handle index
+ * so they are dropped with a single move, the type index is compacted in one
+ * pass.
+ */
+static void db_index_remove_service(struct gatt_db *db,
+					struct gatt_db_service *service)
+{
+	unsigned int start, end, i, len;
+
+	if (!db || !db->index_len)
+		return;
+
+	start = index_lookup(db, service->attributes[0]->handle);
+	for (end = start; end < db->index_len; end++) {
+		if (db->index[end]->service != service)
+			break;
+	}
+
+	if (start == end)
+		return;
+
+	memmove(&db->index[start], &db->index[end],
+			(db->index_len - end) * sizeof(*db->index));
+
+	for (i = 0, len = 0; i < db->index_len; i++) {
+		if (db->type_index[i].attrib->service == service)
+			continue;
+
+		db->type_index[len++] = db->type_index[i];
+	}
+
+	db->index_len = len;
+	db->index_gen++;
+}
+
 static void set_attribute_data(struct gatt_db_attribute *attribute,
 						gatt_db_read_t read_func,
 						gatt_db_write_t write_func,
@@ -218,6 +406,7 @@ static struct gatt_db_attribute *new_attribute(struct gatt_db_service *service,
 	attribute->handle = handle;
 	attribute->uuid = *type;
 	attribute->value_len = len;
+	service->hash_dirty = true;
 	if (len) {
 		attribute->value = malloc0(len);
 		if (!attribute->value)
@@ -230,6 +419,10 @@ static struct gatt_db_attribute *new_attribute(struct gatt_db_service *service,
 	attribute->pending_writes = queue_new();
 	attribute->notify_list = queue_new();
 
+	/* The service declaration is indexed once the service is inserted */
+	if (service->db)
+		db_index_add(service->db, attribute);
+
 	return attribute;
 
 failed:
@@ -295,14 +488,15 @@ static void handle_notify(void *data, void *user_data)
 }
 
 struct hash_data {
-	struct iovec *iov;
-	uint16_t i;
+	uint8_t *data;
+	size_t len;
+	size_t size;
+	bool failed;
 };
 
 static void gen_hash_m(struct gatt_db_attribute *attr, void *user_data)
 {
 	struct hash_data *hash = user_data;
-	uint8_t *data;
 	size_t len;
 
 	if (bt_uuid_len(&attr->uuid) != 2)
@@ -313,67 +507,151 @@ static void gen_hash_m(struct gatt_db_attribute *attr, void *user_data)
 	case GATT_SND_SVC_UUID:
 	case GATT_INCLUDE_UUID:
 	case GATT_CHARAC_UUID:
-		/* Allocate space for handle + type + value */
+		/* Space for handle + type + value */
 		len = 2 + 2 + attr->value_len;
-		data = malloc(2 + 2 + attr->value_len);
-		put_le16(attr->handle, data);
-		bt_uuid_to_le(&attr->uuid, data + 2);
-		memcpy(data + 4, attr->value, attr->value_len);
 		break;
 	case GATT_CHARAC_USER_DESC_UUID:
 	case GATT_CLIENT_CHARAC_CFG_UUID:
 	case GATT_SERVER_CHARAC_CFG_UUID:
 	case GATT_CHARAC_FMT_UUID:
 	case GATT_CHARAC_AGREG_FMT_UUID:
-		/* Allocate space for handle + type  */
+		/* Space for handle + type  */
 		len = 2 + 2;
-		data = malloc(2 + 2 + attr->value_len);
-		put_le16(attr->handle, data);
-		bt_uuid_to_le(&attr->uuid, data + 2);
 		break;
 	default:
 		return;
 	}
 
-	hash->iov[hash->i].iov_base = data;
-	hash->iov[hash->i].iov_len = len;
+	if (hash->failed)
+		return;
+
+	if (hash->len + len > hash->size) {
+		size_t size = MAX(hash->size * 2, hash->len + len);
+		uint8_t *data;
+
+		data = realloc(hash->data, size);
+		if (!data) {
+			hash->failed = true;
+			return;
+		}
+
+		hash->data = data;
+		hash->size = size;
+	}
 
-	hash->i++;
+	put_le16(attr->handle, hash->data + hash->len);
+	bt_uuid_to_le(&attr->uuid, hash->data + hash->len + 2);
+	if (len > 4)
+		memcpy(hash->data + hash->len + 4, attr->value,
+							attr->value_len);
 
-	return;
+	hash->len += len;
 }
 
-static void service_gen_hash_m(struct gatt_db_attribute *attr, void *user_data)
+/* Only the declarations contribute their value to the hash */
+static bool attribute_hash_value(const struct gatt_db_attribute *attr)
 {
-	gatt_db_service_foreach(attr, NULL, gen_hash_m, user_data);
+	if (attr->uuid.type != BT_UUID16)
+		return false;
+
+	switch (attr->uuid.value.u16) {
+	case GATT_PRIM_SVC_UUID:
+	case GATT_SND_SVC_UUID:
+	case GATT_INCLUDE_UUID:
+	case GATT_CHARAC_UUID:
+		return true;
+	}
+
+	return false;
+}
+
+static bool service_hash_update(struct gatt_db_service *service)
+{
+	struct hash_data hash;
+
+	hash.data = service->hash_data;
+	hash.len = 0;
+	hash.size = service->hash_size;
+	hash.failed = false;
+
+	gatt_db_service_foreach(service->attributes[0], NULL, gen_hash_m,
+								&hash);
+
+	service->hash_data = hash.data;
+	service->hash_size = hash.size;
+
+	/* Leave the service dirty so the next update tries again */
+	if (hash.failed) {
+		service->hash_len = 0;
+		return false;
+	}
+
+	service->hash_len = hash.len;
+	service->hash_dirty = false;
+
+	return true;
 }
 
 static bool db_hash_update(void *user_data)
 {
 	struct gatt_db *db = user_data;
-	struct hash_data hash;
-	uint16_t i;
+	const struct queue_entry *entry;
+	struct iovec *iov;
+	unsigned int n = 0;
 
 	db->hash_id = 0;
 
 	if (gatt_db_isempty(db))
 		return false;
 
-	hash.iov = new0(struct iovec, db->last_handle + 1);
-	hash.i = 0;
+	/* Only services that changed since the last update have their input
+	 * regenerated, the others reuse the cached buffer.
+	 */
+	iov = new0(struct iovec, queue_length(db->services));
+
+	for (entry = queue_get_entries(db->services); entry;
+							entry = entry->next) {
+		struct gatt_db_service *service = entry->data;
 
-	gatt_db_foreach_service(db, NULL, service_gen_hash_m, &hash);
-	bt_crypto_gatt_hash(db->crypto, hash.iov, db->last_handle + 1,
-				db->hash);
+		if (!service->active)
+			continue;
+
+		/* Keep the stale hash rather than hashing partial input */
+		if (service->hash_dirty && !service_hash_update(service)) {
+			free(iov);
+			return false;
+		}
 
-	for (i = 0; i < hash.i; i++)
-		free(hash.iov[i].iov_base);
+		if (!service->hash_len)
+			continue;
 
-	free(hash.iov);
+		iov[n].iov_base = service->hash_data;
+		iov[n].iov_len = service->hash_len;
+		n++;
+	}
+
+	bt_crypto_gatt_hash(db->crypto, iov, n, db->hash);
+
+	free(iov);
+
+	db->hash_stale = false;
+	db->hash_updates++;
+	if (db->hash_changes > 1)
+		db->hash_saved += db->hash_changes - 1;
+	db->hash_changes = 0;
 
 	return false;
 }
 
+static void db_hash_schedule(struct gatt_db *db)
+{
+	if (db->hash_hold || db->hash_id || !db->crypto)
+		return;
+
+	db->hash_id = timeout_add(HASH_UPDATE_TIMEOUT, db_hash_update, db,
+									NULL);
+}
+
 static void handle_attribute_notify(void *data, void *user_data)
 {
 	struct attribute_notify *notify = data;
@@ -406,6 +684,9 @@ static void notify_service_changed(struct gatt_db *db,
 	if (!added)
 		notify_attribute_changed(service);
 
+	db->hash_stale = true;
+	db->hash_changes++;
+
 	if (queue_isempty(db->notify_list))
 		return;
 
@@ -417,9 +698,7 @@ static void notify_service_changed(struct gatt_db *db,
 	queue_foreach(db->notify_list, handle_notify, &data);
 
 	/* Tigger hash update */
-	if (!db->hash_id && db->crypto)
-		db->hash_id = timeout_add(HASH_UPDATE_TIMEOUT, db_hash_update,
-								db, NULL);
+	db_hash_schedule(db);
 
 	gatt_db_unref(db);
 }
@@ -432,10 +711,13 @@ static void gatt_db_service_destroy(void *data)
 	if (service->active)
 		notify_service_changed(service->db, service, false);
 
+	db_index_remove_service(service->db, service);
+
 	for (i = 0; i < service->num_handles; i++)
 		attribute_destroy(service->attributes[i]);
 
 	free(service->attributes);
+	free(service->hash_data);
 	free(service);
 }
 
@@ -456,6 +738,15 @@ static void gatt_db_destroy(struct gatt_db *db)
 	if (db->hash_id)
 		timeout_remove(db->hash_id);
 
+	/* Drop the index first, there is no point updating it while
+	 * removing every service.
+	 */
+	free(db->index);
+	free(db->type_index);
+	db->index = NULL;
+	db->type_index = NULL;
+	db->index_len = 0;
+
 	queue_destroy(db->services, gatt_db_service_destroy);
 	free(db->ccc);
 	free(db);
@@ -638,7 +929,7 @@ uint8_t *gatt_db_get_hash(struct gatt_db *db)
 		return NULL;
 
 	/* Generate hash if if has not been generated yet */
-	if (db->hash_id || !memcmp(db->hash, hash, 16)) {
+	if (db->hash_id || db->hash_stale || !memcmp(db->hash, hash, 16)) {
 		timeout_remove(db->hash_id);
 		db_hash_update(db);
 	}
@@ -646,6 +937,45 @@ uint8_t *gatt_db_get_hash(struct gatt_db *db)
 	return db->hash;
 }
 
+bool gatt_db_hash_hold(struct gatt_db *db)
+{
+	if (!db)
+		return false;
+
+	db->hash_hold++;
+
+	return true;
+}
+
+bool gatt_db_hash_release(struct gatt_db *db)
+{
+	if (!db || !db->hash_hold)
+		return false;
+
+	if (--db->hash_hold)
+		return true;
+
+	if (db->hash_stale && !queue_isempty(db->notify_list))
+		db_hash_schedule(db);
+
+	return true;
+}
+
+bool gatt_db_get_hash_stats(struct gatt_db *db, unsigned int *updates,
+							unsigned int *saved)
+{
+	if (!db)
+		return false;
+
+	if (updates)
+		*updates = db->hash_updates;
+
+	if (saved)
+		*saved = db->hash_saved;
+
+	return true;
+}
+
 bool gatt_db_hash_support(struct gatt_db *db)
 {
 	if (!db || !db->crypto)
@@ -747,6 +1077,7 @@ struct gatt_db_attribute *gatt_db_insert_service(struct gatt_db *db,
 	service->db = db;
 	service->attributes[0]->handle = handle;
 	service->num_handles = num_handles;
+	db_index_add(db, service->attributes[0]);
 
 	/* Fast-forward last_handle if the new service was added to the end */
 	db->last_handle = MAX(handle + num_handles - 1, db->last_handle);
@@ -916,6 +1247,7 @@ service_insert_characteristic(struct gatt_db_service *service,
 
 	i = service_get_attribute_index(service, &value_handle, 0);
 	if (!i) {
+		db_index_remove(service->db, *chrc);
 		free(*chrc);
 		*chrc = NULL;
 		return NULL;
@@ -924,6 +1256,7 @@ service_insert_characteristic(struct gatt_db_service *service,
 	service->attributes[i] = new_attribute(service, value_handle, uuid,
 						NULL, 0);
 	if (!service->attributes[i]) {
+		db_index_remove(service->db, *chrc);
 		free(*chrc);
 		*chrc = NULL;
 		return NULL;
@@ -1476,6 +1809,51 @@ static void foreach_in_range(void *data, void *user_data)
 	}
 }
 
+static void foreach_in_index(struct gatt_db *db, struct foreach_data *data)
+{
+	const uint128_t *type = NULL;
+	struct gatt_db_attribute *attrib;
+	bt_uuid_t uuid;
+	unsigned int i, gen;
+
+	gen = db->index_gen;
+
+	if (data->uuid) {
+		bt_uuid_to_uuid128(data->uuid, &uuid);
+		type = &uuid.value.u128;
+		i = type_index_lookup(db, type, data->start);
+	} else
+		i = index_lookup(db, data->start);
+
+	gatt_db_ref(db);
+
+	for (; (attrib = index_get(db, type, i)); i++) {
+		uint16_t handle = attrib->handle;
+
+		if (handle > data->end)
+			break;
+
+		if (!attrib->service->active)
+			continue;
+
+		data->func(attrib, data->user_data);
+
+		/* The callback modified the database, continue with a plain
+		 * scan from the next handle.
+		 */
+		if (db->index_gen != gen) {
+			if (handle < data->end) {
+				data->start = handle + 1;
+				queue_foreach(db->services, foreach_in_range,
+									data);
+			}
+			break;
+		}
+	}
+
+	gatt_db_unref(db);
+}
+
 void gatt_db_foreach_service_in_range(struct gatt_db *db,
 						const bt_uuid_t *uuid,
 						gatt_db_attribute_cb_t func,
@@ -1516,7 +1894,7 @@ void gatt_db_foreach_in_range(struct gatt_db *db, const bt_uuid_t *uuid,
 	data.end = end_handle;
 	data.attr = true;
 
-	queue_foreach(db->services, foreach_in_range, &data);
+	foreach_in_index(db, &data);
 }
 
 void gatt_db_service_foreach(struct gatt_db_attribute *attrib,
@@ -1669,22 +2047,13 @@ struct gatt_db_attribute *gatt_db_get_attribute(struct gatt_db *db,
 							uint16_t handle)
 {
 	struct gatt_db_attribute *attrib;
-	struct gatt_db_service *service;
-	int i;
 
-	attrib = gatt_db_get_service(db, handle);
-	if (!attrib)
+	if (!db || !handle)
 		return NULL;
 
-	service = attrib->service;
-
-	for (i = 0; i < service->num_handles; i++) {
-		if (!service->attributes[i])
-			continue;
-
-		if (service->attributes[i]->handle == handle)
-			return service->attributes[i];
-	}
+	attrib = index_get(db, NULL, index_lookup(db, handle));
+	if (attrib && attrib->handle == handle)
+		return attrib;
 
 	return NULL;
 }
@@ -2186,6 +2555,12 @@ bool gatt_db_attribute_write(struct gatt_db_attribute *attrib, uint16_t offset,
 
 	memcpy(&attrib->value[offset], value, len);
 
+	if (attribute_hash_value(attrib)) {
+		attrib->service->hash_dirty = true;
+		if (attrib->service->active && attrib->service->db)
+			attrib->service->db->hash_stale = true;
+	}
+
 done:
 	if (func)
 		func(attrib, err, user_data);
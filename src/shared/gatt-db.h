@@ -30,6 +30,10 @@ bool gatt_db_clear_range(struct gatt_db *db, uint16_t start_handle,
 							uint16_t end_handle);
 bool gatt_db_hash_support(struct gatt_db *db);
 uint8_t *gatt_db_get_hash(struct gatt_db *db);
+bool gatt_db_hash_hold(struct gatt_db *db);
+bool gatt_db_hash_release(struct gatt_db *db);
+bool gatt_db_get_hash_stats(struct gatt_db *db, unsigned int *updates,
+							unsigned int *saved);
 
 struct gatt_db_attribute *gatt_db_insert_service(struct gatt_db *db,
 							uint16_t handle,
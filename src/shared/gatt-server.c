@@ -1757,27 +1757,44 @@ static bool notify_append_le16(struct nfy_mult_data *data, uint16_t value)
 	return true;
 }
 
+static bool send_notification(struct bt_gatt_server *server, uint16_t handle,
+					const uint8_t *value, uint16_t length)
+{
+	uint8_t hdr[2];
+	struct iovec iov[2];
+
+	put_le16(handle, hdr);
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = (void *) value;
+	iov[1].iov_len = MIN(bt_att_get_mtu(server->att) - 3, length);
+
+	/* Encode directly into the ATT PDU, no intermediate buffer needed */
+	return !!bt_att_sendv(server->att, BT_ATT_OP_HANDLE_NFY, iov, 2, NULL,
+							NULL, NULL);
+}
+
 bool bt_gatt_server_send_notification(struct bt_gatt_server *server,
 					uint16_t handle, const uint8_t *value,
 					uint16_t length, bool multiple)
 {
 	struct nfy_mult_data *data = NULL;
-	bool result;
 
 	if (!server || (length && !value))
 		return false;
 
-	if (multiple) {
-		data = server->nfy_mult;
+	if (!multiple)
+		return send_notification(server, handle, value, length);
 
-		/* flush buffered data if this request hits buffer size limit */
-		if (data && data->offset > 0 &&
-				data->len - data->offset < 4 + length) {
-			notify_multiple_timeout_remove(server);
-			notify_multiple(server);
-			/* data has been freed by notify_multiple */
-			data = NULL;
-		}
+	data = server->nfy_mult;
+
+	/* flush buffered data if this request hits buffer size limit */
+	if (data && data->offset > 0 &&
+			data->len - data->offset < 4 + length) {
+		notify_multiple_timeout_remove(server);
+		notify_multiple(server);
+		/* data has been freed by notify_multiple */
+		data = NULL;
 	}
 
 	if (!data) {
@@ -1789,37 +1806,24 @@ bool bt_gatt_server_send_notification(struct bt_gatt_server *server,
 	if (!notify_append_le16(data, handle))
 		goto error;
 
-	if (multiple) {
-		length = MIN(data->len - data->offset - 2, length);
-		if (!notify_append_le16(data, length))
-			goto error;
-	} else {
-		length = MIN(data->len - data->offset, length);
-	}
+	length = MIN(data->len - data->offset - 2, length);
+	if (!notify_append_le16(data, length))
+		goto error;
 
 	if (value)
 		memcpy(data->pdu + data->offset, value, length);
 
 	data->offset += length;
 
-	if (multiple) {
-		if (!server->nfy_mult)
-			server->nfy_mult = data;
-
-		if (!server->nfy_mult->id)
-			server->nfy_mult->id = timeout_add(NFY_MULT_TIMEOUT,
-						   notify_multiple, server,
-						   NULL);
-
-		return true;
-	}
+	if (!server->nfy_mult)
+		server->nfy_mult = data;
 
-	result = !!bt_att_send(server->att, BT_ATT_OP_HANDLE_NFY,
-				data->pdu, data->offset, NULL, NULL, NULL);
-	free(data->pdu);
-	free(data);
+	if (!server->nfy_mult->id)
+		server->nfy_mult->id = timeout_add(NFY_MULT_TIMEOUT,
+					   notify_multiple, server,
+					   NULL);
 
-	return result;
+	return true;
 
 error:
 	if (data)
@@ -0,0 +1,219 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "src/shared/lz4.h"
+
+/*
+ * Encoder and decoder for the LZ4 block format. Output of lz4_compress()
+ * can be decoded by any LZ4 implementation and vice versa.
+ */
+
+#define HASH_LOG	12
+#define MIN_MATCH	4
+#define LAST_LITERALS	5	/* Block always ends with literals */
+#define MF_LIMIT	12	/* No match may start after end - 12 */
+#define MAX_OFFSET	65535
+#define SKIP_TRIGGER	6	/* Speed up on incompressible data */
+
+static uint32_t read32(const uint8_t *ptr)
+{
+	uint32_t val;
+
+	memcpy(&val, ptr, sizeof(val));
+
+	return val;
+}
+
+static uint32_t hash32(uint32_t val)
+{
+	return (val * 2654435761u) >> (32 - HASH_LOG);
+}
+
+static uint8_t *put_length(uint8_t *op, size_t len)
+{
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+
+	*op++ = len;
+
+	return op;
+}
+
+static uint8_t *put_sequence(uint8_t *op, const uint8_t *oend,
+				const uint8_t *lit, size_t lit_len,
+				size_t offset, size_t match_len)
+{
+	uint8_t *token;
+
+	/* Token, literal length, literals, offset and match length */
+	if ((size_t) (oend - op) < 1 + lit_len + lit_len / 255 + 1 + 2 +
+							match_len / 255 + 1)
+		return NULL;
+
+	token = op++;
+
+	if (lit_len >= 15) {
+		*token = 15 << 4;
+		op = put_length(op, lit_len - 15);
+	} else
+		*token = lit_len << 4;
+
+	memcpy(op, lit, lit_len);
+	op += lit_len;
+
+	if (!offset)
+		return op;
+
+	*op++ = offset & 0xff;
+	*op++ = offset >> 8;
+
+	match_len -= MIN_MATCH;
+
+	if (match_len >= 15) {
+		*token |= 15;
+		op = put_length(op, match_len - 15);
+	} else
+		*token |= match_len;
+
+	return op;
+}
+
+ssize_t lz4_compress(const void *src, size_t size, void *dst,
+							size_t dst_size)
+{
+	uint32_t table[1 << HASH_LOG];
+	const uint8_t *in = src;
+	const uint8_t *end = in + size;
+	const uint8_t *ip = in, *anchor = in;
+	uint8_t *op = dst;
+	const uint8_t *oend = op + dst_size;
+
+	memset(table, 0, sizeof(table));
+
+	while (size > MF_LIMIT && ip < end - MF_LIMIT) {
+		const uint8_t *ref, *limit = end - LAST_LITERALS;
+		uint32_t seq = read32(ip);
+		uint32_t h = hash32(seq);
+		size_t len;
+
+		ref = in + table[h];
+		table[h] = ip - in;
+
+		if (ref >= ip || ip - ref > MAX_OFFSET || read32(ref) != seq) {
+			ip += 1 + ((ip - anchor) >> SKIP_TRIGGER);
+			continue;
+		}
+
+		while (ip > anchor && ref > in && ip[-1] == ref[-1]) {
+			ip--;
+			ref--;
+		}
+
+		len = MIN_MATCH;
+		while (ip + len < limit && ip[len] == ref[len])
+			len++;
+
+		op = put_sequence(op, oend, anchor, ip - anchor, ip - ref,
+									len);
+		if (!op)
+			return -1;
+
+		ip += len;
+		anchor = ip;
+	}
+
+	op = put_sequence(op, oend, anchor, end - anchor, 0, 0);
+	if (!op)
+		return -1;
+
+	return op - (uint8_t *) dst;
+}
+
+static bool get_length(const uint8_t **ip, const uint8_t *iend, size_t *len)
+{
+	uint8_t val;
+
+	do {
+		if (*ip >= iend)
+			return false;
+
+		val = *(*ip)++;
+		*len += val;
+	} while (val == 255);
+
+	return true;
+}
+
+ssize_t lz4_decompress(const void *src, size_t size, void *dst,
+							size_t dst_size)
+{
+	const uint8_t *ip = src;
+	const uint8_t *iend = ip + size;
+	uint8_t *op = dst;
+	uint8_t *oend = op + dst_size;
+
+	while (ip < iend) {
+		uint8_t token = *ip++;
+		size_t len = token >> 4, offset;
+
+		if (len == 15 && !get_length(&ip, iend, &len))
+			return -1;
+
+		if (len > (size_t) (iend - ip) || len > (size_t) (oend - op))
+			return -1;
+
+		memcpy(op, ip, len);
+		ip += len;
+		op += len;
+
+		/* The last sequence has no match part */
+		if (ip == iend)
+			break;
+
+		if (iend - ip < 2)
+			return -1;
+
+		offset = ip[0] | ip[1] << 8;
+		ip += 2;
+
+		if (!offset || offset > (size_t) (op - (uint8_t *) dst))
+			return -1;
+
+		len = token & 15;
+		if (len == 15 && !get_length(&ip, iend, &len))
+			return -1;
+
+		len += MIN_MATCH;
+
+		if (len > (size_t) (oend - op))
+			return -1;
+
+		/* Source and destination overlap for repeated patterns */
+		if (offset >= len) {
+			memcpy(op, op - offset, len);
+			op += len;
+		} else {
+			while (len--) {
+				*op = *(op - offset);
+				op++;
+			}
+		}
+	}
+
+	return op - (uint8_t *) dst;
+}
@@ -0,0 +1,18 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Worst case output size of lz4_compress() */
+#define LZ4_COMPRESS_BOUND(size)	((size) + (size) / 255 + 16)
+
+ssize_t lz4_compress(const void *src, size_t size, void *dst,
+							size_t dst_size);
+ssize_t lz4_decompress(const void *src, size_t size, void *dst,
+							size_t dst_size);
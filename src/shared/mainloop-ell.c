@@ -77,6 +77,15 @@ int mainloop_run_with_signal(mainloop_signal_func func, void *user_data)
 	return l_main_run_with_signal(l_sig_func, user_data);
 }
 
+int mainloop_run_with_signal_mask(const sigset_t *extra,
+				mainloop_signal_func func, void *user_data)
+{
+	if (extra)
+		return -ENOSYS;
+
+	return mainloop_run_with_signal(func, user_data);
+}
+
 int mainloop_add_fd(int fd, uint32_t events, mainloop_event_func callback,
 				void *user_data, mainloop_destroy_func destroy)
 {
@@ -139,13 +139,17 @@ static bool signal_read(struct io *io, void *user_data)
 	return true;
 }
 
-static struct io *setup_signalfd(void *user_data)
+static struct io *setup_signalfd(const sigset_t *extra, void *user_data)
 {
 	struct io *io;
 	sigset_t mask;
 	int fd;
 
-	sigemptyset(&mask);
+	if (extra)
+		mask = *extra;
+	else
+		sigemptyset(&mask);
+
 	sigaddset(&mask, SIGINT);
 	sigaddset(&mask, SIGTERM);
 	sigaddset(&mask, SIGUSR2);
@@ -166,7 +170,9 @@ static struct io *setup_signalfd(void *user_data)
 	return io;
 }
 
-int mainloop_run_with_signal(mainloop_signal_func func, void *user_data)
+/* Signals in extra are delivered to func on top of the default ones */
+int mainloop_run_with_signal_mask(const sigset_t *extra,
+				mainloop_signal_func func, void *user_data)
 {
 	struct signal_data *data;
 	struct io *io;
@@ -179,7 +185,7 @@ int mainloop_run_with_signal(mainloop_signal_func func, void *user_data)
 	data->func = func;
 	data->user_data = user_data;
 
-	io = setup_signalfd(data);
+	io = setup_signalfd(extra, data);
 	if (!io) {
 		free(data);
 		return -errno;
@@ -192,3 +198,8 @@ int mainloop_run_with_signal(mainloop_signal_func func, void *user_data)
 
 	return ret;
 }
+
+int mainloop_run_with_signal(mainloop_signal_func func, void *user_data)
+{
+	return mainloop_run_with_signal_mask(NULL, func, user_data);
+}
@@ -20,6 +20,9 @@
 #include <stdlib.h>
 #include <stddef.h>
 #include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
 #include <signal.h>
 #include <sys/signalfd.h>
 #include <sys/timerfd.h>
@@ -27,10 +30,17 @@
 #include <sys/socket.h>
 #include <sys/un.h>
 
+#ifdef HAVE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
 #include "mainloop.h"
 #include "mainloop-notify.h"
 
-#define MAX_EPOLL_EVENTS 10
+#define MIN_EPOLL_EVENTS 16
+#define MAX_EPOLL_EVENTS 1024
 
 static int epoll_fd;
 static int epoll_terminate;
@@ -42,26 +52,410 @@ struct mainloop_data {
 	mainloop_event_func callback;
 	mainloop_destroy_func destroy;
 	void *user_data;
+	bool removed;
+#ifdef HAVE_IO_URING
+	bool armed;
+	bool rearm;
+#endif
+	struct mainloop_data *next;
 };
 
-#define MAX_MAINLOOP_ENTRIES 128
+#define MIN_MAINLOOP_ENTRIES 128
 
-static struct mainloop_data *mainloop_list[MAX_MAINLOOP_ENTRIES];
+/* Indexed by fd and grown as higher fds are added */
+static struct mainloop_data **mainloop_list;
+static unsigned int mainloop_size;
+static unsigned int mainloop_count;
+
+/* Entries removed while dispatching are freed once it is done */
+static struct mainloop_data *mainloop_removed;
+static bool mainloop_dispatch;
+
+static struct epoll_event epoll_static[MIN_EPOLL_EVENTS];
+static struct epoll_event *epoll_events = epoll_static;
+static unsigned int epoll_size = MIN_EPOLL_EVENTS;
+
+/*
+ * Timeouts are kept in a hierarchical timer wheel with millisecond ticks
+ * that is driven by a single timerfd. Each level has 256 slots and covers
+ * 256 times the range of the level below, so four levels cover the full
+ * range of an unsigned int timeout. Adding, modifying and removing a
+ * timeout take constant time and only need a system call when the new
+ * expiry is earlier than the currently programmed wakeup.
+ */
+#define WHEEL_BITS	8
+#define WHEEL_SIZE	(1 << WHEEL_BITS)
+#define WHEEL_MASK	(WHEEL_SIZE - 1)
+#define WHEEL_LEVELS	4
+
+struct timeout_link {
+	struct timeout_link *next;
+	struct timeout_link *prev;
+};
 
 struct timeout_data {
-	int fd;
+	struct timeout_link link;
+	int id;
+	uint64_t expire;
+	unsigned int level;
+	unsigned int slot;
+	bool pending;
 	mainloop_timeout_func callback;
 	mainloop_destroy_func destroy;
 	void *user_data;
 };
 
+struct timeout_level {
+	struct timeout_link slots[WHEEL_SIZE];
+	uint64_t map[WHEEL_SIZE / 64];
+};
+
+static struct timeout_level wheel[WHEEL_LEVELS];
+static uint64_t wheel_now;
+static uint64_t wheel_wakeup;
+static unsigned int wheel_pending;
+static int wheel_fd = -1;
+
+static struct timeout_data **timeout_list;
+static unsigned int timeout_size;
+static unsigned int timeout_count;
+static unsigned int timeout_next;
+
+#ifdef HAVE_IO_URING
+/*
+ * Optional backend that waits for fd events with io_uring poll requests.
+ * Re-arming the one shot requests is batched with the wait into a single
+ * io_uring_enter call, and every completion that is ready is handled per
+ * wakeup. Requests are re-armed after each event to keep the level
+ * triggered semantics of the epoll backend.
+ */
+#define URING_ENTRIES 256
+
+static struct {
+	int fd;
+	void *ring;
+	size_t ring_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_array;
+	unsigned int sq_mask;
+	unsigned int sq_entries;
+	unsigned int sq_queued;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int cq_mask;
+	struct io_uring_cqe *cqes;
+} uring = { .fd = -1 };
+
+static bool uring_enabled(void)
+{
+	return uring.fd >= 0;
+}
+
+static bool uring_init(void)
+{
+	struct io_uring_params params;
+	size_t size, cq_size;
+	uint8_t *ring;
+	int fd;
+
+	memset(&params, 0, sizeof(params));
+
+	fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+	if (fd < 0)
+		return false;
+
+	/* Completions must never be dropped and both rings share one map */
+	if (!(params.features & IORING_FEAT_NODROP) ||
+			!(params.features & IORING_FEAT_SINGLE_MMAP))
+		goto failed;
+
+	size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	cq_size = params.cq_off.cqes +
+			params.cq_entries * sizeof(struct io_uring_cqe);
+	if (cq_size > size)
+		size = cq_size;
+
+	ring = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (ring == MAP_FAILED)
+		goto failed;
+
+	uring.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	uring.sqes = mmap(NULL, uring.sqes_size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (uring.sqes == MAP_FAILED) {
+		munmap(ring, size);
+		goto failed;
+	}
+
+	uring.ring = ring;
+	uring.ring_size = size;
+	uring.sq_head = (unsigned int *) (ring + params.sq_off.head);
+	uring.sq_tail = (unsigned int *) (ring + params.sq_off.tail);
+	uring.sq_array = (unsigned int *) (ring + params.sq_off.array);
+	uring.sq_mask = *(unsigned int *) (ring + params.sq_off.ring_mask);
+	uring.sq_entries = params.sq_entries;
+	uring.sq_queued = 0;
+	uring.cq_head = (unsigned int *) (ring + params.cq_off.head);
+	uring.cq_tail = (unsigned int *) (ring + params.cq_off.tail);
+	uring.cq_mask = *(unsigned int *) (ring + params.cq_off.ring_mask);
+	uring.cqes = (struct io_uring_cqe *) (ring + params.cq_off.cqes);
+	uring.fd = fd;
+
+	return true;
+
+failed:
+	close(fd);
+	return false;
+}
+
+static void uring_exit(void)
+{
+	munmap(uring.sqes, uring.sqes_size);
+	munmap(uring.ring, uring.ring_size);
+	close(uring.fd);
+	uring.fd = -1;
+}
+
+static int uring_enter(unsigned int wait)
+{
+	int ret;
+
+	ret = syscall(__NR_io_uring_enter, uring.fd, uring.sq_queued, wait,
+				wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	if (ret < 0)
+		return -errno;
+
+	uring.sq_queued -= ret;
+
+	return ret;
+}
+
+static bool uring_queue(uint8_t opcode, int fd, uint32_t events,
+					void *addr, void *user_data)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int head, tail, index;
+
+	tail = *uring.sq_tail;
+	head = __atomic_load_n(uring.sq_head, __ATOMIC_ACQUIRE);
+
+	/* Hand the queued requests to the kernel when the ring is full */
+	if (tail - head == uring.sq_entries && uring_enter(0) <= 0)
+		return false;
+
+	index = tail & uring.sq_mask;
+
+	sqe = &uring.sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->poll_events = events & 0xffff;
+	sqe->addr = (uintptr_t) addr;
+	sqe->user_data = (uintptr_t) user_data;
+
+	uring.sq_array[index] = index;
+	__atomic_store_n(uring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+	uring.sq_queued++;
+
+	return true;
+}
+
+static int uring_arm(struct mainloop_data *data)
+{
+	if (!uring_queue(IORING_OP_POLL_ADD, data->fd, data->events,
+								NULL, data))
+		return -EIO;
+
+	data->armed = true;
+	data->rearm = false;
+
+	return 0;
+}
+
+static int uring_modify(struct mainloop_data *data)
+{
+	if (!data->armed)
+		return uring_arm(data);
+
+	/* Re-armed with the new events once the old request completes */
+	if (!data->rearm) {
+		uring_queue(IORING_OP_POLL_REMOVE, -1, 0, data, NULL);
+		data->rearm = true;
+	}
+
+	return 0;
+}
+
+static bool uring_cancel(struct mainloop_data *data)
+{
+	if (!data->armed)
+		return false;
+
+	uring_queue(IORING_OP_POLL_REMOVE, -1, 0, data, NULL);
+
+	return true;
+}
+
+static bool uring_pending(struct mainloop_data *data)
+{
+	return data->armed;
+}
+
+static void uring_complete(struct mainloop_data *data, int res)
+{
+	data->armed = false;
+
+	/* Removed entries only waited for their request to finish */
+	if (data->removed)
+		return;
+
+	if (res > 0) {
+		uint32_t events = res & (data->events | EPOLLERR | EPOLLHUP);
+
+		if (events) {
+			data->callback(data->fd, events, data->user_data);
+
+			if (data->removed)
+				return;
+		}
+	} else if (res != -ECANCELED) {
+		/* The fd has been closed without removing it first */
+		return;
+	}
+
+	if (!data->armed && (data->rearm || !(data->events & EPOLLONESHOT)))
+		uring_arm(data);
+}
+
+static void uring_dispatch(void)
+{
+	unsigned int head, tail;
+	int err;
+
+	err = uring_enter(1);
+	if (err < 0 && err != -EINTR && err != -EBUSY)
+		return;
+
+	mainloop_dispatch = true;
+
+	head = *uring.cq_head;
+	tail = __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE);
+
+	for (; head != tail; head++) {
+		struct io_uring_cqe *cqe = &uring.cqes[head & uring.cq_mask];
+
+		/* Requests that cancel a poll carry no entry */
+		if (cqe->user_data)
+			uring_complete((void *) (uintptr_t) cqe->user_data,
+								cqe->res);
+	}
+
+	__atomic_store_n(uring.cq_head, head, __ATOMIC_RELEASE);
+
+	mainloop_dispatch = false;
+}
+#else
+static bool uring_enabled(void)
+{
+	return false;
+}
+
+static bool uring_init(void)
+{
+	return false;
+}
+
+static void uring_exit(void)
+{
+}
+
+static int uring_arm(struct mainloop_data *data)
+{
+	return -ENOTSUP;
+}
+
+static int uring_modify(struct mainloop_data *data)
+{
+	return -ENOTSUP;
+}
+
+static bool uring_cancel(struct mainloop_data *data)
+{
+	return false;
+}
+
+static bool uring_pending(struct mainloop_data *data)
+{
+	return false;
+}
+
+static void uring_dispatch(void)
+{
+}
+#endif
+
+static struct mainloop_data *mainloop_get(int fd)
+{
+	if (fd < 0 || (unsigned int) fd >= mainloop_size)
+		return NULL;
+
+	return mainloop_list[fd];
+}
+
+static int mainloop_grow(int fd)
+{
+	unsigned int size = mainloop_size ? : MIN_MAINLOOP_ENTRIES;
+	struct mainloop_data **list;
+
+	while (size <= (unsigned int) fd)
+		size *= 2;
+
+	if (size == mainloop_size)
+		return 0;
+
+	list = realloc(mainloop_list, size * sizeof(*list));
+	if (!list)
+		return -ENOMEM;
+
+	memset(list + mainloop_size, 0,
+				(size - mainloop_size) * sizeof(*list));
+
+	mainloop_list = list;
+	mainloop_size = size;
+
+	return 0;
+}
+
+static void mainloop_free_removed(bool all)
+{
+	struct mainloop_data **next = &mainloop_removed;
+
+	while (*next) {
+		struct mainloop_data *data = *next;
+
+		if (!all && uring_pending(data)) {
+			next = &data->next;
+			continue;
+		}
+
+		*next = data->next;
+		free(data);
+	}
+}
+
 void mainloop_init(void)
 {
 	unsigned int i;
 
-	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	/* Use epoll when io_uring is not available or not permitted */
+	if (!uring_init())
+		epoll_fd = epoll_create1(EPOLL_CLOEXEC);
 
-	for (i = 0; i < MAX_MAINLOOP_ENTRIES; i++)
+	for (i = 0; i < mainloop_size; i++)
 		mainloop_list[i] = NULL;
 
 	epoll_terminate = 0;
@@ -88,33 +482,79 @@ void mainloop_exit_failure(void)
 	epoll_terminate = 1;
 }
 
-int mainloop_run(void)
+static void epoll_resize(void)
 {
-	unsigned int i;
+	unsigned int size = epoll_size;
+	struct epoll_event *events;
 
-	while (!epoll_terminate) {
-		struct epoll_event events[MAX_EPOLL_EVENTS];
-		int n, nfds;
+	/* Allow a single wakeup to return an event for every fd */
+	while (size < mainloop_count && size < MAX_EPOLL_EVENTS)
+		size *= 2;
 
-		nfds = epoll_wait(epoll_fd, events, MAX_EPOLL_EVENTS, -1);
-		if (nfds < 0)
-			continue;
+	if (size == epoll_size)
+		return;
+
+	events = malloc(size * sizeof(*events));
+	if (!events)
+		return;
+
+	if (epoll_events != epoll_static)
+		free(epoll_events);
+
+	epoll_events = events;
+	epoll_size = size;
+}
+
+static void epoll_dispatch(void)
+{
+	int n, nfds;
 
-		for (n = 0; n < nfds; n++) {
-			struct mainloop_data *data = events[n].data.ptr;
+	epoll_resize();
 
-			data->callback(data->fd, events[n].events,
+	nfds = epoll_wait(epoll_fd, epoll_events, epoll_size, -1);
+	if (nfds < 0)
+		return;
+
+	mainloop_dispatch = true;
+
+	for (n = 0; n < nfds; n++) {
+		struct mainloop_data *data = epoll_events[n].data.ptr;
+
+		/* Removed by an earlier callback of this batch */
+		if (data->removed)
+			continue;
+
+		data->callback(data->fd, epoll_events[n].events,
 							data->user_data);
-		}
 	}
 
-	for (i = 0; i < MAX_MAINLOOP_ENTRIES; i++) {
+	mainloop_dispatch = false;
+}
+
+int mainloop_run(void)
+{
+	unsigned int i;
+
+	while (!epoll_terminate) {
+		if (uring_enabled())
+			uring_dispatch();
+		else
+			epoll_dispatch();
+
+		mainloop_free_removed(false);
+	}
+
+	for (i = 0; i < mainloop_size; i++) {
 		struct mainloop_data *data = mainloop_list[i];
 
 		mainloop_list[i] = NULL;
 
 		if (data) {
-			epoll_ctl(epoll_fd, EPOLL_CTL_DEL, data->fd, NULL);
+			mainloop_count--;
+
+			if (!uring_enabled())
+				epoll_ctl(epoll_fd, EPOLL_CTL_DEL, data->fd,
+									NULL);
 
 			if (data->destroy)
 				data->destroy(data->user_data);
@@ -123,9 +563,25 @@ int mainloop_run(void)
 		}
 	}
 
-	close(epoll_fd);
+	free(mainloop_list);
+	mainloop_list = NULL;
+	mainloop_size = 0;
+
+	if (uring_enabled())
+		uring_exit();
+	else
+		close(epoll_fd);
+
 	epoll_fd = 0;
 
+	mainloop_free_removed(true);
+
+	if (epoll_events != epoll_static) {
+		free(epoll_events);
+		epoll_events = epoll_static;
+		epoll_size = MIN_EPOLL_EVENTS;
+	}
+
 	mainloop_notify_exit();
 
 	return exit_status;
@@ -138,9 +594,15 @@ int mainloop_add_fd(int fd, uint32_t events, mainloop_event_func callback,
 	struct epoll_event ev;
 	int err;
 
-	if (fd < 0 || fd > MAX_MAINLOOP_ENTRIES - 1 || !callback)
+	if (fd < 0 || !callback)
 		return -EINVAL;
 
+	if (mainloop_get(fd))
+		return -EEXIST;
+
+	if (mainloop_grow(fd) < 0)
+		return -ENOMEM;
+
 	data = malloc(sizeof(*data));
 	if (!data)
 		return -ENOMEM;
@@ -152,17 +614,23 @@ int mainloop_add_fd(int fd, uint32_t events, mainloop_event_func callback,
 	data->destroy = destroy;
 	data->user_data = user_data;
 
-	memset(&ev, 0, sizeof(ev));
-	ev.events = events;
-	ev.data.ptr = data;
+	if (uring_enabled()) {
+		err = uring_arm(data);
+	} else {
+		memset(&ev, 0, sizeof(ev));
+		ev.events = events;
+		ev.data.ptr = data;
+
+		err = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, data->fd, &ev);
+	}
 
-	err = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, data->fd, &ev);
 	if (err < 0) {
 		free(data);
 		return err;
 	}
 
 	mainloop_list[fd] = data;
+	mainloop_count++;
 
 	return 0;
 }
@@ -173,13 +641,18 @@ int mainloop_modify_fd(int fd, uint32_t events)
 	struct epoll_event ev;
 	int err;
 
-	if (fd < 0 || fd > MAX_MAINLOOP_ENTRIES - 1)
+	if (fd < 0)
 		return -EINVAL;
 
-	data = mainloop_list[fd];
+	data = mainloop_get(fd);
 	if (!data)
 		return -ENXIO;
 
+	if (uring_enabled()) {
+		data->events = events;
+		return uring_modify(data);
+	}
+
 	memset(&ev, 0, sizeof(ev));
 	ev.events = events;
 	ev.data.ptr = data;
@@ -196,69 +669,391 @@ int mainloop_modify_fd(int fd, uint32_t events)
 int mainloop_remove_fd(int fd)
 {
 	struct mainloop_data *data;
-	int err;
+	int err = 0;
 
-	if (fd < 0 || fd > MAX_MAINLOOP_ENTRIES - 1)
+	if (fd < 0)
 		return -EINVAL;
 
-	data = mainloop_list[fd];
+	data = mainloop_get(fd);
 	if (!data)
 		return -ENXIO;
 
 	mainloop_list[fd] = NULL;
+	mainloop_count--;
+
+	if (!uring_enabled())
+		err = epoll_ctl(epoll_fd, EPOLL_CTL_DEL, data->fd, NULL);
 
-	err = epoll_ctl(epoll_fd, EPOLL_CTL_DEL, data->fd, NULL);
+	data->removed = true;
 
 	if (data->destroy)
 		data->destroy(data->user_data);
 
-	free(data);
+	/* Still referenced by pending events or a poll request */
+	if (uring_cancel(data) || mainloop_dispatch) {
+		data->next = mainloop_removed;
+		mainloop_removed = data;
+	} else
+		free(data);
 
 	return err;
 }
 
-static void timeout_destroy(void *user_data)
+static uint64_t time_now(void)
 {
-	struct timeout_data *data = user_data;
+	struct timespec ts;
 
-	close(data->fd);
-	data->fd = -1;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
 
-	if (data->destroy)
-		data->destroy(data->user_data);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
 
-	free(data);
+static int map_find(const uint64_t *map, unsigned int start)
+{
+	unsigned int i = start / 64;
+	uint64_t bits = map[i] & (~0ULL << (start % 64));
+
+	while (!bits) {
+		if (++i == WHEEL_SIZE / 64)
+			return -1;
+
+		bits = map[i];
+	}
+
+	return i * 64 + ffsll(bits) - 1;
+}
+
+static void wheel_arm(uint64_t expire)
+{
+	struct itimerspec itimer;
+
+	if (expire == wheel_wakeup)
+		return;
+
+	memset(&itimer, 0, sizeof(itimer));
+
+	if (expire != UINT64_MAX) {
+		itimer.it_value.tv_sec = expire / 1000;
+		itimer.it_value.tv_nsec = (expire % 1000) * 1000 * 1000;
+	}
+
+	if (timerfd_settime(wheel_fd, TFD_TIMER_ABSTIME, &itimer, NULL) < 0)
+		return;
+
+	wheel_wakeup = expire;
+}
+
+static void wheel_insert(struct timeout_data *data)
+{
+	struct timeout_link *head;
+	uint64_t expire, delta;
+	unsigned int level;
+
+	expire = data->expire < wheel_now ? wheel_now : data->expire;
+	delta = expire - wheel_now;
+
+	for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+		if (!(delta >> (WHEEL_BITS * (level + 1))))
+			break;
+	}
+
+	/* Out of range entries are cascaded again until they fit */
+	if (delta >> (WHEEL_BITS * WHEEL_LEVELS))
+		expire = wheel_now + (1ULL << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+
+	data->level = level;
+	data->slot = (expire >> (WHEEL_BITS * level)) & WHEEL_MASK;
+
+	head = &wheel[level].slots[data->slot];
+	data->link.next = head;
+	data->link.prev = head->prev;
+	head->prev->next = &data->link;
+	head->prev = &data->link;
+
+	wheel[level].map[data->slot / 64] |= 1ULL << (data->slot % 64);
+
+	data->pending = true;
+	wheel_pending++;
+}
+
+static void wheel_remove(struct timeout_data *data)
+{
+	struct timeout_link *head;
+
+	if (!data->pending)
+		return;
+
+	data->link.prev->next = data->link.next;
+	data->link.next->prev = data->link.prev;
+	data->pending = false;
+	wheel_pending--;
+
+	/* Entry is on the expired list of wheel_run */
+	if (data->level >= WHEEL_LEVELS)
+		return;
+
+	head = &wheel[data->level].slots[data->slot];
+	if (head->next == head)
+		wheel[data->level].map[data->slot / 64] &=
+						~(1ULL << (data->slot % 64));
+}
+
+static void wheel_detach(unsigned int level, unsigned int slot,
+						struct timeout_link *list)
+{
+	struct timeout_link *head = &wheel[level].slots[slot];
+
+	list->next = head->next;
+	list->prev = head->prev;
+	list->next->prev = list;
+	list->prev->next = list;
+
+	head->next = head;
+	head->prev = head;
+
+	wheel[level].map[slot / 64] &= ~(1ULL << (slot % 64));
+}
+
+static void wheel_cascade(unsigned int level)
+{
+	unsigned int slot = (wheel_now >> (WHEEL_BITS * level)) & WHEEL_MASK;
+	struct timeout_link list;
+
+	if (!(wheel[level].map[slot / 64] & (1ULL << (slot % 64))))
+		return;
+
+	/* Detach first since entries may end up in the same slot again */
+	wheel_detach(level, slot, &list);
+
+	while (list.next != &list) {
+		struct timeout_data *data = (struct timeout_data *) list.next;
+
+		list.next = data->link.next;
+		list.next->prev = &list;
+		wheel_pending--;
+
+		wheel_insert(data);
+	}
+}
+
+static uint64_t wheel_next(void)
+{
+	uint64_t next = UINT64_MAX;
+	unsigned int level;
+
+	/*
+	 * Entries on higher levels never expire before their slot is
+	 * cascaded, so the earliest slot of each level is a lower bound.
+	 */
+	for (level = 0; level < WHEEL_LEVELS; level++) {
+		unsigned int shift = WHEEL_BITS * level;
+		uint64_t base, expire;
+		int slot;
+
+		base = (wheel_now + (1ULL << shift) - 1) >> shift;
+
+		slot = map_find(wheel[level].map, base & WHEEL_MASK);
+		if (slot < 0)
+			slot = map_find(wheel[level].map, 0);
+		if (slot < 0)
+			continue;
+
+		expire = (base + ((slot - base) & WHEEL_MASK)) << shift;
+		if (expire < next)
+			next = expire;
+	}
+
+	return next;
 }
 
-static void timeout_callback(int fd, uint32_t events, void *user_data)
+static void wheel_run(uint64_t target)
+{
+	while (wheel_now <= target) {
+		unsigned int index = wheel_now & WHEEL_MASK;
+		struct timeout_link list, *link;
+		unsigned int level;
+		uint64_t next;
+		int slot;
+
+		if (!index) {
+			for (level = 1; level < WHEEL_LEVELS; level++) {
+				wheel_cascade(level);
+
+				if ((wheel_now >> (WHEEL_BITS * level)) &
+								WHEEL_MASK)
+					break;
+			}
+		}
+
+		slot = map_find(wheel[0].map, index);
+		if (slot != (int) index) {
+			/* Skip ahead to the next slot with work to do */
+			if (slot < 0)
+				next = wheel_next();
+			else
+				next = wheel_now + slot - index;
+
+			wheel_now = next < target + 1 ? next : target + 1;
+			continue;
+		}
+
+		wheel_detach(0, index, &list);
+
+		for (link = list.next; link != &list; link = link->next)
+			((struct timeout_data *) link)->level = WHEEL_LEVELS;
+
+		wheel_now++;
+
+		/* Callbacks are free to add, modify or remove any timeout */
+		while (list.next != &list) {
+			struct timeout_data *data;
+
+			data = (struct timeout_data *) list.next;
+			wheel_remove(data);
+
+			data->callback(data->id, data->user_data);
+		}
+	}
+}
+
+static void wheel_callback(int fd, uint32_t events, void *user_data)
 {
-	struct timeout_data *data = user_data;
 	uint64_t expired;
 	ssize_t result;
 
 	if (events & (EPOLLERR | EPOLLHUP))
 		return;
 
-	result = read(data->fd, &expired, sizeof(expired));
+	result = read(fd, &expired, sizeof(expired));
 	if (result != sizeof(expired))
 		return;
 
-	if (data->callback)
-		data->callback(data->fd, data->user_data);
+	/* The timerfd is disarmed once it has expired */
+	wheel_wakeup = UINT64_MAX;
+
+	wheel_run(time_now());
+	wheel_arm(wheel_next());
 }
 
-static inline int timeout_set(int fd, unsigned int msec)
+static void timeout_free(struct timeout_data *data)
 {
-	struct itimerspec itimer;
-	unsigned int sec = msec / 1000;
+	timeout_list[data->id - 1] = NULL;
+	timeout_count--;
 
-	memset(&itimer, 0, sizeof(itimer));
-	itimer.it_interval.tv_sec = 0;
-	itimer.it_interval.tv_nsec = 0;
-	itimer.it_value.tv_sec = sec;
-	itimer.it_value.tv_nsec = (msec - (sec * 1000)) * 1000 * 1000;
+	wheel_remove(data);
+
+	if (data->destroy)
+		data->destroy(data->user_data);
+
+	free(data);
+}
+
+static void wheel_destroy(void *user_data)
+{
+	unsigned int i;
+
+	close(wheel_fd);
+	wheel_fd = -1;
 
-	return timerfd_settime(fd, 0, &itimer, NULL);
+	for (i = 0; i < timeout_size; i++) {
+		if (timeout_list[i])
+			timeout_free(timeout_list[i]);
+	}
+
+	free(timeout_list);
+	timeout_list = NULL;
+	timeout_size = 0;
+	timeout_next = 0;
+}
+
+static int wheel_init(void)
+{
+	unsigned int level, slot;
+
+	wheel_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (wheel_fd < 0)
+		return -EIO;
+
+	for (level = 0; level < WHEEL_LEVELS; level++) {
+		for (slot = 0; slot < WHEEL_SIZE; slot++) {
+			struct timeout_link *head = &wheel[level].slots[slot];
+
+			head->next = head;
+			head->prev = head;
+		}
+
+		memset(wheel[level].map, 0, sizeof(wheel[level].map));
+	}
+
+	wheel_now = time_now();
+	wheel_wakeup = UINT64_MAX;
+	wheel_pending = 0;
+
+	if (mainloop_add_fd(wheel_fd, EPOLLIN, wheel_callback, NULL,
+						wheel_destroy) < 0) {
+		close(wheel_fd);
+		wheel_fd = -1;
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static int timeout_alloc(struct timeout_data *data)
+{
+	/* Keep the table at most half full so a free id is found quickly */
+	if (timeout_count * 2 >= timeout_size) {
+		unsigned int size = timeout_size ? timeout_size * 2 : 64;
+		struct timeout_data **list;
+
+		list = realloc(timeout_list, size * sizeof(*list));
+		if (!list)
+			return -ENOMEM;
+
+		memset(list + timeout_size, 0,
+				(size - timeout_size) * sizeof(*list));
+
+		timeout_list = list;
+		timeout_size = size;
+	}
+
+	/* Hand out ids round robin so stale ids are not reused at once */
+	while (timeout_list[timeout_next])
+		timeout_next = (timeout_next + 1) % timeout_size;
+
+	timeout_list[timeout_next] = data;
+	data->id = timeout_next + 1;
+	timeout_count++;
+
+	timeout_next = (timeout_next + 1) % timeout_size;
+
+	return 0;
+}
+
+static struct timeout_data *timeout_lookup(int id)
+{
+	if (id < 1 || (unsigned int) id > timeout_size)
+		return NULL;
+
+	return timeout_list[id - 1];
+}
+
+static void timeout_set(struct timeout_data *data, unsigned int msec)
+{
+	uint64_t now = time_now();
+
+	wheel_remove(data);
+
+	/* Catch up an idle wheel instead of walking the gap later */
+	if (!wheel_pending && now > wheel_now)
+		wheel_now = now;
+
+	/* Round up to the next tick so a timeout never fires early */
+	data->expire = now + 1 + msec;
+	wheel_insert(data);
+
+	if (data->expire < wheel_wakeup)
+		wheel_arm(data->expire);
 }
 
 int mainloop_add_timeout(unsigned int msec, mainloop_timeout_func callback,
@@ -269,6 +1064,9 @@ int mainloop_add_timeout(unsigned int msec, mainloop_timeout_func callback,
 	if (!callback)
 		return -EINVAL;
 
+	if (wheel_fd < 0 && wheel_init() < 0)
+		return -EIO;
+
 	data = malloc(sizeof(*data));
 	if (!data)
 		return -ENOMEM;
@@ -278,44 +1076,40 @@ int mainloop_add_timeout(unsigned int msec, mainloop_timeout_func callback,
 	data->destroy = destroy;
 	data->user_data = user_data;
 
-	data->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
-	if (data->fd < 0) {
+	if (timeout_alloc(data) < 0) {
 		free(data);
-		return -EIO;
+		return -ENOMEM;
 	}
 
-	if (msec > 0) {
-		if (timeout_set(data->fd, msec) < 0) {
-			close(data->fd);
-			free(data);
-			return -EIO;
-		}
-	}
+	if (msec > 0)
+		timeout_set(data, msec);
 
-	if (mainloop_add_fd(data->fd, EPOLLIN | EPOLLONESHOT,
-				timeout_callback, data, timeout_destroy) < 0) {
-		close(data->fd);
-		free(data);
-		return -EIO;
-	}
-
-	return data->fd;
+	return data->id;
 }
 
 int mainloop_modify_timeout(int id, unsigned int msec)
 {
-	if (msec > 0) {
-		if (timeout_set(id, msec) < 0)
-			return -EIO;
-	}
+	struct timeout_data *data;
 
-	if (mainloop_modify_fd(id, EPOLLIN | EPOLLONESHOT) < 0)
-		return -EIO;
+	data = timeout_lookup(id);
+	if (!data)
+		return -ENXIO;
+
+	if (msec > 0)
+		timeout_set(data, msec);
 
 	return 0;
 }
 
 int mainloop_remove_timeout(int id)
 {
-	return mainloop_remove_fd(id);
+	struct timeout_data *data;
+
+	data = timeout_lookup(id);
+	if (!data)
+		return -ENXIO;
+
+	timeout_free(data);
+
+	return 0;
 }
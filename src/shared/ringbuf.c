@@ -30,12 +30,53 @@ struct ringbuf {
 	size_t size;
 	size_t in;
 	size_t out;
+	bool spsc;
 	ringbuf_tracing_func_t in_tracing;
 	void *in_data;
 };
 
 #define RINGBUF_RESET 0
 
+/*
+ * Only the producer moves in and only the consumer moves out. Loading the
+ * other side's index with acquire and publishing our own with release is
+ * all the synchronization a single producer and a single consumer running
+ * on different threads need.
+ */
+static inline size_t load_index(const size_t *index)
+{
+	return __atomic_load_n(index, __ATOMIC_ACQUIRE);
+}
+
+static inline void store_index(size_t *index, size_t value)
+{
+	__atomic_store_n(index, value, __ATOMIC_RELEASE);
+}
+
+static size_t used(struct ringbuf *ringbuf)
+{
+	return load_index(&ringbuf->in) - load_index(&ringbuf->out);
+}
+
+static size_t unused(struct ringbuf *ringbuf)
+{
+	return ringbuf->size - used(ringbuf);
+}
+
+/* Rewind an empty buffer so that the next data does not wrap */
+static void consumed(struct ringbuf *ringbuf, size_t count)
+{
+	size_t out = ringbuf->out + count;
+
+	if (!ringbuf->spsc && out == ringbuf->in) {
+		ringbuf->in = RINGBUF_RESET;
+		ringbuf->out = RINGBUF_RESET;
+		return;
+	}
+
+	store_index(&ringbuf->out, out);
+}
+
 /* Find last (most siginificant) set bit */
 static inline unsigned int fls(unsigned int x)
 {
@@ -73,6 +114,20 @@ struct ringbuf *ringbuf_new(size_t size)
 	return ringbuf;
 }
 
+struct ringbuf *ringbuf_new_spsc(size_t size)
+{
+	struct ringbuf *ringbuf;
+
+	ringbuf = ringbuf_new(size);
+	if (!ringbuf)
+		return NULL;
+
+	/* The consumer must never touch in, so the buffer is never rewound */
+	ringbuf->spsc = true;
+
+	return ringbuf;
+}
+
 void ringbuf_free(struct ringbuf *ringbuf)
 {
 	if (!ringbuf)
@@ -107,7 +162,7 @@ size_t ringbuf_len(struct ringbuf *ringbuf)
 	if (!ringbuf)
 		return 0;
 
-	return ringbuf->in - ringbuf->out;
+	return used(ringbuf);
 }
 
 size_t ringbuf_drain(struct ringbuf *ringbuf, size_t count)
@@ -117,16 +172,11 @@ size_t ringbuf_drain(struct ringbuf *ringbuf, size_t count)
 	if (!ringbuf)
 		return 0;
 
-	len = MIN(count, ringbuf->in - ringbuf->out);
+	len = MIN(count, used(ringbuf));
 	if (!len)
 		return 0;
 
-	ringbuf->out += len;
-
-	if (ringbuf->out == ringbuf->in) {
-		ringbuf->in = RINGBUF_RESET;
-		ringbuf->out = RINGBUF_RESET;
-	}
+	consumed(ringbuf, len);
 
 	return len;
 }
@@ -139,50 +189,96 @@ void *ringbuf_peek(struct ringbuf *ringbuf, size_t offset, size_t *len_nowrap)
 	offset = (ringbuf->out + offset) & (ringbuf->size - 1);
 
 	if (len_nowrap) {
-		size_t len = ringbuf->in - ringbuf->out;
+		size_t len = used(ringbuf);
 		*len_nowrap = MIN(len, ringbuf->size - offset);
 	}
 
 	return ringbuf->buffer + offset;
 }
 
-ssize_t ringbuf_write(struct ringbuf *ringbuf, int fd)
+/* Split len bytes starting at index into the part before and after wrap */
+static size_t fill_iov(struct ringbuf *ringbuf, size_t index, size_t len,
+							struct iovec iov[2])
 {
-	size_t len, offset, end;
-	struct iovec iov[2];
-	ssize_t consumed;
-
-	if (!ringbuf || fd < 0)
-		return -1;
+	size_t offset, end;
 
-	/* Determine how much data is available */
-	len = ringbuf->in - ringbuf->out;
-	if (!len)
-		return 0;
-
-	/* Grab data from buffer starting at offset until the end */
-	offset = ringbuf->out & (ringbuf->size - 1);
+	offset = index & (ringbuf->size - 1);
 	end = MIN(len, ringbuf->size - offset);
 
 	iov[0].iov_base = ringbuf->buffer + offset;
 	iov[0].iov_len = end;
 
-	/* Use second vector for remainder from the beginning */
 	iov[1].iov_base = ringbuf->buffer;
 	iov[1].iov_len = len - end;
 
-	consumed = writev(fd, iov, 2);
-	if (consumed < 0)
-		return -1;
+	return len;
+}
 
-	ringbuf->out += consumed;
+size_t ringbuf_peek_iov(struct ringbuf *ringbuf, struct iovec iov[2])
+{
+	if (!ringbuf || !iov)
+		return 0;
 
-	if (ringbuf->out == ringbuf->in) {
-		ringbuf->in = RINGBUF_RESET;
-		ringbuf->out = RINGBUF_RESET;
+	return fill_iov(ringbuf, ringbuf->out, used(ringbuf), iov);
+}
+
+size_t ringbuf_reserve_iov(struct ringbuf *ringbuf, struct iovec iov[2])
+{
+	if (!ringbuf || !iov)
+		return 0;
+
+	return fill_iov(ringbuf, ringbuf->in, unused(ringbuf), iov);
+}
+
+static void produced(struct ringbuf *ringbuf, size_t count)
+{
+	size_t offset, end;
+
+	if (ringbuf->in_tracing) {
+		offset = ringbuf->in & (ringbuf->size - 1);
+		end = MIN(count, ringbuf->size - offset);
+
+		ringbuf->in_tracing(ringbuf->buffer + offset, end,
+							ringbuf->in_data);
+		if (count - end > 0)
+			ringbuf->in_tracing(ringbuf->buffer, count - end,
+							ringbuf->in_data);
 	}
 
-	return consumed;
+	store_index(&ringbuf->in, ringbuf->in + count);
+}
+
+size_t ringbuf_commit(struct ringbuf *ringbuf, size_t count)
+{
+	if (!ringbuf)
+		return 0;
+
+	count = MIN(count, unused(ringbuf));
+	if (count)
+		produced(ringbuf, count);
+
+	return count;
+}
+
+ssize_t ringbuf_write(struct ringbuf *ringbuf, int fd)
+{
+	struct iovec iov[2];
+	ssize_t len;
+
+	if (!ringbuf || fd < 0)
+		return -1;
+
+	/* Write everything available straight out of the buffer */
+	if (!ringbuf_peek_iov(ringbuf, iov))
+		return 0;
+
+	len = writev(fd, iov, 2);
+	if (len < 0)
+		return -1;
+
+	consumed(ringbuf, len);
+
+	return len;
 }
 
 size_t ringbuf_avail(struct ringbuf *ringbuf)
@@ -190,7 +286,7 @@ size_t ringbuf_avail(struct ringbuf *ringbuf)
 	if (!ringbuf)
 		return 0;
 
-	return ringbuf->size - ringbuf->in + ringbuf->out;
+	return unused(ringbuf);
 }
 
 int ringbuf_printf(struct ringbuf *ringbuf, const char *format, ...)
@@ -207,7 +303,8 @@ int ringbuf_printf(struct ringbuf *ringbuf, const char *format, ...)
 
 int ringbuf_vprintf(struct ringbuf *ringbuf, const char *format, va_list ap)
 {
-	size_t avail, offset, end;
+	struct iovec iov[2];
+	size_t avail;
 	char *str;
 	int len;
 
@@ -215,7 +312,7 @@ int ringbuf_vprintf(struct ringbuf *ringbuf, const char *format, va_list ap)
 		return -1;
 
 	/* Determine maximum length available for string */
-	avail = ringbuf->size - ringbuf->in + ringbuf->out;
+	avail = ringbuf_reserve_iov(ringbuf, iov);
 	if (!avail)
 		return -1;
 
@@ -228,70 +325,39 @@ int ringbuf_vprintf(struct ringbuf *ringbuf, const char *format, va_list ap)
 		return -1;
 	}
 
-	/* Determine possible length of string before wrapping */
-	offset = ringbuf->in & (ringbuf->size - 1);
-	end = MIN((size_t) len, ringbuf->size - offset);
-	memcpy(ringbuf->buffer + offset, str, end);
-
-	if (ringbuf->in_tracing)
-		ringbuf->in_tracing(ringbuf->buffer + offset, end,
-							ringbuf->in_data);
-
-	if (len - end > 0) {
-		/* Put the remainder of string at the beginning */
-		memcpy(ringbuf->buffer, str + end, len - end);
-
-		if (ringbuf->in_tracing)
-			ringbuf->in_tracing(ringbuf->buffer, len - end,
-							ringbuf->in_data);
+	/* Put the remainder of string at the beginning if it wraps */
+	if ((size_t) len <= iov[0].iov_len)
+		memcpy(iov[0].iov_base, str, len);
+	else {
+		memcpy(iov[0].iov_base, str, iov[0].iov_len);
+		memcpy(iov[1].iov_base, str + iov[0].iov_len,
+						len - iov[0].iov_len);
 	}
 
 	free(str);
 
-	ringbuf->in += len;
+	produced(ringbuf, len);
 
 	return len;
 }
 
 ssize_t ringbuf_read(struct ringbuf *ringbuf, int fd)
 {
-	size_t avail, offset, end;
 	struct iovec iov[2];
-	ssize_t consumed;
+	ssize_t len;
 
 	if (!ringbuf || fd < 0)
 		return -1;
 
-	/* Determine how much can actually be consumed */
-	avail = ringbuf->size - ringbuf->in + ringbuf->out;
-	if (!avail)
+	/* Read as much as fits straight into the buffer */
+	if (!ringbuf_reserve_iov(ringbuf, iov))
 		return -1;
 
-	/* Determine how much to consume before wrapping */
-	offset = ringbuf->in & (ringbuf->size - 1);
-	end = MIN(avail, ringbuf->size - offset);
-
-	iov[0].iov_base = ringbuf->buffer + offset;
-	iov[0].iov_len = end;
-
-	/* Now put the remainder into the second vector */
-	iov[1].iov_base = ringbuf->buffer;
-	iov[1].iov_len = avail - end;
-
-	consumed = readv(fd, iov, 2);
-	if (consumed < 0)
+	len = readv(fd, iov, 2);
+	if (len < 0)
 		return -1;
 
-	if (ringbuf->in_tracing) {
-		size_t len = MIN((size_t) consumed, end);
-		ringbuf->in_tracing(ringbuf->buffer + offset, len,
-							ringbuf->in_data);
-		if (consumed - len > 0)
-			ringbuf->in_tracing(ringbuf->buffer, consumed - len,
-							ringbuf->in_data);
-	}
-
-	ringbuf->in += consumed;
+	produced(ringbuf, len);
 
-	return consumed;
+	return len;
 }
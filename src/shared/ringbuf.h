@@ -11,6 +11,7 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <sys/uio.h>
 
 typedef void (*ringbuf_tracing_func_t)(const void *buf, size_t count,
 							void *user_data);
@@ -18,6 +19,7 @@ typedef void (*ringbuf_tracing_func_t)(const void *buf, size_t count,
 struct ringbuf;
 
 struct ringbuf *ringbuf_new(size_t size);
+struct ringbuf *ringbuf_new_spsc(size_t size);
 void ringbuf_free(struct ringbuf *ringbuf);
 
 bool ringbuf_set_input_tracing(struct ringbuf *ringbuf,
@@ -28,9 +30,12 @@ size_t ringbuf_capacity(struct ringbuf *ringbuf);
 size_t ringbuf_len(struct ringbuf *ringbuf);
 size_t ringbuf_drain(struct ringbuf *ringbuf, size_t count);
 void *ringbuf_peek(struct ringbuf *ringbuf, size_t offset, size_t *len_nowrap);
+size_t ringbuf_peek_iov(struct ringbuf *ringbuf, struct iovec iov[2]);
 ssize_t ringbuf_write(struct ringbuf *ringbuf, int fd);
 
 size_t ringbuf_avail(struct ringbuf *ringbuf);
+size_t ringbuf_reserve_iov(struct ringbuf *ringbuf, struct iovec iov[2]);
+size_t ringbuf_commit(struct ringbuf *ringbuf, size_t count);
 int ringbuf_printf(struct ringbuf *ringbuf, const char *format, ...)
 					__attribute__((format(printf, 2, 3)));
 int ringbuf_vprintf(struct ringbuf *ringbuf, const char *format, va_list ap);
@@ -0,0 +1,303 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "src/shared/util.h"
+#include "src/shared/aes.h"
+#include "src/shared/rpa.h"
+
+/* Number of IRKs hashed per call into the AES code */
+#define RPA_BATCH 32
+
+struct rpa_irk {
+	uint8_t key[16];
+	void *user_data;
+};
+
+struct rpa_cache_entry {
+	uint8_t addr[6];
+	int index;		/* -1 if the address did not resolve */
+};
+
+struct bt_rpa_resolver {
+	/* Expanded keys are kept apart so they can be walked linearly */
+	struct bt_aes128 *keys;
+	struct rpa_irk *irks;
+	unsigned int len;
+	unsigned int size;
+
+	/* Most recently used entry first */
+	struct rpa_cache_entry *cache;
+	unsigned int cache_len;
+	unsigned int cache_size;
+
+	unsigned int lookups;
+	unsigned int hits;
+};
+
+struct bt_rpa_resolver *bt_rpa_resolver_new(unsigned int cache_size)
+{
+	struct bt_rpa_resolver *resolver;
+
+	resolver = new0(struct bt_rpa_resolver, 1);
+	resolver->cache_size = cache_size;
+
+	if (cache_size)
+		resolver->cache = new0(struct rpa_cache_entry, cache_size);
+
+	return resolver;
+}
+
+void bt_rpa_resolver_free(struct bt_rpa_resolver *resolver)
+{
+	if (!resolver)
+		return;
+
+	free(resolver->keys);
+	free(resolver->irks);
+	free(resolver->cache);
+	free(resolver);
+}
+
+static void cache_clear(struct bt_rpa_resolver *resolver)
+{
+	resolver->cache_len = 0;
+}
+
+static int find_irk(struct bt_rpa_resolver *resolver, const uint8_t irk[16])
+{
+	unsigned int i;
+
+	for (i = 0; i < resolver->len; i++) {
+		if (!memcmp(resolver->irks[i].key, irk, 16))
+			return i;
+	}
+
+	return -1;
+}
+
+static bool resolver_grow(struct bt_rpa_resolver *resolver)
+{
+	unsigned int size = resolver->size ? resolver->size * 2 : 8;
+	struct bt_aes128 *keys;
+	struct rpa_irk *irks;
+
+	keys = realloc(resolver->keys, size * sizeof(*keys));
+	if (!keys)
+		return false;
+
+	resolver->keys = keys;
+
+	irks = realloc(resolver->irks, size * sizeof(*irks));
+	if (!irks)
+		return false;
+
+	resolver->irks = irks;
+	resolver->size = size;
+
+	return true;
+}
+
+/*
+ * Like a linear search over the IRKs in the order they were added, the first
+ * entry wins if the same IRK is added twice and its user data is kept.
+ */
+bool bt_rpa_resolver_add(struct bt_rpa_resolver *resolver,
+				const uint8_t irk[16], void *user_data)
+{
+	uint8_t key[16];
+	int i;
+
+	if (!resolver || !irk)
+		return false;
+
+	if (find_irk(resolver, irk) >= 0)
+		return true;
+
+	if (resolver->len == resolver->size && !resolver_grow(resolver))
+		return false;
+
+	/* The most significant octet of the IRK is irk[15] */
+	for (i = 0; i < 16; i++)
+		key[i] = irk[15 - i];
+
+	bt_aes128_set_key(&resolver->keys[resolver->len], key);
+	memcpy(resolver->irks[resolver->len].key, irk, 16);
+	resolver->irks[resolver->len].user_data = user_data;
+	resolver->len++;
+
+	/* Addresses that did not resolve before may now */
+	cache_clear(resolver);
+
+	return true;
+}
+
+bool bt_rpa_resolver_remove(struct bt_rpa_resolver *resolver,
+				const uint8_t irk[16])
+{
+	unsigned int n;
+	int i;
+
+	if (!resolver || !irk)
+		return false;
+
+	i = find_irk(resolver, irk);
+	if (i < 0)
+		return false;
+
+	/* Keep the order IRKs were added in */
+	n = resolver->len - i - 1;
+	memmove(&resolver->keys[i], &resolver->keys[i + 1],
+					n * sizeof(*resolver->keys));
+	memmove(&resolver->irks[i], &resolver->irks[i + 1],
+					n * sizeof(*resolver->irks));
+	resolver->len--;
+
+	cache_clear(resolver);
+
+	return true;
+}
+
+void bt_rpa_resolver_clear(struct bt_rpa_resolver *resolver)
+{
+	if (!resolver)
+		return;
+
+	resolver->len = 0;
+	cache_clear(resolver);
+}
+
+unsigned int bt_rpa_resolver_count(struct bt_rpa_resolver *resolver)
+{
+	if (!resolver)
+		return 0;
+
+	return resolver->len;
+}
+
+static struct rpa_cache_entry *cache_lookup(struct bt_rpa_resolver *resolver,
+							const uint8_t addr[6])
+{
+	struct rpa_cache_entry entry;
+	unsigned int i;
+
+	for (i = 0; i < resolver->cache_len; i++) {
+		if (memcmp(resolver->cache[i].addr, addr, 6))
+			continue;
+
+		/* Move to front */
+		entry = resolver->cache[i];
+		memmove(&resolver->cache[1], &resolver->cache[0],
+					i * sizeof(*resolver->cache));
+		resolver->cache[0] = entry;
+
+		return &resolver->cache[0];
+	}
+
+	return NULL;
+}
+
+static void cache_add(struct bt_rpa_resolver *resolver, const uint8_t addr[6],
+								int index)
+{
+	if (!resolver->cache_size)
+		return;
+
+	/* Drop the least recently used entry when full */
+	if (resolver->cache_len < resolver->cache_size)
+		resolver->cache_len++;
+
+	memmove(&resolver->cache[1], &resolver->cache[0],
+			(resolver->cache_len - 1) * sizeof(*resolver->cache));
+
+	memcpy(resolver->cache[0].addr, addr, 6);
+	resolver->cache[0].index = index;
+}
+
+/*
+ * Resolve addr against every IRK: ah(k, prand) = e(k, padding || prand)
+ * mod 2^24 must match the hash part of the address.
+ */
+static int resolve(struct bt_rpa_resolver *resolver, const uint8_t addr[6])
+{
+	uint8_t in[16] = {};
+	uint8_t out[RPA_BATCH][16];
+	unsigned int i, j;
+
+	/* prand is addr[3..5], most significant octet first */
+	in[13] = addr[5];
+	in[14] = addr[4];
+	in[15] = addr[3];
+
+	for (i = 0; i < resolver->len; i += RPA_BATCH) {
+		unsigned int n = resolver->len - i;
+
+		if (n > RPA_BATCH)
+			n = RPA_BATCH;
+
+		bt_aes128_encrypt_keys(&resolver->keys[i], n, in, out);
+
+		for (j = 0; j < n; j++) {
+			if (out[j][15] == addr[0] && out[j][14] == addr[1] &&
+							out[j][13] == addr[2])
+				return i + j;
+		}
+	}
+
+	return -1;
+}
+
+bool bt_rpa_resolver_resolve(struct bt_rpa_resolver *resolver,
+				const uint8_t addr[6], void **user_data)
+{
+	struct rpa_cache_entry *entry;
+	int index;
+
+	if (!resolver || !addr)
+		return false;
+
+	resolver->lookups++;
+
+	entry = cache_lookup(resolver, addr);
+	if (entry) {
+		resolver->hits++;
+		index = entry->index;
+	} else {
+		index = resolve(resolver, addr);
+		cache_add(resolver, addr, index);
+	}
+
+	if (index < 0)
+		return false;
+
+	if (user_data)
+		*user_data = resolver->irks[index].user_data;
+
+	return true;
+}
+
+bool bt_rpa_resolver_get_stats(struct bt_rpa_resolver *resolver,
+				unsigned int *lookups, unsigned int *hits)
+{
+	if (!resolver)
+		return false;
+
+	if (lookups)
+		*lookups = resolver->lookups;
+
+	if (hits)
+		*hits = resolver->hits;
+
+	return true;
+}
@@ -0,0 +1,28 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct bt_rpa_resolver;
+
+struct bt_rpa_resolver *bt_rpa_resolver_new(unsigned int cache_size);
+void bt_rpa_resolver_free(struct bt_rpa_resolver *resolver);
+
+bool bt_rpa_resolver_add(struct bt_rpa_resolver *resolver,
+				const uint8_t irk[16], void *user_data);
+bool bt_rpa_resolver_remove(struct bt_rpa_resolver *resolver,
+				const uint8_t irk[16]);
+void bt_rpa_resolver_clear(struct bt_rpa_resolver *resolver);
+unsigned int bt_rpa_resolver_count(struct bt_rpa_resolver *resolver);
+
+bool bt_rpa_resolver_resolve(struct bt_rpa_resolver *resolver,
+				const uint8_t addr[6], void **user_data);
+
+bool bt_rpa_resolver_get_stats(struct bt_rpa_resolver *resolver,
+				unsigned int *lookups, unsigned int *hits);
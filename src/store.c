@@ -0,0 +1,230 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdbool.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "log.h"
+#include "textfile.h"
+#include "src/shared/timeout.h"
+#include "store.h"
+
+/*
+ * Device storage files are kept in memory for up to STORE_FLUSH_TIMEOUT
+ * seconds after their first use. Changes made in that window are written
+ * back together, so a burst of property updates costs a single rewrite of
+ * each file and a file read at startup is parsed only once.
+ */
+#define STORE_FLUSH_TIMEOUT 1
+
+struct store_entry {
+	GKeyFile *key_file;
+	bool dirty;
+};
+
+static GHashTable *store_cache;
+static unsigned int store_flush_id;
+
+static void store_entry_free(void *data)
+{
+	struct store_entry *entry = data;
+
+	g_key_file_unref(entry->key_file);
+	g_free(entry);
+}
+
+static bool store_flush_cb(void *user_data)
+{
+	store_flush_id = 0;
+
+	btd_store_flush();
+
+	return false;
+}
+
+static struct store_entry *store_entry_new(const char *filename,
+							GKeyFile *key_file)
+{
+	struct store_entry *entry;
+
+	if (!store_cache)
+		store_cache = g_hash_table_new_full(g_str_hash, g_str_equal,
+							g_free,
+							store_entry_free);
+
+	entry = g_new0(struct store_entry, 1);
+	entry->key_file = g_key_file_ref(key_file);
+
+	g_hash_table_insert(store_cache, g_strdup(filename), entry);
+
+	if (!store_flush_id)
+		store_flush_id = timeout_add_seconds(STORE_FLUSH_TIMEOUT,
+							store_flush_cb,
+							NULL, NULL);
+
+	return entry;
+}
+
+static struct store_entry *store_entry_lookup(const char *filename)
+{
+	if (!store_cache)
+		return NULL;
+
+	return g_hash_table_lookup(store_cache, filename);
+}
+
+static void store_write(const char *filename, GKeyFile *key_file)
+{
+	GError *gerr = NULL;
+	char *data;
+	gsize length = 0;
+
+	data = g_key_file_to_data(key_file, &length, NULL);
+
+	create_file(filename, 0600);
+
+	if (!g_file_set_contents(filename, data, length, &gerr)) {
+		error("Unable set contents for %s: (%s)", filename,
+								gerr->message);
+		g_error_free(gerr);
+	}
+
+	g_free(data);
+}
+
+/*
+ * Returns a reference to the cached key file, which has to be released with
+ * g_key_file_unref(). Changes only reach the disk after btd_store_save().
+ * A missing file is not an error and results in an empty key file.
+ */
+GKeyFile *btd_store_load(const char *filename, GError **gerr)
+{
+	struct store_entry *entry;
+	GKeyFile *key_file;
+	GError *err = NULL;
+
+	entry = store_entry_lookup(filename);
+	if (entry)
+		return g_key_file_ref(entry->key_file);
+
+	key_file = g_key_file_new();
+
+	if (!g_key_file_load_from_file(key_file, filename, 0, &err)) {
+		if (!g_error_matches(err, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+			/* Files which cannot be parsed are not cached */
+			g_propagate_error(gerr, err);
+			return key_file;
+		}
+
+		g_error_free(err);
+	}
+
+	store_entry_new(filename, key_file);
+
+	return key_file;
+}
+
+void btd_store_save(const char *filename, GKeyFile *key_file)
+{
+	struct store_entry *entry;
+
+	entry = store_entry_lookup(filename);
+	if (!entry) {
+		entry = store_entry_new(filename, key_file);
+	} else if (entry->key_file != key_file) {
+		g_key_file_unref(entry->key_file);
+		entry->key_file = g_key_file_ref(key_file);
+	}
+
+	entry->dirty = true;
+}
+
+/* Writes the file right away, for data which has to survive a crash */
+void btd_store_commit(const char *filename, GKeyFile *key_file)
+{
+	struct store_entry *entry;
+
+	btd_store_save(filename, key_file);
+
+	entry = store_entry_lookup(filename);
+	entry->dirty = false;
+
+	store_write(filename, key_file);
+}
+
+static gboolean store_match_path(gpointer key, gpointer value,
+							gpointer user_data)
+{
+	const char *filename = key;
+	const char *path = user_data;
+	size_t len = strlen(path);
+
+	if (strncmp(filename, path, len))
+		return FALSE;
+
+	return filename[len] == '\0' || filename[len] == '/';
+}
+
+/* Drops pending changes of a file, or of every file below a directory */
+void btd_store_remove(const char *path)
+{
+	if (!store_cache)
+		return;
+
+	g_hash_table_foreach_remove(store_cache, store_match_path,
+							(gpointer) path);
+}
+
+void btd_store_flush(void)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	unsigned int count = 0;
+
+	if (store_flush_id) {
+		timeout_remove(store_flush_id);
+		store_flush_id = 0;
+	}
+
+	if (!store_cache)
+		return;
+
+	g_hash_table_iter_init(&iter, store_cache);
+
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		struct store_entry *entry = value;
+
+		if (!entry->dirty)
+			continue;
+
+		store_write(key, entry->key_file);
+		count++;
+	}
+
+	if (count)
+		DBG("%u of %u files written", count,
+					g_hash_table_size(store_cache));
+
+	g_hash_table_remove_all(store_cache);
+}
+
+void btd_store_cleanup(void)
+{
+	btd_store_flush();
+
+	if (store_cache) {
+		g_hash_table_destroy(store_cache);
+		store_cache = NULL;
+	}
+}
@@ -0,0 +1,14 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+GKeyFile *btd_store_load(const char *filename, GError **gerr);
+void btd_store_save(const char *filename, GKeyFile *key_file);
+void btd_store_commit(const char *filename, GKeyFile *key_file);
+void btd_store_remove(const char *path);
+void btd_store_flush(void);
+void btd_store_cleanup(void);
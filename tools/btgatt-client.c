@@ -20,6 +20,7 @@
 #include <getopt.h>
 #include <limits.h>
 #include <errno.h>
+#include <time.h>
 
 #include "lib/bluetooth.h"
 #include "lib/hci.h"
@@ -32,6 +33,7 @@
 #include "src/shared/att.h"
 #include "src/shared/queue.h"
 #include "src/shared/gatt-db.h"
+#include "src/shared/gatt-cache.h"
 #include "src/shared/gatt-client.h"
 #include "src/shared/gatt-helpers.h"
 
@@ -50,6 +52,8 @@
 #define COLOR_BOLDWHITE	"\x1B[1;37m"
 
 static bool verbose = false;
+static const char *cache_file;
+static struct timespec connect_time;
 
 struct client {
 	int fd;
@@ -208,6 +212,15 @@ static struct client *client_create(int fd, uint16_t mtu)
 		return NULL;
 	}
 
+	if (cache_file) {
+		int err;
+
+		err = gatt_cache_load(cli->db, cache_file);
+		if (err < 0 && err != -ENOENT)
+			fprintf(stderr, "Failed to load GATT cache: %s\n",
+								strerror(-err));
+	}
+
 	cli->gatt = bt_gatt_client_new(cli->db, cli->att, mtu, 0);
 	if (!cli->gatt) {
 		fprintf(stderr, "Failed to create GATT client\n");
@@ -355,6 +368,8 @@ static void print_services_by_handle(struct client *cli, uint16_t handle)
 static void ready_cb(bool success, uint8_t att_ecode, void *user_data)
 {
 	struct client *cli = user_data;
+	struct timespec now;
+	long msec;
 
 	if (!success) {
 		PRLOG("GATT discovery procedures failed - error code: 0x%02x\n",
@@ -362,7 +377,22 @@ static void ready_cb(bool success, uint8_t att_ecode, void *user_data)
 		return;
 	}
 
-	PRLOG("GATT discovery procedures complete\n");
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	msec = (now.tv_sec - connect_time.tv_sec) * 1000L +
+		(now.tv_nsec - connect_time.tv_nsec) / 1000000L;
+
+	PRLOG("GATT discovery procedures complete in %ld ms\n", msec);
+
+	if (cache_file) {
+		int err;
+
+		err = gatt_cache_store(cli->db, cache_file);
+		if (err < 0) {
+			PRLOG("Failed to store GATT cache: %s\n",
+								strerror(-err));
+		}
+	}
 
 	print_services(cli);
 	print_prompt();
@@ -1713,6 +1743,7 @@ static void usage(void)
 		"\t-m, --mtu <mtu> \t\tThe ATT MTU to use\n"
 		"\t-s, --security-level <sec> \tSet security level (low|medium|"
 								"high|fips)\n"
+		"\t-c, --cache <file>\t\tLoad and store the GATT cache\n"
 		"\t-v, --verbose\t\t\tEnable extra logging\n"
 		"\t-h, --help\t\t\tDisplay help\n");
 }
@@ -1723,6 +1754,7 @@ static struct option main_options[] = {
 	{ "type",		1, 0, 't' },
 	{ "mtu",		1, 0, 'm' },
 	{ "security-level",	1, 0, 's' },
+	{ "cache",		1, 0, 'c' },
 	{ "verbose",		0, 0, 'v' },
 	{ "help",		0, 0, 'h' },
 	{ }
@@ -1740,7 +1772,7 @@ int main(int argc, char *argv[])
 	int fd;
 	struct client *cli;
 
-	while ((opt = getopt_long(argc, argv, "+hvs:m:t:d:i:",
+	while ((opt = getopt_long(argc, argv, "+hvs:m:t:d:i:c:",
 						main_options, NULL)) != -1) {
 		switch (opt) {
 		case 'h':
@@ -1808,6 +1840,9 @@ int main(int argc, char *argv[])
 				return EXIT_FAILURE;
 			}
 
+			break;
+		case 'c':
+			cache_file = optarg;
 			break;
 		default:
 			fprintf(stderr, "Invalid option: %c\n", opt);
@@ -1843,6 +1878,8 @@ int main(int argc, char *argv[])
 
 	mainloop_init();
 
+	clock_gettime(CLOCK_MONOTONIC, &connect_time);
+
 	fd = l2cap_le_att_connect(&src_addr, &dst_addr, dst_type, sec);
 	if (fd < 0)
 		return EXIT_FAILURE;
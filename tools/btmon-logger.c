@@ -22,8 +22,11 @@
 #include <time.h>
 #include <getopt.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/eventfd.h>
 #include <libgen.h>
 #include <errno.h>
 
@@ -34,6 +37,7 @@
 
 #include "src/shared/util.h"
 #include "src/shared/mainloop.h"
+#include "src/shared/ringbuf.h"
 #include "src/shared/btsnoop.h"
 
 #define MONITOR_INDEX_NONE 0xffff
@@ -44,64 +48,318 @@ struct monitor_hdr {
 	uint16_t len;
 } __attribute__ ((packed));
 
-static struct btsnoop *btsnoop_file = NULL;
+/* Frames received with a single recvmmsg() call */
+#define CAPTURE_BATCH		32
 
-static void data_callback(int fd, uint32_t events, void *user_data)
-{
+/* Must be a power of two */
+#define CAPTURE_RING_SIZE	(4 * 1024 * 1024)
+
+#define WRITE_BLOCK_SIZE	(64 * 1024)
+#define WRITE_BLOCK_ALIGN	4096
+
+/*
+ * Time the receive side may wait for the writer per recvmmsg() batch.
+ * Once it is used up, frames that do not fit are dropped right away.
+ */
+#define BACKPRESSURE_USEC	50
+#define BACKPRESSURE_BATCH_USEC	1000
+
+#define STATUS_INTERVAL		10000
+
+struct capture_frame {
+	struct monitor_hdr hdr;
 	uint8_t buf[BTSNOOP_MAX_PACKET_SIZE];
 	unsigned char control[64];
-	struct monitor_hdr hdr;
-	struct msghdr msg;
 	struct iovec iov[2];
+};
+
+static struct btsnoop *btsnoop_file = NULL;
+
+static struct capture_frame frames[CAPTURE_BATCH];
+static struct mmsghdr msgs[CAPTURE_BATCH];
+
+static struct ringbuf *capture_ring;
+static int writer_fd = -1;
+static pthread_t writer_thread;
+static volatile bool writer_quit;
+static volatile bool writer_flush;
+static volatile bool writer_failed;
+
+static unsigned int backpressure_budget;
+
+static unsigned long long num_frames;
+static unsigned long long num_backpressured;
+static unsigned long long num_dropped;
+
+static void *writer_func(void *user_data)
+{
+	uint8_t *block;
+	size_t block_len = 0;
+
+	if (posix_memalign((void **) &block, WRITE_BLOCK_ALIGN,
+						WRITE_BLOCK_SIZE)) {
+		writer_failed = true;
+		return NULL;
+	}
+
+	while (1) {
+		struct iovec iov[2];
+		size_t len, copy;
+		ssize_t written;
+		eventfd_t val;
+
+		len = ringbuf_peek_iov(capture_ring, iov);
+
+		if (!len && !block_len) {
+			/* Everything received so far goes to disk */
+			if (writer_flush || writer_quit) {
+				writer_flush = false;
+
+				if (!btsnoop_flush(btsnoop_file)) {
+					writer_failed = true;
+					break;
+				}
+			}
 
+			if (writer_quit)
+				break;
+
+			/* Counter based, so no wakeup is lost */
+			eventfd_read(writer_fd, &val);
+			continue;
+		}
+
+		copy = WRITE_BLOCK_SIZE - block_len;
+		if (copy > len)
+			copy = len;
+
+		if (copy > iov[0].iov_len) {
+			memcpy(block + block_len, iov[0].iov_base,
+							iov[0].iov_len);
+			memcpy(block + block_len + iov[0].iov_len,
+					iov[1].iov_base, copy - iov[0].iov_len);
+		} else
+			memcpy(block + block_len, iov[0].iov_base, copy);
+
+		ringbuf_drain(capture_ring, copy);
+		block_len += copy;
+
+		/* Keep filling the block while frames are coming in */
+		if (block_len < WRITE_BLOCK_SIZE && copy < len)
+			continue;
+
+		if (block_len < WRITE_BLOCK_SIZE &&
+					ringbuf_len(capture_ring))
+			continue;
+
+		written = btsnoop_write_records(btsnoop_file, block,
+								block_len);
+		if (written < 0) {
+			writer_failed = true;
+			break;
+		}
+
+		/* Partial trailing record is completed by the next copy */
+		block_len -= written;
+		memmove(block, block + written, block_len);
+	}
+
+	free(block);
+
+	return NULL;
+}
+
+static void copy_to_iov(struct iovec iov[2], size_t offset, const void *data,
+								size_t size)
+{
+	const uint8_t *ptr = data;
+	size_t len;
+
+	if (offset < iov[0].iov_len) {
+		len = iov[0].iov_len - offset;
+		if (len > size)
+			len = size;
+
+		memcpy((uint8_t *) iov[0].iov_base + offset, ptr, len);
+		ptr += len;
+		size -= len;
+		offset = 0;
+	} else
+		offset -= iov[0].iov_len;
+
+	if (size)
+		memcpy((uint8_t *) iov[1].iov_base + offset, ptr, size);
+}
+
+static void capture_frame(struct timeval *tv, uint16_t index, uint16_t opcode,
+					const void *data, uint16_t size)
+{
+	uint8_t hdr[BTSNOOP_RECORD_HDR_SIZE];
+	struct iovec iov[2];
+	bool waited = false;
+
+	num_frames++;
+
+	while (ringbuf_avail(capture_ring) < sizeof(hdr) + size) {
+		if (writer_failed || backpressure_budget < BACKPRESSURE_USEC) {
+			num_dropped++;
+			return;
+		}
+
+		if (!waited) {
+			num_backpressured++;
+			waited = true;
+		}
+
+		eventfd_write(writer_fd, 1);
+		usleep(BACKPRESSURE_USEC);
+		backpressure_budget -= BACKPRESSURE_USEC;
+	}
+
+	btsnoop_encode_hci(hdr, tv, index, opcode, num_dropped, size);
+
+	ringbuf_reserve_iov(capture_ring, iov);
+	copy_to_iov(iov, 0, hdr, sizeof(hdr));
+	copy_to_iov(iov, sizeof(hdr), data, size);
+	ringbuf_commit(capture_ring, sizeof(hdr) + size);
+}
+
+static void data_callback(int fd, uint32_t events, void *user_data)
+{
 	if (events & (EPOLLERR | EPOLLHUP)) {
 		mainloop_exit_failure();
 		return;
 	}
 
-	iov[0].iov_base = &hdr;
-	iov[0].iov_len = sizeof(hdr);
-	iov[1].iov_base = buf;
-	iov[1].iov_len = sizeof(buf);
+	while (1) {
+		int i, count;
 
-	memset(&msg, 0, sizeof(msg));
-	msg.msg_iov = iov;
-	msg.msg_iovlen = 2;
-	msg.msg_control = control;
-	msg.msg_controllen = sizeof(control);
+		for (i = 0; i < CAPTURE_BATCH; i++) {
+			struct msghdr *msg = &msgs[i].msg_hdr;
 
-	while (1) {
-		struct cmsghdr *cmsg;
-		struct timeval *tv = NULL;
-		struct timeval ctv;
-		uint16_t opcode, index, pktlen;
-		ssize_t len;
-
-		len = recvmsg(fd, &msg, MSG_DONTWAIT);
-		if (len < 0)
-			break;
+			frames[i].iov[0].iov_base = &frames[i].hdr;
+			frames[i].iov[0].iov_len = sizeof(frames[i].hdr);
+			frames[i].iov[1].iov_base = frames[i].buf;
+			frames[i].iov[1].iov_len = sizeof(frames[i].buf);
 
-		if (len < (ssize_t) sizeof(hdr))
+			memset(msg, 0, sizeof(*msg));
+			msg->msg_iov = frames[i].iov;
+			msg->msg_iovlen = 2;
+			msg->msg_control = frames[i].control;
+			msg->msg_controllen = sizeof(frames[i].control);
+		}
+
+		count = recvmmsg(fd, msgs, CAPTURE_BATCH, MSG_DONTWAIT, NULL);
+		if (count <= 0)
 			break;
 
-		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
-					cmsg = CMSG_NXTHDR(&msg, cmsg)) {
-			if (cmsg->cmsg_level != SOL_SOCKET)
+		backpressure_budget = BACKPRESSURE_BATCH_USEC;
+
+		for (i = 0; i < count; i++) {
+			struct msghdr *msg = &msgs[i].msg_hdr;
+			struct monitor_hdr *hdr = &frames[i].hdr;
+			struct cmsghdr *cmsg;
+			struct timeval tv;
+			bool has_tv = false;
+			uint16_t pktlen;
+
+			if (msgs[i].msg_len < sizeof(*hdr))
 				continue;
 
-			if (cmsg->cmsg_type == SCM_TIMESTAMP) {
-				memcpy(&ctv, CMSG_DATA(cmsg), sizeof(ctv));
-				tv = &ctv;
+			for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL;
+					cmsg = CMSG_NXTHDR(msg, cmsg)) {
+				if (cmsg->cmsg_level != SOL_SOCKET)
+					continue;
+
+				if (cmsg->cmsg_type == SCM_TIMESTAMP) {
+					memcpy(&tv, CMSG_DATA(cmsg),
+								sizeof(tv));
+					has_tv = true;
+				}
 			}
+
+			if (!has_tv)
+				gettimeofday(&tv, NULL);
+
+			pktlen = le16_to_cpu(hdr->len);
+			if (pktlen > msgs[i].msg_len - sizeof(*hdr))
+				pktlen = msgs[i].msg_len - sizeof(*hdr);
+
+			capture_frame(&tv, le16_to_cpu(hdr->index),
+					le16_to_cpu(hdr->opcode),
+					frames[i].buf, pktlen);
 		}
 
-		opcode = le16_to_cpu(hdr.opcode);
-		index  = le16_to_cpu(hdr.index);
-		pktlen = le16_to_cpu(hdr.len);
+		eventfd_write(writer_fd, 1);
+
+		if (count < CAPTURE_BATCH)
+			break;
+	}
+}
+
+static bool start_writer(void)
+{
+	int err;
+
+	capture_ring = ringbuf_new_spsc(CAPTURE_RING_SIZE);
+	if (!capture_ring) {
+		fprintf(stderr, "Failed to allocate capture buffer\n");
+		return false;
+	}
+
+	writer_fd = eventfd(0, EFD_CLOEXEC);
+	if (writer_fd < 0) {
+		perror("Failed to create writer event");
+		ringbuf_free(capture_ring);
+		return false;
+	}
+
+	err = pthread_create(&writer_thread, NULL, writer_func, NULL);
+	if (err) {
+		fprintf(stderr, "Failed to start writer: %s\n", strerror(err));
+		close(writer_fd);
+		ringbuf_free(capture_ring);
+		return false;
+	}
+
+	return true;
+}
+
+static void stop_writer(void)
+{
+	writer_quit = true;
+	eventfd_write(writer_fd, 1);
+
+	pthread_join(writer_thread, NULL);
+
+	close(writer_fd);
+	ringbuf_free(capture_ring);
+}
 
-		btsnoop_write_hci(btsnoop_file, tv, index, opcode, 0, buf,
-									pktlen);
+static void status_callback(int id, void *user_data)
+{
+	char status[128];
+
+	snprintf(status, sizeof(status), "STATUS=Running, %llu frames, "
+				"%llu backpressured, %llu dropped",
+				num_frames, num_backpressured, num_dropped);
+	mainloop_sd_notify(status);
+
+	if (writer_failed) {
+		fprintf(stderr, "Failed to write trace\n");
+		mainloop_exit_failure();
+		return;
 	}
+
+	mainloop_modify_timeout(id, STATUS_INTERVAL);
+}
+
+static void flush_callback(int id, void *user_data)
+{
+	writer_flush = true;
+	eventfd_write(writer_fd, 1);
+
+	mainloop_modify_timeout(id, BTSNOOP_FLUSH_INTERVAL * 1000);
 }
 
 static bool open_monitor_channel(void)
@@ -196,6 +454,7 @@ static void usage(void)
 		"\t-p, --parents          Create basename parent directories\n"
 		"\t-l, --limit <limit>    Limit traces file size (rotate)\n"
 		"\t-c, --count <count>    Limit number of rotated files\n"
+		"\t-z, --compress         Compress traces\n"
 		"\t-v, --version          Show version\n"
 		"\t-h, --help             Show help options\n");
 }
@@ -205,6 +464,7 @@ static const struct option main_options[] = {
 	{ "parents",	no_argument,		NULL, 'p' },
 	{ "limit",	required_argument,	NULL, 'l' },
 	{ "count",	required_argument,	NULL, 'c' },
+	{ "compress",	no_argument,		NULL, 'z' },
 	{ "version",	no_argument,		NULL, 'v' },
 	{ "help",	no_argument,		NULL, 'h' },
 	{ }
@@ -263,6 +523,7 @@ int main(int argc, char *argv[])
 	unsigned long max_count = 0;
 	size_t size_limit = 0;
 	bool parents = false;
+	bool compress = false;
 	int exit_status;
 	char *endptr;
 
@@ -273,7 +534,7 @@ int main(int argc, char *argv[])
 	while (true) {
 		int opt;
 
-		opt = getopt_long(argc, argv, "b:l:c:vhp", main_options,
+		opt = getopt_long(argc, argv, "b:l:c:zvhp", main_options,
 									NULL);
 		if (opt < 0)
 			break;
@@ -314,6 +575,9 @@ int main(int argc, char *argv[])
 		case 'c':
 			max_count = strtoul(optarg, &endptr, 10);
 			break;
+		case 'z':
+			compress = true;
+			break;
 		case 'p':
 			if (getppid() != 1) {
 				fprintf(stderr, "Parents option allowed only "
@@ -345,11 +609,21 @@ int main(int argc, char *argv[])
 	if (parents && create_dir(path) < 0)
 		return EXIT_FAILURE;
 
-	btsnoop_file = btsnoop_create(path, size_limit, max_count,
+	/* With compression the limit applies to the compressed size */
+	if (compress)
+		btsnoop_file = btsnoop_create_compressed(path, size_limit,
+					max_count, BTSNOOP_FORMAT_MONITOR);
+	else
+		btsnoop_file = btsnoop_create(path, size_limit, max_count,
 							BTSNOOP_FORMAT_MONITOR);
 	if (!btsnoop_file)
 		return EXIT_FAILURE;
 
+	if (!start_writer()) {
+		btsnoop_unref(btsnoop_file);
+		return EXIT_FAILURE;
+	}
+
 	drop_capabilities();
 
 	printf("Bluetooth monitor logger ver %s\n", VERSION);
@@ -357,10 +631,22 @@ int main(int argc, char *argv[])
 	mainloop_sd_notify("STATUS=Running");
 	mainloop_sd_notify("READY=1");
 
+	mainloop_add_timeout(STATUS_INTERVAL, status_callback, NULL, NULL);
+
+	/* Compressed traces are otherwise only written a block at a time */
+	if (compress)
+		mainloop_add_timeout(BTSNOOP_FLUSH_INTERVAL * 1000,
+						flush_callback, NULL, NULL);
+
 	exit_status = mainloop_run_with_signal(signal_callback, NULL);
 
 	mainloop_sd_notify("STATUS=Quitting");
 
+	stop_writer();
+
+	printf("%llu frames captured, %llu backpressured, %llu dropped\n",
+				num_frames, num_backpressured, num_dropped);
+
 	btsnoop_unref(btsnoop_file);
 
 	return exit_status;
@@ -23,6 +23,7 @@
 #include <stdbool.h>
 #include <string.h>
 #include <getopt.h>
+#include <time.h>
 #include <endian.h>
 #include <arpa/inet.h>
 #include <sys/stat.h>
@@ -497,6 +498,108 @@ close_input:
 	close(fd);
 }
 
+static void command_index(const char *input)
+{
+	struct btsnoop_index *idx;
+
+	idx = btsnoop_index_open(input, BTSNOOP_FLAG_PKLG_SUPPORT);
+	if (!idx) {
+		fprintf(stderr, "failed to open input file\n");
+		return;
+	}
+
+	if (!btsnoop_index_save(idx))
+		fprintf(stderr, "failed to write index\n");
+	else
+		printf("Indexed %zu packets\n", btsnoop_index_count(idx));
+
+	btsnoop_index_close(idx);
+}
+
+static double elapsed(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) +
+				(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void command_compress(const char *output, const char *input)
+{
+	unsigned char buf[BTSNOOP_MAX_PACKET_SIZE];
+	struct btsnoop *btsnoop_in, *btsnoop_out;
+	struct timespec start;
+	struct timeval tv;
+	struct stat st_in, st_out;
+	uint16_t index, opcode, size;
+	unsigned long num_packets = 0;
+	uint32_t format;
+	double t_write, t_read;
+
+	btsnoop_in = btsnoop_open(input, BTSNOOP_FLAG_PKLG_SUPPORT);
+	if (!btsnoop_in) {
+		fprintf(stderr, "failed to open input file\n");
+		return;
+	}
+
+	/* Only unencapsulated HCI can be written other than as monitor */
+	format = btsnoop_get_format(btsnoop_in);
+	if (format != BTSNOOP_FORMAT_HCI)
+		format = BTSNOOP_FORMAT_MONITOR;
+
+	btsnoop_out = btsnoop_create_compressed(output, 0, 0, format);
+	if (!btsnoop_out) {
+		fprintf(stderr, "failed to create output file\n");
+		btsnoop_unref(btsnoop_in);
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (btsnoop_read_hci(btsnoop_in, &tv, &index, &opcode,
+							buf, &size)) {
+		if (!btsnoop_write_hci(btsnoop_out, &tv, index, opcode, 0,
+								buf, size))
+			continue;
+
+		num_packets++;
+	}
+
+	btsnoop_unref(btsnoop_out);
+	btsnoop_unref(btsnoop_in);
+
+	t_write = elapsed(&start);
+
+	/* Read back to measure the cost on the decoding side */
+	btsnoop_in = btsnoop_open(output, 0);
+	if (!btsnoop_in) {
+		fprintf(stderr, "failed to open output file\n");
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (btsnoop_read_hci(btsnoop_in, &tv, &index, &opcode,
+							buf, &size));
+
+	t_read = elapsed(&start);
+
+	btsnoop_unref(btsnoop_in);
+
+	if (stat(input, &st_in) < 0 || stat(output, &st_out) < 0)
+		return;
+
+	printf("Compressed %lu packets\n", num_packets);
+	printf("  %lld -> %lld bytes (%.1f%%)\n", (long long) st_in.st_size,
+			(long long) st_out.st_size,
+			100.0 * st_out.st_size / st_in.st_size);
+	printf("  write %.1f MB/s, read %.1f MB/s\n",
+				st_in.st_size / t_write / 1e6,
+				st_in.st_size / t_read / 1e6);
+}
+
 static void usage(void)
 {
 	printf("btsnoop trace file handling tool\n"
@@ -505,19 +608,23 @@ static void usage(void)
 	printf("commands:\n"
 		"\t-m, --merge <output>   Merge multiple btsnoop files\n"
 		"\t-e, --extract <input>  Extract data from btsnoop file\n"
+		"\t-i, --index <input>    Write packet index of btsnoop file\n"
+		"\t-z, --compress <out>   Write compressed btsnoop file\n"
 		"\t-h, --help             Show help options\n");
 }
 
 static const struct option main_options[] = {
 	{ "merge",   required_argument, NULL, 'm' },
 	{ "extract", required_argument, NULL, 'e' },
+	{ "index",   required_argument, NULL, 'i' },
+	{ "compress", required_argument, NULL, 'z' },
 	{ "type",    required_argument, NULL, 't' },
 	{ "version", no_argument,       NULL, 'v' },
 	{ "help",    no_argument,       NULL, 'h' },
 	{ }
 };
 
-enum { INVALID, MERGE, EXTRACT };
+enum { INVALID, MERGE, EXTRACT, INDEX, COMPRESS };
 
 int main(int argc, char *argv[])
 {
@@ -529,7 +636,8 @@ int main(int argc, char *argv[])
 	for (;;) {
 		int opt;
 
-		opt = getopt_long(argc, argv, "m:e:t:vh", main_options, NULL);
+		opt = getopt_long(argc, argv, "m:e:i:z:t:vh", main_options,
+									NULL);
 		if (opt < 0)
 			break;
 
@@ -542,6 +650,14 @@ int main(int argc, char *argv[])
 			command = EXTRACT;
 			input_path = optarg;
 			break;
+		case 'i':
+			command = INDEX;
+			input_path = optarg;
+			break;
+		case 'z':
+			command = COMPRESS;
+			output_path = optarg;
+			break;
 		case 't':
 			type = optarg;
 			break;
@@ -587,6 +703,24 @@ int main(int argc, char *argv[])
 			fprintf(stderr, "extract type not supported\n");
 		break;
 
+	case INDEX:
+		if (argc - optind > 0) {
+			fprintf(stderr, "extra arguments not allowed\n");
+			return EXIT_FAILURE;
+		}
+
+		command_index(input_path);
+		break;
+
+	case COMPRESS:
+		if (argc - optind != 1) {
+			fprintf(stderr, "one input file required\n");
+			return EXIT_FAILURE;
+		}
+
+		command_compress(output_path, argv[optind]);
+		break;
+
 	default:
 		usage();
 		return EXIT_FAILURE;
@@ -0,0 +1,834 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+
+#include "src/shared/btsnoop.h"
+#include "src/shared/tester.h"
+
+#define TEST_PACKETS	1000
+#define BENCH_PACKETS	200000
+
+/* Layout of the .idx sidecar file */
+#define INDEX_HDR_SIZE		32
+#define INDEX_ENTRY_SIZE	24
+#define INDEX_ENTRY_SIZE_OFFSET	22
+
+static char path[] = "/tmp/test-btsnoop-XXXXXX";
+
+static uint16_t test_handle(unsigned int i)
+{
+	return 0x0040 + i % 3;
+}
+
+static void write_trace(struct btsnoop *btsnoop, unsigned int count,
+							uint16_t len)
+{
+	struct btsnoop_opcode_new_index ni;
+	struct timeval tv;
+	uint8_t acl[300];
+	unsigned int i;
+
+	g_assert(len <= sizeof(acl));
+
+	memset(&ni, 0, sizeof(ni));
+	memcpy(ni.name, "hci0", 4);
+
+	tv.tv_sec = 1700000000;
+	tv.tv_usec = 0;
+
+	g_assert(btsnoop_write_hci(btsnoop, &tv, 0, BTSNOOP_OPCODE_NEW_INDEX,
+						0, &ni, sizeof(ni)));
+
+	/* One packet every 10 ms, alternating between three connections */
+	for (i = 0; i < count; i++) {
+		tv.tv_usec += 10000;
+		if (tv.tv_usec >= 1000000) {
+			tv.tv_sec++;
+			tv.tv_usec -= 1000000;
+		}
+
+		memset(acl, i, len);
+		acl[0] = test_handle(i) & 0xff;
+		acl[1] = 0x20 | test_handle(i) >> 8;
+
+		g_assert(btsnoop_write_hci(btsnoop, &tv, 0,
+					BTSNOOP_OPCODE_ACL_TX_PKT, 0,
+					acl, len));
+	}
+}
+
+static void create_trace(void)
+{
+	struct btsnoop *btsnoop;
+	int fd;
+
+	fd = mkstemp(path);
+	g_assert(fd >= 0);
+	close(fd);
+
+	btsnoop = btsnoop_create(path, 0, 0, BTSNOOP_FORMAT_MONITOR);
+	g_assert(btsnoop);
+
+	write_trace(btsnoop, TEST_PACKETS, 8);
+
+	btsnoop_unref(btsnoop);
+}
+
+static void test_iterate(const void *data)
+{
+	struct btsnoop_index *idx;
+	struct btsnoop_record rec;
+	struct btsnoop *btsnoop;
+	uint8_t buf[BTSNOOP_MAX_PACKET_SIZE];
+	uint16_t index, opcode, size;
+	struct timeval tv;
+	unsigned int count = 0;
+
+	btsnoop = btsnoop_open(path, 0);
+	g_assert(btsnoop);
+
+	idx = btsnoop_index_open(path, 0);
+	g_assert(idx);
+	g_assert_cmpint(btsnoop_index_get_format(idx), ==,
+						BTSNOOP_FORMAT_MONITOR);
+
+	/* Both readers must return the same records */
+	while (btsnoop_read_hci(btsnoop, &tv, &index, &opcode, buf, &size)) {
+		g_assert(btsnoop_index_next(idx, &rec));
+		g_assert_cmpint(rec.tv.tv_sec, ==, tv.tv_sec);
+		g_assert_cmpint(rec.tv.tv_usec, ==, tv.tv_usec);
+		g_assert_cmpint(rec.index, ==, index);
+		g_assert_cmpint(rec.opcode, ==, opcode);
+		g_assert_cmpint(rec.size, ==, size);
+		g_assert(!memcmp(rec.data, buf, size));
+
+		if (opcode == BTSNOOP_OPCODE_ACL_TX_PKT)
+			g_assert_cmpint(rec.handle, ==, test_handle(count++));
+		else
+			g_assert_cmpint(rec.handle, ==, 0xffff);
+	}
+
+	g_assert(!btsnoop_index_next(idx, &rec));
+	g_assert_cmpint(count, ==, TEST_PACKETS);
+
+	btsnoop_index_close(idx);
+	btsnoop_unref(btsnoop);
+
+	tester_test_passed();
+}
+
+static void test_seek(const void *data)
+{
+	struct btsnoop_index *idx;
+	struct btsnoop_record rec;
+	struct timeval tv;
+	size_t pos;
+
+	idx = btsnoop_index_open(path, 0);
+	g_assert(idx);
+
+	g_assert_cmpint(btsnoop_index_count(idx), ==, TEST_PACKETS + 1);
+
+	/* Exactly on a record */
+	tv.tv_sec = 1700000001;
+	tv.tv_usec = 0;
+	pos = btsnoop_index_find_time(idx, &tv);
+	g_assert_cmpint(pos, ==, 100);
+
+	/* In between records */
+	tv.tv_usec = 5000;
+	pos = btsnoop_index_find_time(idx, &tv);
+	g_assert_cmpint(pos, ==, 101);
+
+	g_assert(btsnoop_index_get(idx, pos, &rec));
+	g_assert_cmpint(rec.tv.tv_sec, ==, 1700000001);
+	g_assert_cmpint(rec.tv.tv_usec, ==, 10000);
+
+	g_assert(btsnoop_index_seek(idx, pos));
+	g_assert(btsnoop_index_next(idx, &rec));
+	g_assert_cmpint(rec.tv.tv_usec, ==, 10000);
+
+	/* Past the end */
+	tv.tv_sec = 1800000000;
+	pos = btsnoop_index_find_time(idx, &tv);
+	g_assert_cmpint(pos, ==, TEST_PACKETS + 1);
+	g_assert(!btsnoop_index_get(idx, pos, &rec));
+
+	pos = btsnoop_index_find_handle(idx, 0, 0xffff, 0x0042);
+	g_assert_cmpint(pos, ==, 3);
+	pos = btsnoop_index_find_handle(idx, pos + 1, 0, 0x0042);
+	g_assert_cmpint(pos, ==, 6);
+	pos = btsnoop_index_find_handle(idx, 0, 1, 0x0042);
+	g_assert_cmpint(pos, ==, TEST_PACKETS + 1);
+
+	btsnoop_index_close(idx);
+
+	tester_test_passed();
+}
+
+static void test_sidecar(const void *data)
+{
+	struct btsnoop_index *idx;
+	struct btsnoop_record rec, saved;
+	char *idx_path;
+	FILE *fp;
+
+	idx = btsnoop_index_open(path, 0);
+	g_assert(idx);
+	g_assert(btsnoop_index_save(idx));
+	g_assert(btsnoop_index_get(idx, 500, &saved));
+	btsnoop_index_close(idx);
+
+	idx_path = g_strdup_printf("%s.idx", path);
+	g_assert(access(idx_path, R_OK) == 0);
+
+	/* Loaded from the sidecar file */
+	idx = btsnoop_index_open(path, 0);
+	g_assert(idx);
+	g_assert_cmpint(btsnoop_index_count(idx), ==, TEST_PACKETS + 1);
+	g_assert(btsnoop_index_get(idx, 500, &rec));
+	g_assert_cmpint(rec.tv.tv_sec, ==, saved.tv.tv_sec);
+	g_assert_cmpint(rec.tv.tv_usec, ==, saved.tv.tv_usec);
+	g_assert_cmpint(rec.opcode, ==, saved.opcode);
+	g_assert_cmpint(rec.handle, ==, saved.handle);
+	g_assert_cmpint(rec.size, ==, saved.size);
+	btsnoop_index_close(idx);
+
+	/* A corrupted index must be ignored */
+	fp = fopen(idx_path, "r+");
+	g_assert(fp);
+	fputs("garbage", fp);
+	fclose(fp);
+
+	idx = btsnoop_index_open(path, 0);
+	g_assert(idx);
+	g_assert_cmpint(btsnoop_index_count(idx), ==, TEST_PACKETS + 1);
+	btsnoop_index_close(idx);
+
+	/* An entry reaching past the end of the trace rejects the index */
+	idx = btsnoop_index_open(path, 0);
+	g_assert(idx);
+	g_assert(btsnoop_index_save(idx));
+	btsnoop_index_close(idx);
+
+	fp = fopen(idx_path, "r+");
+	g_assert(fp);
+	g_assert(!fseek(fp, INDEX_HDR_SIZE + TEST_PACKETS * INDEX_ENTRY_SIZE +
+					INDEX_ENTRY_SIZE_OFFSET, SEEK_SET));
+	fputc(0xff, fp);
+	fputc(0xff, fp);
+	fclose(fp);
+
+	idx = btsnoop_index_open(path, 0);
+	g_assert(idx);
+	g_assert(btsnoop_index_get(idx, TEST_PACKETS, &rec));
+	g_assert_cmpint(rec.size, ==, 8);
+	btsnoop_index_close(idx);
+
+	unlink(idx_path);
+	g_free(idx_path);
+
+	tester_test_passed();
+}
+
+static void test_handles(const void *data)
+{
+	static const uint8_t disconnect[] = { 0x06, 0x04, 0x03, 0x41, 0x00,
+						0x13 };
+	static const uint8_t reset[] = { 0x03, 0x0c, 0x00 };
+	static const uint8_t nocp_multi[] = { 0x13, 0x09, 0x02, 0x40, 0x00,
+						0x01, 0x00, 0x42, 0x00, 0x01,
+						0x00 };
+	static const uint8_t nocp[] = { 0x13, 0x05, 0x01, 0x41, 0x00, 0x01,
+						0x00 };
+	char trace[] = "/tmp/test-btsnoop-XXXXXX";
+	struct btsnoop_index *idx;
+	struct btsnoop_record rec;
+	struct btsnoop *btsnoop;
+	struct timeval tv;
+	int fd;
+
+	fd = mkstemp(trace);
+	g_assert(fd >= 0);
+	close(fd);
+
+	btsnoop = btsnoop_create(trace, 0, 0, BTSNOOP_FORMAT_MONITOR);
+	g_assert(btsnoop);
+
+	tv.tv_sec = 1700000000;
+	tv.tv_usec = 0;
+
+	g_assert(btsnoop_write_hci(btsnoop, &tv, 0, BTSNOOP_OPCODE_COMMAND_PKT,
+					0, disconnect, sizeof(disconnect)));
+	g_assert(btsnoop_write_hci(btsnoop, &tv, 0, BTSNOOP_OPCODE_EVENT_PKT,
+					0, nocp_multi, sizeof(nocp_multi)));
+	g_assert(btsnoop_write_hci(btsnoop, &tv, 0, BTSNOOP_OPCODE_COMMAND_PKT,
+					0, reset, sizeof(reset)));
+	g_assert(btsnoop_write_hci(btsnoop, &tv, 0, BTSNOOP_OPCODE_EVENT_PKT,
+					0, nocp, sizeof(nocp)));
+
+	btsnoop_unref(btsnoop);
+
+	idx = btsnoop_index_open(trace, 0);
+	g_assert(idx);
+	g_assert_cmpint(btsnoop_index_count(idx), ==, 4);
+
+	g_assert(btsnoop_index_get(idx, 0, &rec));
+	g_assert_cmpint(rec.handle, ==, 0x0041);
+
+	g_assert(btsnoop_index_get(idx, 1, &rec));
+	g_assert_cmpint(rec.handle, ==, BTSNOOP_HANDLE_MULTIPLE);
+	g_assert(btsnoop_record_has_handle(&rec, 0x0040));
+	g_assert(btsnoop_record_has_handle(&rec, 0x0042));
+	g_assert(!btsnoop_record_has_handle(&rec, 0x0041));
+
+	g_assert(btsnoop_index_get(idx, 2, &rec));
+	g_assert_cmpint(rec.handle, ==, 0xffff);
+
+	g_assert_cmpint(btsnoop_index_find_handle(idx, 0, 0xffff, 0x0042),
+									==, 1);
+	g_assert_cmpint(btsnoop_index_find_handle(idx, 0, 0xffff, 0x0041),
+									==, 0);
+	g_assert_cmpint(btsnoop_index_find_handle(idx, 1, 0xffff, 0x0041),
+									==, 3);
+	g_assert_cmpint(btsnoop_index_find_handle(idx, 0, 0xffff, 0x0043),
+									==, 4);
+
+	btsnoop_index_close(idx);
+	unlink(trace);
+
+	tester_test_passed();
+}
+
+static void write_rotated(const char *base, bool records)
+{
+	struct btsnoop *btsnoop;
+	struct timeval tv;
+	uint8_t buf[4096], acl[300];
+	size_t len = 0;
+	unsigned int i;
+
+	btsnoop = btsnoop_create(base, 4096, 0, BTSNOOP_FORMAT_MONITOR);
+	g_assert(btsnoop);
+
+	tv.tv_sec = 1700000000;
+	tv.tv_usec = 0;
+
+	for (i = 0; i < 100; i++) {
+		uint16_t size = 8 + (i * 37) % (sizeof(acl) - 8);
+
+		tv.tv_usec = i * 1000;
+		memset(acl, i, size);
+
+		if (!records) {
+			g_assert(btsnoop_write_hci(btsnoop, &tv, 0,
+					BTSNOOP_OPCODE_ACL_TX_PKT, 0,
+					acl, size));
+			continue;
+		}
+
+		if (len + BTSNOOP_RECORD_HDR_SIZE + size > sizeof(buf)) {
+			g_assert(btsnoop_write_records(btsnoop, buf, len) ==
+							(ssize_t) len);
+			len = 0;
+		}
+
+		btsnoop_encode_hci(buf + len, &tv, 0,
+					BTSNOOP_OPCODE_ACL_TX_PKT, 0, size);
+		memcpy(buf + len + BTSNOOP_RECORD_HDR_SIZE, acl, size);
+		len += BTSNOOP_RECORD_HDR_SIZE + size;
+	}
+
+	/* A trailing partial record must not be written */
+	g_assert(btsnoop_write_records(btsnoop, buf, len + 10) ==
+							(ssize_t) len);
+
+	btsnoop_unref(btsnoop);
+}
+
+static void test_records(const void *data)
+{
+	char dir[] = "/tmp/test-btsnoop-XXXXXX";
+	char *base[2], *file[2];
+	unsigned int i, n;
+
+	g_assert(mkdtemp(dir));
+
+	base[0] = g_strdup_printf("%s/hci", dir);
+	base[1] = g_strdup_printf("%s/rec", dir);
+
+	write_rotated(base[0], false);
+	write_rotated(base[1], true);
+
+	/* Both must produce the same rotated files */
+	for (n = 0; ; n++) {
+		gchar *contents[2];
+		gsize len[2];
+		bool found[2];
+
+		for (i = 0; i < 2; i++) {
+			file[i] = g_strdup_printf("%s.%u", base[i], n);
+			found[i] = g_file_get_contents(file[i], &contents[i],
+							&len[i], NULL);
+		}
+
+		g_assert(found[0] == found[1]);
+
+		if (found[0]) {
+			g_assert_cmpint(len[0], ==, len[1]);
+			g_assert(!memcmp(contents[0], contents[1], len[0]));
+			g_assert_cmpint(len[0], <=, 4096);
+			g_free(contents[0]);
+			g_free(contents[1]);
+		}
+
+		for (i = 0; i < 2; i++) {
+			unlink(file[i]);
+			g_free(file[i]);
+		}
+
+		if (!found[0])
+			break;
+	}
+
+	g_assert_cmpint(n, >, 2);
+
+	rmdir(dir);
+	g_free(base[0]);
+	g_free(base[1]);
+
+	tester_test_passed();
+}
+
+static void compare_traces(const char *path1, const char *path2)
+{
+	uint8_t buf1[BTSNOOP_MAX_PACKET_SIZE], buf2[BTSNOOP_MAX_PACKET_SIZE];
+	uint16_t index1, opcode1, size1, index2, opcode2, size2;
+	struct btsnoop *btsnoop1, *btsnoop2;
+	struct timeval tv1, tv2;
+
+	btsnoop1 = btsnoop_open(path1, 0);
+	g_assert(btsnoop1);
+	btsnoop2 = btsnoop_open(path2, 0);
+	g_assert(btsnoop2);
+
+	while (btsnoop_read_hci(btsnoop1, &tv1, &index1, &opcode1,
+							buf1, &size1)) {
+		g_assert(btsnoop_read_hci(btsnoop2, &tv2, &index2, &opcode2,
+							buf2, &size2));
+		g_assert(!memcmp(&tv1, &tv2, sizeof(tv1)));
+		g_assert_cmpint(index1, ==, index2);
+		g_assert_cmpint(opcode1, ==, opcode2);
+		g_assert_cmpint(size1, ==, size2);
+		g_assert(!memcmp(buf1, buf2, size1));
+	}
+
+	g_assert(!btsnoop_read_hci(btsnoop2, &tv2, &index2, &opcode2,
+							buf2, &size2));
+
+	btsnoop_unref(btsnoop2);
+	btsnoop_unref(btsnoop1);
+}
+
+static void check_seek(const char *zpath)
+{
+	uint8_t buf[BTSNOOP_MAX_PACKET_SIZE];
+	uint16_t index, opcode, size;
+	struct btsnoop *btsnoop;
+	struct timeval tv;
+
+	btsnoop = btsnoop_open(zpath, 0);
+	g_assert(btsnoop);
+
+	/* Packet 1500 is 15 seconds after the first one */
+	tv.tv_sec = 1700000015;
+	tv.tv_usec = 5000;
+	g_assert(btsnoop_seek(btsnoop, &tv));
+	g_assert(btsnoop_read_hci(btsnoop, &tv, &index, &opcode, buf, &size));
+	g_assert_cmpint(tv.tv_sec, ==, 1700000015);
+	g_assert_cmpint(tv.tv_usec, ==, 10000);
+	g_assert_cmpint(buf[2], ==, 1500 % 256);
+
+	/* Backwards to the first record */
+	tv.tv_sec = 1600000000;
+	g_assert(btsnoop_seek(btsnoop, &tv));
+	g_assert(btsnoop_read_hci(btsnoop, &tv, &index, &opcode, buf, &size));
+	g_assert_cmpint(opcode, ==, BTSNOOP_OPCODE_NEW_INDEX);
+
+	tv.tv_sec = 1800000000;
+	g_assert(btsnoop_seek(btsnoop, &tv));
+	g_assert(!btsnoop_read_hci(btsnoop, &tv, &index, &opcode, buf, &size));
+
+	btsnoop_unref(btsnoop);
+}
+
+static void test_compressed(const void *data)
+{
+	char raw_path[] = "/tmp/test-btsnoop-XXXXXX";
+	char zpath[] = "/tmp/test-btsnoop-XXXXXX";
+	struct btsnoop_index *idx;
+	struct btsnoop_record rec;
+	struct btsnoop *btsnoop;
+	struct stat st;
+	int fd;
+
+	fd = mkstemp(raw_path);
+	g_assert(fd >= 0);
+	close(fd);
+
+	fd = mkstemp(zpath);
+	g_assert(fd >= 0);
+	close(fd);
+
+	btsnoop = btsnoop_create(raw_path, 0, 0, BTSNOOP_FORMAT_MONITOR);
+	g_assert(btsnoop);
+	write_trace(btsnoop, 3000, 200);
+	btsnoop_unref(btsnoop);
+
+	btsnoop = btsnoop_create_compressed(zpath, 0, 0,
+						BTSNOOP_FORMAT_MONITOR);
+	g_assert(btsnoop);
+	write_trace(btsnoop, 3000, 200);
+	btsnoop_unref(btsnoop);
+
+	compare_traces(raw_path, zpath);
+
+	idx = btsnoop_index_open(zpath, 0);
+	g_assert(idx);
+	g_assert_cmpint(btsnoop_index_count(idx), ==, 3001);
+	g_assert(btsnoop_index_get(idx, 1001, &rec));
+	g_assert_cmpint(rec.handle, ==, test_handle(1000));
+	g_assert_cmpint(rec.size, ==, 200);
+	btsnoop_index_close(idx);
+
+	check_seek(zpath);
+
+	/* Without the index blocks are walked from the start */
+	g_assert(stat(zpath, &st) == 0);
+	g_assert(truncate(zpath, st.st_size - 16) == 0);
+	check_seek(zpath);
+	compare_traces(raw_path, zpath);
+
+	unlink(raw_path);
+	unlink(zpath);
+
+	tester_test_passed();
+}
+
+static void test_compressed_rotate(const void *data)
+{
+	char dir[] = "/tmp/test-btsnoop-XXXXXX";
+	uint8_t buf[BTSNOOP_MAX_PACKET_SIZE];
+	uint16_t index, opcode, size;
+	struct btsnoop *btsnoop;
+	struct timeval tv, last;
+	unsigned int n;
+	char *base;
+
+	g_assert(mkdtemp(dir));
+	base = g_strdup_printf("%s/hci", dir);
+
+	btsnoop = btsnoop_create_compressed(base, 8192, 0,
+						BTSNOOP_FORMAT_MONITOR);
+	g_assert(btsnoop);
+	write_trace(btsnoop, 20000, 100);
+	btsnoop_unref(btsnoop);
+
+	for (n = 0; ; n++) {
+		char *file = g_strdup_printf("%s.%u", base, n);
+		struct stat st;
+
+		if (stat(file, &st) < 0) {
+			g_free(file);
+			break;
+		}
+
+		/* The limit applies to the compressed size */
+		g_assert_cmpint(st.st_size, <=, 8192);
+
+		btsnoop = btsnoop_open(file, 0);
+		g_assert(btsnoop);
+
+		while (btsnoop_read_hci(btsnoop, &tv, &index, &opcode,
+							buf, &size))
+			last = tv;
+
+		btsnoop_unref(btsnoop);
+		unlink(file);
+		g_free(file);
+	}
+
+	/* Every file must be complete up to the last record */
+	g_assert_cmpint(n, >, 1);
+	g_assert_cmpint(last.tv_sec, ==, 1700000200);
+	g_assert_cmpint(last.tv_usec, ==, 0);
+
+	rmdir(dir);
+	g_free(base);
+
+	tester_test_passed();
+}
+
+static unsigned int count_records(const char *zpath)
+{
+	uint8_t buf[BTSNOOP_MAX_PACKET_SIZE];
+	uint16_t index, opcode, size;
+	struct btsnoop *btsnoop;
+	struct timeval tv;
+	unsigned int n = 0;
+
+	btsnoop = btsnoop_open(zpath, 0);
+	g_assert(btsnoop);
+
+	while (btsnoop_read_hci(btsnoop, &tv, &index, &opcode, buf, &size))
+		n++;
+
+	btsnoop_unref(btsnoop);
+
+	return n;
+}
+
+static void test_compressed_flush(const void *data)
+{
+	char zpath[] = "/tmp/test-btsnoop-XXXXXX";
+	struct btsnoop_opcode_new_index ni;
+	struct btsnoop *btsnoop;
+	struct timeval tv = { 1700000000, 0 };
+	int fd;
+
+	fd = mkstemp(zpath);
+	g_assert(fd >= 0);
+	close(fd);
+
+	memset(&ni, 0, sizeof(ni));
+
+	btsnoop = btsnoop_create_compressed(zpath, 0, 0,
+						BTSNOOP_FORMAT_MONITOR);
+	g_assert(btsnoop);
+
+	g_assert(btsnoop_write_hci(btsnoop, &tv, 0, BTSNOOP_OPCODE_NEW_INDEX,
+						0, &ni, sizeof(ni)));
+	g_assert_cmpint(count_records(zpath), ==, 0);
+
+	/* An explicit flush writes out the open block */
+	g_assert(btsnoop_flush(btsnoop));
+	g_assert_cmpint(count_records(zpath), ==, 1);
+
+	tv.tv_sec += 1;
+	g_assert(btsnoop_write_hci(btsnoop, &tv, 0, BTSNOOP_OPCODE_OPEN_INDEX,
+							0, NULL, 0));
+	g_assert_cmpint(count_records(zpath), ==, 1);
+
+	/* A block spanning the flush interval is written out right away */
+	tv.tv_sec += BTSNOOP_FLUSH_INTERVAL;
+	g_assert(btsnoop_write_hci(btsnoop, &tv, 0, BTSNOOP_OPCODE_CLOSE_INDEX,
+							0, NULL, 0));
+	g_assert_cmpint(count_records(zpath), ==, 3);
+
+	g_assert(btsnoop_flush(btsnoop));
+	g_assert_cmpint(count_records(zpath), ==, 3);
+
+	btsnoop_unref(btsnoop);
+
+	g_assert_cmpint(count_records(zpath), ==, 3);
+
+	unlink(zpath);
+
+	tester_test_passed();
+}
+
+static double elapsed(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) +
+				(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Mix of advertising reports, ATT traffic, commands and completions */
+static void write_traffic(struct btsnoop *btsnoop)
+{
+	struct timeval tv = { 1700000000, 0 };
+	uint8_t buf[64];
+	uint32_t x = 1;
+	unsigned int i, j;
+
+	for (i = 0; i < BENCH_PACKETS; i++) {
+		uint16_t opcode, size;
+
+		memset(buf, 0, sizeof(buf));
+
+		x = x * 1103515245 + 12345;
+		tv.tv_usec += 50 + (x >> 20) % 3000;
+		if (tv.tv_usec >= 1000000) {
+			tv.tv_sec++;
+			tv.tv_usec -= 1000000;
+		}
+
+		switch ((x >> 8) % 8) {
+		case 0:
+		case 1:
+		case 2:
+			/* LE Advertising Report from a random address */
+			memcpy(buf, "\x3e\x1c\x02\x01\x00\x01", 6);
+			for (j = 6; j < 12; j++) {
+				x = x * 1103515245 + 12345;
+				buf[j] = x >> 24;
+			}
+			memcpy(buf + 12, "\x10\x02\x01\x06\x05\x09" "Dev"
+					"\x00\x03\x03\x0f\x18\xc0", 15);
+			buf[20] = 'A' + i % 26;
+			opcode = BTSNOOP_OPCODE_EVENT_PKT;
+			size = 30;
+			break;
+		case 3:
+			/* Number Of Completed Packets */
+			memcpy(buf, "\x13\x05\x01\x40\x00\x01\x00", 7);
+			buf[3] = 0x40 + i % 3;
+			opcode = BTSNOOP_OPCODE_EVENT_PKT;
+			size = 7;
+			break;
+		case 4:
+			/* LE Set Scan Enable and its Command Complete */
+			if (i % 2) {
+				memcpy(buf, "\x0c\x20\x02\x01\x00", 5);
+				opcode = BTSNOOP_OPCODE_COMMAND_PKT;
+				size = 5;
+			} else {
+				memcpy(buf, "\x0e\x04\x01\x0c\x20\x00", 6);
+				opcode = BTSNOOP_OPCODE_EVENT_PKT;
+				size = 6;
+			}
+			break;
+		default:
+			/* ATT Handle Value Notification with sensor data */
+			memcpy(buf, "\x40\x20\x0f\x00\x0b\x00\x04\x00"
+						"\x1b\x2a\x00", 11);
+			buf[0] = 0x40 + i % 3;
+			for (j = 11; j < 19; j++)
+				buf[j] = (i >> (j % 4)) & 0xff;
+			opcode = i % 2 ? BTSNOOP_OPCODE_ACL_TX_PKT :
+						BTSNOOP_OPCODE_ACL_RX_PKT;
+			size = 19;
+			break;
+		}
+
+		g_assert(btsnoop_write_hci(btsnoop, &tv, 0, opcode, 0, buf,
+									size));
+	}
+}
+
+static void test_compress_benchmark(const void *data)
+{
+	char raw_path[] = "/tmp/test-btsnoop-XXXXXX";
+	char zpath[] = "/tmp/test-btsnoop-XXXXXX";
+	uint8_t buf[BTSNOOP_MAX_PACKET_SIZE];
+	uint16_t index, opcode, size;
+	struct btsnoop *btsnoop;
+	struct timespec start;
+	struct timeval tv;
+	struct stat st_raw, st_z;
+	double t_raw, t_z, t_read;
+	int fd;
+
+	fd = mkstemp(raw_path);
+	g_assert(fd >= 0);
+	close(fd);
+
+	fd = mkstemp(zpath);
+	g_assert(fd >= 0);
+	close(fd);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	btsnoop = btsnoop_create(raw_path, 0, 0, BTSNOOP_FORMAT_MONITOR);
+	g_assert(btsnoop);
+	write_traffic(btsnoop);
+	btsnoop_unref(btsnoop);
+	t_raw = elapsed(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	btsnoop = btsnoop_create_compressed(zpath, 0, 0,
+						BTSNOOP_FORMAT_MONITOR);
+	g_assert(btsnoop);
+	write_traffic(btsnoop);
+	btsnoop_unref(btsnoop);
+	t_z = elapsed(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	btsnoop = btsnoop_open(zpath, 0);
+	g_assert(btsnoop);
+	while (btsnoop_read_hci(btsnoop, &tv, &index, &opcode, buf, &size));
+	btsnoop_unref(btsnoop);
+	t_read = elapsed(&start);
+
+	compare_traces(raw_path, zpath);
+
+	g_assert(stat(raw_path, &st_raw) == 0);
+	g_assert(stat(zpath, &st_z) == 0);
+	g_assert_cmpint(st_z.st_size, <, st_raw.st_size);
+
+	tester_debug("%u packets, %lld bytes", BENCH_PACKETS,
+						(long long) st_raw.st_size);
+	tester_debug("  compressed:   %lld bytes (%.1f%%)",
+				(long long) st_z.st_size,
+				100.0 * st_z.st_size / st_raw.st_size);
+	tester_debug("  write raw:    %10.0f packets/sec",
+						BENCH_PACKETS / t_raw);
+	tester_debug("  write lz4:    %10.0f packets/sec",
+						BENCH_PACKETS / t_z);
+	tester_debug("  read lz4:     %10.0f packets/sec",
+						BENCH_PACKETS / t_read);
+
+	unlink(raw_path);
+	unlink(zpath);
+
+	tester_test_passed();
+}
+
+int main(int argc, char *argv[])
+{
+	int exit_status;
+
+	tester_init(&argc, &argv);
+
+	create_trace();
+
+	tester_add("/btsnoop/iterate", NULL, NULL, test_iterate, NULL);
+	tester_add("/btsnoop/seek", NULL, NULL, test_seek, NULL);
+	tester_add("/btsnoop/sidecar", NULL, NULL, test_sidecar, NULL);
+	tester_add("/btsnoop/handles", NULL, NULL, test_handles, NULL);
+	tester_add("/btsnoop/records", NULL, NULL, test_records, NULL);
+	tester_add("/btsnoop/compressed", NULL, NULL, test_compressed, NULL);
+	tester_add("/btsnoop/compressed-flush", NULL, NULL,
+					test_compressed_flush, NULL);
+	tester_add("/btsnoop/compressed-rotate", NULL, NULL,
+					test_compressed_rotate, NULL);
+	tester_add("/btsnoop/compress-benchmark", NULL, NULL,
+					test_compress_benchmark, NULL);
+
+	exit_status = tester_run();
+
+	unlink(path);
+
+	return exit_status;
+}
@@ -12,11 +12,13 @@
 #include <config.h>
 #endif
 
+#include "src/shared/aes.h"
 #include "src/shared/crypto.h"
 #include "src/shared/util.h"
 #include "src/shared/tester.h"
 
 #include <string.h>
+#include <time.h>
 #include <glib.h>
 
 static struct bt_crypto *crypto;
@@ -383,6 +385,169 @@ static void test_sih(const void *data)
 	tester_test_passed();
 }
 
+static void test_ah(const void *data)
+{
+	const uint8_t irk[16] = {
+			0x9b, 0x7d, 0x39, 0x0a, 0xa6, 0x10, 0x10, 0x34,
+			0x05, 0xad, 0xc8, 0x57, 0xa3, 0x34, 0x02, 0xec };
+	const uint8_t r[3] = { 0x94, 0x81, 0x70 };
+	const uint8_t exp[3] = { 0xaa, 0xfb, 0x0d };
+	uint8_t hash[3];
+
+	if (!bt_crypto_ah(crypto, irk, r, hash)) {
+		tester_test_failed();
+		return;
+	}
+
+	tester_debug("Expected:");
+	util_hexdump(' ', exp, 3, print_debug, NULL);
+
+	tester_debug("Result:");
+	util_hexdump(' ', hash, 3, print_debug, NULL);
+
+	if (memcmp(hash, exp, 3)) {
+		tester_test_failed();
+		return;
+	}
+
+	tester_test_passed();
+}
+
+static void test_c1(const void *data)
+{
+	const uint8_t k[16] = {};
+	const uint8_t r[16] = {
+			0xe0, 0x2e, 0x70, 0xc6, 0x4e, 0x27, 0x88, 0x63,
+			0x0e, 0x6f, 0xad, 0x56, 0x21, 0xd5, 0x83, 0x57 };
+	const uint8_t pres[7] = { 0x02, 0x03, 0x00, 0x00, 0x08, 0x00, 0x05 };
+	const uint8_t preq[7] = { 0x01, 0x01, 0x00, 0x00, 0x10, 0x07, 0x07 };
+	const uint8_t ia[6] = { 0xa6, 0xa5, 0xa4, 0xa3, 0xa2, 0xa1 };
+	const uint8_t ra[6] = { 0xb6, 0xb5, 0xb4, 0xb3, 0xb2, 0xb1 };
+	const uint8_t exp[16] = {
+			0x86, 0x3b, 0xf1, 0xbe, 0xc5, 0x4d, 0xa7, 0xd2,
+			0xea, 0x88, 0x89, 0x87, 0xef, 0x3f, 0x1e, 0x1e };
+	uint8_t res[16];
+
+	if (!bt_crypto_c1(crypto, k, r, pres, preq, 0x01, ia, 0x00, ra,
+								res)) {
+		tester_test_failed();
+		return;
+	}
+
+	tester_debug("Expected:");
+	util_hexdump(' ', exp, 16, print_debug, NULL);
+
+	tester_debug("Result:");
+	util_hexdump(' ', res, 16, print_debug, NULL);
+
+	if (memcmp(res, exp, 16)) {
+		tester_test_failed();
+		return;
+	}
+
+	tester_test_passed();
+}
+
+#define BENCH_ROUNDS 2000
+
+struct bench_result {
+	uint8_t ah[3];
+	uint8_t c1[16];
+	uint8_t ltk[16];
+	uint8_t sign[12];
+};
+
+static double bench_rate(const struct timespec *start)
+{
+	struct timespec now;
+	double secs;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	secs = (now.tv_sec - start->tv_sec) +
+				(now.tv_nsec - start->tv_nsec) / 1e9;
+
+	return secs > 0 ? BENCH_ROUNDS / secs : 0;
+}
+
+static bool bench_backend(struct bench_result *res)
+{
+	uint8_t k[16] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+			0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10 };
+	uint8_t w[32] = { 0xec, 0x02, 0x34, 0xa3 };
+	uint8_t n1[16] = { 0xab }, n2[16] = { 0xcd };
+	uint8_t a1[7] = { 0x00, 0x56, 0x12, 0x37, 0x37, 0xbf, 0xce };
+	uint8_t a2[7] = { 0x00, 0xa7, 0x13, 0x70, 0x2d, 0xcf, 0xc1 };
+	uint8_t r[16] = { 0x12, 0x34, 0x56 };
+	uint8_t pres[7] = {}, preq[7] = {}, ia[6] = {}, ra[6] = {};
+	uint8_t msg[20] = { 0xd2, 0x12, 0x00, 0x13, 0x37 };
+	uint8_t mackey[16];
+	struct timespec start;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < BENCH_ROUNDS; i++) {
+		if (!bt_crypto_ah(crypto, k, r, res->ah))
+			return false;
+	}
+	tester_debug("  ah:       %10.0f ops/sec", bench_rate(&start));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < BENCH_ROUNDS; i++) {
+		if (!bt_crypto_c1(crypto, k, r, pres, preq, 0x01, ia, 0x00,
+							ra, res->c1))
+			return false;
+	}
+	tester_debug("  c1:       %10.0f ops/sec", bench_rate(&start));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < BENCH_ROUNDS; i++) {
+		if (!bt_crypto_f5(crypto, w, n1, n2, a1, a2, mackey,
+								res->ltk))
+			return false;
+	}
+	tester_debug("  f5:       %10.0f ops/sec", bench_rate(&start));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < BENCH_ROUNDS; i++) {
+		if (!bt_crypto_sign_att(crypto, k, msg, sizeof(msg), i,
+								res->sign))
+			return false;
+	}
+	tester_debug("  sign_att: %10.0f ops/sec", bench_rate(&start));
+
+	return true;
+}
+
+static void test_benchmark(const void *data)
+{
+	enum bt_crypto_backend backend = bt_crypto_get_backend(crypto);
+	struct bench_result kernel, aes;
+	bool has_kernel;
+
+	has_kernel = bt_crypto_set_backend(crypto, BT_CRYPTO_BACKEND_KERNEL);
+	if (has_kernel) {
+		tester_debug("kernel (AF_ALG):");
+		g_assert(bench_backend(&kernel));
+	} else
+		tester_debug("kernel (AF_ALG): not available");
+
+	g_assert(bt_crypto_set_backend(crypto, BT_CRYPTO_BACKEND_AES));
+	tester_debug("in-process (%s):", bt_aes128_accel() ? "AES-NI" :
+								"generic");
+	g_assert(bench_backend(&aes));
+
+	bt_crypto_set_backend(crypto, backend);
+
+	/* Both backends must agree */
+	if (has_kernel && memcmp(&kernel, &aes, sizeof(aes))) {
+		tester_test_failed();
+		return;
+	}
+
+	tester_test_passed();
+}
+
 int main(int argc, char *argv[])
 {
 	int exit_status;
@@ -411,6 +576,10 @@ int main(int argc, char *argv[])
 						NULL, test_verify_sign, NULL);
 	tester_add("/crypto/sef", NULL, NULL, test_sef, NULL);
 	tester_add("/crypto/sih", NULL, NULL, test_sih, NULL);
+	tester_add("/crypto/ah", NULL, NULL, test_ah, NULL);
+	tester_add("/crypto/c1", NULL, NULL, test_c1, NULL);
+
+	tester_add("/crypto/benchmark", NULL, NULL, test_benchmark, NULL);
 
 	exit_status = tester_run();
 
@@ -0,0 +1,285 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <glib.h>
+
+#include "lib/bluetooth.h"
+#include "src/shared/tester.h"
+#include "src/device-index.h"
+
+#define LARGE_COUNT	10000
+
+struct test_device {
+	bdaddr_t bdaddr;
+	uint8_t bdaddr_type;
+	bdaddr_t conn_bdaddr;
+	uint8_t conn_bdaddr_type;
+	char path[48];
+};
+
+struct test_addr {
+	bdaddr_t bdaddr;
+	uint8_t bdaddr_type;
+};
+
+/* Same address and type matching rules as device_addr_type_cmp() */
+static int test_addr_cmp(gconstpointer a, gconstpointer b)
+{
+	const struct test_device *dev = a;
+	const struct test_addr *addr = b;
+
+	if (addr->bdaddr_type == dev->bdaddr_type)
+		return bacmp(&dev->bdaddr, &addr->bdaddr);
+
+	if (addr->bdaddr_type == dev->conn_bdaddr_type)
+		return bacmp(&dev->conn_bdaddr, &addr->bdaddr);
+
+	return -1;
+}
+
+static void test_device_init(struct test_device *dev, unsigned int id,
+							uint8_t type)
+{
+	memset(dev, 0, sizeof(*dev));
+
+	dev->bdaddr.b[0] = id & 0xff;
+	dev->bdaddr.b[1] = (id >> 8) & 0xff;
+	dev->bdaddr.b[2] = (id >> 16) & 0xff;
+	dev->bdaddr.b[5] = type == BDADDR_LE_RANDOM ? 0x40 : 0x00;
+	dev->bdaddr_type = type;
+	dev->conn_bdaddr_type = type;
+
+	snprintf(dev->path, sizeof(dev->path),
+			"/org/bluez/hci0/dev_%02X_%02X_%02X_%02X_%02X_%02X",
+			dev->bdaddr.b[5], dev->bdaddr.b[4], dev->bdaddr.b[3],
+			dev->bdaddr.b[2], dev->bdaddr.b[1], dev->bdaddr.b[0]);
+}
+
+static bool test_device_add(struct device_index *index,
+					struct test_device *dev)
+{
+	return device_index_add(index, dev, dev->path, &dev->bdaddr,
+							&dev->conn_bdaddr);
+}
+
+static void *find(struct device_index *index, const bdaddr_t *bdaddr,
+							uint8_t type)
+{
+	struct test_addr addr;
+
+	bacpy(&addr.bdaddr, bdaddr);
+	addr.bdaddr_type = type;
+
+	return device_index_find(index, bdaddr, &addr, test_addr_cmp);
+}
+
+static void test_add_remove(const void *data)
+{
+	struct device_index *index = device_index_new();
+	struct test_device dev1, dev2, dev3;
+
+	test_device_init(&dev1, 1, BDADDR_BREDR);
+	test_device_init(&dev2, 2, BDADDR_LE_PUBLIC);
+	test_device_init(&dev3, 1, BDADDR_LE_RANDOM);
+
+	g_assert(test_device_add(index, &dev1));
+	g_assert(test_device_add(index, &dev2));
+	g_assert(test_device_add(index, &dev3));
+	g_assert(!test_device_add(index, &dev2));
+	g_assert_cmpint(device_index_count(index), ==, 3);
+
+	g_assert(find(index, &dev1.bdaddr, BDADDR_BREDR) == &dev1);
+	g_assert(find(index, &dev2.bdaddr, BDADDR_LE_PUBLIC) == &dev2);
+	g_assert(find(index, &dev3.bdaddr, BDADDR_LE_RANDOM) == &dev3);
+	g_assert(!find(index, &dev2.bdaddr, BDADDR_BREDR));
+
+	g_assert(device_index_find_by_path(index, dev1.path) == &dev1);
+	g_assert(device_index_find_by_path(index,
+				"/org/bluez/hci0/dev_00_00_00_00_00_02") == &dev2);
+	g_assert(device_index_find_by_path(index,
+				"/org/bluez/hci0/dev_00_00_00_00_00_0a") == NULL);
+
+	device_index_remove(index, &dev2);
+	g_assert_cmpint(device_index_count(index), ==, 2);
+	g_assert(!find(index, &dev2.bdaddr, BDADDR_LE_PUBLIC));
+	g_assert(!device_index_find_by_path(index, dev2.path));
+	g_assert(!device_index_lookup(index, &dev2.bdaddr));
+
+	/* Removing twice is harmless */
+	device_index_remove(index, &dev2);
+	g_assert_cmpint(device_index_count(index), ==, 2);
+
+	device_index_clear(index);
+	g_assert_cmpint(device_index_count(index), ==, 0);
+	g_assert(!find(index, &dev1.bdaddr, BDADDR_BREDR));
+	g_assert(!device_index_find_by_path(index, dev3.path));
+
+	device_index_free(index);
+
+	tester_test_passed();
+}
+
+static void test_rpa_update(const void *data)
+{
+	struct device_index *index = device_index_new();
+	struct test_device dev;
+	bdaddr_t rpa;
+
+	/* Connected over a resolvable private address */
+	test_device_init(&dev, 0x1234, BDADDR_LE_RANDOM);
+	bacpy(&rpa, &dev.bdaddr);
+	bacpy(&dev.conn_bdaddr, &rpa);
+
+	g_assert(test_device_add(index, &dev));
+	g_assert(find(index, &rpa, BDADDR_LE_RANDOM) == &dev);
+
+	/* Identity address resolved, connection address is still the RPA */
+	dev.bdaddr.b[5] = 0x00;
+	dev.bdaddr_type = BDADDR_LE_PUBLIC;
+	g_assert(device_index_update(index, &dev, &dev.bdaddr,
+							&dev.conn_bdaddr));
+
+	g_assert(find(index, &dev.bdaddr, BDADDR_LE_PUBLIC) == &dev);
+	g_assert(find(index, &rpa, BDADDR_LE_RANDOM) == &dev);
+	g_assert(device_index_find_by_path(index, dev.path) == &dev);
+
+	/* New connection made over the identity address */
+	bacpy(&dev.conn_bdaddr, &dev.bdaddr);
+	dev.conn_bdaddr_type = dev.bdaddr_type;
+	g_assert(device_index_update(index, &dev, &dev.bdaddr,
+							&dev.conn_bdaddr));
+
+	g_assert(find(index, &dev.bdaddr, BDADDR_LE_PUBLIC) == &dev);
+	g_assert(!find(index, &rpa, BDADDR_LE_RANDOM));
+	g_assert(!device_index_lookup(index, &rpa));
+
+	device_index_remove(index, &dev);
+	g_assert(!find(index, &dev.bdaddr, BDADDR_LE_PUBLIC));
+
+	/* Devices that are not indexed are not added by an update */
+	g_assert(!device_index_update(index, &dev, &dev.bdaddr, NULL));
+	g_assert_cmpint(device_index_count(index), ==, 0);
+
+	device_index_free(index);
+
+	tester_test_passed();
+}
+
+static double elapsed_ms(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) * 1000.0 +
+				(now.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+static int test_path_cmp(gconstpointer a, gconstpointer b)
+{
+	const struct test_device *dev = a;
+
+	return g_ascii_strcasecmp(dev->path, b);
+}
+
+/*
+ * Look up every one of LARGE_COUNT devices by address and type and by path,
+ * checking the index against a scan of the device list and timing both.
+ */
+static void test_large(const void *data)
+{
+	struct device_index *index = device_index_new();
+	struct test_device *devs;
+	struct test_addr addr;
+	struct timespec start;
+	GSList *list = NULL, *l;
+	double ms_index, ms_scan;
+	unsigned int i;
+
+	devs = g_new0(struct test_device, LARGE_COUNT);
+
+	for (i = 0; i < LARGE_COUNT; i++) {
+		test_device_init(&devs[i], i, i % 2 ? BDADDR_LE_RANDOM :
+							BDADDR_LE_PUBLIC);
+		g_assert(test_device_add(index, &devs[i]));
+		list = g_slist_prepend(list, &devs[i]);
+	}
+
+	g_assert_cmpint(device_index_count(index), ==, LARGE_COUNT);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < LARGE_COUNT; i++) {
+		struct test_device *dev = &devs[i];
+
+		g_assert(find(index, &dev->bdaddr, dev->bdaddr_type) == dev);
+		g_assert(device_index_find_by_path(index, dev->path) == dev);
+	}
+
+	ms_index = elapsed_ms(&start);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < LARGE_COUNT; i++) {
+		struct test_device *dev = &devs[i];
+
+		bacpy(&addr.bdaddr, &dev->bdaddr);
+		addr.bdaddr_type = dev->bdaddr_type;
+
+		l = g_slist_find_custom(list, &addr, test_addr_cmp);
+		g_assert(l && l->data == dev);
+
+		l = g_slist_find_custom(list, dev->path, test_path_cmp);
+		g_assert(l && l->data == dev);
+	}
+
+	ms_scan = elapsed_ms(&start);
+
+	tester_debug("%u devices, %u lookups: %.3f ms (scan %.3f ms)",
+				LARGE_COUNT, LARGE_COUNT * 2, ms_index,
+				ms_scan);
+
+	/* Remove every other device */
+	for (i = 0; i < LARGE_COUNT; i += 2)
+		device_index_remove(index, &devs[i]);
+
+	g_assert_cmpint(device_index_count(index), ==, LARGE_COUNT / 2);
+
+	for (i = 0; i < LARGE_COUNT; i++) {
+		void *dev = find(index, &devs[i].bdaddr, devs[i].bdaddr_type);
+
+		g_assert(dev == (i % 2 ? &devs[i] : NULL));
+	}
+
+	g_slist_free(list);
+	device_index_free(index);
+	g_free(devs);
+
+	tester_test_passed();
+}
+
+int main(int argc, char *argv[])
+{
+	tester_init(&argc, &argv);
+
+	tester_add("/device-index/add-remove", NULL, NULL, test_add_remove,
+									NULL);
+	tester_add("/device-index/rpa-update", NULL, NULL, test_rpa_update,
+									NULL);
+	tester_add("/device-index/large", NULL, NULL, test_large, NULL);
+
+	return tester_run();
+}
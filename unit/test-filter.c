@@ -0,0 +1,179 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <glib.h>
+
+#include "src/shared/btsnoop.h"
+#include "src/shared/tester.h"
+#include "monitor/filter.h"
+
+/* Disconnection Complete for handle 0x0040 */
+static const uint8_t evt_disconn[] = { 0x05, 0x04, 0x00, 0x40, 0x00, 0x13 };
+
+/* LE Connection Complete for handle 0x0041 */
+static const uint8_t evt_le_conn[] = { 0x3e, 0x13, 0x01, 0x00, 0x41, 0x00,
+					0x00, 0x00, 0x11, 0x22, 0x33, 0x44,
+					0x55, 0x66, 0x18, 0x00, 0x00, 0x00,
+					0x48, 0x00, 0x00 };
+
+/* Number of Completed Packets is not matched by handle */
+static const uint8_t evt_nocp[] = { 0x13, 0x05, 0x01, 0x40, 0x00, 0x01,
+					0x00 };
+
+/* ATT Read Request on handle 0x0040 */
+static const uint8_t acl_start[] = { 0x40, 0x20, 0x07, 0x00, 0x03, 0x00,
+					0x04, 0x00, 0x0a, 0x01, 0x00 };
+
+/* Continuation fragment on handle 0x0042 */
+static const uint8_t acl_cont[] = { 0x42, 0x10, 0x02, 0x00, 0x01, 0x02 };
+
+/* Disconnect command for handle 0x0040 */
+static const uint8_t cmd_disconn[] = { 0x06, 0x04, 0x03, 0x40, 0x00, 0x13 };
+
+/* Reset, followed by what would be a handle */
+static const uint8_t cmd_reset[] = { 0x03, 0x0c, 0x00, 0x40, 0x00 };
+
+static bool match_cmd(const uint8_t *data, uint16_t size)
+{
+	return filter_packet(0, BTSNOOP_OPCODE_COMMAND_PKT, data, size);
+}
+
+static bool match_evt(const uint8_t *data, uint16_t size)
+{
+	return filter_packet(0, BTSNOOP_OPCODE_EVENT_PKT, data, size);
+}
+
+static bool match_acl(const uint8_t *data, uint16_t size)
+{
+	return filter_packet(0, BTSNOOP_OPCODE_ACL_RX_PKT, data, size);
+}
+
+static bool match_acl_tx(const uint8_t *data, uint16_t size)
+{
+	return filter_packet(0, BTSNOOP_OPCODE_ACL_TX_PKT, data, size);
+}
+
+static void test_handle(const void *data)
+{
+	g_assert(filter_compile("handle 0x40"));
+
+	g_assert(match_evt(evt_disconn, sizeof(evt_disconn)));
+	g_assert(!match_evt(evt_le_conn, sizeof(evt_le_conn)));
+	g_assert(!match_evt(evt_nocp, sizeof(evt_nocp)));
+	g_assert(match_acl(acl_start, sizeof(acl_start)));
+	g_assert(match_acl_tx(acl_start, sizeof(acl_start)));
+	g_assert(!match_acl(acl_cont, sizeof(acl_cont)));
+	g_assert(match_cmd(cmd_disconn, sizeof(cmd_disconn)));
+	g_assert(!match_cmd(cmd_reset, sizeof(cmd_reset)));
+
+	/* Truncated packets never match */
+	g_assert(!match_evt(evt_disconn, 4));
+	g_assert(!match_acl(acl_start, 1));
+	g_assert(!match_cmd(cmd_disconn, 4));
+
+	g_assert(filter_compile("handle 0x41"));
+
+	g_assert(!match_evt(evt_disconn, sizeof(evt_disconn)));
+	g_assert(match_evt(evt_le_conn, sizeof(evt_le_conn)));
+	g_assert(!match_acl(acl_start, sizeof(acl_start)));
+	g_assert(!match_cmd(cmd_disconn, sizeof(cmd_disconn)));
+
+	g_assert(filter_compile("handle 0x42"));
+
+	g_assert(match_acl(acl_cont, sizeof(acl_cont)));
+	g_assert(!match_evt(evt_disconn, sizeof(evt_disconn)));
+
+	tester_test_passed();
+}
+
+static void test_expr(const void *data)
+{
+	g_assert(filter_compile("acl and handle 0x40"));
+
+	g_assert(match_acl(acl_start, sizeof(acl_start)));
+	g_assert(!match_evt(evt_disconn, sizeof(evt_disconn)));
+
+	g_assert(filter_compile("not handle 0x40"));
+
+	g_assert(!match_acl(acl_start, sizeof(acl_start)));
+	g_assert(!match_evt(evt_disconn, sizeof(evt_disconn)));
+	g_assert(match_evt(evt_le_conn, sizeof(evt_le_conn)));
+
+	g_assert(filter_compile("evt 0x05 or (att 0x0a && !handle 0x41)"));
+
+	g_assert(match_evt(evt_disconn, sizeof(evt_disconn)));
+	g_assert(match_acl(acl_start, sizeof(acl_start)));
+	g_assert(!match_evt(evt_le_conn, sizeof(evt_le_conn)));
+	g_assert(!match_acl(acl_cont, sizeof(acl_cont)));
+
+	g_assert(filter_compile("le-meta 0x01 || cid 4"));
+
+	g_assert(match_evt(evt_le_conn, sizeof(evt_le_conn)));
+	g_assert(match_acl(acl_start, sizeof(acl_start)));
+	g_assert(match_acl_tx(acl_start, sizeof(acl_start)));
+	g_assert(!match_evt(evt_disconn, sizeof(evt_disconn)));
+
+	tester_test_passed();
+}
+
+static void test_addr(const void *data)
+{
+	g_assert(filter_compile("addr 66:55:44:33:22:11"));
+
+	g_assert(match_evt(evt_le_conn, sizeof(evt_le_conn)));
+	g_assert(!match_evt(evt_disconn, sizeof(evt_disconn)));
+	g_assert(!match_acl(acl_start, sizeof(acl_start)));
+
+	tester_test_passed();
+}
+
+static void test_other(const void *data)
+{
+	g_assert(filter_compile("evt"));
+
+	g_assert(!filter_packet(0, BTSNOOP_OPCODE_COMMAND_PKT, cmd_disconn,
+							sizeof(cmd_disconn)));
+
+	/* Packets other than HCI traffic are always accepted */
+	g_assert(filter_packet(0, BTSNOOP_OPCODE_NEW_INDEX, NULL, 0));
+	g_assert(filter_packet(0, BTSNOOP_OPCODE_USER_LOGGING, cmd_disconn,
+							sizeof(cmd_disconn)));
+
+	tester_test_passed();
+}
+
+static void test_invalid(const void *data)
+{
+	g_assert(!filter_compile("handle"));
+	g_assert(!filter_compile("handle 0x1000"));
+	g_assert(!filter_compile("(acl or sco"));
+	g_assert(!filter_compile("acl sco"));
+	g_assert(!filter_compile("addr 00:11:22"));
+
+	tester_test_passed();
+}
+
+int main(int argc, char *argv[])
+{
+	tester_init(&argc, &argv);
+
+	tester_add("/filter/handle", NULL, NULL, test_handle, NULL);
+	tester_add("/filter/expr", NULL, NULL, test_expr, NULL);
+	tester_add("/filter/addr", NULL, NULL, test_addr, NULL);
+	tester_add("/filter/other", NULL, NULL, test_other, NULL);
+	tester_add("/filter/invalid", NULL, NULL, test_invalid, NULL);
+
+	return tester_run();
+}
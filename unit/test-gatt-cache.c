@@ -0,0 +1,336 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "lib/bluetooth.h"
+#include "lib/uuid.h"
+#include "src/shared/util.h"
+#include "src/shared/queue.h"
+#include "src/shared/att.h"
+#include "src/shared/gatt-db.h"
+#include "src/shared/gatt-cache.h"
+#include "src/shared/tester.h"
+
+#define BENCH_SERVICES	100
+#define BENCH_LOOPS	100
+
+static const uint8_t test_hash[16] = {
+	0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef,
+	0xfe, 0xdc, 0xba, 0x98, 0x76, 0x54, 0x32, 0x10,
+};
+
+static void write_cb(struct gatt_db_attribute *attrib, int err,
+							void *user_data)
+{
+}
+
+static struct gatt_db_attribute *add_chrc(struct gatt_db_attribute *service,
+						uint16_t handle,
+						const bt_uuid_t *uuid,
+						uint8_t properties)
+{
+	struct gatt_db_attribute *attr;
+
+	attr = gatt_db_service_insert_characteristic(service, handle,
+						handle + 1, uuid, 0,
+						properties, NULL, NULL, NULL);
+	g_assert(attr);
+
+	return attr;
+}
+
+static void add_desc(struct gatt_db_attribute *service, uint16_t handle,
+					uint16_t uuid16, const void *value,
+					size_t len)
+{
+	struct gatt_db_attribute *attr;
+	bt_uuid_t uuid;
+
+	bt_uuid16_create(&uuid, uuid16);
+
+	attr = gatt_db_service_insert_descriptor(service, handle, &uuid, 0,
+							NULL, NULL, NULL);
+	g_assert(attr);
+
+	if (value)
+		g_assert(gatt_db_attribute_write(attr, 0, value, len, 0, NULL,
+							write_cb, NULL));
+}
+
+/*
+ * Database as discovered from a remote device: a GATT service with the
+ * Database Hash, a secondary service included by a primary service and a
+ * characteristic with a 128-bit UUID and Extended Properties.
+ */
+static void populate_db(struct gatt_db *db, uint16_t base)
+{
+	struct gatt_db_attribute *gatt, *secondary, *primary, *attr;
+	uint8_t ext_props[2];
+	bt_uuid_t uuid;
+
+	bt_uuid16_create(&uuid, 0x1801);
+	gatt = gatt_db_insert_service(db, base, &uuid, true, 6);
+	g_assert(gatt);
+
+	bt_uuid16_create(&uuid, GATT_CHARAC_SERVICE_CHANGED);
+	add_chrc(gatt, base + 1, &uuid, BT_GATT_CHRC_PROP_INDICATE);
+	add_desc(gatt, base + 3, GATT_CLIENT_CHARAC_CFG_UUID, NULL, 0);
+
+	bt_uuid16_create(&uuid, GATT_CHARAC_DB_HASH);
+	attr = add_chrc(gatt, base + 4, &uuid, BT_GATT_CHRC_PROP_READ);
+	g_assert(gatt_db_attribute_write(attr, 0, test_hash,
+						sizeof(test_hash), 0, NULL,
+						write_cb, NULL));
+
+	bt_uuid16_create(&uuid, 0x180f);
+	secondary = gatt_db_insert_service(db, base + 0x10, &uuid, false, 3);
+	g_assert(secondary);
+
+	bt_uuid16_create(&uuid, 0x2a19);
+	add_chrc(secondary, base + 0x11, &uuid, BT_GATT_CHRC_PROP_READ);
+
+	bt_string_to_uuid(&uuid, "12345678-1234-5678-1234-56789abcdef0");
+	primary = gatt_db_insert_service(db, base + 0x20, &uuid, true, 6);
+	g_assert(primary);
+
+	g_assert(gatt_db_service_insert_included(primary, base + 0x21,
+								secondary));
+
+	bt_string_to_uuid(&uuid, "12345678-1234-5678-1234-56789abcdef1");
+	add_chrc(primary, base + 0x22, &uuid, BT_GATT_CHRC_PROP_READ |
+					BT_GATT_CHRC_PROP_EXT_PROP);
+
+	put_le16(0x0001, ext_props);
+	add_desc(primary, base + 0x24, GATT_CHARAC_EXT_PROPER_UUID,
+					ext_props, sizeof(ext_props));
+	add_desc(primary, base + 0x25, GATT_CHARAC_USER_DESC_UUID, NULL, 0);
+
+	gatt_db_service_set_active(gatt, true);
+	gatt_db_service_set_active(secondary, true);
+	gatt_db_service_set_active(primary, true);
+}
+
+static void hash_read_cb(struct gatt_db_attribute *attrib, int err,
+					const uint8_t *value, size_t length,
+					void *user_data)
+{
+	g_assert_cmpint(err, ==, 0);
+	g_assert_cmpint(length, ==, sizeof(test_hash));
+	g_assert(!memcmp(value, test_hash, length));
+
+	*((bool *) user_data) = true;
+}
+
+static void check_db(struct gatt_db *db)
+{
+	struct gatt_db_attribute *attr;
+	uint16_t start, end, ext_props;
+	uint8_t properties;
+	bool primary, read = false;
+	bt_uuid_t uuid;
+
+	attr = gatt_db_get_attribute(db, 0x0011);
+	g_assert(gatt_db_attribute_get_service_data(attr, &start, &end,
+							&primary, &uuid));
+	g_assert_cmpint(start, ==, 0x0011);
+	g_assert_cmpint(end, ==, 0x0013);
+	g_assert(!primary);
+	g_assert(gatt_db_service_get_active(attr));
+
+	attr = gatt_db_get_attribute(db, 0x0022);
+	g_assert(gatt_db_attribute_get_incl_data(attr, NULL, &start, &end));
+	g_assert_cmpint(start, ==, 0x0011);
+	g_assert_cmpint(end, ==, 0x0013);
+
+	attr = gatt_db_get_attribute(db, 0x0023);
+	g_assert(gatt_db_attribute_get_char_data(attr, NULL, NULL,
+						&properties, &ext_props,
+						&uuid));
+	g_assert_cmpint(properties, ==, BT_GATT_CHRC_PROP_READ |
+						BT_GATT_CHRC_PROP_EXT_PROP);
+	g_assert_cmpint(ext_props, ==, 0x0001);
+	g_assert_cmpint(uuid.type, ==, BT_UUID128);
+
+	attr = gatt_db_get_attribute(db, 0x0026);
+	g_assert(attr);
+	g_assert(bt_uuid16_cmp(gatt_db_attribute_get_type(attr),
+						GATT_CHARAC_USER_DESC_UUID));
+
+	attr = gatt_db_get_attribute(db, 0x0006);
+	g_assert(gatt_db_attribute_read(attr, 0, BT_ATT_OP_READ_REQ, NULL,
+							hash_read_cb, &read));
+	g_assert(read);
+}
+
+static void test_round_trip(const void *data)
+{
+	struct gatt_db *db, *copy;
+	struct iovec iov, iov2;
+
+	db = gatt_db_new();
+	populate_db(db, 0x0001);
+
+	g_assert(gatt_cache_encode(db, &iov));
+
+	copy = gatt_db_new();
+	g_assert_cmpint(gatt_cache_decode(copy, iov.iov_base, iov.iov_len),
+									==, 0);
+	check_db(copy);
+
+	/* Encoding the loaded database gives the very same cache */
+	g_assert(gatt_cache_encode(copy, &iov2));
+	g_assert(!util_iov_memcmp(&iov, &iov2));
+
+	free(iov.iov_base);
+	free(iov2.iov_base);
+	gatt_db_unref(copy);
+	gatt_db_unref(db);
+
+	tester_test_passed();
+}
+
+static void test_invalid(const void *data)
+{
+	struct gatt_db *db;
+	struct iovec iov;
+	uint8_t *buf;
+
+	db = gatt_db_new();
+	populate_db(db, 0x0001);
+	g_assert(gatt_cache_encode(db, &iov));
+	gatt_db_unref(db);
+
+	buf = iov.iov_base;
+	db = gatt_db_new();
+
+	g_assert_cmpint(gatt_cache_decode(db, "[General]\n", 10), ==,
+								-ENOMSG);
+
+	/* Payload corruption is caught by the checksum */
+	buf[iov.iov_len - 1] ^= 0x80;
+	g_assert_cmpint(gatt_cache_decode(db, buf, iov.iov_len), ==,
+								-EBADMSG);
+	buf[iov.iov_len - 1] ^= 0x80;
+
+	g_assert_cmpint(gatt_cache_decode(db, buf, iov.iov_len - 1), ==,
+								-EBADMSG);
+
+	buf[4] = GATT_CACHE_VERSION + 1;
+	g_assert_cmpint(gatt_cache_decode(db, buf, iov.iov_len), ==,
+							-EPROTONOSUPPORT);
+
+	g_assert(gatt_db_isempty(db));
+
+	free(iov.iov_base);
+	gatt_db_unref(db);
+
+	tester_test_passed();
+}
+
+static void test_file(const void *data)
+{
+	char path[] = "/tmp/test-gatt-cache-XXXXXX";
+	struct gatt_db *db;
+	int fd;
+
+	fd = mkstemp(path);
+	g_assert(fd >= 0);
+	close(fd);
+
+	db = gatt_db_new();
+	g_assert_cmpint(gatt_cache_load(db, path), ==, -ENOMSG);
+
+	populate_db(db, 0x0001);
+	g_assert_cmpint(gatt_cache_store(db, path), ==, 0);
+	gatt_db_unref(db);
+
+	db = gatt_db_new();
+	g_assert_cmpint(gatt_cache_load(db, path), ==, 0);
+	check_db(db);
+	gatt_db_unref(db);
+
+	unlink(path);
+
+	db = gatt_db_new();
+	g_assert_cmpint(gatt_cache_load(db, path), ==, -ENOENT);
+	gatt_db_unref(db);
+
+	tester_test_passed();
+}
+
+static double time_diff(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) +
+				(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void test_benchmark(const void *data)
+{
+	struct gatt_db *db;
+	struct timespec start;
+	struct iovec iov;
+	unsigned int i;
+	double t;
+
+	db = gatt_db_new();
+
+	for (i = 0; i < BENCH_SERVICES; i++)
+		populate_db(db, 1 + i * 0x30);
+
+	g_assert(gatt_cache_encode(db, &iov));
+	gatt_db_unref(db);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < BENCH_LOOPS; i++) {
+		db = gatt_db_new();
+		g_assert_cmpint(gatt_cache_decode(db, iov.iov_base,
+						iov.iov_len), ==, 0);
+		gatt_db_unref(db);
+	}
+
+	t = time_diff(&start);
+
+	tester_debug("%u services in %zu bytes, loaded in %.1f us",
+				BENCH_SERVICES * 3, iov.iov_len,
+				t * 1e6 / BENCH_LOOPS);
+
+	free(iov.iov_base);
+
+	tester_test_passed();
+}
+
+int main(int argc, char *argv[])
+{
+	tester_init(&argc, &argv);
+
+	tester_add("/gatt-cache/round-trip", NULL, NULL, test_round_trip,
+									NULL);
+	tester_add("/gatt-cache/invalid", NULL, NULL, test_invalid, NULL);
+	tester_add("/gatt-cache/file", NULL, NULL, test_file, NULL);
+	tester_add("/gatt-cache/benchmark", NULL, NULL, test_benchmark, NULL);
+
+	return tester_run();
+}
@@ -18,6 +18,7 @@
 #include <inttypes.h>
 #include <string.h>
 #include <fcntl.h>
+#include <time.h>
 #include <sys/socket.h>
 
 #include <glib.h>
@@ -25,6 +26,7 @@
 #include "lib/bluetooth.h"
 #include "lib/uuid.h"
 #include "src/shared/util.h"
+#include "src/shared/io.h"
 #include "src/shared/att.h"
 #include "src/shared/gatt-helpers.h"
 #include "src/shared/queue.h"
@@ -2412,6 +2414,416 @@ static void test_hash_db(gconstpointer data)
 	context_quit(context);
 }
 
+#define LARGE_DB_SERVICES	100
+#define LARGE_DB_CHARS		6
+#define LARGE_DB_LOOKUPS	200
+
+static struct gatt_db *make_large_db(void)
+{
+	struct gatt_db *db = gatt_db_new();
+	bt_uuid_t uuid, ccc;
+	int i, j;
+
+	bt_uuid16_create(&ccc, GATT_CLIENT_CHARAC_CFG_UUID);
+
+	/* Each service is 1 + 3 * LARGE_DB_CHARS handles plus a spare one,
+	 * 2000 handles total.
+	 */
+	for (i = 0; i < LARGE_DB_SERVICES; i++) {
+		struct gatt_db_attribute *svc;
+
+		bt_uuid16_create(&uuid, 0x1800 + (i % 16));
+		svc = gatt_db_add_service(db, &uuid, true,
+						2 + 3 * LARGE_DB_CHARS);
+		g_assert(svc);
+
+		for (j = 0; j < LARGE_DB_CHARS; j++) {
+			struct gatt_db_attribute *chrc;
+			uint128_t u128 = {};
+
+			u128.data[0] = j;
+			u128.data[15] = i % 8;
+			bt_uuid128_create(&uuid, u128);
+
+			chrc = gatt_db_service_add_characteristic(svc, &uuid,
+						BT_ATT_PERM_READ,
+						BT_GATT_CHRC_PROP_READ |
+						BT_GATT_CHRC_PROP_NOTIFY,
+						NULL, NULL, NULL);
+			g_assert(chrc);
+
+			g_assert(gatt_db_service_add_descriptor(chrc, &ccc,
+						BT_ATT_PERM_READ |
+						BT_ATT_PERM_WRITE,
+						NULL, NULL, NULL));
+		}
+
+		/* Leave every 10th service inactive */
+		gatt_db_service_set_active(svc, i % 10);
+	}
+
+	return db;
+}
+
+static void collect_attribute(struct gatt_db_attribute *attrib,
+							void *user_data)
+{
+	struct queue *queue = user_data;
+
+	queue_push_tail(queue, attrib);
+}
+
+static void collect_service(struct gatt_db_attribute *attrib, void *user_data)
+{
+	if (gatt_db_service_get_active(attrib))
+		gatt_db_service_foreach(attrib, NULL, collect_attribute,
+								user_data);
+}
+
+/* Reference lookup by walking every attribute of the database */
+static void scan_range(struct queue *all, uint16_t start, uint16_t end,
+					const bt_uuid_t *type, struct queue *q)
+{
+	const struct queue_entry *entry;
+
+	for (entry = queue_get_entries(all); entry; entry = entry->next) {
+		struct gatt_db_attribute *attrib = entry->data;
+		uint16_t handle = gatt_db_attribute_get_handle(attrib);
+
+		if (handle < start || handle > end)
+			continue;
+
+		if (type && bt_uuid_cmp(type,
+					gatt_db_attribute_get_type(attrib)))
+			continue;
+
+		queue_push_tail(q, attrib);
+	}
+}
+
+static void compare_queues(struct queue *q1, struct queue *q2)
+{
+	const struct queue_entry *e1 = queue_get_entries(q1);
+	const struct queue_entry *e2 = queue_get_entries(q2);
+
+	g_assert_cmpint(queue_length(q1), ==, queue_length(q2));
+
+	for (; e1 && e2; e1 = e1->next, e2 = e2->next)
+		g_assert(e1->data == e2->data);
+}
+
+static double elapsed_ms(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) * 1000.0 +
+				(now.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+static void test_large_db(const void *data)
+{
+	struct gatt_db *db = make_large_db();
+	struct queue *all = queue_new();
+	struct queue *q1 = queue_new();
+	struct queue *q2 = queue_new();
+	struct gatt_db_attribute *svc;
+	struct timespec start;
+	bt_uuid_t chrc, ccc, type;
+	uint128_t u128 = {};
+	double ms_db, ms_scan;
+	int i;
+
+	bt_uuid16_create(&chrc, GATT_CHARAC_UUID);
+	bt_uuid16_create(&ccc, GATT_CLIENT_CHARAC_CFG_UUID);
+	u128.data[0] = 3;
+	u128.data[15] = 5;
+	bt_uuid128_create(&type, u128);
+
+	gatt_db_foreach_service(db, NULL, collect_service, all);
+
+	/* Results must match a full scan of the database */
+	for (i = 0; i < LARGE_DB_LOOKUPS; i++) {
+		uint16_t s = 1 + (i * 37) % 2000;
+		uint16_t e = s + (i % 5) * 50;
+
+		gatt_db_read_by_type(db, s, e, chrc, q1);
+		scan_range(all, s, e, &chrc, q2);
+		compare_queues(q1, q2);
+		queue_remove_all(q1, NULL, NULL, NULL);
+		queue_remove_all(q2, NULL, NULL, NULL);
+
+		gatt_db_read_by_type(db, s, e, type, q1);
+		scan_range(all, s, e, &type, q2);
+		compare_queues(q1, q2);
+		queue_remove_all(q1, NULL, NULL, NULL);
+		queue_remove_all(q2, NULL, NULL, NULL);
+
+		gatt_db_find_by_type(db, s, e, &ccc, collect_attribute, q1);
+		scan_range(all, s, e, &ccc, q2);
+		compare_queues(q1, q2);
+		queue_remove_all(q1, NULL, NULL, NULL);
+		queue_remove_all(q2, NULL, NULL, NULL);
+
+		gatt_db_find_information(db, s, e, q1);
+		scan_range(all, s, e, NULL, q2);
+		compare_queues(q1, q2);
+		queue_remove_all(q1, NULL, NULL, NULL);
+		queue_remove_all(q2, NULL, NULL, NULL);
+	}
+
+	for (i = 1; i <= 2000; i++) {
+		struct gatt_db_attribute *attrib;
+
+		attrib = gatt_db_get_attribute(db, i);
+		if ((i % 20) == 0) {
+			g_assert(!attrib);
+			continue;
+		}
+
+		g_assert(attrib);
+		g_assert_cmpint(gatt_db_attribute_get_handle(attrib), ==, i);
+	}
+
+	/* Discovery style lookups: characteristics of one service at a time */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < LARGE_DB_LOOKUPS * 10; i++) {
+		uint16_t s = 1 + (i % LARGE_DB_SERVICES) * 20;
+
+		gatt_db_read_by_type(db, s, s + 19, chrc, q1);
+		queue_remove_all(q1, NULL, NULL, NULL);
+	}
+	ms_db = elapsed_ms(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < LARGE_DB_LOOKUPS * 10; i++) {
+		uint16_t s = 1 + (i % LARGE_DB_SERVICES) * 20;
+
+		scan_range(all, s, s + 19, &chrc, q2);
+		queue_remove_all(q2, NULL, NULL, NULL);
+	}
+	ms_scan = elapsed_ms(&start);
+
+	tester_debug("%u attributes, %u lookups: %.3f ms (scan %.3f ms)",
+			queue_length(all), LARGE_DB_LOOKUPS * 10, ms_db,
+			ms_scan);
+
+	/* Lookups interleaved with service removal and insertion */
+	g_assert(gatt_db_remove_service(db, gatt_db_get_attribute(db, 201)));
+
+	for (i = 201; i < 220; i++)
+		g_assert(!gatt_db_get_attribute(db, i));
+
+	gatt_db_read_by_type(db, 201, 220, chrc, q1);
+	g_assert(queue_isempty(q1));
+
+	bt_uuid16_create(&type, 0x1800);
+	svc = gatt_db_insert_service(db, 201, &type, true, 4);
+	g_assert(svc);
+	g_assert(gatt_db_get_attribute(db, 201) == svc);
+
+	bt_uuid16_create(&type, 0x2a00);
+	g_assert(gatt_db_service_insert_characteristic(svc, 202, 203, &type,
+						BT_ATT_PERM_READ,
+						BT_GATT_CHRC_PROP_READ,
+						NULL, NULL, NULL));
+	gatt_db_service_set_active(svc, true);
+
+	gatt_db_read_by_type(db, 201, 220, chrc, q1);
+	g_assert_cmpint(queue_length(q1), ==, 1);
+	g_assert_cmpint(gatt_db_attribute_get_handle(queue_peek_head(q1)), ==,
+									202);
+	queue_remove_all(q1, NULL, NULL, NULL);
+
+	queue_remove_all(all, NULL, NULL, NULL);
+	gatt_db_foreach_service(db, NULL, collect_service, all);
+
+	gatt_db_find_information(db, 1, 0xffff, q1);
+	scan_range(all, 1, 0xffff, NULL, q2);
+	compare_queues(q1, q2);
+	queue_remove_all(q1, NULL, NULL, NULL);
+	queue_remove_all(q2, NULL, NULL, NULL);
+
+	gatt_db_read_by_type(db, 1, 0xffff, chrc, q1);
+	scan_range(all, 1, 0xffff, &chrc, q2);
+	compare_queues(q1, q2);
+
+	queue_destroy(q1, NULL);
+	queue_destroy(q2, NULL);
+	queue_destroy(all, NULL);
+	gatt_db_unref(db);
+
+	tester_test_passed();
+}
+
+static void add_large_db_service(struct gatt_db *db, uint16_t id)
+{
+	struct gatt_db_attribute *svc;
+	bt_uuid_t uuid;
+
+	bt_uuid16_create(&uuid, id);
+	svc = gatt_db_add_service(db, &uuid, true, 4);
+	g_assert(svc);
+
+	bt_uuid16_create(&uuid, id + 1);
+	g_assert(gatt_db_service_add_characteristic(svc, &uuid,
+						BT_ATT_PERM_READ,
+						BT_GATT_CHRC_PROP_READ,
+						NULL, NULL, NULL));
+
+	gatt_db_service_set_active(svc, true);
+}
+
+static void test_hash_update(const void *data)
+{
+	struct gatt_db *db1 = make_large_db();
+	struct gatt_db *db2 = make_large_db();
+	struct gatt_db_attribute *svc;
+	unsigned int updates, saved, prev;
+	uint8_t hash[16];
+	int i;
+
+	if (!gatt_db_hash_support(db1)) {
+		gatt_db_unref(db1);
+		gatt_db_unref(db2);
+		tester_test_abort();
+		return;
+	}
+
+	memcpy(hash, gatt_db_get_hash(db1), sizeof(hash));
+
+	/* Toggling a service must restore the original hash */
+	svc = gatt_db_get_service(db1, 5 * 20 + 1);
+	g_assert(svc);
+
+	gatt_db_service_set_active(svc, false);
+	g_assert(memcmp(hash, gatt_db_get_hash(db1), sizeof(hash)));
+
+	gatt_db_service_set_active(svc, true);
+	g_assert(!memcmp(hash, gatt_db_get_hash(db1), sizeof(hash)));
+
+	g_assert(gatt_db_get_hash_stats(db1, &updates, &prev));
+	g_assert_cmpint(updates, ==, 3);
+
+	/* Batch several registrations into a single update */
+	g_assert(gatt_db_hash_hold(db1));
+	for (i = 0; i < 3; i++)
+		add_large_db_service(db1, 0x2a00 + i * 2);
+	g_assert(gatt_db_hash_release(db1));
+
+	memcpy(hash, gatt_db_get_hash(db1), sizeof(hash));
+
+	g_assert(gatt_db_get_hash_stats(db1, &updates, &saved));
+	g_assert_cmpint(updates, ==, 4);
+	g_assert_cmpint(saved - prev, ==, 2);
+
+	/* Incremental result must match computing everything at once */
+	for (i = 0; i < 3; i++)
+		add_large_db_service(db2, 0x2a00 + i * 2);
+
+	g_assert(!memcmp(hash, gatt_db_get_hash(db2), sizeof(hash)));
+
+	gatt_db_unref(db1);
+	gatt_db_unref(db2);
+
+	tester_test_passed();
+}
+
+#define NFY_SUBSCRIBERS	3
+
+struct nfy_subscriber {
+	struct bt_att *att;
+	struct io *io;
+};
+
+static struct nfy_subscriber nfy_subscribers[NFY_SUBSCRIBERS];
+static unsigned int nfy_received;
+
+static const uint8_t nfy_pdu[] = { 0x1b, 0x03, 0x00, 0x01, 0x02, 0x03,
+					0x04, 0x05, 0x06, 0x07, 0x08 };
+
+static bool nfy_read_cb(struct io *io, void *user_data)
+{
+	uint8_t buf[64];
+	ssize_t len;
+	int i;
+
+	len = read(io_get_fd(io), buf, sizeof(buf));
+	g_assert_cmpint(len, ==, sizeof(nfy_pdu));
+	g_assert(!memcmp(buf, nfy_pdu, sizeof(nfy_pdu)));
+
+	if (++nfy_received < NFY_SUBSCRIBERS)
+		return true;
+
+	for (i = 0; i < NFY_SUBSCRIBERS; i++) {
+		bt_att_unref(nfy_subscribers[i].att);
+		io_destroy(nfy_subscribers[i].io);
+	}
+
+	tester_test_passed();
+
+	return false;
+}
+
+/* One notification encoded once and sent to every subscriber */
+static void test_shared_notification(const void *data)
+{
+	uint8_t value[8] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08 };
+	uint8_t large[BT_ATT_DEFAULT_LE_MTU];
+	struct bt_att_pdu *pdu;
+	struct iovec iov[2];
+	uint8_t hdr[2];
+	int i;
+
+	put_le16(0x0003, hdr);
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = value;
+	iov[1].iov_len = sizeof(value);
+
+	pdu = bt_att_pdu_new(BT_ATT_OP_HANDLE_NFY, iov, 2);
+	g_assert(pdu);
+
+	/* Later changes to the value must not affect the encoded PDU */
+	memset(value, 0xff, sizeof(value));
+
+	nfy_received = 0;
+
+	for (i = 0; i < NFY_SUBSCRIBERS; i++) {
+		struct nfy_subscriber *sub = &nfy_subscribers[i];
+		int sv[2];
+
+		g_assert(!socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC,
+								0, sv));
+
+		sub->att = bt_att_new(sv[0], false);
+		g_assert(sub->att);
+		bt_att_set_close_on_unref(sub->att, true);
+
+		sub->io = io_new(sv[1]);
+		g_assert(sub->io);
+		io_set_close_on_destroy(sub->io, true);
+		io_set_read_handler(sub->io, nfy_read_cb, NULL, NULL);
+
+		g_assert(bt_att_send_pdu(sub->att, pdu, NULL, NULL, NULL));
+	}
+
+	/* Every pending send holds its own reference */
+	bt_att_pdu_unref(pdu);
+
+	/* A PDU that does not fit the MTU of a bearer is not sent */
+	memset(large, 0, sizeof(large));
+	iov[1].iov_base = large;
+	iov[1].iov_len = sizeof(large);
+
+	pdu = bt_att_pdu_new(BT_ATT_OP_HANDLE_NFY, iov, 2);
+	g_assert(pdu);
+	g_assert(!bt_att_send_pdu(nfy_subscribers[0].att, pdu, NULL, NULL,
+									NULL));
+	bt_att_pdu_unref(pdu);
+}
+
 int main(int argc, char *argv[])
 {
 	struct gatt_db *service_db_1, *service_db_2, *service_db_3;
@@ -4559,5 +4971,10 @@ int main(int argc, char *argv[])
 			test_hash_db, ts_tail_db, NULL,
 			{});
 
+	tester_add("/gatt-db/large-db", NULL, NULL, test_large_db, NULL);
+	tester_add("/gatt-db/hash-update", NULL, NULL, test_hash_update, NULL);
+	tester_add("/att/shared-notification", NULL, NULL,
+					test_shared_notification, NULL);
+
 	return tester_run();
 }
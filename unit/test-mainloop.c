@@ -0,0 +1,425 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+#include <glib.h>
+
+#include "src/shared/util.h"
+#include "src/shared/mainloop.h"
+#include "src/shared/timeout.h"
+
+#define BENCH_TIMERS	10000
+#define BENCH_CHURN	200000
+#define BENCH_FDS	1000
+#define BENCH_ROUNDS	200
+
+struct context {
+	unsigned int fired[8];
+	unsigned int count;
+	unsigned int destroyed;
+	int ids[8];
+	struct timespec start;
+};
+
+static struct context ctx;
+
+static void context_init(void)
+{
+	memset(&ctx, 0, sizeof(ctx));
+	clock_gettime(CLOCK_MONOTONIC, &ctx.start);
+
+	mainloop_init();
+}
+
+static unsigned int elapsed_ms(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - ctx.start.tv_sec) * 1000 +
+				(now.tv_nsec - ctx.start.tv_nsec) / 1000000;
+}
+
+static void destroy_count(void *user_data)
+{
+	ctx.destroyed++;
+}
+
+static void order_callback(int id, void *user_data)
+{
+	unsigned int msec = PTR_TO_UINT(user_data);
+
+	g_assert_cmpuint(elapsed_ms(), >=, msec);
+
+	ctx.fired[ctx.count++] = msec;
+
+	mainloop_remove_timeout(id);
+
+	if (ctx.count == 5)
+		mainloop_quit();
+}
+
+static void test_order(void)
+{
+	static const unsigned int msecs[] = { 30, 10, 300, 20, 10 };
+	unsigned int i;
+
+	context_init();
+
+	/* 300 msec is placed on the second level of the wheel */
+	for (i = 0; i < G_N_ELEMENTS(msecs); i++)
+		g_assert_cmpint(mainloop_add_timeout(msecs[i], order_callback,
+					UINT_TO_PTR(msecs[i]), destroy_count),
+					>, 0);
+
+	mainloop_run();
+
+	g_assert_cmpuint(ctx.fired[0], ==, 10);
+	g_assert_cmpuint(ctx.fired[1], ==, 10);
+	g_assert_cmpuint(ctx.fired[2], ==, 20);
+	g_assert_cmpuint(ctx.fired[3], ==, 30);
+	g_assert_cmpuint(ctx.fired[4], ==, 300);
+	g_assert_cmpuint(ctx.destroyed, ==, 5);
+}
+
+static void unexpected_callback(int id, void *user_data)
+{
+	g_assert_not_reached();
+}
+
+static void quit_callback(int id, void *user_data)
+{
+	mainloop_quit();
+}
+
+static void remove_callback(int id, void *user_data)
+{
+	ctx.count++;
+
+	/* Remove a timeout that is due in the same tick */
+	g_assert_cmpint(mainloop_remove_timeout(ctx.ids[1]), ==, 0);
+	g_assert_cmpint(mainloop_remove_timeout(ctx.ids[1]), <, 0);
+
+	mainloop_add_timeout(5, quit_callback, NULL, NULL);
+}
+
+static void test_remove(void)
+{
+	context_init();
+
+	ctx.ids[0] = mainloop_add_timeout(10, remove_callback, NULL, NULL);
+	ctx.ids[1] = mainloop_add_timeout(10, unexpected_callback, NULL,
+							destroy_count);
+	ctx.ids[2] = mainloop_add_timeout(20, unexpected_callback, NULL,
+							destroy_count);
+
+	g_assert_cmpint(mainloop_remove_timeout(ctx.ids[2]), ==, 0);
+
+	/* Timeouts with no expiry stay until they are modified */
+	ctx.ids[3] = mainloop_add_timeout(0, unexpected_callback, NULL,
+							destroy_count);
+
+	mainloop_run();
+
+	g_assert_cmpuint(ctx.count, ==, 1);
+
+	/* Pending timeouts are destroyed when the mainloop exits */
+	g_assert_cmpuint(ctx.destroyed, ==, 3);
+}
+
+static void modify_callback(int id, void *user_data)
+{
+	if (++ctx.count == 5) {
+		mainloop_quit();
+		return;
+	}
+
+	g_assert_cmpint(mainloop_modify_timeout(id, 2), ==, 0);
+}
+
+static void test_modify(void)
+{
+	context_init();
+
+	ctx.ids[0] = mainloop_add_timeout(0, modify_callback, NULL, NULL);
+	g_assert_cmpint(ctx.ids[0], >, 0);
+
+	/* Pushing a pending timeout out must keep it from firing early */
+	ctx.ids[1] = mainloop_add_timeout(5, modify_callback, NULL, NULL);
+	g_assert_cmpint(mainloop_modify_timeout(ctx.ids[1], 1000), ==, 0);
+	g_assert_cmpint(mainloop_modify_timeout(ctx.ids[0], 10), ==, 0);
+
+	mainloop_run();
+
+	g_assert_cmpuint(ctx.count, ==, 5);
+	g_assert_cmpuint(elapsed_ms(), <, 1000);
+}
+
+static bool repeat_callback(void *user_data)
+{
+	if (++ctx.count < 3)
+		return true;
+
+	mainloop_quit();
+
+	return false;
+}
+
+static void test_timeout_add(void)
+{
+	context_init();
+
+	g_assert_cmpuint(timeout_add(5, repeat_callback, NULL,
+						destroy_count), >, 0);
+
+	mainloop_run();
+
+	g_assert_cmpuint(ctx.count, ==, 3);
+	g_assert_cmpuint(ctx.destroyed, ==, 1);
+}
+
+static void bench_callback(int id, void *user_data)
+{
+}
+
+static void test_benchmark(void)
+{
+	static int ids[BENCH_TIMERS];
+	unsigned int i, seed = 1;
+	double secs;
+	struct timespec now;
+
+	context_init();
+
+	/* Mix of ATT, mgmt and tester style timeouts from 1 to 60 seconds */
+	for (i = 0; i < BENCH_TIMERS; i++) {
+		ids[i] = mainloop_add_timeout(1000 + (i * 7919) % 59000,
+						bench_callback, NULL, NULL);
+		g_assert_cmpint(ids[i], >, 0);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ctx.start);
+
+	for (i = 0; i < BENCH_CHURN; i++) {
+		unsigned int n;
+
+		seed = seed * 1103515245 + 12345;
+		n = (seed >> 8) % BENCH_TIMERS;
+
+		mainloop_remove_timeout(ids[n]);
+		ids[n] = mainloop_add_timeout(1000 + seed % 59000,
+						bench_callback, NULL, NULL);
+		g_assert_cmpint(ids[n], >, 0);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	secs = (now.tv_sec - ctx.start.tv_sec) +
+			(now.tv_nsec - ctx.start.tv_nsec) / 1000000000.0;
+
+	if (g_test_verbose())
+		printf("%u outstanding timeouts: %.0f add/remove per second\n",
+					BENCH_TIMERS, BENCH_CHURN / secs);
+
+	mainloop_add_timeout(1, quit_callback, NULL, NULL);
+	mainloop_run();
+}
+
+static void fd_callback(int fd, uint32_t events, void *user_data)
+{
+	uint64_t value;
+
+	g_assert(events & EPOLLIN);
+	g_assert_cmpint(read(fd, &value, sizeof(value)), ==, sizeof(value));
+
+	ctx.count++;
+
+	/* The other fd is removed while its event is still pending */
+	g_assert_cmpint(mainloop_remove_fd(PTR_TO_INT(user_data)), ==, 0);
+	g_assert_cmpint(mainloop_remove_fd(fd), ==, 0);
+
+	mainloop_add_timeout(5, quit_callback, NULL, NULL);
+}
+
+static void test_fd_remove(void)
+{
+	uint64_t value = 1;
+	int fd[2];
+
+	context_init();
+
+	/* Use fd numbers beyond the initial size of the handler table */
+	fd[0] = eventfd(0, EFD_CLOEXEC);
+	fd[1] = eventfd(0, EFD_CLOEXEC);
+	g_assert_cmpint(dup2(fd[0], 300), ==, 300);
+	g_assert_cmpint(dup2(fd[1], 700), ==, 700);
+	close(fd[0]);
+	close(fd[1]);
+
+	g_assert_cmpint(mainloop_add_fd(300, EPOLLIN, fd_callback,
+					INT_TO_PTR(700), destroy_count), ==, 0);
+	g_assert_cmpint(mainloop_add_fd(700, EPOLLIN, fd_callback,
+					INT_TO_PTR(300), destroy_count), ==, 0);
+	g_assert_cmpint(mainloop_add_fd(700, EPOLLIN, fd_callback,
+					NULL, NULL), <, 0);
+
+	/* Both fds are readable so they are reported in the same wakeup */
+	g_assert_cmpint(write(300, &value, sizeof(value)), ==, sizeof(value));
+	g_assert_cmpint(write(700, &value, sizeof(value)), ==, sizeof(value));
+
+	mainloop_run();
+
+	g_assert_cmpuint(ctx.count, ==, 1);
+	g_assert_cmpuint(ctx.destroyed, ==, 2);
+
+	close(300);
+	close(700);
+}
+
+static void hup_callback(int fd, uint32_t events, void *user_data)
+{
+	if (!(events & (EPOLLRDHUP | EPOLLHUP)))
+		return;
+
+	mainloop_remove_fd(fd);
+	mainloop_quit();
+}
+
+static void idle_callback(int fd, uint32_t events, void *user_data)
+{
+}
+
+static void close_callback(int id, void *user_data)
+{
+	int fd = PTR_TO_INT(user_data);
+
+	/* The peer must see the hangup once the fd has been removed */
+	mainloop_remove_fd(fd);
+	close(fd);
+}
+
+static void test_fd_close(void)
+{
+	int sv[2];
+
+	context_init();
+
+	g_assert_cmpint(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0,
+								sv), ==, 0);
+
+	g_assert_cmpint(mainloop_add_fd(sv[0], EPOLLIN, idle_callback,
+							NULL, NULL), ==, 0);
+	g_assert_cmpint(mainloop_add_fd(sv[1], EPOLLIN | EPOLLRDHUP,
+					hup_callback, NULL, NULL), ==, 0);
+
+	mainloop_add_timeout(5, close_callback, INT_TO_PTR(sv[0]), NULL);
+	mainloop_add_timeout(1000, unexpected_callback, NULL, NULL);
+
+	mainloop_run();
+
+	close(sv[1]);
+}
+
+static int bench_fds[BENCH_FDS];
+
+static void bench_kick(void)
+{
+	uint64_t value = 1;
+	unsigned int i;
+
+	for (i = 0; i < BENCH_FDS; i++)
+		g_assert_cmpint(write(bench_fds[i], &value, sizeof(value)),
+							==, sizeof(value));
+}
+
+static void bench_fd_callback(int fd, uint32_t events, void *user_data)
+{
+	uint64_t value;
+
+	g_assert_cmpint(read(fd, &value, sizeof(value)), ==, sizeof(value));
+
+	if (++ctx.count % BENCH_FDS)
+		return;
+
+	if (ctx.count == BENCH_FDS * BENCH_ROUNDS) {
+		mainloop_quit();
+		return;
+	}
+
+	bench_kick();
+}
+
+static void test_fd_benchmark(void)
+{
+	struct rlimit limit;
+	struct timespec now;
+	unsigned int i;
+	double secs;
+
+	if (!getrlimit(RLIMIT_NOFILE, &limit) &&
+				limit.rlim_cur < BENCH_FDS + 64) {
+		limit.rlim_cur = BENCH_FDS + 64;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	context_init();
+
+	for (i = 0; i < BENCH_FDS; i++) {
+		bench_fds[i] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		g_assert_cmpint(bench_fds[i], >=, 0);
+
+		g_assert_cmpint(mainloop_add_fd(bench_fds[i], EPOLLIN,
+					bench_fd_callback, NULL, NULL), ==, 0);
+	}
+
+	/* Every round wakes up all fds at once */
+	bench_kick();
+
+	mainloop_run();
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	secs = (now.tv_sec - ctx.start.tv_sec) +
+			(now.tv_nsec - ctx.start.tv_nsec) / 1000000000.0;
+
+	if (g_test_verbose())
+		printf("%u active fds: %.0f ns per event\n", BENCH_FDS,
+					secs * 1000000000.0 / ctx.count);
+
+	for (i = 0; i < BENCH_FDS; i++)
+		close(bench_fds[i]);
+}
+
+int main(int argc, char *argv[])
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/mainloop/timeout/order", test_order);
+	g_test_add_func("/mainloop/timeout/remove", test_remove);
+	g_test_add_func("/mainloop/timeout/modify", test_modify);
+	g_test_add_func("/mainloop/timeout/timeout_add", test_timeout_add);
+	g_test_add_func("/mainloop/timeout/benchmark", test_benchmark);
+	g_test_add_func("/mainloop/fd/remove", test_fd_remove);
+	g_test_add_func("/mainloop/fd/close", test_fd_close);
+	g_test_add_func("/mainloop/fd/benchmark", test_fd_benchmark);
+
+	return g_test_run();
+}
@@ -0,0 +1,213 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "mesh/msg-cache.c"
+
+#define CACHE_SIZE	70
+#define TRACE_LEN	100000
+#define TRACE_NODES	500
+
+struct trace_pkt {
+	uint16_t src;
+	uint32_t seq;
+	uint32_t mic;
+};
+
+/* Reference FIFO cache matching the previous l_queue based behavior */
+struct ref_cache {
+	struct trace_pkt entries[CACHE_SIZE];
+	unsigned int len;
+	unsigned int next;
+};
+
+static bool ref_cache_check(struct ref_cache *cache,
+						const struct trace_pkt *pkt)
+{
+	unsigned int i;
+
+	for (i = 0; i < cache->len; i++) {
+		const struct trace_pkt *entry = &cache->entries[i];
+
+		if (entry->src == pkt->src && entry->seq == pkt->seq &&
+							entry->mic == pkt->mic)
+			return true;
+	}
+
+	cache->entries[cache->next] = *pkt;
+	cache->next = (cache->next + 1) % CACHE_SIZE;
+
+	if (cache->len < CACHE_SIZE)
+		cache->len++;
+
+	return false;
+}
+
+/*
+ * Synthetic relay trace: a few hundred nodes each sending with increasing
+ * sequence numbers, where roughly half of the packets are retransmissions
+ * or relayed copies of a recently seen packet.
+ */
+static struct trace_pkt *build_trace(void)
+{
+	struct trace_pkt *trace;
+	uint32_t seq[TRACE_NODES] = { 0 };
+	unsigned int i;
+
+	trace = l_new(struct trace_pkt, TRACE_LEN);
+	srand(0x6d657368);
+
+	for (i = 0; i < TRACE_LEN; i++) {
+		unsigned int node;
+
+		if (i > 0 && rand() % 2) {
+			unsigned int back = rand() % 100;
+
+			trace[i] = trace[i > back ? i - back - 1 : 0];
+			continue;
+		}
+
+		node = rand() % TRACE_NODES;
+		trace[i].src = node + 1;
+		trace[i].seq = ++seq[node];
+		trace[i].mic = rand();
+	}
+
+	return trace;
+}
+
+static double elapsed(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) +
+				(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void check_eviction(void)
+{
+	struct mesh_msg_cache *cache;
+	unsigned int i;
+
+	cache = msg_cache_new(CACHE_SIZE);
+	if (!cache)
+		exit(1);
+
+	for (i = 0; i < CACHE_SIZE; i++) {
+		if (msg_cache_check(cache, 1, i, 0))
+			exit(1);
+	}
+
+	if (msg_cache_len(cache) != CACHE_SIZE)
+		exit(1);
+
+	/* All entries still present, hits don't change eviction order */
+	for (i = 0; i < CACHE_SIZE; i++) {
+		if (!msg_cache_check(cache, 1, i, 0))
+			exit(1);
+	}
+
+	/* Adding a new entry evicts the oldest one */
+	if (msg_cache_check(cache, 1, CACHE_SIZE, 0))
+		exit(1);
+
+	if (msg_cache_len(cache) != CACHE_SIZE)
+		exit(1);
+
+	if (!msg_cache_check(cache, 1, 1, 0))
+		exit(1);
+
+	if (msg_cache_check(cache, 1, 0, 0))
+		exit(1);
+
+	msg_cache_clear(cache);
+
+	if (msg_cache_len(cache) || msg_cache_check(cache, 1, 1, 0))
+		exit(1);
+
+	msg_cache_free(cache);
+
+	l_info("Eviction order => PASS");
+}
+
+static void check_trace(const struct trace_pkt *trace)
+{
+	struct mesh_msg_cache *cache;
+	struct ref_cache *ref;
+	struct timespec start;
+	unsigned int i, dups = 0;
+	double ref_time, cache_time;
+
+	ref = l_new(struct ref_cache, 1);
+	cache = msg_cache_new(CACHE_SIZE);
+	if (!cache)
+		exit(1);
+
+	for (i = 0; i < TRACE_LEN; i++) {
+		bool found = msg_cache_check(cache, trace[i].src, trace[i].seq,
+								trace[i].mic);
+
+		if (found != ref_cache_check(ref, &trace[i])) {
+			l_info("Mismatch at packet %u", i);
+			exit(1);
+		}
+
+		if (found)
+			dups++;
+	}
+
+	l_info("Trace %u packets, %u duplicates => PASS", TRACE_LEN,
+									dups);
+
+	memset(ref, 0, sizeof(*ref));
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < TRACE_LEN; i++)
+		ref_cache_check(ref, &trace[i]);
+
+	ref_time = elapsed(&start);
+
+	msg_cache_clear(cache);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < TRACE_LEN; i++)
+		msg_cache_check(cache, trace[i].src, trace[i].seq,
+								trace[i].mic);
+
+	cache_time = elapsed(&start);
+
+	l_info("Linear cache: %.0f packets/sec", TRACE_LEN / ref_time);
+	l_info("Hashed cache: %.0f packets/sec", TRACE_LEN / cache_time);
+
+	msg_cache_free(cache);
+	l_free(ref);
+}
+
+int main(int argc, char *argv[])
+{
+	struct trace_pkt *trace;
+
+	l_log_set_stderr();
+
+	check_eviction();
+
+	trace = build_trace();
+	check_trace(trace);
+	l_free(trace);
+
+	return 0;
+}
@@ -14,11 +14,15 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include "client/display.h"
 
 #include "mesh/crypto.c"
 
+#define BENCH_KEYS	8
+#define BENCH_PDUS	2000
+
 struct mesh_crypto_test {
 	const char *name;
 
@@ -2133,6 +2137,204 @@ static void check_k4(const struct mesh_crypto_test *keys)
 	l_info("");
 }
 
+static void check_net_ctx(const struct mesh_crypto_test *keys)
+{
+	struct mesh_crypto_net_ctx *ctx;
+	uint8_t *enc_key, *priv_key, *packet;
+	uint8_t plain[29], clear[29];
+	size_t packet_len;
+	bool status;
+	int i;
+
+	l_info(COLOR_BLUE "[Net Context %s]" COLOR_OFF, keys->name);
+
+	enc_key = l_util_from_hexstring(keys->enc_key, NULL);
+	priv_key = l_util_from_hexstring(keys->priv_key, NULL);
+	ctx = mesh_crypto_net_ctx_new(enc_key, priv_key);
+	verify_bool("Context", 0, true, !!ctx);
+
+	for (i = 0; i < 32 && keys->packet[i]; i++) {
+		packet = l_util_from_hexstring(keys->packet[i], &packet_len);
+
+		/* Must match the one-shot helper */
+		status = mesh_crypto_packet_decode(packet, packet_len, false,
+						plain, keys->iv_index,
+						enc_key, priv_key);
+		verify_bool("Decode", 0, true, status);
+
+		status = mesh_crypto_net_ctx_decode(ctx, packet, packet_len,
+						false, clear, keys->iv_index);
+		verify_bool("Context Decode", 0, true, status);
+		verify_bool("Same Decode", 0, true,
+					!memcmp(plain, clear, packet_len));
+
+		/* And encode back to the sample packet */
+		status = mesh_crypto_net_ctx_encode(ctx, clear, packet_len,
+							keys->iv_index);
+		verify_bool("Context Encode", 0, true, status);
+		mesh_crypto_packet_label(clear, packet_len, keys->iv_index,
+								packet[0] & 0x7f);
+		verify_data("Encoded-Packet", 0, keys->packet[i], clear,
+								packet_len);
+
+		l_free(packet);
+	}
+
+	mesh_crypto_net_ctx_free(ctx);
+	l_free(priv_key);
+	l_free(enc_key);
+
+	l_info("");
+}
+
+static double elapsed(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) +
+				(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/*
+ * Decode a stream of PDUs sent under several NetKeys, trying every key with
+ * a matching NID the way net_key_decrypt() does. Compares building ciphers
+ * per PDU with keeping one context per key, and with a batch decode that
+ * walks the whole vector once per key so each context is used back to back.
+ */
+static void check_net_ctx_bench(const struct mesh_crypto_test *keys)
+{
+	static uint8_t pdus[BENCH_PDUS][29];
+	static uint8_t pdu_len[BENCH_PDUS];
+	static uint8_t plain[BENCH_PDUS][29];
+	static uint8_t batch_plain[BENCH_PDUS][29];
+	static uint8_t pdu_key[BENCH_PDUS];
+	static uint8_t batch_key[BENCH_PDUS];
+	struct mesh_crypto_net_ctx *ctx[BENCH_KEYS];
+	uint8_t enc_key[BENCH_KEYS][16];
+	uint8_t priv_key[BENCH_KEYS][16];
+	uint8_t nid[BENCH_KEYS];
+	uint8_t net_key[16], payload[8], out[29];
+	uint8_t p[] = { 0 };
+	struct timespec start;
+	double t_fresh, t_ctx, t_batch;
+	unsigned int i, k, ctxs = 0, fresh = 0, cached = 0, batched = 0;
+	unsigned int same = 0;
+
+	l_info(COLOR_BLUE "[Net Context Benchmark]" COLOR_OFF);
+
+	for (k = 0; k < BENCH_KEYS; k++) {
+		memset(net_key, 0, sizeof(net_key));
+		net_key[0] = k + 1;
+		mesh_crypto_k2(net_key, p, sizeof(p), &nid[k], enc_key[k],
+								priv_key[k]);
+		ctx[k] = mesh_crypto_net_ctx_new(enc_key[k], priv_key[k]);
+		if (ctx[k])
+			ctxs++;
+	}
+
+	verify_uint32("Contexts", 0, BENCH_KEYS, ctxs);
+
+	for (i = 0; i < BENCH_PDUS; i++) {
+		k = i % BENCH_KEYS;
+		memset(payload, i, sizeof(payload));
+
+		mesh_crypto_packet_build(false, 5, i + 1, 0x1201, 0xc000, 0,
+					false, 0, false, false, 0, 0, 0,
+					payload, sizeof(payload),
+					pdus[i], &pdu_len[i]);
+		mesh_crypto_net_ctx_encode(ctx[k], pdus[i], pdu_len[i],
+							keys->iv_index);
+		mesh_crypto_packet_label(pdus[i], pdu_len[i], keys->iv_index,
+								nid[k]);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < BENCH_PDUS; i++) {
+		for (k = 0; k < BENCH_KEYS; k++) {
+			if ((pdus[i][0] & 0x7f) != nid[k])
+				continue;
+
+			if (mesh_crypto_packet_decode(pdus[i], pdu_len[i],
+						false, out, keys->iv_index,
+						enc_key[k], priv_key[k])) {
+				fresh++;
+				break;
+			}
+		}
+	}
+
+	t_fresh = elapsed(&start);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < BENCH_PDUS; i++) {
+		pdu_key[i] = BENCH_KEYS;
+
+		for (k = 0; k < BENCH_KEYS; k++) {
+			if ((pdus[i][0] & 0x7f) != nid[k])
+				continue;
+
+			if (mesh_crypto_net_ctx_decode(ctx[k], pdus[i],
+						pdu_len[i], false, plain[i],
+						keys->iv_index)) {
+				pdu_key[i] = k;
+				cached++;
+				break;
+			}
+		}
+	}
+
+	t_ctx = elapsed(&start);
+
+	memset(batch_key, BENCH_KEYS, sizeof(batch_key));
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (k = 0; k < BENCH_KEYS; k++) {
+		for (i = 0; i < BENCH_PDUS; i++) {
+			if (batch_key[i] != BENCH_KEYS)
+				continue;
+
+			if ((pdus[i][0] & 0x7f) != nid[k])
+				continue;
+
+			if (mesh_crypto_net_ctx_decode(ctx[k], pdus[i],
+						pdu_len[i], false,
+						batch_plain[i],
+						keys->iv_index)) {
+				batch_key[i] = k;
+				batched++;
+			}
+		}
+	}
+
+	t_batch = elapsed(&start);
+
+	/* The batch must find the same key and clear text for every PDU */
+	for (i = 0; i < BENCH_PDUS; i++) {
+		if (batch_key[i] == pdu_key[i] &&
+				!memcmp(batch_plain[i], plain[i], pdu_len[i]))
+			same++;
+	}
+
+	verify_uint32("Decoded", 0, BENCH_PDUS, fresh);
+	verify_uint32("Context Decoded", 0, BENCH_PDUS, cached);
+	verify_uint32("Batch Decoded", 0, BENCH_PDUS, batched);
+	verify_uint32("Batch Matches", 0, BENCH_PDUS, same);
+
+	l_info("%u PDUs, %u NetKeys", BENCH_PDUS, BENCH_KEYS);
+	l_info("  per PDU ciphers: %10.0f PDUs/sec", BENCH_PDUS / t_fresh);
+	l_info("  net context:     %10.0f PDUs/sec", BENCH_PDUS / t_ctx);
+	l_info("  batch per key:   %10.0f PDUs/sec (%.2fx per PDU context)",
+					BENCH_PDUS / t_batch, t_ctx / t_batch);
+
+	for (k = 0; k < BENCH_KEYS; k++)
+		mesh_crypto_net_ctx_free(ctx[k]);
+
+	l_info("");
+}
+
 int main(int argc, char *argv[])
 {
 	l_log_set_stderr();
@@ -2179,6 +2381,13 @@ int main(int argc, char *argv[])
 	check_encrypt(&s8_3_22);
 	check_decrypt(&s8_3_22);
 
+	/* Cached network layer ciphers */
+	check_net_ctx(&s8_3_1);
+	check_net_ctx(&s8_3_4);
+	check_net_ctx(&s8_3_6);
+	check_net_ctx(&s8_3_22);
+	check_net_ctx_bench(&s8_3_1);
+
 	/* Section 8.4 Beacon Sample Data */
 	check_beacon(&s8_4_3);
 	check_beacon(&s8_4_6_1);
@@ -16,12 +16,19 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
 
 #include <glib.h>
 
 #include "src/shared/ringbuf.h"
 #include "src/shared/tester.h"
 
+#define BENCH_SIZE	(64 * 1024)
+#define BENCH_BYTES	(64 * 1024 * 1024)
+#define BENCH_CHUNK	4096
+
 static unsigned int nlpo2(unsigned int x)
 {
 	x--;
@@ -133,13 +140,299 @@ static void test_printf(const void *data)
 	tester_test_passed();
 }
 
+/* Stream byte n is always n & 0xff, so any part can be copied from here */
+static uint8_t pattern[BENCH_CHUNK + 256];
+
+static void init_pattern(void)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(pattern); i++)
+		pattern[i] = i & 0xff;
+}
+
+static size_t fill(struct ringbuf *rb, size_t *pos, size_t count)
+{
+	struct iovec iov[2];
+	size_t len, done = 0;
+	int i;
+
+	len = MIN(ringbuf_reserve_iov(rb, iov), count);
+
+	for (i = 0; i < 2 && done < len; i++) {
+		size_t off = 0;
+
+		while (off < iov[i].iov_len && done < len) {
+			size_t n = MIN(iov[i].iov_len - off, len - done);
+
+			n = MIN(n, BENCH_CHUNK);
+			memcpy(iov[i].iov_base + off,
+					pattern + ((*pos + done) & 0xff), n);
+			off += n;
+			done += n;
+		}
+	}
+
+	*pos += len;
+
+	return ringbuf_commit(rb, len);
+}
+
+static size_t check(struct ringbuf *rb, size_t *pos, size_t count)
+{
+	struct iovec iov[2];
+	size_t len, done = 0;
+	int i;
+
+	len = MIN(ringbuf_peek_iov(rb, iov), count);
+
+	for (i = 0; i < 2 && done < len; i++) {
+		size_t off = 0;
+
+		while (off < iov[i].iov_len && done < len) {
+			size_t n = MIN(iov[i].iov_len - off, len - done);
+
+			n = MIN(n, BENCH_CHUNK);
+			g_assert(!memcmp(iov[i].iov_base + off,
+					pattern + ((*pos + done) & 0xff), n));
+			off += n;
+			done += n;
+		}
+	}
+
+	*pos += len;
+
+	return ringbuf_drain(rb, len);
+}
+
+static void test_iov(const void *data)
+{
+	struct ringbuf *rb;
+	struct iovec iov[2];
+	size_t in = 0, out = 0;
+	int i;
+
+	rb = ringbuf_new(64);
+	g_assert(rb != NULL);
+
+	g_assert(ringbuf_peek_iov(rb, iov) == 0);
+	g_assert(ringbuf_reserve_iov(rb, iov) == 64);
+	g_assert(iov[0].iov_len == 64 && iov[1].iov_len == 0);
+
+	/* Keep some data in the buffer so that it wraps around */
+	g_assert(fill(rb, &in, 40) == 40);
+
+	for (i = 0; i < 1000; i++) {
+		size_t count = i % 37 + 1;
+
+		g_assert(check(rb, &out, count) == count);
+		g_assert(fill(rb, &in, count) == count);
+		g_assert(ringbuf_len(rb) == 40);
+
+		g_assert(ringbuf_peek_iov(rb, iov) == 40);
+		g_assert(iov[0].iov_len + iov[1].iov_len == 40);
+		g_assert(ringbuf_reserve_iov(rb, iov) == 24);
+		g_assert(iov[0].iov_len + iov[1].iov_len == 24);
+	}
+
+	/* Committing more than fits only takes what is available */
+	g_assert(ringbuf_commit(rb, 100) == 24);
+	g_assert(ringbuf_avail(rb) == 0);
+	g_assert(ringbuf_reserve_iov(rb, iov) == 0);
+
+	ringbuf_free(rb);
+	tester_test_passed();
+}
+
+static double elapsed(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) +
+				(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+struct spsc_data {
+	struct ringbuf *rb;
+	size_t chunk;
+	size_t total;
+};
+
+static void *spsc_producer(void *user_data)
+{
+	struct spsc_data *data = user_data;
+	size_t pos = 0;
+
+	while (pos < data->total) {
+		/* Let the consumer run if the buffer is full */
+		if (!fill(data->rb, &pos, MIN(data->chunk, data->total - pos)))
+			sched_yield();
+	}
+
+	return NULL;
+}
+
+static double run_spsc(size_t chunk)
+{
+	struct spsc_data data;
+	struct timespec start;
+	pthread_t thread;
+	size_t pos = 0;
+
+	data.rb = ringbuf_new_spsc(BENCH_SIZE);
+	data.chunk = chunk;
+	data.total = BENCH_BYTES / 4;
+	g_assert(data.rb != NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	g_assert(pthread_create(&thread, NULL, spsc_producer, &data) == 0);
+
+	while (pos < data.total) {
+		if (!check(data.rb, &pos, chunk))
+			sched_yield();
+	}
+
+	pthread_join(thread, NULL);
+
+	g_assert(ringbuf_len(data.rb) == 0);
+	ringbuf_free(data.rb);
+
+	return elapsed(&start);
+}
+
+static void test_spsc(const void *data)
+{
+	double t;
+
+	t = run_spsc(16);
+	tester_debug("16 byte chunks: %8.1f MB/s", BENCH_BYTES / 4 / t / 1e6);
+
+	t = run_spsc(4096);
+	tester_debug("4096 byte chunks: %8.1f MB/s", BENCH_BYTES / 4 / t / 1e6);
+
+	tester_test_passed();
+}
+
+/* Consume by copying every chunk out of the buffer one at a time */
+static double run_copy(size_t chunk, unsigned int *result)
+{
+	struct ringbuf *rb;
+	struct timespec start;
+	uint8_t buf[BENCH_CHUNK];
+	unsigned int sum = 0;
+	size_t pos = 0, done = 0;
+
+	rb = ringbuf_new(BENCH_SIZE);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (done < BENCH_BYTES) {
+		fill(rb, &pos, BENCH_SIZE);
+
+		while (ringbuf_len(rb) >= chunk) {
+			size_t len;
+			void *ptr;
+
+			ptr = ringbuf_peek(rb, 0, &len);
+			len = MIN(len, chunk);
+			memcpy(buf, ptr, len);
+
+			if (len < chunk) {
+				ptr = ringbuf_peek(rb, len, NULL);
+				memcpy(buf + len, ptr, chunk - len);
+			}
+
+			sum += buf[0] + buf[chunk - 1];
+
+			done += ringbuf_drain(rb, chunk);
+		}
+	}
+
+	ringbuf_free(rb);
+
+	*result = sum;
+
+	return elapsed(&start);
+}
+
+static uint8_t iov_byte(const struct iovec iov[2], size_t i)
+{
+	if (i < iov[0].iov_len)
+		return ((uint8_t *) iov[0].iov_base)[i];
+
+	return ((uint8_t *) iov[1].iov_base)[i - iov[0].iov_len];
+}
+
+/* Look at every chunk in place and drain them all at once */
+static double run_iov(size_t chunk, unsigned int *result)
+{
+	struct ringbuf *rb;
+	struct timespec start;
+	struct iovec iov[2];
+	unsigned int sum = 0;
+	size_t pos = 0, done = 0;
+
+	rb = ringbuf_new(BENCH_SIZE);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (done < BENCH_BYTES) {
+		size_t len, i;
+
+		fill(rb, &pos, BENCH_SIZE);
+
+		len = ringbuf_peek_iov(rb, iov);
+		len -= len % chunk;
+
+		for (i = 0; i < len; i += chunk)
+			sum += iov_byte(iov, i) + iov_byte(iov, i + chunk - 1);
+
+		done += ringbuf_drain(rb, len);
+	}
+
+	ringbuf_free(rb);
+
+	*result = sum;
+
+	return elapsed(&start);
+}
+
+static void test_benchmark(const void *data)
+{
+	static const size_t chunks[] = { 16, 4096 };
+	unsigned int i;
+
+	for (i = 0; i < G_N_ELEMENTS(chunks); i++) {
+		unsigned int sum_copy, sum_iov;
+		double t_copy, t_iov;
+
+		t_copy = run_copy(chunks[i], &sum_copy);
+		t_iov = run_iov(chunks[i], &sum_iov);
+		g_assert(sum_copy == sum_iov);
+
+		tester_debug("%zu byte chunks: copy %8.1f MB/s iov %8.1f MB/s",
+					chunks[i], BENCH_BYTES / t_copy / 1e6,
+					BENCH_BYTES / t_iov / 1e6);
+	}
+
+	tester_test_passed();
+}
+
 int main(int argc, char *argv[])
 {
 	tester_init(&argc, &argv);
 
+	init_pattern();
+
 	tester_add("/ringbuf/power2", NULL, NULL, test_power2, NULL);
 	tester_add("/ringbuf/alloc", NULL, NULL, test_alloc, NULL);
 	tester_add("/ringbuf/printf", NULL, NULL, test_printf, NULL);
+	tester_add("/ringbuf/iov", NULL, NULL, test_iov, NULL);
+	tester_add("/ringbuf/spsc", NULL, NULL, test_spsc, NULL);
+	tester_add("/ringbuf/benchmark", NULL, NULL, test_benchmark, NULL);
 
 	return tester_run();
 }
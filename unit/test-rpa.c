@@ -0,0 +1,230 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <time.h>
+
+#include <glib.h>
+
+#include "src/shared/util.h"
+#include "src/shared/crypto.h"
+#include "src/shared/rpa.h"
+#include "src/shared/tester.h"
+
+#define BENCH_IRKS	1000
+#define BENCH_ADDRS	2000
+
+static struct bt_crypto *crypto;
+static uint8_t irks[BENCH_IRKS][16];
+static uint8_t addrs[BENCH_ADDRS][6];
+
+static void make_irk(unsigned int seed, uint8_t irk[16])
+{
+	uint32_t x = seed * 2654435761u + 1;
+	unsigned int i;
+
+	for (i = 0; i < 16; i++) {
+		x = x * 1103515245 + 12345;
+		irk[i] = x >> 24;
+	}
+}
+
+static void make_rpa(const uint8_t irk[16], unsigned int seed,
+							uint8_t addr[6])
+{
+	addr[3] = seed & 0xff;
+	addr[4] = (seed >> 8) & 0xff;
+	addr[5] = 0x40 | ((seed >> 16) & 0x3f);
+
+	g_assert(bt_crypto_ah(crypto, irk, addr + 3, addr));
+}
+
+static void test_resolve(const void *data)
+{
+	const uint8_t irk[16] = {
+			0x9b, 0x7d, 0x39, 0x0a, 0xa6, 0x10, 0x10, 0x34,
+			0x05, 0xad, 0xc8, 0x57, 0xa3, 0x34, 0x02, 0xec };
+	const uint8_t rpa[6] = { 0xaa, 0xfb, 0x0d, 0x94, 0x81, 0x70 };
+	struct bt_rpa_resolver *resolver;
+	uint8_t other[16];
+	void *user_data;
+
+	resolver = bt_rpa_resolver_new(4);
+
+	g_assert(!bt_rpa_resolver_resolve(resolver, rpa, &user_data));
+
+	make_irk(1, other);
+	g_assert(bt_rpa_resolver_add(resolver, other, UINT_TO_PTR(1)));
+	g_assert(bt_rpa_resolver_add(resolver, irk, UINT_TO_PTR(2)));
+	g_assert_cmpint(bt_rpa_resolver_count(resolver), ==, 2);
+
+	g_assert(bt_rpa_resolver_resolve(resolver, rpa, &user_data));
+	g_assert(user_data == UINT_TO_PTR(2));
+
+	/* Adding the same IRK again keeps the first entry */
+	g_assert(bt_rpa_resolver_add(resolver, irk, UINT_TO_PTR(3)));
+	g_assert_cmpint(bt_rpa_resolver_count(resolver), ==, 2);
+	g_assert(bt_rpa_resolver_resolve(resolver, rpa, &user_data));
+	g_assert(user_data == UINT_TO_PTR(2));
+
+	g_assert(bt_rpa_resolver_remove(resolver, irk));
+	g_assert(!bt_rpa_resolver_remove(resolver, irk));
+	g_assert(!bt_rpa_resolver_resolve(resolver, rpa, &user_data));
+
+	bt_rpa_resolver_free(resolver);
+
+	tester_test_passed();
+}
+
+static void test_cache(const void *data)
+{
+	struct bt_rpa_resolver *resolver;
+	unsigned int lookups, hits;
+	uint8_t irk[16], addr[3][6];
+	void *user_data;
+	int i;
+
+	resolver = bt_rpa_resolver_new(2);
+
+	make_irk(7, irk);
+	for (i = 0; i < 3; i++)
+		make_rpa(irk, i + 1, addr[i]);
+
+	g_assert(bt_rpa_resolver_resolve(resolver, addr[0], NULL) == false);
+
+	/* A new IRK must invalidate the cached negative result */
+	g_assert(bt_rpa_resolver_add(resolver, irk, UINT_TO_PTR(1)));
+	g_assert(bt_rpa_resolver_resolve(resolver, addr[0], &user_data));
+	g_assert(user_data == UINT_TO_PTR(1));
+
+	g_assert(bt_rpa_resolver_resolve(resolver, addr[1], NULL));
+	g_assert(bt_rpa_resolver_resolve(resolver, addr[0], NULL));
+	g_assert(bt_rpa_resolver_get_stats(resolver, &lookups, &hits));
+	g_assert_cmpint(lookups, ==, 4);
+	g_assert_cmpint(hits, ==, 1);
+
+	/* addr[1] is the least recently used and gets evicted */
+	g_assert(bt_rpa_resolver_resolve(resolver, addr[2], NULL));
+	g_assert(bt_rpa_resolver_resolve(resolver, addr[0], NULL));
+	g_assert(bt_rpa_resolver_resolve(resolver, addr[1], NULL));
+	g_assert(bt_rpa_resolver_get_stats(resolver, &lookups, &hits));
+	g_assert_cmpint(lookups, ==, 7);
+	g_assert_cmpint(hits, ==, 2);
+
+	bt_rpa_resolver_free(resolver);
+
+	tester_test_passed();
+}
+
+static double elapsed(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) +
+				(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Resolve the same way as before, one bt_crypto_ah call per IRK */
+static int resolve_each(const uint8_t addr[6])
+{
+	unsigned int i;
+
+	for (i = 0; i < BENCH_IRKS; i++) {
+		uint8_t hash[3];
+
+		bt_crypto_ah(crypto, irks[i], addr + 3, hash);
+		if (!memcmp(hash, addr, 3))
+			return i;
+	}
+
+	return -1;
+}
+
+static void test_benchmark(const void *data)
+{
+	struct bt_rpa_resolver *resolver;
+	struct timespec start;
+	double t_each, t_bulk;
+	unsigned int i;
+
+	resolver = bt_rpa_resolver_new(0);
+
+	for (i = 0; i < BENCH_IRKS; i++) {
+		make_irk(i, irks[i]);
+		g_assert(bt_rpa_resolver_add(resolver, irks[i],
+							UINT_TO_PTR(i + 1)));
+	}
+
+	/* Every other address belongs to a device in the list */
+	for (i = 0; i < BENCH_ADDRS; i++) {
+		if (i % 2)
+			make_rpa(irks[(i * 7919) % BENCH_IRKS], i, addrs[i]);
+		else {
+			make_rpa(irks[0], i, addrs[i]);
+			addrs[i][0] ^= 0x5a;
+		}
+	}
+
+	/* Both must give the same answer */
+	for (i = 0; i < BENCH_ADDRS; i++) {
+		void *user_data = NULL;
+		int index = resolve_each(addrs[i]);
+
+		g_assert(bt_rpa_resolver_resolve(resolver, addrs[i],
+						&user_data) == (index >= 0));
+		if (index >= 0)
+			g_assert(user_data == UINT_TO_PTR(index + 1));
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < BENCH_ADDRS; i++)
+		resolve_each(addrs[i]);
+	t_each = elapsed(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < BENCH_ADDRS; i++)
+		bt_rpa_resolver_resolve(resolver, addrs[i], NULL);
+	t_bulk = elapsed(&start);
+
+	tester_debug("%u IRKs, %u addresses", BENCH_IRKS, BENCH_ADDRS);
+	tester_debug("  bt_crypto_ah: %10.0f addresses/sec",
+							BENCH_ADDRS / t_each);
+	tester_debug("  resolver:     %10.0f addresses/sec",
+							BENCH_ADDRS / t_bulk);
+
+	bt_rpa_resolver_free(resolver);
+
+	tester_test_passed();
+}
+
+int main(int argc, char *argv[])
+{
+	int exit_status;
+
+	crypto = bt_crypto_new();
+	if (!crypto)
+		return 0;
+
+	tester_init(&argc, &argv);
+
+	tester_add("/rpa/resolve", NULL, NULL, test_resolve, NULL);
+	tester_add("/rpa/cache", NULL, NULL, test_cache, NULL);
+	tester_add("/rpa/benchmark", NULL, NULL, test_benchmark, NULL);
+
+	exit_status = tester_run();
+
+	bt_crypto_unref(crypto);
+
+	return exit_status;
+}
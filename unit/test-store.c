@@ -0,0 +1,345 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "src/textfile.h"
+#include "src/store.h"
+#include "src/shared/tester.h"
+
+#define STARTUP_DEVICES	5000
+#define CACHE_ENTRIES	40
+
+static const char * const device_files[] = { "%s/%s/info",
+						"%s/%s/attributes",
+						"%s/cache/%s" };
+
+static char *device_file(const char *dir, unsigned int file, unsigned int id)
+{
+	char addr[18];
+
+	snprintf(addr, sizeof(addr), "00:11:22:%02X:%02X:%02X",
+				(id >> 16) & 0xff, (id >> 8) & 0xff, id & 0xff);
+
+	return g_strdup_printf(device_files[file], dir, addr);
+}
+
+static bool file_exists(const char *filename)
+{
+	return !access(filename, F_OK);
+}
+
+static char *file_get_string(const char *filename, const char *group,
+							const char *key)
+{
+	GKeyFile *key_file;
+	char *str;
+
+	key_file = g_key_file_new();
+	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	str = g_key_file_get_string(key_file, group, key, NULL);
+	g_key_file_free(key_file);
+
+	return str;
+}
+
+static void test_write_back(const void *data)
+{
+	char dir[] = "/tmp/test-store-XXXXXX";
+	GKeyFile *key_file, *cached;
+	char *filename, *str;
+
+	g_assert(mkdtemp(dir));
+	filename = device_file(dir, 0, 1);
+
+	/* A missing file results in an empty key file */
+	key_file = btd_store_load(filename, NULL);
+	g_assert(key_file);
+
+	g_key_file_set_string(key_file, "General", "Name", "Test");
+	btd_store_save(filename, key_file);
+	g_key_file_unref(key_file);
+
+	/* Nothing is written until the cache is flushed */
+	g_assert(!file_exists(filename));
+
+	cached = btd_store_load(filename, NULL);
+	g_assert(cached == key_file);
+	g_key_file_set_string(cached, "General", "Alias", "Alias");
+	btd_store_save(filename, cached);
+	g_key_file_unref(cached);
+
+	btd_store_flush();
+
+	str = file_get_string(filename, "General", "Name");
+	g_assert_cmpstr(str, ==, "Test");
+	g_free(str);
+
+	str = file_get_string(filename, "General", "Alias");
+	g_assert_cmpstr(str, ==, "Alias");
+	g_free(str);
+
+	btd_store_cleanup();
+
+	unlink(filename);
+	g_free(filename);
+	filename = g_strdup_printf("%s/00:11:22:00:00:01", dir);
+	rmdir(filename);
+	rmdir(dir);
+	g_free(filename);
+
+	tester_test_passed();
+}
+
+static void test_commit_remove(const void *data)
+{
+	char dir[] = "/tmp/test-store-XXXXXX";
+	char *info, *attrib, *device;
+	GKeyFile *key_file;
+
+	g_assert(mkdtemp(dir));
+	info = device_file(dir, 0, 2);
+	attrib = device_file(dir, 1, 2);
+	device = g_strdup_printf("%s/00:11:22:00:00:02", dir);
+
+	/* Keys are written right away */
+	key_file = btd_store_load(info, NULL);
+	g_key_file_set_string(key_file, "LinkKey", "Key",
+					"00112233445566778899AABBCCDDEEFF");
+	btd_store_commit(info, key_file);
+	g_key_file_unref(key_file);
+
+	g_assert(file_exists(info));
+
+	/* Pending changes of a removed device are dropped */
+	key_file = btd_store_load(attrib, NULL);
+	g_key_file_set_string(key_file, "0x0001", "UUID", "1800");
+	btd_store_save(attrib, key_file);
+	g_key_file_unref(key_file);
+
+	btd_store_remove(device);
+	btd_store_flush();
+
+	g_assert(file_exists(info));
+	g_assert(!file_exists(attrib));
+
+	btd_store_cleanup();
+
+	unlink(info);
+	rmdir(device);
+	rmdir(dir);
+	g_free(device);
+	g_free(attrib);
+	g_free(info);
+
+	tester_test_passed();
+}
+
+static void populate(const char *dir)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < STARTUP_DEVICES; i++) {
+		char *filename;
+		GKeyFile *key_file;
+		char key[8], value[64];
+		char *str;
+		gsize len;
+
+		filename = device_file(dir, 0, i);
+		key_file = g_key_file_new();
+		g_key_file_set_string(key_file, "General", "Name", filename);
+		g_key_file_set_string(key_file, "LinkKey", "Key",
+					"00112233445566778899AABBCCDDEEFF");
+		str = g_key_file_to_data(key_file, &len, NULL);
+		create_file(filename, 0600);
+		g_assert(g_file_set_contents(filename, str, len, NULL));
+		g_free(str);
+		g_key_file_free(key_file);
+		g_free(filename);
+
+		filename = device_file(dir, 1, i);
+		key_file = g_key_file_new();
+		g_key_file_set_string(key_file, "0x0001", "UUID",
+				"00001800-0000-1000-8000-00805f9b34fb");
+		str = g_key_file_to_data(key_file, &len, NULL);
+		create_file(filename, 0600);
+		g_assert(g_file_set_contents(filename, str, len, NULL));
+		g_free(str);
+		g_key_file_free(key_file);
+		g_free(filename);
+
+		filename = device_file(dir, 2, i);
+		key_file = g_key_file_new();
+		g_key_file_set_string(key_file, "General", "Name", filename);
+
+		for (j = 1; j < CACHE_ENTRIES; j++) {
+			snprintf(key, sizeof(key), "%04x", j);
+			snprintf(value, sizeof(value), "2803:%04x:02:"
+				"00002a%02x-0000-1000-8000-00805f9b34fb",
+				j + 1, j);
+			g_key_file_set_string(key_file, "Attributes", key,
+									value);
+		}
+
+		str = g_key_file_to_data(key_file, &len, NULL);
+		create_file(filename, 0600);
+		g_assert(g_file_set_contents(filename, str, len, NULL));
+		g_free(str);
+		g_key_file_free(key_file);
+		g_free(filename);
+	}
+}
+
+static void cleanup(const char *dir)
+{
+	unsigned int i, j;
+	char *path;
+
+	for (i = 0; i < STARTUP_DEVICES; i++) {
+		for (j = 0; j < G_N_ELEMENTS(device_files); j++) {
+			path = device_file(dir, j, i);
+			unlink(path);
+			g_free(path);
+		}
+
+		path = device_file(dir, 0, i);
+		*strrchr(path, '/') = '\0';
+		rmdir(path);
+		g_free(path);
+	}
+
+	path = g_strdup_printf("%s/cache", dir);
+	rmdir(path);
+	g_free(path);
+
+	rmdir(dir);
+}
+
+static double elapsed_ms(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) * 1000.0 +
+				(now.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+/*
+ * Files read for every device by load_devices() and
+ * device_create_from_storage(): info, attributes and the cache file for the
+ * name, name resolving and the GATT database.
+ */
+static const unsigned int startup_files[] = { 0, 1, 2, 2, 2 };
+
+static unsigned int load_plain(const char *dir, unsigned int id)
+{
+	unsigned int i, found = 0;
+
+	for (i = 0; i < G_N_ELEMENTS(startup_files); i++) {
+		char *filename = device_file(dir, startup_files[i], id);
+		GKeyFile *key_file;
+		char *str;
+
+		key_file = g_key_file_new();
+		g_key_file_load_from_file(key_file, filename, 0, NULL);
+
+		str = g_key_file_get_string(key_file, "General", "Name", NULL);
+		if (str && !strcmp(str, filename))
+			found++;
+
+		g_free(str);
+		g_key_file_free(key_file);
+		g_free(filename);
+	}
+
+	return found;
+}
+
+static unsigned int load_store(const char *dir, unsigned int id)
+{
+	unsigned int i, found = 0;
+
+	for (i = 0; i < G_N_ELEMENTS(startup_files); i++) {
+		char *filename = device_file(dir, startup_files[i], id);
+		GKeyFile *key_file;
+		char *str;
+
+		key_file = btd_store_load(filename, NULL);
+
+		str = g_key_file_get_string(key_file, "General", "Name", NULL);
+		if (str && !strcmp(str, filename))
+			found++;
+
+		g_free(str);
+		g_key_file_unref(key_file);
+		g_free(filename);
+	}
+
+	/* As load_devices() does after each device */
+	btd_store_flush();
+
+	return found;
+}
+
+static void test_startup(const void *data)
+{
+	char dir[] = "/tmp/test-store-XXXXXX";
+	unsigned int i, plain = 0, store = 0;
+	struct timespec start;
+	double ms_plain, ms_store;
+
+	g_assert(mkdtemp(dir));
+	populate(dir);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < STARTUP_DEVICES; i++)
+		plain += load_plain(dir, i);
+	ms_plain = elapsed_ms(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < STARTUP_DEVICES; i++)
+		store += load_store(dir, i);
+	ms_store = elapsed_ms(&start);
+
+	/* Same data seen through both paths: info and 3 cache file reads */
+	g_assert_cmpint(plain, ==, STARTUP_DEVICES * 4);
+	g_assert_cmpint(store, ==, plain);
+
+	tester_debug("%u devices: %.1f ms (without store %.1f ms)",
+				STARTUP_DEVICES, ms_store, ms_plain);
+
+	btd_store_cleanup();
+	cleanup(dir);
+
+	tester_test_passed();
+}
+
+int main(int argc, char *argv[])
+{
+	tester_init(&argc, &argv);
+
+	tester_add("/store/write-back", NULL, NULL, test_write_back, NULL);
+	tester_add("/store/commit-remove", NULL, NULL, test_commit_remove,
+									NULL);
+	tester_add("/store/startup", NULL, NULL, test_startup, NULL);
+
+	return tester_run();
+}